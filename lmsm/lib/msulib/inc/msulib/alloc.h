@@ -25,4 +25,10 @@ allocator_t managed_heap_alloc_new();
 void managed_heap_alloc_free(allocator_t *alloc);
 size_t managed_heap_alloc_debug(allocator_t *alloc); // prints out which objects were not deallocated, returns # alive
 
+// hands out memory from big blocks and frees nothing until arena_alloc_free, which lets
+// everything go at once. for lots of small objects that all die together
+allocator_t arena_alloc_new();
+void arena_alloc_free(allocator_t *alloc);
+size_t arena_alloc_used(allocator_t *alloc); // bytes handed out
+
 #endif // MSU_ALLOC_H
\ No newline at end of file
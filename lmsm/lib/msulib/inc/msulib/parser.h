@@ -14,6 +14,8 @@ typedef enum tokenkind {
     TT_RPAREN,
     TT_LBRACE,
     TT_RBRACE,
+    TT_LBRACKET,
+    TT_RBRACKET,
 
     TT_COLON,
     TT_SEMICOLON,
@@ -32,6 +34,8 @@ typedef enum tokenkind {
     TT_RARROW,
     TT_LARROW_EQ,
     TT_RARROW_EQ,
+    TT_AMP2,
+    TT_PIPE2,
 } tokenkind;
 
 typedef struct token {
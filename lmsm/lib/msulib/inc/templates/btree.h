@@ -358,7 +358,7 @@ void bt_node_free(allocator_t allocator, bt_node_t *node) {
             bt_entry_free_all(allocator, (bt_entry_t *) node->pointers[i]);
         }
     } else {
-        for (size_t i = 0; i < node->num_keys; i++) {
+        for (size_t i = 0; i < node->num_keys + 1; i++) {
             bt_node_free(allocator, (bt_node_t *) node->pointers[i]);
         }
     }
@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <memory.h>
+#include <stdalign.h>
 
 void *msu_malloc(allocator_t a, size_t size) { (void) a; return malloc(size); }
 void *msu_realloc(allocator_t a, void *ptr, size_t size) { (void) a; return realloc(ptr, size); }
@@ -131,4 +132,91 @@ size_t managed_heap_alloc_debug(allocator_t *alloc) {
     }
     fflush(stderr);
     return n;
-}
\ No newline at end of file
+}
+
+#define ARENA_FIRST_BLOCK 4096
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size, used;
+    alignas(max_align_t) unsigned char data[];
+} arena_block_t;
+
+typedef struct arena_state {
+    arena_block_t *blocks; // the newest first, which is the one allocated from
+    size_t used;
+} arena_state_t;
+
+// every allocation keeps its size in front of it, for realloc
+typedef struct arena_header {
+    alignas(max_align_t) size_t size;
+} arena_header_t;
+
+void *arena_alloc(allocator_t alloc, size_t size) {
+    arena_state_t *state = alloc.state;
+    size_t need = sizeof(arena_header_t) + (size + alignof(max_align_t) - 1) / alignof(max_align_t) * alignof(max_align_t);
+
+    arena_block_t *block = state->blocks;
+    if (!block || block->size - block->used < need) {
+        size_t block_size = block ? block->size * 2 : ARENA_FIRST_BLOCK;
+        while (block_size < need) block_size *= 2;
+        arena_block_t *next = malloc(sizeof(arena_block_t) + block_size);
+        if (!next) return NULL;
+        next->next = block;
+        next->size = block_size;
+        next->used = 0;
+        state->blocks = block = next;
+    }
+
+    arena_header_t *header = (arena_header_t *) (block->data + block->used);
+    header->size = size;
+    block->used += need;
+    state->used += size;
+    return header + 1;
+}
+
+void *arena_realloc(allocator_t alloc, void *ptr, size_t size) {
+    if (!ptr) return arena_alloc(alloc, size);
+    arena_header_t *header = (arena_header_t *) ptr - 1;
+    if (header->size >= size) return ptr;
+    void *data = arena_alloc(alloc, size);
+    if (data) memcpy(data, ptr, header->size);
+    return data;
+}
+
+void arena_free(allocator_t alloc, void *ptr) {
+    (void) alloc;
+    (void) ptr;
+}
+
+allocator_t arena_alloc_new() {
+    arena_state_t *state = malloc(sizeof(arena_state_t));
+    assert(state && "out of memory!\n");
+    state->blocks = NULL;
+    state->used = 0;
+
+    allocator_t out;
+    out.alloc = arena_alloc;
+    out.realloc = arena_realloc;
+    out.free = arena_free;
+    out.state = state;
+    return out;
+}
+
+void arena_alloc_free(allocator_t *alloc) {
+    if (!alloc || !alloc->state) return;
+    arena_state_t *state = alloc->state;
+    arena_block_t *block = state->blocks;
+    while (block) {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(state);
+    memset(alloc, 0, sizeof(allocator_t));
+}
+
+size_t arena_alloc_used(allocator_t *alloc) {
+    arena_state_t *state = alloc->state;
+    return state->used;
+}
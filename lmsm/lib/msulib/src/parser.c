@@ -70,6 +70,10 @@ token *tokenize_impl(const msu_str_t *src, const msu_str_t *commentPat, bool ext
             kind = TT_LBRACE;
         } else if (c == '}') {
             kind = TT_RBRACE;
+        } else if (c == '[') {
+            kind = TT_LBRACKET;
+        } else if (c == ']') {
+            kind = TT_RBRACKET;
         } else if (c == ':') {
             kind = TT_COLON;
         } else if (c == ',') {
@@ -114,6 +118,9 @@ token *tokenize_impl(const msu_str_t *src, const msu_str_t *commentPat, bool ext
             } else {
                 kind = TT_RARROW;
             }
+        } else if ((c == '&' || c == '|') && index < msu_str_len(src) && msu_str_at(src, index) == c) {
+            index += 1;
+            kind = c == '&' ? TT_AMP2 : TT_PIPE2;
         } else {
             kind = TT_ERROR;
             content = msu_str_printf("unexpected character c=%d c=%c", (int) c,
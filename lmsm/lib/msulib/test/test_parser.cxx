@@ -22,6 +22,8 @@ TEST(msu_parser_tests, test_tokens) {
     test_token("hi_there", TT_IDENT);
     test_token("(", TT_LPAREN);
     test_token(")", TT_RPAREN);
+    test_token("[", TT_LBRACKET);
+    test_token("]", TT_RBRACKET);
     test_token("!", TT_BANG);
     test_token("!=", TT_BANG_EQ);
     test_token("=", TT_EQ);
@@ -34,6 +36,8 @@ TEST(msu_parser_tests, test_tokens) {
     test_token(">", TT_RARROW);
     test_token("<=", TT_LARROW_EQ);
     test_token(">=", TT_RARROW_EQ);
+    test_token("&&", TT_AMP2);
+    test_token("||", TT_PIPE2);
 }
 
 TEST(msu_parser_tests, test_comments) {
@@ -0,0 +1,133 @@
+/*
+ * lmsmc - compiles to lmsm assembly from the command line
+ *
+ *   lmsmc [-O] [--opt-report] [--static-locals] [--no-loop-opt] [-j threads] [-o out] file
+ *
+ * `file` is .sea, .firth, .zt or .asm, the assembly goes to
+ * stdout or `out`. -O runs the optimizer over it, and
+ * --opt-report does too and prints what each pass did and how
+ * long it took to stderr. --static-locals gives the variables
+ * of Sea functions that don't recurse fixed cells and
+ * --no-loop-opt leaves Sea loops as they're written. -j
+ * compiles that many Sea functions at once, see sea_options_t
+*/
+
+#include "msulib/fs.h"
+#include "msulib/parser.h"
+
+#include "lmsm/firth.h"
+#include "lmsm/opt.h"
+#include "lmsm/sea.h"
+#include "lmsm/zortran.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void usage() {
+    fprintf(stderr, "usage: lmsmc [-O] [--opt-report] [--static-locals] [--no-loop-opt] [-j threads] [-o out] file\n");
+    exit(EXIT_FAILURE);
+}
+
+bool has_errors(const parsenode_t *program, const msu_str_t *src, const char *path) {
+    list_of_parsenodes_t *errors = list_of_parsenodes_new();
+    parsenode_collect_errors(program, errors);
+    for (size_t i = 0; i < errors->len; i++) {
+        parsenode_t *node = list_of_parsenodes_get(errors, i);
+        if (node->token) {
+            fprintf(stderr, "%s:%zu:%zu: %s\n", path, msu_str_get_lineno_for_index(src, node->token->index),
+                    msu_str_get_lineoff_for_index(src, node->token->index), msu_str_data(node->error));
+        } else {
+            fprintf(stderr, "%s: %s\n", path, msu_str_data(node->error));
+        }
+    }
+    bool out = errors->len > 0;
+    list_of_parsenodes_free(errors, false);
+    return out;
+}
+
+// the instructions `path` compiles to, NULL if it doesn't
+list_of_asm_insrs_t *compile_file(const char *path, const sea_options_t *sea_options) {
+    const msu_str_t *name = msu_str_new(path), *src = NULL;
+    if (fs_read_to_string(name, &src) != FS_ERROR_NONE) {
+        fprintf(stderr, "%s: cannot read\n", path);
+        msu_str_free(name);
+        return NULL;
+    }
+    msu_str_free(name);
+
+    const char *ext = strrchr(path, '.');
+    ext = ext ? ext + 1 : "";
+    list_of_asm_insrs_t *out = NULL;
+    parsenode_t *program = NULL;
+    if (strcmp(ext, "asm") == 0) {
+        out = asm_parse(src);
+    } else if (strcmp(ext, "sea") == 0) {
+        program = sea_parse(src);
+        sea_error_t *err = NULL;
+        if (!has_errors(program, src, path)) out = sea_compile_ir_with(program, sea_options, &err);
+        if (err) {
+            fprintf(stderr, "%s: %s\n", path, msu_str_data(err->message));
+            list_of_asm_insrs_free(out, true);
+            out = NULL;
+        }
+        sea_error_free(err);
+    } else if (strcmp(ext, "firth") == 0) {
+        program = fr_parse(src);
+        if (!has_errors(program, src, path)) out = fr_compile_program_ir(program);
+    } else if (strcmp(ext, "zt") == 0) {
+        program = zt_parse(src);
+        if (!has_errors(program, src, path)) out = zt_compile_ir(program);
+    } else {
+        fprintf(stderr, "%s: not a .sea, .firth, .zt or .asm file\n", path);
+    }
+
+    parsenode_free(program);
+    msu_str_free(src);
+    return out;
+}
+
+int main(int argc, char **argv) {
+    bool optimize = false, report = false;
+    sea_options_t sea_options = sea_default_options();
+    const char *out_path = NULL, *in_path = NULL;
+    for (int arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "-O") == 0) optimize = true;
+        else if (strcmp(argv[arg], "--opt-report") == 0) optimize = report = true;
+        else if (strcmp(argv[arg], "--static-locals") == 0) sea_options.static_locals = true;
+        else if (strcmp(argv[arg], "--no-loop-opt") == 0) sea_options.optimize_loops = false;
+        else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) sea_options.threads = atoi(argv[++arg]);
+        else if (strcmp(argv[arg], "-o") == 0 && arg + 1 < argc) out_path = argv[++arg];
+        else if (argv[arg][0] != '-' && !in_path) in_path = argv[arg];
+        else usage();
+    }
+    if (!in_path) usage();
+
+    list_of_asm_insrs_t *insrs = compile_file(in_path, &sea_options);
+    if (!insrs) return EXIT_FAILURE;
+
+    if (optimize) {
+        opt_stats_t stats;
+        list_of_asm_insrs_t *optimized = asm_optimize_stats(insrs, &stats);
+        list_of_asm_insrs_free(insrs, true);
+        insrs = optimized;
+        if (report) {
+            const msu_str_t *table = opt_stats_print(&stats);
+            fputs(msu_str_data(table), stderr);
+            msu_str_free(table);
+        }
+    }
+
+    const msu_str_t *text = asm_print(insrs);
+    FILE *out = out_path ? fopen(out_path, "w") : stdout;
+    if (out) {
+        fputs(msu_str_data(text), out);
+        if (out != stdout) fclose(out);
+    } else {
+        fprintf(stderr, "%s: cannot write\n", out_path);
+    }
+
+    msu_str_free(text);
+    list_of_asm_insrs_free(insrs, true);
+    return out ? EXIT_SUCCESS : EXIT_FAILURE;
+}
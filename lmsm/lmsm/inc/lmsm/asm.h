@@ -4,48 +4,7 @@
 
 #include <msulib/str.h>
 #include <msulib/parser.h>
-
-extern const char *ASM_INSTRUCTIONS[];
-extern const size_t ASM_INSTRUCTION_COUNT;
-
-extern const char *ASM_ARG_INSTRUCTIONS[];
-extern const size_t ASM_ARG_INSTRUCTION_COUNT;
-
-typedef enum asm_insr_kind {
-    ASM_INSR_SSTA = -500,
-    ASM_INSR_SLDA = -300,
-    ASM_INSR_SDEC = -200,
-    ASM_INSR_SINC = -100,
-    ASM_INSR_HLT = 0,
-    ASM_INSR_COB = 0,
-    ASM_INSR_ADD = 100,
-    ASM_INSR_SUB = 200,
-    ASM_INSR_STA = 300,
-    ASM_INSR_LDI = 400,
-    ASM_INSR_LDA = 500,
-    ASM_INSR_BRA = 600,
-    ASM_INSR_BRZ = 700,
-    ASM_INSR_BRP = 800,
-
-    ASM_INSR_INP = 901,
-    ASM_INSR_OUT = 902,
-
-    ASM_INSR_JAL = 910,
-    ASM_INSR_RET = 911,
-
-    ASM_INSR_SPUSH = 920,
-    ASM_INSR_SPOP = 921,
-    ASM_INSR_SDUP = 922,
-    ASM_INSR_SSWAP = 923,
-    ASM_INSR_SADD = 930,
-    ASM_INSR_SSUB = 931,
-    ASM_INSR_SMUL = 932,
-    ASM_INSR_SDIV = 933,
-    ASM_INSR_SMAX = 934,
-    ASM_INSR_SMIN = 935,
-
-    ASM_INSR_DAT = 999,
-} asm_insr_kind;
+#include "lmsm/emulator.h"
 
 typedef enum asm_error_kind {
     ASM_ERROR_NONE = 0,
@@ -53,14 +12,24 @@ typedef enum asm_error_kind {
     ASM_ERROR_BAD_LABEL,
     ASM_ERROR_BAD_ARG,
     ASM_ERROR_BAD_INSR,
+    ASM_ERROR_BAD_DIRECTIVE,
 } asm_error_kind_t;
 
 typedef struct asm_insr asm_insr_t;
 typedef struct asm_error asm_error_t;
 
+// where an instruction came from, stored inline so it costs no allocation
+typedef struct asm_span {
+    size_t line;   // 1-based, 0 if the instruction didn't come from source
+    size_t offset; // index of the start of the line in the source
+    size_t len;    // length of the line
+} asm_span_t;
+
 struct asm_error {
     asm_error_kind_t kind;
     const msu_str_t *message;
+    asm_span_t span;
+    asm_error_t *next; // the rest of the errors from the same pass, if any
 };
 
 struct asm_insr {
@@ -69,6 +38,7 @@ struct asm_insr {
     int value;
     const msu_str_t *label_reference;
     asm_error_t *error;
+    asm_span_t span;
 };
 typedef struct list_of_asm_insrs list_of_asm_insrs_t;
 
@@ -79,12 +49,121 @@ asm_error_t *asm_error_clone(const asm_error_t *src);
 int asm_insr_size(const asm_insr_t *insr);
 
 asm_insr_t *asm_parse_insr(const msu_str_t *line);
+// expands directives as it goes:
+//   .equ NAME VALUE         NAME can be used wherever a number can
+//   .macro NAME P1 P2 ...   starts a macro, the lines up to .endm are its body
+//   .endm                   with P1.. replaced by the arguments of `NAME A1 A2 ...`
+//   [label] .org N          pads with zeros up to address N
+//   [label] .align N        pads with zeros up to a multiple of N
 list_of_asm_insrs_t *asm_parse(const msu_str_t *src);
+// errors come back as one list linked through `next`, every parse error or else every emit error
 int *asm_assemble(const msu_str_t *src, asm_error_t **errout);
+int *asm_assemble_insrs(list_of_asm_insrs_t *insrs, asm_error_t **errout); // e.g. from an asm_builder_t
 asm_error_t *asm_emit(list_of_asm_insrs_t *insrs, int *outcode, size_t codesize);
+asm_error_t *asm_emit_insr(const asm_insr_t *insr, int value, int *outcode); // writes asm_insr_size(insr) cells
 
 void asm_insr_free(asm_insr_t *insr);
-void asm_error_free(asm_error_t *err);
+void asm_error_free(asm_error_t *err); // frees the whole list
+// appends `err` (a single error or a list) to the list ending at *tail, returns the new tail
+asm_error_t **asm_error_append(asm_error_t **tail, asm_error_t *err);
+
+// opcodes come from EMULATOR_OPCODES, plus COB, DAT, CALL and SPUSHI
+bool asm_is_insr(const char *insr);
+bool asm_is_arg_insr(const char *insr);
+
+// turns a memory image back into instructions that assemble to the same image.
+// cells reachable from address 0 are code, the rest are DAT; branch, call and
+// memory operands that land inside the image get labels
+list_of_asm_insrs_t *asm_disassemble(const int *code, size_t n);
+
+//===================================================================
+//  Instruction builder
+//
+//  the compilers write instructions straight into a list through
+//  this instead of printing text for asm_parse to read back in.
+//  a label goes on the next instruction emitted; a second label
+//  before that instruction becomes an alias for the first
+//===================================================================
+
+typedef struct asm_builder {
+    list_of_asm_insrs_t *insrs;
+    const msu_str_t *label;      // pending, goes on the next instruction
+    list_of_msu_strs_t *aliases; // pairs of (label, label it was merged into)
+} asm_builder_t;
+
+asm_builder_t *asm_builder_new();
+void asm_builder_label(asm_builder_t *builder, const msu_str_t *label);
+void asm_builder_op(asm_builder_t *builder, const char *insr);
+void asm_builder_op_value(asm_builder_t *builder, const char *insr, int value);
+void asm_builder_op_ref(asm_builder_t *builder, const char *insr, const msu_str_t *label);
+list_of_asm_insrs_t *asm_builder_finish(asm_builder_t *builder); // frees the builder
+// moves what another builder finished with onto the end, and frees `insrs`
+void asm_builder_append(asm_builder_t *builder, list_of_asm_insrs_t *insrs);
+void asm_builder_free(asm_builder_t *builder);
+
+// the text asm_parse would read back as `insrs`
+const msu_str_t *asm_print(const list_of_asm_insrs_t *insrs);
+
+//===================================================================
+//  Constant pool
+//
+//  DAT cells holding constants, one cell per value. the compilers
+//  take their labels from a pool and the optimizer starts its own
+//  from the cells already in the program, so between them a value
+//  never gets two cells, and cells nothing reads any more are
+//  dropped as dead code. looking a value up is an index into a
+//  table over the whole -999..999 range
+//===================================================================
+
+#define ASM_CONSTS_RANGE 1999
+
+typedef struct asm_consts {
+    const msu_str_t *by_value[ASM_CONSTS_RANGE]; // value + 999, borrowed from the cells
+    list_of_asm_insrs_t *added; // cells the pool made, in the order they were asked for
+} asm_consts_t;
+
+void asm_consts_init(asm_consts_t *consts);
+// makes the existing cell `label` the one for `value`, unless the pool has one already
+void asm_consts_adopt(asm_consts_t *consts, int value, const msu_str_t *label);
+// the label of the cell for `value`, which is made if there isn't one
+const msu_str_t *asm_consts_get(asm_consts_t *consts, int value);
+// moves the cells made onto the end of `out`, or frees them if it is NULL
+void asm_consts_finish(asm_consts_t *consts, list_of_asm_insrs_t *out);
+
+//===================================================================
+//  Incremental assembly
+//
+//  a session remembers the lines, parsed instructions and symbol
+//  table of the last source it assembled. the next source is diffed
+//  against it by line hash and only the lines that changed are
+//  re-parsed; the rest of the image is shifted/patched in place
+//===================================================================
+
+typedef struct asm_session_line {
+    hash_t hash;
+    const msu_str_t *text;
+    asm_insr_t *insr; // NULL for blank lines
+    size_t offset; // index of the line in the source
+    int pc;
+} asm_session_line_t;
+
+typedef struct asm_symtab asm_symtab_t;
+
+typedef struct asm_session {
+    asm_session_line_t *lines;
+    size_t len, cap;
+    asm_symtab_t *symbols;
+    int code[MIDDLE_OF_MEMORY];
+    int size; // slots used by the current image
+    bool had_error; // last image is incomplete, re-emit everything next time
+    bool duplicate_labels;
+    size_t reparsed; // lines re-parsed by the last call, for diagnostics
+} asm_session_t;
+
+asm_session_t *asm_session_new();
+// returns the session-owned image (MIDDLE_OF_MEMORY cells), valid until the next call
+const int *asm_session_assemble(asm_session_t *session, const msu_str_t *src, asm_error_t **errout);
+void asm_session_free(asm_session_t *session);
 
 #endif // asm_h
 
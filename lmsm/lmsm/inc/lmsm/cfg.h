@@ -0,0 +1,76 @@
+/*
+ * cfg.h - Control flow graph
+ *
+ * optimizations need to know which instructions can run after
+ * which, and which values are still needed at each point.
+ * this module splits a program into basic blocks, links them up,
+ * and works out what is live in the accumulator and memory cells
+*/
+
+#ifndef cfg_h
+#define cfg_h
+
+#include "lmsm/asm.h"
+
+#include <stdint.h>
+
+//===================================================================
+//  Blocks
+//
+//  a block starts at the first instruction, at every label and
+//  after every jump, and runs to the next start. calls end a block
+//  and come back to the next one. anything that goes somewhere
+//  unknown (RET, a jump to a missing label, running into data)
+//  "exits", and everything is assumed to be live after it
+//===================================================================
+
+typedef struct cfg_block {
+    size_t start, end; // the instructions [start, end)
+    int succ[2];       // the blocks that can run next, -1 for none
+    int callee;        // the block a CALL at the end enters, or -1
+    bool exits;
+} cfg_block_t;
+
+//===================================================================
+//  Liveness
+//
+//  bit CFG_ACC of a set is the accumulator, CFG_RA the return
+//  address and CFG_CELLS + i is cells[i]. the cells are the labels
+//  LDA, STA, ADD and SUB refer to. a call might read any of them, so
+//  they are all live before one. a call wrapped in RPUSH and RPOP
+//  leaves $ra as it was, so its liveness goes straight through
+//===================================================================
+
+#define CFG_ACC 0
+#define CFG_RA 1
+#define CFG_CELLS 2
+
+typedef struct cfg {
+    const list_of_asm_insrs_t *insrs; // borrowed
+    cfg_block_t *blocks;
+    size_t len;
+    size_t *block_of; // the block each instruction is in
+    const msu_str_t **cells; // borrowed from the instructions
+    size_t cell_count;
+    struct cfg_names *names; // cell label -> bit
+    int *cell_of; // the bit of the cell each instruction refers to, or -1
+    unsigned char *effects; // what each instruction does to the accumulator and cells
+    size_t words; // the length of a set
+    uint64_t *live_in, *live_out; // a set per block, `words` apart
+} cfg_t;
+
+// builds the blocks and edges and solves liveness. `insrs` has to outlive the graph
+cfg_t *cfg_build(const list_of_asm_insrs_t *insrs);
+void cfg_free(cfg_t *cfg);
+
+// the bit of the cell `label`, or -1 if it isn't one
+int cfg_cell(const cfg_t *cfg, const msu_str_t *label);
+
+const uint64_t *cfg_live_in(const cfg_t *cfg, size_t block);
+const uint64_t *cfg_live_out(const cfg_t *cfg, size_t block);
+bool cfg_bits_has(const uint64_t *set, size_t bit);
+
+// whether `bit` is live just before the instruction at `index` runs
+bool cfg_is_live(const cfg_t *cfg, size_t index, size_t bit);
+
+#endif // cfg_h
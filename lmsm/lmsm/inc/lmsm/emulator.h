@@ -1,6 +1,9 @@
 #ifndef emulator_H
 #define emulator_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
 //===================================================================
 //  ENUMS for the virtual machine
 //===================================================================
@@ -16,6 +19,7 @@ typedef enum emulator_error_code {
     ERROR_BAD_STACK,
     ERROR_OUTPUT_EXHAUSTED,
     ERROR_UNKNOWN_INSTRUCTION,
+    ERROR_BAD_INDEX,
 } emulator_error_code;
 
 #define TOP_OF_MEMORY 199
@@ -23,6 +27,31 @@ typedef enum emulator_error_code {
 #define OUTPUT_BUFFER_SIZE 4000
 #define INPUT_BUFFER_SIZE 400
 
+//===================================================================
+//  The instruction set
+//
+//  one table shared by the emulator, the assembler and the
+//  disassembler. an instruction with an operand covers the cells
+//  code + n for n in 0..max_operand, or code - n for the negative
+//  stack instructions
+//===================================================================
+
+typedef struct emulator_opcode {
+    const char *name;
+    int code;
+    bool has_operand;
+    int max_operand;
+    const char *description; // printf format, %d is the operand
+} emulator_opcode_t;
+
+extern const emulator_opcode_t EMULATOR_OPCODES[];
+extern const size_t EMULATOR_OPCODE_COUNT;
+
+// the opcode `cell` decodes to, with its operand in *operand, or NULL
+const emulator_opcode_t *emulator_decode(int cell, int *operand);
+const emulator_opcode_t *emulator_find_opcode(const char *name);
+int emulator_encode(const emulator_opcode_t *op, int operand);
+
 //===================================================================
 //  Represents the core computational infrastructure of the
 //  LMSM architecture
@@ -39,6 +68,7 @@ typedef struct emulator_t {
     int memory[TOP_OF_MEMORY + 1];
     char output_buffer[OUTPUT_BUFFER_SIZE];
     char *input_buffer;
+    int *profile; // if set, profile[pc] counts how often the instruction at pc runs
 } emulator_t;
 
 //=====================================================
@@ -1,5 +1,6 @@
 #include <msulib/str.h>
 #include <msulib/parser.h>
+#include "lmsm/asm.h"
 
 typedef enum firth_node_kind {
     FR_PROGRAM,
@@ -31,9 +32,10 @@ parsenode_t *fr_parse_elt(const msu_str_t *src);
 fr_context_t *fr_context_new();
 void fr_context_free(fr_context_t *ctx);
 
-void fr_compile_node(const parsenode_t *node, fr_context_t *ctx, msu_str_builder_t output);
-void firth_code_gen(const parsenode_t *program, fr_context_t *ctx, msu_str_builder_t output);
+void fr_compile_node(const parsenode_t *node, fr_context_t *ctx, asm_builder_t *output);
+void firth_code_gen(const parsenode_t *program, fr_context_t *ctx, asm_builder_t *output);
 
 const msu_str_t *fr_compile(const msu_str_t *src);
 const msu_str_t *fr_compile_debug(const msu_str_t *src);
-const msu_str_t *fr_compile_program(const parsenode_t *program);
+const msu_str_t *fr_compile_program(const parsenode_t *program); // asm_print of the below
+list_of_asm_insrs_t *fr_compile_program_ir(const parsenode_t *program);
@@ -7,6 +7,106 @@
  * that's what this module is for
 */
 
+#ifndef opt_h
+#define opt_h
+
 #include "lmsm/asm.h"
 
-list_of_asm_insrs_t *asm_optimize(const list_of_asm_insrs_t *insrs);
\ No newline at end of file
+list_of_asm_insrs_t *asm_optimize(const list_of_asm_insrs_t *insrs);
+
+// like asm_optimize, but first lays the blocks out so the paths that ran most fall through.
+// profile[pc] is how often the instruction at pc ran with `insrs` assembled as they are,
+// see emulator_t.profile
+list_of_asm_insrs_t *asm_optimize_profiled(const list_of_asm_insrs_t *insrs, const int *profile);
+list_of_asm_insrs_t *opt_layout(const list_of_asm_insrs_t *insrs, const int *profile);
+
+//===================================================================
+//  Peephole rules
+//
+//  a rule is a window of instructions and what to replace it with,
+//  written one per line as
+//
+//      SPUSHI a; SPOP => LDI a
+//
+//  a lowercase letter matches any argument (the same one everywhere
+//  it appears), a number matches only that value, and an empty right
+//  hand side deletes the window. a rule has to make the code smaller,
+//  fewer instructions or else fewer cells, so rewriting always stops
+//===================================================================
+
+#define OPT_WINDOW_MAX 4
+
+typedef enum opt_arg_kind {
+    OPT_ARG_NONE,
+    OPT_ARG_VAR,
+    OPT_ARG_INT,
+} opt_arg_kind_t;
+
+typedef struct opt_step {
+    char insr[8];
+    opt_arg_kind_t arg;
+    int value; // the variable (0 for a, ...) or the number
+} opt_step_t;
+
+typedef struct opt_rule {
+    opt_step_t pattern[OPT_WINDOW_MAX];
+    size_t pattern_len;
+    opt_step_t rewrite[OPT_WINDOW_MAX];
+    size_t rewrite_len;
+} opt_rule_t;
+
+typedef struct opt_rules {
+    opt_rule_t *rules;
+    size_t len, cap;
+} opt_rules_t;
+
+extern const char *OPT_DEFAULT_RULES;
+// the rules superopt found for what the compilers emit, see superopt/main.c
+extern const char *OPT_SEARCHED_RULES;
+
+// the cells a step takes once assembled
+int opt_step_size(const opt_step_t *step);
+// parses one side of a rule, `a; b; c`, `text` is modified. returns an error or NULL
+const char *opt_parse_steps(char *text, opt_step_t *steps, size_t *len);
+
+opt_rules_t *opt_rules_new();
+// appends the rules in `src` (blank lines and # comments are skipped), errors carry the line
+asm_error_t *opt_rules_parse(opt_rules_t *rules, const msu_str_t *src);
+void opt_rules_free(opt_rules_t *rules);
+
+// rewrites in one scan: after each instruction is appended to the output, the windows
+// ending at it are matched and a rewrite is pushed back onto the input, so only
+// instructions next to a change are ever looked at again
+list_of_asm_insrs_t *opt_peephole(const list_of_asm_insrs_t *insrs, const opt_rules_t *rules);
+
+//===================================================================
+//  Statistics
+//
+//  what each pass of asm_optimize did and how long it took, so a
+//  slow compile or bad code can be pinned on a pass. see
+//  opt_stats_print for a table of it
+//===================================================================
+
+#define OPT_MAX_PASSES 8
+
+typedef struct opt_pass_stats {
+    const char *name;
+    size_t insrs_before, insrs_after;
+    size_t cells_before, cells_after;
+    size_t labels_merged; // labels gone, merged into another or dropped with dead code
+    int iterations;       // rewrites for peephole, rounds to a fixpoint for thread, else 1
+    double ms;
+} opt_pass_stats_t;
+
+typedef struct opt_stats {
+    opt_pass_stats_t passes[OPT_MAX_PASSES]; // in the order they ran
+    size_t len;
+    double rules_ms; // getting the peephole rules, only the first optimize parses them
+    double ms;       // everything
+} opt_stats_t;
+
+// asm_optimize, filling in `stats` if it isn't NULL
+list_of_asm_insrs_t *asm_optimize_stats(const list_of_asm_insrs_t *insrs, opt_stats_t *stats);
+const msu_str_t *opt_stats_print(const opt_stats_t *stats);
+
+#endif // opt_h
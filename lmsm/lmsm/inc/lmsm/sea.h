@@ -1,4 +1,7 @@
+#include <msulib/alloc.h>
+#include <msulib/hash.h>
 #include <msulib/parser.h>
+#include "lmsm/asm.h"
 
 typedef enum SEA_kind {
     SEA_PROGRAM,
@@ -10,6 +13,7 @@ typedef enum SEA_kind {
     SEA_PARAM,
 
     SEA_VAR,
+    SEA_ARRAY,
     SEA_BLOCK,
     SEA_IF,
     SEA_WHILE,
@@ -21,6 +25,7 @@ typedef enum SEA_kind {
     SEA_UNARY,
     SEA_CALL,
     SEA_ARGS,
+    SEA_INDEX,
     SEA_INT,
     SEA_GROUP,
 
@@ -31,6 +36,139 @@ parsenode_t *sea_parse(const msu_str_t *src);
 parsenode_t *sea_parse_stmt(const msu_str_t *src);
 parsenode_t *sea_parse_expr(const msu_str_t *src);
 
+//===================================================================
+//  Typed AST
+//
+//  what the compiler works on. sea_lower turns a parse tree into a
+//  struct per kind of node, all allocated from one arena: a node is
+//  only as big as its kind needs, its parts are fields instead of
+//  positions in a child list, and sea_ast_free lets the whole tree
+//  go at once. names are borrowed from the parse tree's tokens, so
+//  the parse tree has to outlive the AST
+//===================================================================
+
+typedef enum sea_op {
+    SEA_OP_ASSIGN,
+    SEA_OP_ADD,
+    SEA_OP_SUB,
+    SEA_OP_MUL,
+    SEA_OP_DIV,
+    SEA_OP_GT,
+    SEA_OP_GE,
+    SEA_OP_LT,
+    SEA_OP_LE,
+    SEA_OP_EQ,
+    SEA_OP_NE,
+    SEA_OP_AND,
+    SEA_OP_OR,
+    SEA_OP_NEG,
+    SEA_OP_NOT,
+} sea_op_t;
+
+// the start of every node, cast to the struct for its kind
+typedef struct sea_node {
+    sea_kind_t kind; // SEA_ERROR for anything the compiler can't take
+    const parsenode_t *src; // what errors point at
+} sea_node_t;
+
+typedef struct sea_int {
+    sea_node_t base;
+    int value;
+} sea_int_t;
+
+typedef struct sea_ident {
+    sea_node_t base;
+    const msu_str_t *name;
+} sea_ident_t;
+
+typedef struct sea_unary {
+    sea_node_t base;
+    sea_op_t op;
+    sea_node_t *operand;
+} sea_unary_t;
+
+typedef struct sea_binary {
+    sea_node_t base;
+    sea_op_t op;
+    sea_node_t *lhs, *rhs;
+} sea_binary_t;
+
+typedef struct sea_call {
+    sea_node_t base;
+    sea_node_t *functor;
+    sea_node_t **args;
+    size_t n_args;
+} sea_call_t;
+
+// a[i], only global arrays can be indexed
+typedef struct sea_index {
+    sea_node_t base;
+    sea_node_t *array;
+    sea_node_t *index;
+} sea_index_t;
+
+typedef struct sea_var {
+    sea_node_t base;
+    const msu_str_t *name;
+    sea_node_t *value; // NULL if it has none
+} sea_var_t;
+
+// a global `int name[length]`, the elements past the values it's given start at 0
+typedef struct sea_array {
+    sea_node_t base;
+    const msu_str_t *name;
+    int length;
+    sea_node_t **values;
+    size_t n_values;
+} sea_array_t;
+
+typedef struct sea_block {
+    sea_node_t base;
+    sea_node_t **stmts;
+    size_t len;
+} sea_block_t;
+
+typedef struct sea_if {
+    sea_node_t base;
+    sea_node_t *cond, *then, *else_; // else_ may be NULL
+} sea_if_t;
+
+// SEA_FOR, SEA_WHILE and SEA_DO_WHILE, the parts a loop doesn't have are NULL
+typedef struct sea_loop {
+    sea_node_t base;
+    sea_node_t *init, *cond, *incr, *body;
+} sea_loop_t;
+
+typedef struct sea_return {
+    sea_node_t base;
+    sea_node_t *value; // NULL in a void function
+} sea_return_t;
+
+typedef struct sea_funcdef {
+    sea_node_t base;
+    const msu_str_t *name;
+    bool returns_int;
+    const msu_str_t **params;
+    size_t n_params;
+    sea_node_t *body;
+} sea_funcdef_t;
+
+typedef struct sea_program {
+    sea_node_t base;
+    sea_node_t **decls; // SEA_FUNCDEF, SEA_VAR and SEA_ARRAY, in the order they're written
+    size_t len;
+} sea_program_t;
+
+typedef struct sea_ast {
+    allocator_t arena;
+    sea_program_t *program;
+} sea_ast_t;
+
+sea_ast_t *sea_lower(const parsenode_t *program);
+// a zeroed node of `size` bytes from the tree's arena, for passes that rewrite the tree
+void *sea_ast_new(sea_ast_t *ast, size_t size, sea_kind_t kind, const parsenode_t *src);
+void sea_ast_free(sea_ast_t *ast);
+
 typedef struct sea_error {
     const parsenode_t *node;
     const msu_str_t *message;
@@ -38,7 +176,68 @@ typedef struct sea_error {
 
 sea_error_t *sea_error_new(const parsenode_t *node, const msu_str_t *msg);
 
-const msu_str_t *sea_compile(const parsenode_t *program, sea_error_t **errout);
+typedef struct sea_options {
+    // functions that aren't on a cycle of calls keep their variables in fixed cells
+    // instead of in the frame, where the optimizer can work on them with the
+    // accumulator. parameters stay on the stack, recursive functions are as usual
+    bool static_locals;
+    // expressions that don't change around a loop are computed once before it, and
+    // multiplies by a variable stepped once per time around become additions
+    bool optimize_loops;
+    // functions compiled at once, each on its own. the code is the same for any number
+    int threads;
+} sea_options_t;
+
+sea_options_t sea_default_options();
+
+const msu_str_t *sea_compile(const parsenode_t *program, sea_error_t **errout); // asm_print of the below
+list_of_asm_insrs_t *sea_compile_ir(const parsenode_t *program, sea_error_t **errout);
+list_of_asm_insrs_t *sea_compile_ir_with(const parsenode_t *program, const sea_options_t *options, sea_error_t **errout);
 const msu_str_t *sea_compile_debug(const parsenode_t *program);
 
-void sea_error_free(sea_error_t *error);
\ No newline at end of file
+void sea_error_free(sea_error_t *error);
+
+//===================================================================
+//  Compile cache
+//
+//  what a source compiled to, found again by a murmurhash of the
+//  source and of the options that change the code, so compiling
+//  the same program twice skips sea_parse, sea_compile and
+//  asm_assemble. a key holds one entry, a source that hashes
+//  to the same key replaces it. the most recently used entries stay in memory up
+//  to a bound. given a directory, every entry is also written there
+//  as a file, so a new cache (the next run of the server) starts
+//  warm. only programs that compiled and assembled are stored,
+//  errors always go the long way
+//===================================================================
+
+#define SEA_CACHE_DEFAULT_MAX 64
+// part of every key and file. bump it whenever the compiler makes different code or the file
+// layout changes, so entries an older build wrote are misses
+#define SEA_CACHE_VERSION 1
+
+typedef struct sea_cache_entry {
+    hash_t key;
+    const msu_str_t *src;
+    int flags;                  // the options that change the code
+    const msu_str_t *assembly;  // asm_print of the code
+    int code[MIDDLE_OF_MEMORY]; // assembled
+    struct sea_cache_entry *newer, *older;
+} sea_cache_entry_t;
+
+typedef struct sea_cache {
+    sea_cache_entry_t *newest, *oldest;
+    struct sea_cache_index *index; // the entry for each key
+    size_t len, max;
+    const msu_str_t *dir; // NULL to keep to memory
+    size_t hits, misses;
+} sea_cache_t;
+
+// `dir` has to exist, NULL for a cache only in memory
+sea_cache_t *sea_cache_new(size_t max, const char *dir);
+void sea_cache_free(sea_cache_t *cache);
+// what `src` compiled to with `options`, NULL if it isn't stored. valid until the next lookup or store
+const sea_cache_entry_t *sea_cache_lookup(sea_cache_t *cache, const msu_str_t *src, const sea_options_t *options);
+// remembers what `src` compiled and assembled to, `assembly` and `code` are copied
+void sea_cache_store(sea_cache_t *cache, const msu_str_t *src, const sea_options_t *options,
+                     const msu_str_t *assembly, const int *code);
\ No newline at end of file
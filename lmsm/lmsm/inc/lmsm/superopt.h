@@ -0,0 +1,87 @@
+/*
+ * superopt.h - Superoptimizer
+ *
+ * peephole rules are only as good as whoever thought of them.
+ * this module finds them instead: it collects the short runs of
+ * stack code the compilers emit, tries every cheaper sequence
+ * against each one on the emulator, and keeps the ones that
+ * leave the machine in exactly the same state
+*/
+
+#ifndef superopt_h
+#define superopt_h
+
+#include "lmsm/asm.h"
+#include "lmsm/opt.h"
+
+//===================================================================
+//  Sequences
+//
+//  a sequence is one side of a peephole rule. only instructions
+//  that work on the accumulator and the stack take part, anything
+//  touching memory, the return stack or the program counter ends
+//  a run. LDI and SPUSHI values other than 0 and 1 become rule
+//  variables, so a pattern covers every constant
+//===================================================================
+
+typedef struct superopt_seq {
+    opt_step_t steps[OPT_WINDOW_MAX];
+    size_t len;
+} superopt_seq_t;
+
+// fewer instructions, or as many in fewer cells, which is what a rule has to be
+bool superopt_seq_is_cheaper(const superopt_seq_t *seq, const superopt_seq_t *than);
+const msu_str_t *superopt_seq_print(const superopt_seq_t *seq);
+
+typedef struct superopt_pattern {
+    superopt_seq_t seq;
+    int count; // how often the compilers emitted it
+} superopt_pattern_t;
+
+typedef struct superopt_patterns {
+    superopt_pattern_t *patterns;
+    size_t len, cap;
+    struct superopt_pattern_index *index; // printed sequence -> position
+} superopt_patterns_t;
+
+superopt_patterns_t *superopt_patterns_new();
+void superopt_patterns_free(superopt_patterns_t *patterns);
+
+// counts every window of 2 to `max_len` straight line stack instructions in `insrs`
+void superopt_patterns_add(superopt_patterns_t *patterns, const list_of_asm_insrs_t *insrs, size_t max_len);
+
+//===================================================================
+//  Search
+//
+//  equivalence is checked on the emulator itself. both sequences
+//  run from the same states, random ones first so most candidates
+//  fail fast, then each input in turn swept over its whole range.
+//  they have to agree on the accumulator, the stack pointer, the
+//  stack and whether they fault. what is left below the stack is
+//  garbage either way and isn't compared
+//===================================================================
+
+typedef struct superopt_options {
+    size_t max_len;  // the longest pattern, up to OPT_WINDOW_MAX
+    int min_count;   // patterns seen fewer times are skipped
+    int tests;       // random states every candidate has to pass
+    bool exhaustive; // also sweep every pair of the accumulator and the top two cells
+    int threads;
+    unsigned seed;
+} superopt_options_t;
+
+superopt_options_t superopt_default_options();
+
+// whether `a` and `b` do the same from every state tried
+bool superopt_equivalent(const superopt_seq_t *a, const superopt_seq_t *b, const superopt_options_t *options);
+
+// the cheapest sequence equivalent to `pattern`, false if there is none cheaper
+bool superopt_search(const superopt_seq_t *pattern, const superopt_options_t *options, superopt_seq_t *out);
+
+// searches the patterns seen often enough, shortest first and spread over `options->threads`,
+// and returns the rules found in the format opt_rules_parse reads. patterns `rules` or an
+// earlier find already rewrite are skipped
+const msu_str_t *superopt_search_all(const superopt_patterns_t *patterns, const opt_rules_t *rules,
+                                     const superopt_options_t *options);
+
+#endif // superopt_h
@@ -3,6 +3,7 @@
 
 #include <msulib/str.h>
 #include <msulib/parser.h>
+#include "lmsm/asm.h"
 
 typedef enum zortran_node_kind {
     ZT_PROGRAM,
@@ -19,6 +20,7 @@ typedef enum zortran_node_kind {
 
 parsenode_t *zt_parse(const msu_str_t *src);
 parsenode_t *zt_parse_stmt(const msu_str_t *src);
-const msu_str_t *zt_compile(parsenode_t *node);
+const msu_str_t *zt_compile(parsenode_t *node); // asm_print of the below
+list_of_asm_insrs_t *zt_compile_ir(parsenode_t *node);
 
 #endif // zortran_h
\ No newline at end of file
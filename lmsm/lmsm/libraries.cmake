@@ -0,0 +1,30 @@
+############################################################
+### what the libraries have grown since CMakeLists.txt here,
+### which isn't ours to edit. included from ../CMakeLists.txt
+### once the targets in it exist
+############################################################
+set(LMSM_DIR ${CMAKE_CURRENT_LIST_DIR})
+find_package(Threads REQUIRED)
+
+target_link_libraries(ZORTRAN PRIVATE ASSEMBLER)
+target_link_libraries(FIRTH PRIVATE ASSEMBLER)
+
+target_sources(SEA PRIVATE ${LMSM_DIR}/src/sea_ast.c ${LMSM_DIR}/src/sea_cache.c)
+target_link_libraries(SEA PRIVATE ASSEMBLER Threads::Threads)
+
+target_sources(ASSEMBLER PRIVATE ${LMSM_DIR}/src/asm_builder.c ${LMSM_DIR}/src/asm_disasm.c)
+target_link_libraries(ASSEMBLER PRIVATE EMULATOR)
+
+add_library(CFG STATIC ${LMSM_DIR}/src/cfg.c ${LMSM_DIR}/inc/lmsm/cfg.h)
+target_include_directories(CFG PUBLIC ${LMSM_DIR}/inc)
+target_link_libraries(CFG PRIVATE msulib ASSEMBLER EMULATOR)
+
+target_sources(OPTIMIZER PRIVATE ${LMSM_DIR}/src/opt_searched.c)
+target_link_libraries(OPTIMIZER PRIVATE ASSEMBLER CFG Threads::Threads)
+
+add_library(SUPEROPT STATIC ${LMSM_DIR}/src/superopt.c ${LMSM_DIR}/inc/lmsm/superopt.h)
+target_include_directories(SUPEROPT PUBLIC ${LMSM_DIR}/inc)
+target_link_libraries(SUPEROPT PRIVATE msulib ASSEMBLER EMULATOR OPTIMIZER Threads::Threads)
+
+add_subdirectory(${LMSM_DIR}/superopt)
+add_subdirectory(${LMSM_DIR}/cli)
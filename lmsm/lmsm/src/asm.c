@@ -2,47 +2,46 @@
 #include "msulib/hash.h"
 #include "msulib/str.h"
 
+#include <assert.h>
+#include <ctype.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "lmsm/emulator.h"
 
-const char *ASM_INSTRUCTIONS[] = {
-    "SSTA", "SLDA",
-    "SPADD", "SPSUB",
-    "HLT", "COB",
-    "ADD", "SUB",
-    "STA", "LDI", "LDA",
-    "BRA", "BRZ", "BRP",
-    "INP", "OUT",
-    "JAL", "RET",
-    "SPUSH", "SPOP", "SDUP", "SDROP", "SSWAP",
-    "SADD", "SSUB", "SMUL", "SDIV", "SMAX", "SMIN", "SCMPGT", "SCMPLT", "SNOT",
-    "RPUSH", "RPOP",
-    "DAT",
-    "CALL", "SPUSHI"
-};
-const size_t ASM_INSTRUCTION_COUNT = sizeof(ASM_INSTRUCTIONS) / sizeof(ASM_INSTRUCTIONS[0]);
-
-const char *ASM_ARG_INSTRUCTIONS[] = {
-    "SSTA", "SLDA",
-    "SPADD", "SPSUB",
-    "ADD", "SUB",
-    "STA", "LDI", "LDA",
-    "BRA", "BRZ", "BRP", "CALL", "SPUSHI", "DAT"
-};
-
-const size_t ASM_ARG_INSTRUCTION_COUNT = sizeof(ASM_ARG_INSTRUCTIONS) / sizeof(ASM_ARG_INSTRUCTIONS[0]);
+// instructions that only exist in the assembler, the rest come from EMULATOR_OPCODES
+const char *ASM_PSEUDO_INSTRUCTIONS[] = {"COB", "DAT", "CALL", "SPUSHI"};
+const size_t ASM_PSEUDO_INSTRUCTION_COUNT = sizeof(ASM_PSEUDO_INSTRUCTIONS) / sizeof(ASM_PSEUDO_INSTRUCTIONS[0]);
 
 asm_error_t *asm_error_new(asm_error_kind_t kind, const msu_str_t *context) {
     asm_error_t *out = malloc(sizeof(asm_error_t));
     assert(out && "out of memory!\n");
     out->kind = kind;
     out->message = context;
+    out->span = (asm_span_t) {0};
+    out->next = NULL;
     return out;
 }
 
+asm_error_t **asm_error_append(asm_error_t **tail, asm_error_t *err) {
+    *tail = err;
+    while (*tail) tail = &(*tail)->next;
+    return tail;
+}
+
+// where the line that starts at `offset` ends, skipping its line terminator
+size_t asm_next_line_offset(const msu_str_t *src, size_t offset, const msu_str_t *line) {
+    size_t end = offset + msu_str_len(line);
+    if (end < msu_str_len(src) && msu_str_at(src, end) == '\r') end++;
+    return end + 1;
+}
+
 bool asm_is_insr(const char *insr) {
-    for (size_t i = 0; i < ASM_INSTRUCTION_COUNT; i++) {
-        if (strcmp(insr, ASM_INSTRUCTIONS[i]) == 0) {
+    if (emulator_find_opcode(insr)) {
+        return true;
+    }
+    for (size_t i = 0; i < ASM_PSEUDO_INSTRUCTION_COUNT; i++) {
+        if (strcmp(insr, ASM_PSEUDO_INSTRUCTIONS[i]) == 0) {
             return true;
         }
     }
@@ -50,12 +49,11 @@ bool asm_is_insr(const char *insr) {
 }
 
 bool asm_is_arg_insr(const char *insr) {
-    for (int i = 0; i < ASM_ARG_INSTRUCTION_COUNT; ++i) {
-        if (strcmp(insr, ASM_ARG_INSTRUCTIONS[i]) == 0) {
-            return true;
-        }
+    const emulator_opcode_t *op = emulator_find_opcode(insr);
+    if (op) {
+        return op->has_operand;
     }
-    return false;
+    return strcmp(insr, "DAT") == 0 || strcmp(insr, "CALL") == 0 || strcmp(insr, "SPUSHI") == 0;
 }
 
 asm_insr_t *asm_parse_insr(const msu_str_t *line) {
@@ -96,7 +94,8 @@ asm_insr_t *asm_parse_insr(const msu_str_t *line) {
             return new_insr;
         }
 
-        if (!isdigit((unsigned char)arg[0]) || strchr(arg, '$') != NULL) {
+        bool is_number = isdigit((unsigned char) arg[0]) || (arg[0] == '-' && isdigit((unsigned char) arg[1]));
+        if (!is_number || strchr(arg, '$') != NULL) {
             new_insr->label_reference = msu_str_new(arg);
             new_insr->value = 0;
             free(buffer);
@@ -115,21 +114,346 @@ asm_insr_t *asm_parse_insr(const msu_str_t *line) {
     return new_insr;
 }
 
+//======================================================
+//  Directives
+//
+//  the first pass of asm_parse: expands macros, substitutes
+//  .equ constants and pads for .org/.align while tracking
+//  the address of every instruction it produces
+//======================================================
+
+typedef struct asm_macro {
+    const msu_str_t *name;
+    list_of_msu_strs_t *params;
+    list_of_msu_strs_t *body;
+    asm_span_t span;
+} asm_macro_t;
+
+void asm_macro_free(asm_macro_t *macro) {
+    if (macro) {
+        msu_str_free(macro->name);
+        list_of_msu_strs_free(macro->params, true);
+        list_of_msu_strs_free(macro->body, true);
+        free(macro);
+    }
+}
+
+#define BT_IMPL
+#define BT_NAME asm_symtab
+#define BT_KEY const msu_str_t *
+#define BT_VALUE int
+#define BT_HASHFUNC(x) msu_str_hash(x, 42)
+#define BT_EQFUNC msu_str_eq
+#include "templates/btree.h"
+#undef bt_getv
+
+#define BT_NAME asm_macros
+#define BT_KEY const msu_str_t *
+#define BT_VALUE asm_macro_t *
+#define BT_HASHFUNC(x) msu_str_hash(x, 42)
+#define BT_EQFUNC msu_str_eq
+#define BT_FREE_VALUE(v) asm_macro_free(v)
+#include "templates/btree.h"
+#undef bt_getv
+
+#define ASM_MAX_MACRO_DEPTH 16
+
+typedef struct asm_expander {
+    list_of_asm_insrs_t *out;
+    asm_symtab_t *equs;
+    list_of_msu_strs_t *equ_names; // owns the keys of `equs`
+    asm_macros_t *macros;
+    asm_macro_t *defining; // the macro whose body is being collected
+    const msu_str_t *label; // from a directive line, goes on the next instruction
+    int pc;
+    int expansions; // numbers the labels of each macro expansion apart
+} asm_expander_t;
+
+void asm_expander_push(asm_expander_t *x, asm_insr_t *insr, asm_span_t span) {
+    insr->span = span;
+    if (x->label) {
+        if (msu_str_is_empty(insr->label)) {
+            insr->label = x->label;
+        } else {
+            if (!insr->error) {
+                insr->error = asm_error_new(ASM_ERROR_BAD_LABEL,
+                                            msu_str_printf("'%s' and '%s' label the same instruction",
+                                                           msu_str_data(x->label), msu_str_data(insr->label)));
+            }
+            msu_str_free(x->label);
+        }
+        x->label = NULL;
+    }
+    if (insr->error) {
+        insr->error->span = span;
+    }
+    x->pc += asm_insr_size(insr);
+    list_of_asm_insrs_append(x->out, insr);
+}
+
+void asm_expander_error(asm_expander_t *x, asm_span_t span, asm_error_kind_t kind, const msu_str_t *message) {
+    asm_insr_t *insr = calloc(1, sizeof(asm_insr_t));
+    assert(insr && "out of memory!\n");
+    insr->error = asm_error_new(kind, message);
+    asm_expander_push(x, insr, span);
+}
+
+// a number or a previously defined .equ
+bool asm_expander_value(asm_expander_t *x, const msu_str_t *tok, int *out) {
+    int *equ = asm_symtab_getv(x->equs, tok);
+    if (equ) {
+        *out = *equ;
+        return true;
+    }
+    return !msu_str_is_empty(tok) && msu_str_try_parse_int(tok, out) && *out <= 999 && *out >= -999;
+}
+
+// cheap check so plain lines never get tokenized: does the first or second word start with '.'
+bool asm_line_has_directive(const msu_str_t *line) {
+    const char *c = msu_str_data(line);
+    for (int word = 0; word < 2; word++) {
+        while (*c && isspace((unsigned char) *c)) c++;
+        if (*c == '.') return true;
+        while (*c && !isspace((unsigned char) *c)) c++;
+    }
+    return false;
+}
+
+void asm_expand_line(asm_expander_t *x, const msu_str_t *line, asm_span_t span, int depth);
+
+void asm_expand_insr(asm_expander_t *x, const msu_str_t *line, asm_span_t span) {
+    asm_insr_t *insr = asm_parse_insr(line);
+    int *equ = msu_str_is_empty(insr->label_reference) ? NULL : asm_symtab_getv(x->equs, insr->label_reference);
+    if (equ) {
+        msu_str_free(insr->label_reference);
+        insr->label_reference = EMPTY_STRING;
+        insr->value = *equ;
+    }
+    asm_expander_push(x, insr, span);
+}
+
+void asm_expand_macro(asm_expander_t *x, const asm_macro_t *macro, list_of_msu_strs_t *args, asm_span_t span,
+                      int depth) {
+    if (args->len != macro->params->len) {
+        asm_expander_error(x, span, ASM_ERROR_BAD_ARG,
+                           msu_str_printf("'%s' takes %zu arguments, got %zu", msu_str_data(macro->name),
+                                          macro->params->len, args->len));
+        return;
+    }
+    if (depth >= ASM_MAX_MACRO_DEPTH) {
+        asm_expander_error(x, span, ASM_ERROR_BAD_DIRECTIVE,
+                           msu_str_printf("'%s' expands too deeply", msu_str_data(macro->name)));
+        return;
+    }
+
+    // the labels the body defines are its own, each expansion gets them with its number on the end
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "$%d", ++x->expansions);
+    list_of_msu_strs_t *locals = list_of_msu_strs_new();
+    for (size_t i = 0; i < macro->body->len; i++) {
+        list_of_msu_strs_t *toks = msu_str_splitwhite(list_of_msu_strs_get_const(macro->body, i));
+        const msu_str_t *tok0 = toks->len > 0 ? list_of_msu_strs_get_const(toks, 0) : NULL;
+        if (tok0 && !asm_is_insr(msu_str_data(tok0)) && msu_str_at(tok0, 0) != '.'
+            && !asm_macros_contains(x->macros, tok0) && !list_of_msu_strs_contains(macro->params, tok0)) {
+            list_of_msu_strs_append(locals, msu_str_clone(tok0));
+        }
+        list_of_msu_strs_free(toks, true);
+    }
+
+    for (size_t i = 0; i < macro->body->len; i++) {
+        list_of_msu_strs_t *toks = msu_str_splitwhite(list_of_msu_strs_get_const(macro->body, i));
+        msu_str_builder_t sb = msu_str_builder_new();
+        for (size_t t = 0; t < toks->len; t++) {
+            const msu_str_t *tok = list_of_msu_strs_get_const(toks, t);
+            bool local = list_of_msu_strs_contains(locals, tok);
+            for (size_t p = 0; p < macro->params->len; p++) {
+                if (msu_str_eq(tok, list_of_msu_strs_get_const(macro->params, p))) {
+                    tok = list_of_msu_strs_get_const(args, p);
+                    break;
+                }
+            }
+            if (t > 0) msu_str_builder_push(sb, ' ');
+            msu_str_builder_pushstr(sb, tok);
+            if (local) msu_str_builder_pushs(sb, suffix);
+        }
+        const msu_str_t *expanded = msu_str_builder_into_string_and_free(sb);
+        asm_expand_line(x, expanded, span, depth + 1);
+        msu_str_free(expanded);
+        list_of_msu_strs_free(toks, true);
+    }
+    list_of_msu_strs_free(locals, true);
+}
+
+void asm_expand_directive(asm_expander_t *x, list_of_msu_strs_t *toks, size_t first, asm_span_t span) {
+    const msu_str_t *directive = list_of_msu_strs_get_const(toks, first);
+    size_t argc = toks->len - first - 1;
+    const msu_str_t *arg = argc > 0 ? list_of_msu_strs_get_const(toks, first + 1) : EMPTY_STRING;
+
+    if (msu_str_eqs(directive, ".macro")) {
+        if (argc < 1) {
+            asm_expander_error(x, span, ASM_ERROR_BAD_ARG, msu_str_new("'.macro' needs a name"));
+            return;
+        }
+        asm_macro_t *macro = calloc(1, sizeof(asm_macro_t));
+        assert(macro && "out of memory!\n");
+        macro->name = msu_str_clone(arg);
+        macro->params = list_of_msu_strs_new();
+        for (size_t i = first + 2; i < toks->len; i++) {
+            list_of_msu_strs_append(macro->params, msu_str_clone(list_of_msu_strs_get_const(toks, i)));
+        }
+        macro->body = list_of_msu_strs_new();
+        macro->span = span;
+        x->defining = macro;
+    } else if (msu_str_eqs(directive, ".endm")) {
+        asm_expander_error(x, span, ASM_ERROR_BAD_DIRECTIVE, msu_str_new("'.endm' without '.macro'"));
+    } else if (msu_str_eqs(directive, ".equ")) {
+        int value;
+        if (argc != 2 || !asm_expander_value(x, list_of_msu_strs_get_const(toks, first + 2), &value)) {
+            asm_expander_error(x, span, ASM_ERROR_BAD_ARG, msu_str_new("expected '.equ NAME VALUE'"));
+            return;
+        }
+        if (!asm_symtab_contains(x->equs, arg)) {
+            arg = msu_str_clone(arg);
+            list_of_msu_strs_append(x->equ_names, arg);
+        }
+        asm_symtab_insert(x->equs, arg, value);
+    } else if (msu_str_eqs(directive, ".org") || msu_str_eqs(directive, ".align")) {
+        bool org = msu_str_eqs(directive, ".org");
+        int value;
+        if (argc != 1 || !asm_expander_value(x, arg, &value) || value < (org ? 0 : 1)) {
+            asm_expander_error(x, span, ASM_ERROR_BAD_ARG,
+                               msu_str_printf("bad argument to '%s'", msu_str_data(directive)));
+            return;
+        }
+        if (org && value < x->pc) {
+            asm_expander_error(x, span, ASM_ERROR_BAD_DIRECTIVE,
+                               msu_str_printf("'.org %d' is behind the current address %d", value, x->pc));
+            return;
+        }
+        int target = org ? value : (x->pc + value - 1) / value * value;
+        if (target >= MIDDLE_OF_MEMORY) {
+            asm_expander_error(x, span, ASM_ERROR_TOO_LARGE,
+                               msu_str_printf("'%s %d' is past the end of memory", msu_str_data(directive), value));
+            return;
+        }
+        // a label on the directive is for the address it moves to, not the padding
+        const msu_str_t *label = x->label;
+        x->label = NULL;
+        while (x->pc < target) {
+            asm_insr_t *pad = calloc(1, sizeof(asm_insr_t));
+            assert(pad && "out of memory!\n");
+            pad->instruction = msu_str_new("DAT");
+            asm_expander_push(x, pad, span);
+        }
+        x->label = label;
+    } else {
+        asm_expander_error(x, span, ASM_ERROR_BAD_DIRECTIVE,
+                           msu_str_printf("unknown directive '%s'", msu_str_data(directive)));
+    }
+}
+
+void asm_expand_line(asm_expander_t *x, const msu_str_t *line, asm_span_t span, int depth) {
+    if (!x->defining && asm_macros_size(x->macros) == 0 && !asm_line_has_directive(line)) {
+        asm_expand_insr(x, line, span);
+        return;
+    }
+
+    list_of_msu_strs_t *toks = msu_str_splitwhite(line);
+    if (toks->len == 0) {
+        list_of_msu_strs_free(toks, true);
+        return;
+    }
+    const msu_str_t *tok0 = list_of_msu_strs_get_const(toks, 0);
+    const msu_str_t *tok1 = toks->len > 1 ? list_of_msu_strs_get_const(toks, 1) : EMPTY_STRING;
+
+    if (x->defining) {
+        if (msu_str_eqs(tok0, ".endm")) {
+            asm_macro_t *macro = x->defining;
+            x->defining = NULL;
+            if (asm_macros_contains(x->macros, macro->name)) {
+                asm_expander_error(x, macro->span, ASM_ERROR_BAD_DIRECTIVE,
+                                   msu_str_printf("macro '%s' is defined twice", msu_str_data(macro->name)));
+                asm_macro_free(macro);
+            } else {
+                asm_macros_insert(x->macros, macro->name, macro);
+            }
+        } else if (msu_str_eqs(tok0, ".macro")) {
+            asm_expander_error(x, span, ASM_ERROR_BAD_DIRECTIVE, msu_str_new("macros can't be defined in macros"));
+        } else {
+            list_of_msu_strs_append(x->defining->body, msu_str_clone(line));
+        }
+        list_of_msu_strs_free(toks, true);
+        return;
+    }
+
+    // an optional label, then a directive, a macro or a plain instruction
+    size_t first = 0;
+    if (!asm_is_insr(msu_str_data(tok0)) && msu_str_at(tok0, 0) != '.' && !asm_macros_contains(x->macros, tok0)
+        && (msu_str_sws(tok1, ".") || asm_macros_contains(x->macros, tok1))) {
+        first = 1;
+    }
+    const msu_str_t *head = list_of_msu_strs_get_const(toks, first);
+
+    if (msu_str_at(head, 0) == '.' || asm_macros_contains(x->macros, head)) {
+        if (first == 1) {
+            msu_str_free(x->label);
+            x->label = msu_str_clone(tok0);
+        }
+        if (msu_str_at(head, 0) == '.') {
+            asm_expand_directive(x, toks, first, span);
+        } else {
+            list_of_msu_strs_t *args = list_of_msu_strs_new();
+            for (size_t i = first + 1; i < toks->len; i++) {
+                list_of_msu_strs_append(args, msu_str_clone(list_of_msu_strs_get_const(toks, i)));
+            }
+            asm_expand_macro(x, *asm_macros_getv(x->macros, head), args, span, depth);
+            list_of_msu_strs_free(args, true);
+        }
+    } else {
+        asm_expand_insr(x, line, span);
+    }
+    list_of_msu_strs_free(toks, true);
+}
+
 list_of_asm_insrs_t *asm_parse(const msu_str_t *src) {
-    list_of_asm_insrs_t *insrs = list_of_asm_insrs_new();
+    asm_expander_t x = {
+        .out = list_of_asm_insrs_new(),
+        .equs = asm_symtab_new(),
+        .equ_names = list_of_msu_strs_new(),
+        .macros = asm_macros_new(),
+    };
+
     list_of_msu_strs_t *lines = msu_str_splitlines(src);
+    size_t offset = 0;
     for (int lineno = 0; lineno < lines->len; ++lineno) {
         const msu_str_t *line = list_of_msu_strs_get(lines, lineno);
+        size_t start = offset;
+        offset = asm_next_line_offset(src, offset, line);
         if (msu_str_is_blank(line)) {
             continue;
         }
 
-        asm_insr_t *insr = asm_parse_insr(line);
-        list_of_asm_insrs_append(insrs, insr);
+        asm_expand_line(&x, line, (asm_span_t) {lineno + 1, start, msu_str_len(line)}, 0);
+    }
+
+    if (x.defining) {
+        asm_expander_error(&x, x.defining->span, ASM_ERROR_BAD_DIRECTIVE,
+                           msu_str_printf("'.macro %s' is missing '.endm'", msu_str_data(x.defining->name)));
+        asm_macro_free(x.defining);
+    }
+    if (x.label) {
+        const msu_str_t *label = x.label;
+        x.label = NULL;
+        asm_expander_error(&x, (asm_span_t) {0}, ASM_ERROR_BAD_LABEL,
+                           msu_str_printf("label '%s' doesn't mark an instruction", msu_str_data(label)));
+        msu_str_free(label);
     }
 
+    asm_symtab_free(x.equs);
+    list_of_msu_strs_free(x.equ_names, true);
+    asm_macros_free(x.macros);
     list_of_msu_strs_free(lines, true);
-    return insrs;
+    return x.out;
 }
 
 int asm_insr_size(const asm_insr_t *insr) {
@@ -152,66 +476,79 @@ int asm_find_label_offset(const list_of_asm_insrs_t *insrs, const msu_str_t *lab
     return -1;
 }
 
+asm_error_t *asm_emit_op(const emulator_opcode_t *op, int value, int *outcode) {
+    if (!op->has_operand) {
+        value = 0;
+    } else if (value < 0 || value > op->max_operand) {
+        return asm_error_new(ASM_ERROR_BAD_ARG, msu_str_printf("%s takes 0 to %d, not %d\n", op->name,
+                                                                op->max_operand, value));
+    }
+    *outcode = emulator_encode(op, value);
+    return NULL;
+}
+
+asm_error_t *asm_emit_insr(const asm_insr_t *insr, int value, int outcode[]) {
+    const char *inst = msu_str_data(insr->instruction);
+
+    if (strcmp(inst, "COB") == 0) {
+        return asm_emit_op(emulator_find_opcode("HLT"), 0, outcode);
+    } else if (strcmp(inst, "DAT") == 0) {
+        if (value < -999 || value > 999) {
+            return asm_error_new(ASM_ERROR_BAD_ARG, msu_str_printf("DAT takes -999 to 999, not %d\n", value));
+        }
+        outcode[0] = value;
+        return NULL;
+    } else if (strcmp(inst, "SPUSHI") == 0 || strcmp(inst, "CALL") == 0) {
+        const char *second = strcmp(inst, "CALL") == 0 ? "JAL" : "SPUSH";
+        asm_error_t *err = asm_emit_op(emulator_find_opcode("LDI"), value, &outcode[0]);
+        if (err) return err;
+        return asm_emit_op(emulator_find_opcode(second), 0, &outcode[1]);
+    }
+
+    const emulator_opcode_t *op = emulator_find_opcode(inst);
+    if (!op) {
+        return asm_error_new(ASM_ERROR_BAD_INSR, msu_str_printf("unknown instruction '%s'\n", inst));
+    }
+    return asm_emit_op(op, value, outcode);
+}
+
 asm_error_t *asm_emit(list_of_asm_insrs_t *insrs, int outcode[], size_t codesize) {
+    asm_error_t *errors = NULL;
+    asm_error_t **tail = &errors;
     int off = 0;
     for (size_t i = 0; i < insrs->len; i++) {
         const asm_insr_t *insr = list_of_asm_insrs_get_const(insrs, i);
         int slots = asm_insr_size(insr);
         if (off + slots >= codesize) {
-            return asm_error_new(ASM_ERROR_TOO_LARGE, msu_str_new("too many instructions"));
+            asm_error_t *err = asm_error_new(ASM_ERROR_TOO_LARGE, msu_str_new("too many instructions"));
+            err->span = insr->span;
+            asm_error_append(tail, err);
+            break;
         }
 
         int value;
+        asm_error_t *err = NULL;
         if (!msu_str_is_empty(insr->label_reference)) {
             value = asm_find_label_offset(insrs, insr->label_reference);
             if (value == -1) {
-                return asm_error_new(ASM_ERROR_BAD_LABEL, msu_str_printf("unknown label '%s'\n",
-                                                                         msu_str_data(insr->label_reference)));
+                err = asm_error_new(ASM_ERROR_BAD_LABEL, msu_str_printf("unknown label '%s'\n",
+                                                                        msu_str_data(insr->label_reference)));
             }
         } else {
             value = insr->value;
         }
 
-        const char *inst = msu_str_data(insr->instruction);
-
-        if (strcmp(inst, "HLT") == 0 || strcmp(inst, "COB") == 0) outcode[off++] = 0;
-        else if (strcmp(inst, "ADD") == 0) outcode[off++] = 100 + value;
-        else if (strcmp(inst, "SUB") == 0) outcode[off++] = 200 + value;
-        else if (strcmp(inst, "STA") == 0) outcode[off++] = 300 + value;
-        else if (strcmp(inst, "LDI") == 0) outcode[off++] = 400 + value;
-        else if (strcmp(inst, "LDA") == 0) outcode[off++] = 500 + value;
-        else if (strcmp(inst, "BRA") == 0) outcode[off++] = 600 + value;
-        else if (strcmp(inst, "BRZ") == 0) outcode[off++] = 700 + value;
-        else if (strcmp(inst, "BRP") == 0) outcode[off++] = 800 + value;
-        else if (strcmp(inst, "INP") == 0) outcode[off++] = 901;
-        else if (strcmp(inst, "OUT") == 0) outcode[off++] = 902;
-        else if (strcmp(inst, "JAL") == 0) outcode[off++] = 910;
-        else if (strcmp(inst, "RET") == 0) outcode[off++] = 911;
-        else if (strcmp(inst, "SPUSH") == 0) outcode[off++] = 920;
-        else if (strcmp(inst, "SPOP") == 0) outcode[off++] = 921;
-        else if (strcmp(inst, "SDUP") == 0) outcode[off++] = 922;
-        else if (strcmp(inst, "SDROP") == 0) outcode[off++] = 923;
-        else if (strcmp(inst, "SSWAP") == 0) outcode[off++] = 924;
-        else if (strcmp(inst, "SADD") == 0) outcode[off++] = 930;
-        else if (strcmp(inst, "SSUB") == 0) outcode[off++] = 931;
-        else if (strcmp(inst, "SMUL") == 0) outcode[off++] = 932;
-        else if (strcmp(inst, "SDIV") == 0) outcode[off++] = 933;
-        else if (strcmp(inst, "SMAX") == 0) outcode[off++] = 934;
-        else if (strcmp(inst, "SMIN") == 0) outcode[off++] = 935;
-        else if (strcmp(inst, "SPUSHI") == 0) {
-            outcode[off++] = 400 + value;
-            outcode[off++] = 920;
-        } else if (strcmp(inst, "CALL") == 0) {
-            outcode[off++] = 400 + value;
-            outcode[off++] = 910;
-        } else if (strcmp(inst, "DAT") == 0) {
-            outcode[off++] = value;
-        } else {
-            return asm_error_new(ASM_ERROR_BAD_INSR, msu_str_printf("unknown instruction '%s'\n", inst));
+        if (!err) {
+            err = asm_emit_insr(insr, value, outcode + off);
+        }
+        if (err) {
+            err->span = insr->span;
+            tail = asm_error_append(tail, err);
         }
+        off += slots;
     }
 
-    return NULL;
+    return errors;
 }
 
 asm_insr_t *asm_insr_clone(const asm_insr_t *src) {
@@ -221,7 +558,8 @@ asm_insr_t *asm_insr_clone(const asm_insr_t *src) {
     out->instruction = msu_str_clone(src->instruction);
     out->value = src->value;
     out->label_reference = msu_str_clone(src->label_reference);
-    out->error = src->error;
+    out->error = src->error ? asm_error_clone(src->error) : NULL;
+    out->span = src->span;
     return out;
 }
 
@@ -230,6 +568,8 @@ asm_error_t *asm_error_clone(const asm_error_t *src) {
     assert(out && "out of memory!\n");
     out->kind = src->kind;
     out->message = msu_str_clone(src->message);
+    out->span = src->span;
+    out->next = src->next ? asm_error_clone(src->next) : NULL;
     return out;
 }
 
@@ -244,42 +584,327 @@ void asm_insr_free(asm_insr_t *current) {
 }
 
 void asm_error_free(asm_error_t *err) {
-    if (err) {
+    while (err) {
+        asm_error_t *next = err->next;
         msu_str_free(err->message);
         free(err);
+        err = next;
     }
 }
 
-bool asm_report_errors(list_of_asm_insrs_t *insrs) {
-    bool errors = false;
-    for (int i = 0; i < insrs->len; ++i) {
-        const asm_insr_t *insr = list_of_asm_insrs_get(insrs, i);
+// the parse errors of `insrs`, cloned into one list
+asm_error_t *asm_collect_errors(const list_of_asm_insrs_t *insrs) {
+    asm_error_t *errors = NULL;
+    asm_error_t **tail = &errors;
+    for (size_t i = 0; i < insrs->len; ++i) {
+        const asm_insr_t *insr = list_of_asm_insrs_get_const(insrs, i);
         if (insr->error) {
-            if (!errors) {
-                printf("\n\n"
-                       "######################################\n"
-                       "# Assembler Errors:\n"
-                       "######################################\n\n");
-            }
-            errors = true;
-            printf("  %s - %s\n", msu_str_data(insr->instruction), msu_str_data(insr->error->message));
+            tail = asm_error_append(tail, asm_error_clone(insr->error));
         }
     }
-    if (errors) {
-        printf("\n\n");
-    }
     return errors;
 }
 
-int *asm_assemble(const msu_str_t *src, asm_error_t **err) {
-    list_of_asm_insrs_t *insrs = asm_parse(src);
-
+int *asm_assemble_insrs(list_of_asm_insrs_t *insrs, asm_error_t **err) {
     int *code = (int *) calloc(MIDDLE_OF_MEMORY, sizeof(int));
     assert(code && "out of memory!\n");
 
-    if (!asm_report_errors(insrs)) {
+    *err = asm_collect_errors(insrs);
+    if (!*err) {
         *err = asm_emit(insrs, code, MIDDLE_OF_MEMORY);
     }
+    return code;
+}
+
+int *asm_assemble(const msu_str_t *src, asm_error_t **err) {
+    list_of_asm_insrs_t *insrs = asm_parse(src);
+    int *code = asm_assemble_insrs(insrs, err);
     list_of_asm_insrs_free(insrs, true);
     return code;
 }
+
+//======================================================
+//  Incremental assembly
+//======================================================
+
+
+asm_session_t *asm_session_new() {
+    asm_session_t *out = calloc(1, sizeof(asm_session_t));
+    assert(out && "out of memory!\n");
+    out->symbols = asm_symtab_new();
+    return out;
+}
+
+void asm_session_line_free(asm_session_line_t *line) {
+    msu_str_free(line->text);
+    asm_insr_free(line->insr);
+}
+
+void asm_session_free(asm_session_t *session) {
+    if (session) {
+        for (size_t i = 0; i < session->len; i++) {
+            asm_session_line_free(&session->lines[i]);
+        }
+        free(session->lines);
+        asm_symtab_free(session->symbols);
+        free(session);
+    }
+}
+
+bool asm_session_line_matches(const asm_session_line_t *line, hash_t hash, const msu_str_t *text) {
+    return line->hash == hash && msu_str_eq(line->text, text);
+}
+
+bool asm_session_has_label(const asm_session_line_t *line) {
+    return line->insr && !msu_str_is_empty(line->insr->label);
+}
+
+// rebuilds the symbol table from scratch, the first definition of a label wins
+void asm_session_rebuild_symbols(asm_session_t *session) {
+    asm_symtab_free(session->symbols);
+    session->symbols = asm_symtab_new();
+    session->duplicate_labels = false;
+    for (size_t i = 0; i < session->len; i++) {
+        const asm_session_line_t *line = &session->lines[i];
+        if (!asm_session_has_label(line)) continue;
+        if (asm_symtab_contains(session->symbols, line->insr->label)) {
+            session->duplicate_labels = true;
+        } else {
+            asm_symtab_insert(session->symbols, line->insr->label, line->pc);
+        }
+    }
+}
+
+asm_error_t *asm_session_emit_line(asm_session_t *session, const asm_session_line_t *line) {
+    const asm_insr_t *insr = line->insr;
+    if (!insr) return NULL;
+
+    int value = insr->value;
+    asm_error_t *err = NULL;
+    if (!msu_str_is_empty(insr->label_reference)) {
+        int *pc = asm_symtab_getv(session->symbols, insr->label_reference);
+        if (pc) {
+            value = *pc;
+        } else {
+            err = asm_error_new(ASM_ERROR_BAD_LABEL, msu_str_printf("unknown label '%s'\n",
+                                                                    msu_str_data(insr->label_reference)));
+        }
+    }
+    if (!err) {
+        err = asm_emit_insr(insr, value, session->code + line->pc);
+    }
+    if (err) {
+        err->span = insr->span;
+    }
+    return err;
+}
+
+void asm_session_set_span(asm_session_line_t *line, size_t lineno) {
+    if (!line->insr) return;
+    line->insr->span = (asm_span_t) {lineno + 1, line->offset, msu_str_len(line->text)};
+    if (line->insr->error) {
+        line->insr->error->span = line->insr->span;
+    }
+}
+
+// directives make lines depend on each other, so sources using them are assembled from scratch
+const int *asm_session_assemble_all(asm_session_t *session, const msu_str_t *src, asm_error_t **errout) {
+    for (size_t i = 0; i < session->len; i++) {
+        asm_session_line_free(&session->lines[i]);
+    }
+    session->len = 0;
+    asm_symtab_free(session->symbols);
+    session->symbols = asm_symtab_new();
+    session->duplicate_labels = false;
+    memset(session->code, 0, sizeof(session->code));
+
+    list_of_asm_insrs_t *insrs = asm_parse(src);
+    asm_error_t *errors = asm_collect_errors(insrs);
+    if (!errors) {
+        errors = asm_emit(insrs, session->code, MIDDLE_OF_MEMORY);
+    }
+    session->size = 0;
+    for (size_t i = 0; i < insrs->len; i++) {
+        session->size += asm_insr_size(list_of_asm_insrs_get_const(insrs, i));
+    }
+    session->reparsed = insrs->len;
+    list_of_asm_insrs_free(insrs, true);
+
+    session->had_error = true; // there are no lines to patch, the next call starts over
+    *errout = errors;
+    return session->code;
+}
+
+const int *asm_session_assemble(asm_session_t *session, const msu_str_t *src, asm_error_t **errout) {
+    const size_t seed = 42;
+    list_of_msu_strs_t *texts = msu_str_splitlines(src);
+    for (size_t i = 0; i < texts->len; i++) {
+        if (asm_line_has_directive(list_of_msu_strs_get_const(texts, i))) {
+            list_of_msu_strs_free(texts, true);
+            return asm_session_assemble_all(session, src, errout);
+        }
+    }
+    const size_t n = texts->len;
+    const size_t old_n = session->len;
+    asm_session_line_t *old = session->lines;
+
+    hash_t *hashes = malloc(sizeof(hash_t) * (n + 1));
+    assert(hashes && "out of memory!\n");
+    for (size_t i = 0; i < n; i++) {
+        hashes[i] = msu_str_hash(list_of_msu_strs_get_const(texts, i), seed);
+    }
+
+    // the edited region is whatever lies between the longest unchanged prefix and suffix
+    size_t prefix = 0;
+    while (prefix < n && prefix < old_n
+           && asm_session_line_matches(&old[prefix], hashes[prefix], list_of_msu_strs_get_const(texts, prefix))) {
+        prefix++;
+    }
+    size_t suffix = 0;
+    while (suffix < n - prefix && suffix < old_n - prefix
+           && asm_session_line_matches(&old[old_n - 1 - suffix], hashes[n - 1 - suffix],
+                                       list_of_msu_strs_get_const(texts, n - 1 - suffix))) {
+        suffix++;
+    }
+    const size_t old_mid_end = old_n - suffix;
+    const size_t mid_end = n - suffix;
+
+    const int old_size = old_n > 0 ? session->size : 0; // an image assembled from scratch has no lines to keep
+    const int mid_pc = prefix < old_n ? old[prefix].pc : old_size;
+    const int old_suffix_pc = old_mid_end < old_n ? old[old_mid_end].pc : old_size;
+
+    asm_symtab_t *dirty = asm_symtab_new();
+    bool rebuild = session->duplicate_labels; // can't tell which definition a removal refers to
+
+    // labels defined in the replaced lines go away (the lines are freed at the very end,
+    // `dirty` borrows their names until then)
+    for (size_t i = prefix; i < old_mid_end; i++) {
+        if (asm_session_has_label(&old[i])) {
+            asm_symtab_remove(session->symbols, old[i].insr->label, NULL);
+            asm_symtab_insert(dirty, old[i].insr->label, 0);
+        }
+    }
+
+    asm_session_line_t *lines = malloc(sizeof(asm_session_line_t) * (n + 1));
+    assert(lines && "out of memory!\n");
+    memcpy(lines, old, sizeof(asm_session_line_t) * prefix);
+
+    session->reparsed = 0;
+    int pc = mid_pc;
+    size_t offset = prefix > 0 ? asm_next_line_offset(src, lines[prefix - 1].offset, lines[prefix - 1].text) : 0;
+    for (size_t i = prefix; i < mid_end; i++) {
+        const msu_str_t *text = list_of_msu_strs_get_const(texts, i);
+        asm_session_line_t *line = &lines[i];
+        line->hash = hashes[i];
+        line->text = text;
+        line->offset = offset;
+        line->pc = pc;
+        line->insr = NULL;
+        offset = asm_next_line_offset(src, offset, text);
+        if (msu_str_is_blank(text)) continue;
+
+        line->insr = asm_parse_insr(text);
+        asm_session_set_span(line, i);
+        session->reparsed++;
+        pc += asm_insr_size(line->insr);
+
+        if (asm_session_has_label(line)) {
+            if (!asm_symtab_insert(session->symbols, line->insr->label, line->pc)) {
+                rebuild = true; // a duplicate label, let the first definition win
+            }
+            asm_symtab_insert(dirty, line->insr->label, 0);
+        }
+    }
+    const int delta = (pc - mid_pc) - (old_suffix_pc - mid_pc);
+    const size_t shift = suffix > 0 ? offset - old[old_mid_end].offset : 0;
+
+    for (size_t i = 0; i < suffix; i++) {
+        asm_session_line_t *line = &lines[mid_end + i];
+        *line = old[old_mid_end + i];
+        line->offset += shift;
+        asm_session_set_span(line, mid_end + i);
+        if (delta == 0) continue;
+
+        line->pc += delta;
+        if (asm_session_has_label(line)) {
+            int *value = asm_symtab_getv(session->symbols, line->insr->label);
+            if (value && *value == line->pc - delta) {
+                *value = line->pc;
+            } else {
+                rebuild = true;
+            }
+            asm_symtab_insert(dirty, line->insr->label, 0);
+        }
+    }
+
+    // texts outside of the edit are already owned by the reused lines
+    for (size_t i = 0; i < n; i++) {
+        if (i < prefix || i >= mid_end) {
+            msu_str_free(list_of_msu_strs_get_const(texts, i));
+        }
+    }
+    list_of_msu_strs_free(texts, false);
+    free(hashes);
+
+    session->lines = lines;
+    session->len = n;
+    session->cap = n + 1;
+    session->size = old_size + delta;
+
+    if (rebuild) {
+        asm_session_rebuild_symbols(session);
+    }
+    const bool full = rebuild || session->had_error;
+
+    asm_error_t *errors = NULL;
+    asm_error_t **tail = &errors;
+    for (size_t i = 0; i < n; i++) {
+        if (lines[i].insr && lines[i].insr->error) {
+            tail = asm_error_append(tail, asm_error_clone(lines[i].insr->error));
+        }
+    }
+    if (!errors && session->size >= MIDDLE_OF_MEMORY) {
+        errors = asm_error_new(ASM_ERROR_TOO_LARGE, msu_str_new("too many instructions"));
+    }
+
+    if (!errors) {
+        if (full) {
+            memset(session->code, 0, sizeof(session->code));
+            for (size_t i = 0; i < n; i++) {
+                tail = asm_error_append(tail, asm_session_emit_line(session, &lines[i]));
+            }
+        } else {
+            if (delta != 0) {
+                memmove(session->code + old_suffix_pc + delta, session->code + old_suffix_pc,
+                        sizeof(int) * (old_size - old_suffix_pc));
+                if (delta < 0) {
+                    memset(session->code + session->size, 0, sizeof(int) * -delta);
+                }
+            }
+            for (size_t i = prefix; i < mid_end; i++) {
+                tail = asm_error_append(tail, asm_session_emit_line(session, &lines[i]));
+            }
+            if (asm_symtab_size(dirty) > 0) {
+                for (size_t i = 0; i < n; i++) {
+                    if (i == prefix) i = mid_end;
+                    if (i >= n) break;
+                    const asm_insr_t *insr = lines[i].insr;
+                    if (insr && !msu_str_is_empty(insr->label_reference)
+                        && asm_symtab_contains(dirty, insr->label_reference)) {
+                        tail = asm_error_append(tail, asm_session_emit_line(session, &lines[i]));
+                    }
+                }
+            }
+        }
+    }
+    session->had_error = errors != NULL;
+    *errout = errors;
+
+    asm_symtab_free(dirty);
+    for (size_t i = prefix; i < old_mid_end; i++) {
+        asm_session_line_free(&old[i]);
+    }
+    free(old);
+
+    return session->code;
+}
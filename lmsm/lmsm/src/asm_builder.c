@@ -0,0 +1,197 @@
+#include "lmsm/asm.h"
+#include "msulib/hash.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// each label merged into another to the one it was merged into, borrowed from builder->aliases
+#define BT_IMPL
+#define BT_NAME asm_aliases
+#define BT_KEY const msu_str_t *
+#define BT_VALUE const msu_str_t *
+#define BT_HASHFUNC(x) msu_str_hash(x, 42)
+#define BT_EQFUNC msu_str_eq
+#include "templates/btree.h"
+#undef bt_getv
+
+asm_builder_t *asm_builder_new() {
+    asm_builder_t *out = calloc(1, sizeof(asm_builder_t));
+    assert(out && "out of memory!\n");
+    out->insrs = list_of_asm_insrs_new();
+    out->aliases = list_of_msu_strs_new();
+    return out;
+}
+
+void asm_builder_label(asm_builder_t *builder, const msu_str_t *label) {
+    if (builder->label) {
+        list_of_msu_strs_append(builder->aliases, msu_str_clone(label));
+        list_of_msu_strs_append(builder->aliases, msu_str_clone(builder->label));
+    } else {
+        builder->label = msu_str_clone(label);
+    }
+}
+
+asm_insr_t *asm_builder_push(asm_builder_t *builder, const char *insr) {
+    asm_insr_t *out = calloc(1, sizeof(asm_insr_t));
+    assert(out && "out of memory!\n");
+    out->label = builder->label;
+    out->instruction = msu_str_new(insr);
+    builder->label = NULL;
+    if (!asm_is_insr(insr)) {
+        out->error = asm_error_new(ASM_ERROR_BAD_INSR, msu_str_new(insr));
+    }
+    list_of_asm_insrs_append(builder->insrs, out);
+    return out;
+}
+
+void asm_builder_op(asm_builder_t *builder, const char *insr) {
+    asm_insr_t *out = asm_builder_push(builder, insr);
+    if (!out->error && asm_is_arg_insr(insr)) {
+        out->error = asm_error_new(ASM_ERROR_BAD_ARG, msu_str_new("missing argument"));
+    }
+}
+
+void asm_builder_op_value(asm_builder_t *builder, const char *insr, int value) {
+    asm_insr_t *out = asm_builder_push(builder, insr);
+    out->value = value;
+    if (!out->error && (value > 999 || value < -999)) {
+        out->error = asm_error_new(ASM_ERROR_BAD_ARG, msu_str_printf("%d", value));
+    }
+}
+
+void asm_builder_op_ref(asm_builder_t *builder, const char *insr, const msu_str_t *label) {
+    asm_insr_t *out = asm_builder_push(builder, insr);
+    out->label_reference = msu_str_clone(label);
+}
+
+// the label `label` ends up as, through any number of merges. everything on the way is pointed
+// straight at it, so the next lookup is one step
+const msu_str_t *asm_aliases_find(asm_aliases_t *aliases, const msu_str_t *label) {
+    const msu_str_t *root = label, **to;
+    for (size_t hops = 0; (to = asm_aliases_getv(aliases, root)) && hops < asm_aliases_size(aliases); hops++) {
+        root = *to;
+    }
+    while ((to = asm_aliases_getv(aliases, label)) && *to != root) {
+        label = *to;
+        *to = root;
+    }
+    return root;
+}
+
+list_of_asm_insrs_t *asm_builder_finish(asm_builder_t *builder) {
+    if (builder->label) {
+        asm_builder_op_value(builder, "DAT", 0); // a label at the very end still needs a cell
+    }
+
+    if (builder->aliases->len > 0) {
+        asm_aliases_t *aliases = asm_aliases_new();
+        for (size_t j = 0; j < builder->aliases->len; j += 2) {
+            const msu_str_t *label = list_of_msu_strs_get_const(builder->aliases, j);
+            if (asm_aliases_contains(aliases, label)) continue; // the first merge is the one that counts
+            asm_aliases_insert(aliases, label, list_of_msu_strs_get_const(builder->aliases, j + 1));
+        }
+        for (size_t i = 0; i < builder->insrs->len; i++) {
+            asm_insr_t *insr = list_of_asm_insrs_get(builder->insrs, i);
+            if (msu_str_is_empty(insr->label_reference)) continue;
+            const msu_str_t *label = asm_aliases_find(aliases, insr->label_reference);
+            if (label != insr->label_reference) {
+                msu_str_free(insr->label_reference);
+                insr->label_reference = msu_str_clone(label);
+            }
+        }
+        asm_aliases_free(aliases);
+    }
+
+    list_of_asm_insrs_t *out = builder->insrs;
+    builder->insrs = NULL;
+    asm_builder_free(builder);
+    return out;
+}
+
+void asm_builder_append(asm_builder_t *builder, list_of_asm_insrs_t *insrs) {
+    for (size_t i = 0; i < insrs->len; i++) {
+        asm_insr_t *insr = list_of_asm_insrs_get(insrs, i);
+        if (i == 0 && builder->label) {
+            // the pending label goes on the first instruction, or is merged into the one it has
+            if (msu_str_is_empty(insr->label)) {
+                msu_str_free(insr->label);
+                insr->label = builder->label;
+            } else {
+                list_of_msu_strs_append(builder->aliases, builder->label);
+                list_of_msu_strs_append(builder->aliases, msu_str_clone(insr->label));
+            }
+            builder->label = NULL;
+        }
+        list_of_asm_insrs_append(builder->insrs, insr);
+    }
+    list_of_asm_insrs_free(insrs, false);
+}
+
+void asm_builder_free(asm_builder_t *builder) {
+    if (builder) {
+        if (builder->insrs) list_of_asm_insrs_free(builder->insrs, true);
+        msu_str_free(builder->label);
+        list_of_msu_strs_free(builder->aliases, true);
+        free(builder);
+    }
+}
+
+const msu_str_t *asm_print(const list_of_asm_insrs_t *insrs) {
+    msu_str_builder_t sb = msu_str_builder_new();
+    for (size_t i = 0; i < insrs->len; i++) {
+        const asm_insr_t *insr = list_of_asm_insrs_get_const(insrs, i);
+        if (!msu_str_is_empty(insr->label)) {
+            msu_str_builder_pushstr(sb, insr->label);
+            msu_str_builder_push(sb, ' ');
+        }
+        msu_str_builder_pushstr(sb, insr->instruction);
+        if (!msu_str_is_empty(insr->label_reference)) {
+            msu_str_builder_push(sb, ' ');
+            msu_str_builder_pushstr(sb, insr->label_reference);
+        } else if (asm_is_arg_insr(msu_str_data(insr->instruction))) {
+            msu_str_builder_printf(sb, " %d", insr->value);
+        }
+        msu_str_builder_push(sb, '\n');
+    }
+    return msu_str_builder_into_string_and_free(sb);
+}
+
+void asm_consts_init(asm_consts_t *consts) {
+    memset(consts->by_value, 0, sizeof(consts->by_value));
+    consts->added = list_of_asm_insrs_new();
+}
+
+void asm_consts_adopt(asm_consts_t *consts, int value, const msu_str_t *label) {
+    assert(value >= -999 && value <= 999);
+    if (!consts->by_value[value + 999]) consts->by_value[value + 999] = label;
+}
+
+const msu_str_t *asm_consts_get(asm_consts_t *consts, int value) {
+    assert(value >= -999 && value <= 999);
+    const msu_str_t **label = &consts->by_value[value + 999];
+    if (!*label) {
+        asm_insr_t *insr = calloc(1, sizeof(asm_insr_t));
+        assert(insr && "out of memory!\n");
+        insr->label = msu_str_printf("$const.%d", value);
+        insr->instruction = msu_str_new("DAT");
+        insr->value = value;
+        list_of_asm_insrs_append(consts->added, insr);
+        *label = insr->label;
+    }
+    return *label;
+}
+
+void asm_consts_finish(asm_consts_t *consts, list_of_asm_insrs_t *out) {
+    for (size_t i = 0; i < consts->added->len; i++) {
+        asm_insr_t *insr = list_of_asm_insrs_get(consts->added, i);
+        if (out) {
+            list_of_asm_insrs_append(out, insr);
+        } else {
+            asm_insr_free(insr);
+        }
+    }
+    list_of_asm_insrs_free(consts->added, false);
+    consts->added = NULL;
+    memset(consts->by_value, 0, sizeof(consts->by_value));
+}
@@ -0,0 +1,125 @@
+#include "lmsm/asm.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+// the target of the CALL whose JAL is at `pc`, or -1 if the JAL doesn't follow an LDI
+int asm_disasm_call_target(const int *code, const bool *is_code, size_t pc) {
+    int operand;
+    if (pc == 0 || !is_code[pc - 1]) return -1;
+    const emulator_opcode_t *op = emulator_decode(code[pc - 1], &operand);
+    return op && op->code == 400 ? operand : -1;
+}
+
+// marks every cell reachable from address 0, everything else is data
+void asm_disasm_mark_code(const int *code, size_t n, bool *is_code) {
+    size_t *pending = malloc((n + 1) * sizeof(size_t));
+    bool *queued = calloc(n + 1, sizeof(bool));
+    assert(pending && queued && "out of memory!\n");
+    size_t top = 0;
+    if (n > 0) {
+        pending[top++] = 0;
+        queued[0] = true;
+    }
+
+    while (top > 0) {
+        size_t pc = pending[--top];
+        while (pc < n && !is_code[pc]) {
+            int operand;
+            const emulator_opcode_t *op = emulator_decode(code[pc], &operand);
+            if (!op) break;
+            is_code[pc] = true;
+
+            bool falls_through = op->code != 0 && op->code != 600 && op->code != 911;
+            int target = -1;
+            if (op->code == 600 || op->code == 700 || op->code == 800) {
+                target = operand;
+            } else if (op->code == 910) {
+                target = asm_disasm_call_target(code, is_code, pc);
+            }
+            if (target >= 0 && (size_t) target < n && !queued[target]) {
+                pending[top++] = target;
+                queued[target] = true;
+            }
+
+            if (!falls_through) break;
+            pc++;
+        }
+    }
+    free(queued);
+    free(pending);
+}
+
+void asm_disasm_name(const msu_str_t **labels, size_t n, int address, const char *prefix) {
+    if (address >= 0 && (size_t) address < n && !labels[address]) {
+        labels[address] = msu_str_printf("%s%d", prefix, address);
+    }
+}
+
+list_of_asm_insrs_t *asm_disassemble(const int *code, size_t n) {
+    bool *is_code = calloc(n + 1, sizeof(bool));
+    const msu_str_t **labels = calloc(n + 1, sizeof(msu_str_t *));
+    assert(is_code && labels && "out of memory!\n");
+
+    asm_disasm_mark_code(code, n, is_code);
+
+    // calls name their targets first, then branches, then data
+    for (int pass = 0; pass < 3; pass++) {
+        for (size_t pc = 0; pc < n; pc++) {
+            int operand;
+            const emulator_opcode_t *op = is_code[pc] ? emulator_decode(code[pc], &operand) : NULL;
+            if (!op) continue;
+            if (pass == 0 && op->code == 910) {
+                asm_disasm_name(labels, n, asm_disasm_call_target(code, is_code, pc), "fn_");
+            } else if (pass == 1 && (op->code == 600 || op->code == 700 || op->code == 800)) {
+                asm_disasm_name(labels, n, operand, "L");
+            } else if (pass == 2 && op->code >= 100 && op->code <= 500 && op->code != 400) {
+                asm_disasm_name(labels, n, operand, "D");
+            }
+        }
+    }
+
+    // trailing zeros are what unassembled memory holds anyway
+    size_t end = n;
+    while (end > 0 && code[end - 1] == 0 && !is_code[end - 1] && !labels[end - 1]) end--;
+
+    asm_builder_t *builder = asm_builder_new();
+    for (size_t pc = 0; pc < end; pc++) {
+        if (labels[pc]) asm_builder_label(builder, labels[pc]);
+
+        int operand;
+        const emulator_opcode_t *op = is_code[pc] ? emulator_decode(code[pc], &operand) : NULL;
+        if (!op) {
+            asm_builder_op_value(builder, "DAT", code[pc]);
+            continue;
+        }
+
+        // LDI n followed by JAL or SPUSH is how CALL and SPUSHI assemble
+        const emulator_opcode_t *next = NULL;
+        if (op->code == 400 && pc + 1 < end && is_code[pc + 1] && !labels[pc + 1]) {
+            next = emulator_decode(code[pc + 1], NULL);
+        }
+        if (next && next->code == 910) {
+            if ((size_t) operand < n && labels[operand]) {
+                asm_builder_op_ref(builder, "CALL", labels[operand]);
+            } else {
+                asm_builder_op_value(builder, "CALL", operand);
+            }
+            pc++;
+        } else if (next && next->code == 920) {
+            asm_builder_op_value(builder, "SPUSHI", operand);
+            pc++;
+        } else if (!op->has_operand) {
+            asm_builder_op(builder, op->name);
+        } else if (op->code != 400 && op->code > 0 && (size_t) operand < n && labels[operand]) {
+            asm_builder_op_ref(builder, op->name, labels[operand]);
+        } else {
+            asm_builder_op_value(builder, op->name, operand);
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) msu_str_free(labels[i]);
+    free(labels);
+    free(is_code);
+    return asm_builder_finish(builder);
+}
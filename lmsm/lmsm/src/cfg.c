@@ -0,0 +1,306 @@
+#include "lmsm/cfg.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BT_IMPL
+#define BT_NAME cfg_names
+#define BT_KEY const msu_str_t *
+#define BT_VALUE int
+#define BT_HASHFUNC(x) msu_str_hash(x, 42)
+#define BT_EQFUNC msu_str_eq
+#include "templates/btree.h"
+#undef bt_getv
+
+//======================================================
+//  Bit sets
+//======================================================
+
+bool cfg_bits_has(const uint64_t *set, size_t bit) {
+    return (set[bit / 64] >> (bit % 64)) & 1;
+}
+
+void cfg_bits_set(uint64_t *set, size_t bit) {
+    set[bit / 64] |= (uint64_t) 1 << (bit % 64);
+}
+
+void cfg_bits_clear(uint64_t *set, size_t bit) {
+    set[bit / 64] &= ~((uint64_t) 1 << (bit % 64));
+}
+
+void cfg_bits_fill(uint64_t *set, size_t words) {
+    memset(set, 0xff, words * sizeof(uint64_t));
+}
+
+// every cell, but not the registers
+void cfg_bits_set_cells(const cfg_t *cfg, uint64_t *set) {
+    bool acc = cfg_bits_has(set, CFG_ACC), ra = cfg_bits_has(set, CFG_RA);
+    cfg_bits_fill(set, cfg->words);
+    if (!acc) cfg_bits_clear(set, CFG_ACC);
+    if (!ra) cfg_bits_clear(set, CFG_RA);
+}
+
+const uint64_t *cfg_live_in(const cfg_t *cfg, size_t block) {
+    return cfg->live_in + block * cfg->words;
+}
+
+const uint64_t *cfg_live_out(const cfg_t *cfg, size_t block) {
+    return cfg->live_out + block * cfg->words;
+}
+
+//======================================================
+//  Instructions
+//======================================================
+
+bool cfg_is(const asm_insr_t *insr, const char *name) {
+    return msu_str_eqs(insr->instruction, name);
+}
+
+// data, errors and anything else that isn't an instruction the machine runs
+bool cfg_is_unknown(const asm_insr_t *insr) {
+    if (insr->error) return true;
+    if (cfg_is(insr, "CALL") || cfg_is(insr, "SPUSHI") || cfg_is(insr, "COB")) return false;
+    return emulator_find_opcode(msu_str_data(insr->instruction)) == NULL;
+}
+
+bool cfg_is_branch(const asm_insr_t *insr) {
+    return cfg_is(insr, "BRA") || cfg_is(insr, "BRZ") || cfg_is(insr, "BRP");
+}
+
+// whether the block has to end after `insr`
+bool cfg_ends_block(const asm_insr_t *insr) {
+    return cfg_is_unknown(insr) || cfg_is_branch(insr) || cfg_is(insr, "HLT") || cfg_is(insr, "COB")
+           || cfg_is(insr, "RET") || cfg_is(insr, "JAL") || cfg_is(insr, "CALL");
+}
+
+// SLDX and SSTX read the length in the cell they name, the elements after it aren't named
+bool cfg_reads_memory(const asm_insr_t *insr) {
+    return cfg_is(insr, "LDA") || cfg_is(insr, "ADD") || cfg_is(insr, "SUB") || cfg_is(insr, "SLDX")
+           || cfg_is(insr, "SSTX");
+}
+
+// what an instruction does, worked out once so solving doesn't compare names
+enum cfg_effect {
+    CFG_DEFS_ACC = 1,
+    CFG_USES_ACC = 2,
+    CFG_READS = 4,  // the cell in cell_of, or any of them
+    CFG_WRITES = 8, // the cell in cell_of
+    CFG_CALLS = 16, // anything could read any cell
+    CFG_UNKNOWN = 32,
+    CFG_DEFS_RA = 64,
+    CFG_USES_RA = 128,
+};
+
+unsigned char cfg_effects(const asm_insr_t *insr) {
+    if (cfg_is_unknown(insr)) return CFG_UNKNOWN;
+    unsigned char out = 0;
+    if (cfg_is(insr, "LDI") || cfg_is(insr, "LDA") || cfg_is(insr, "INP") || cfg_is(insr, "SPOP")
+        || cfg_is(insr, "CALL") || cfg_is(insr, "SPUSHI")) {
+        out |= CFG_DEFS_ACC;
+    }
+    if (cfg_is(insr, "ADD") || cfg_is(insr, "SUB") || cfg_is(insr, "STA") || cfg_is(insr, "OUT")
+        || cfg_is(insr, "SPUSH") || cfg_is(insr, "BRZ") || cfg_is(insr, "BRP") || cfg_is(insr, "JAL")) {
+        out |= CFG_USES_ACC;
+    }
+    if (cfg_reads_memory(insr)) out |= CFG_READS;
+    if (cfg_is(insr, "STA")) out |= CFG_WRITES;
+    if (cfg_is(insr, "CALL") || cfg_is(insr, "JAL")) out |= CFG_CALLS;
+    if (cfg_is(insr, "CALL") || cfg_is(insr, "JAL") || cfg_is(insr, "RPOP")) out |= CFG_DEFS_RA;
+    if (cfg_is(insr, "RET") || cfg_is(insr, "RPUSH")) out |= CFG_USES_RA;
+    return out;
+}
+
+// turns `live` after the instruction at `index` into `live` before it
+void cfg_transfer(const cfg_t *cfg, size_t index, uint64_t *live) {
+    unsigned char effects = cfg->effects[index];
+    int cell = cfg->cell_of[index];
+    if (effects & CFG_UNKNOWN) {
+        cfg_bits_fill(live, cfg->words);
+        return;
+    }
+
+    // what it writes is dead before it, unless it reads it as well
+    if (effects & CFG_DEFS_ACC) cfg_bits_clear(live, CFG_ACC);
+    if ((effects & CFG_WRITES) && cell >= 0) cfg_bits_clear(live, cell);
+    if (effects & CFG_DEFS_RA) cfg_bits_clear(live, CFG_RA);
+
+    if (effects & CFG_USES_ACC) cfg_bits_set(live, CFG_ACC);
+    if (effects & CFG_USES_RA) cfg_bits_set(live, CFG_RA);
+    if ((effects & CFG_READS) && cell >= 0) cfg_bits_set(live, cell);
+    // a numbered cell could be any of them
+    if (((effects & CFG_READS) && cell < 0) || (effects & CFG_CALLS)) cfg_bits_set_cells(cfg, live);
+}
+
+// RPUSH; CALL f; RPOP, which leaves $ra as it was
+bool cfg_is_saved_call(const list_of_asm_insrs_t *insrs, size_t i) {
+    for (size_t j = 0; j < 3; j++) {
+        const asm_insr_t *insr = list_of_asm_insrs_get_const(insrs, i + j);
+        if (insr->error || (j > 0 && !msu_str_is_empty(insr->label))) return false;
+    }
+    return cfg_is(list_of_asm_insrs_get_const(insrs, i), "RPUSH")
+           && cfg_is(list_of_asm_insrs_get_const(insrs, i + 1), "CALL")
+           && cfg_is(list_of_asm_insrs_get_const(insrs, i + 2), "RPOP");
+}
+
+//======================================================
+//  Building
+//======================================================
+
+int cfg_cell(const cfg_t *cfg, const msu_str_t *label) {
+    int *bit = msu_str_is_empty(label) ? NULL : cfg_names_getv(cfg->names, label);
+    return bit ? *bit : -1;
+}
+
+void cfg_find_cells(cfg_t *cfg) {
+    cfg->names = cfg_names_new();
+    cfg->cells = malloc((cfg->insrs->len + 1) * sizeof(msu_str_t *));
+    cfg->cell_of = malloc((cfg->insrs->len + 1) * sizeof(int));
+    cfg->effects = malloc(cfg->insrs->len + 1);
+    assert(cfg->cells && cfg->cell_of && cfg->effects && "out of memory!\n");
+    for (size_t i = 0; i < cfg->insrs->len; i++) {
+        const asm_insr_t *insr = list_of_asm_insrs_get_const(cfg->insrs, i);
+        cfg->effects[i] = cfg_effects(insr);
+        cfg->cell_of[i] = -1;
+        if (i >= 2 && cfg_is_saved_call(cfg->insrs, i - 2)) {
+            cfg->effects[i - 2] &= ~CFG_USES_RA;
+            cfg->effects[i - 1] &= ~CFG_DEFS_RA;
+            cfg->effects[i] &= ~CFG_DEFS_RA;
+        }
+        if (insr->error || msu_str_is_empty(insr->label_reference)) continue;
+        if (!cfg_reads_memory(insr) && !cfg_is(insr, "STA")) continue;
+        cfg->cell_of[i] = cfg_cell(cfg, insr->label_reference);
+        if (cfg->cell_of[i] < 0) {
+            cfg->cell_of[i] = (int) (CFG_CELLS + cfg->cell_count);
+            cfg->cells[cfg->cell_count++] = insr->label_reference;
+            cfg_names_insert(cfg->names, insr->label_reference, cfg->cell_of[i]);
+        }
+    }
+    cfg->words = (cfg->cell_count + CFG_CELLS) / 64 + 1;
+}
+
+// the block starting at `label`, or -1
+int cfg_block_at(const cfg_t *cfg, cfg_names_t *labels, const msu_str_t *label) {
+    int *index = msu_str_is_empty(label) ? NULL : cfg_names_getv(labels, label);
+    return index ? (int) cfg->block_of[*index] : -1;
+}
+
+void cfg_find_blocks(cfg_t *cfg) {
+    const list_of_asm_insrs_t *insrs = cfg->insrs;
+    cfg_names_t *labels = cfg_names_new();
+    cfg->blocks = malloc((insrs->len + 1) * sizeof(cfg_block_t));
+    cfg->block_of = malloc((insrs->len + 1) * sizeof(size_t));
+    assert(cfg->blocks && cfg->block_of && "out of memory!\n");
+
+    for (size_t i = 0; i < insrs->len; i++) {
+        const asm_insr_t *insr = list_of_asm_insrs_get_const(insrs, i);
+        bool leader = i == 0 || !msu_str_is_empty(insr->label)
+                      || cfg_ends_block(list_of_asm_insrs_get_const(insrs, i - 1));
+        if (leader) {
+            cfg_block_t *block = &cfg->blocks[cfg->len++];
+            block->start = i;
+            block->succ[0] = block->succ[1] = -1;
+            block->callee = -1;
+            block->exits = false;
+        }
+        cfg->blocks[cfg->len - 1].end = i + 1;
+        cfg->block_of[i] = cfg->len - 1;
+        if (!msu_str_is_empty(insr->label) && !cfg_names_contains(labels, insr->label)) {
+            cfg_names_insert(labels, insr->label, (int) i);
+        }
+    }
+
+    for (size_t b = 0; b < cfg->len; b++) {
+        cfg_block_t *block = &cfg->blocks[b];
+        const asm_insr_t *last = list_of_asm_insrs_get_const(insrs, block->end - 1);
+        int next = b + 1 < cfg->len ? (int) b + 1 : -1; // off the end is zeroed memory, which halts
+        int target = cfg_block_at(cfg, labels, last->label_reference);
+
+        if (cfg_is_unknown(last) || cfg_is(last, "RET")) {
+            block->exits = true;
+        } else if (cfg_is(last, "HLT") || cfg_is(last, "COB")) {
+            // nothing runs after it
+        } else if (cfg_is_branch(last)) {
+            block->succ[0] = target;
+            block->exits = target < 0;
+            if (!cfg_is(last, "BRA")) block->succ[1] = next;
+        } else {
+            block->succ[0] = next;
+            if (cfg_is(last, "CALL")) block->callee = target;
+        }
+    }
+    cfg_names_free(labels);
+}
+
+void cfg_solve_liveness(cfg_t *cfg) {
+    size_t words = cfg->words;
+    cfg->live_in = calloc(cfg->len * words + 1, sizeof(uint64_t));
+    cfg->live_out = calloc(cfg->len * words + 1, sizeof(uint64_t));
+    uint64_t *live = malloc(words * sizeof(uint64_t));
+    assert(cfg->live_in && cfg->live_out && live && "out of memory!\n");
+
+    // backwards through the blocks, so straight line code settles in one round
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = cfg->len; b > 0; b--) {
+            const cfg_block_t *block = &cfg->blocks[b - 1];
+            uint64_t *out = cfg->live_out + (b - 1) * words;
+            uint64_t *in = cfg->live_in + (b - 1) * words;
+
+            if (block->exits) cfg_bits_fill(out, words);
+            for (int s = 0; s < 2; s++) {
+                if (block->succ[s] < 0) continue;
+                const uint64_t *succ_in = cfg_live_in(cfg, block->succ[s]);
+                for (size_t w = 0; w < words; w++) out[w] |= succ_in[w];
+            }
+
+            memcpy(live, out, words * sizeof(uint64_t));
+            for (size_t i = block->end; i > block->start; i--) {
+                cfg_transfer(cfg, i - 1, live);
+            }
+            if (memcmp(live, in, words * sizeof(uint64_t)) != 0) {
+                memcpy(in, live, words * sizeof(uint64_t));
+                changed = true;
+            }
+        }
+    }
+    free(live);
+}
+
+cfg_t *cfg_build(const list_of_asm_insrs_t *insrs) {
+    cfg_t *cfg = calloc(1, sizeof(cfg_t));
+    assert(cfg && "out of memory!\n");
+    cfg->insrs = insrs;
+    cfg_find_cells(cfg);
+    cfg_find_blocks(cfg);
+    cfg_solve_liveness(cfg);
+    return cfg;
+}
+
+void cfg_free(cfg_t *cfg) {
+    if (cfg) {
+        free(cfg->blocks);
+        free(cfg->block_of);
+        free(cfg->cells);
+        free(cfg->cell_of);
+        free(cfg->effects);
+        cfg_names_free(cfg->names);
+        free(cfg->live_in);
+        free(cfg->live_out);
+        free(cfg);
+    }
+}
+
+bool cfg_is_live(const cfg_t *cfg, size_t index, size_t bit) {
+    const cfg_block_t *block = &cfg->blocks[cfg->block_of[index]];
+    uint64_t *live = malloc(cfg->words * sizeof(uint64_t));
+    assert(live && "out of memory!\n");
+    memcpy(live, cfg_live_out(cfg, cfg->block_of[index]), cfg->words * sizeof(uint64_t));
+    for (size_t i = block->end; i > index; i--) {
+        cfg_transfer(cfg, i - 1, live);
+    }
+    bool out = cfg_bits_has(live, bit);
+    free(live);
+    return out;
+}
@@ -22,6 +22,74 @@ int emulator_has_two_values_on_stack(emulator_t *emulator) {
     return emulator->stack_pointer <= TOP_OF_MEMORY - 1;
 }
 
+//======================================================
+//  Instruction Set
+//======================================================
+
+const emulator_opcode_t EMULATOR_OPCODES[] = {
+    {"HLT", 0, false, 0, "Halt the machine"},
+    {"ADD", 100, true, 99, "Add: $acc += mem[%d]"},
+    {"SUB", 200, true, 99, "Sub: $acc -= mem[%d]"},
+    {"STA", 300, true, 99, "Store: mem[%d] = $acc"},
+    {"LDI", 400, true, 99, "Load Immediate: $acc = %d"},
+    {"LDA", 500, true, 99, "Load: $acc = mem[%d]"},
+    {"BRA", 600, true, 99, "Branch Always: jump to %d"},
+    {"BRZ", 700, true, 99, "Branch If Zero: if $acc == 0, jump to %d"},
+    {"BRP", 800, true, 99, "Branch If Positive: if $acc >= 0, jump to %d"},
+    {"INP", 901, false, 0, "Input: $acc = input()"},
+    {"OUT", 902, false, 0, "Output: print($acc)"},
+    {"JAL", 910, false, 0, "Jump And Link: $ra = $pc, $pc = $acc"},
+    {"RET", 911, false, 0, "Return: $pc = $ra"},
+    {"SPUSH", 920, false, 0, "Stack Push: $sp--, mem[$sp] = $acc"},
+    {"SPOP", 921, false, 0, "Stack Pop: $acc = mem[$sp], $sp++"},
+    {"SDUP", 922, false, 0, "Stack Duplicate: mem[$sp-1] = mem[$sp], $sp--"},
+    {"SDROP", 923, false, 0, "Stack Drop: $sp++"},
+    {"SSWAP", 924, false, 0, "Stack Swap: mem[$sp] <> mem[$sp+1]"},
+    {"RPUSH", 925, false, 0, "Return Stack Push: $rp++, mem[$rp] = $ra"},
+    {"RPOP", 926, false, 0, "Return Stack Pop: $ra = mem[$rp], $rp--"},
+    {"SADD", 930, false, 0, "Stack Add: mem[$sp+1] = mem[$sp+1] + mem[$sp], $sp++"},
+    {"SSUB", 931, false, 0, "Stack Subtract: mem[$sp+1] = mem[$sp+1] - mem[$sp], $sp++"},
+    {"SMUL", 932, false, 0, "Stack Multiply: mem[$sp+1] = mem[$sp+1] * mem[$sp], $sp++"},
+    {"SDIV", 933, false, 0, "Stack Divide: mem[$sp+1] = mem[$sp+1] / mem[$sp], $sp++"},
+    {"SMAX", 934, false, 0, "Stack Max: mem[$sp+1] = max(mem[$sp+1], mem[$sp]), $sp++"},
+    {"SMIN", 935, false, 0, "Stack Min: mem[$sp+1] = min(mem[$sp+1], mem[$sp]), $sp++"},
+    {"SCMPGT", 937, false, 0, "Stack Compare Greater: mem[$sp+1] = mem[$sp+1] > mem[$sp], $sp++"},
+    {"SCMPLT", 938, false, 0, "Stack Compare Less: mem[$sp+1] = mem[$sp+1] < mem[$sp], $sp++"},
+    {"SNOT", 939, false, 0, "Stack Not: mem[$sp] = mem[$sp] == 0"},
+    {"SPADD", -1, true, 98, "SP Add: $sp += 1 + %d"},
+    {"SPSUB", -101, true, 98, "SP Sub: $sp -= 1 + %d"},
+    {"SLDA", -201, true, 98, "Stack Load: mem[$sp-1] = mem[$sp+%d], $sp--"},
+    {"SSTA", -401, true, 99, "Stack Store: mem[$sp+1+%d] = mem[$sp], $sp++"},
+    {"SLDX", -301, true, 98, "Stack Indexed Load: mem[$sp] = element mem[$sp] of the array at %d"},
+    {"SSTX", -501, true, 98, "Stack Indexed Store: element mem[$sp] of the array at %d = mem[$sp+1], $sp += 2"},
+};
+const size_t EMULATOR_OPCODE_COUNT = sizeof(EMULATOR_OPCODES) / sizeof(EMULATOR_OPCODES[0]);
+
+const emulator_opcode_t *emulator_decode(int cell, int *operand) {
+    for (size_t i = 0; i < EMULATOR_OPCODE_COUNT; i++) {
+        const emulator_opcode_t *op = &EMULATOR_OPCODES[i];
+        int n = op->code < 0 ? op->code - cell : cell - op->code;
+        if (n >= 0 && n <= op->max_operand) {
+            if (operand) *operand = n;
+            return op;
+        }
+    }
+    return NULL;
+}
+
+const emulator_opcode_t *emulator_find_opcode(const char *name) {
+    for (size_t i = 0; i < EMULATOR_OPCODE_COUNT; i++) {
+        if (strcmp(EMULATOR_OPCODES[i].name, name) == 0) {
+            return &EMULATOR_OPCODES[i];
+        }
+    }
+    return NULL;
+}
+
+int emulator_encode(const emulator_opcode_t *op, int operand) {
+    return op->code < 0 ? op->code - operand : op->code + operand;
+}
+
 //======================================================
 //  Instruction Implementation
 //======================================================
@@ -111,6 +179,40 @@ void emulator_i_ssta(emulator_t *emulator, int offset) {
     emulator->memory[index] = value;
 }
 
+// the cell of element `index` of the array at `array`, which starts with its length, or -1
+int emulator_array_cell(emulator_t *emulator, int array, int index) {
+    int length = emulator->memory[array];
+    if (index < 0 || index >= length || array + 1 + index >= MIDDLE_OF_MEMORY) {
+        emulator->error_code = ERROR_BAD_INDEX;
+        emulator->status = STATUS_HALTED;
+        return -1;
+    }
+    return array + 1 + index;
+}
+
+void emulator_i_sldx(emulator_t *emulator, int array) {
+    if (emulator->stack_pointer > TOP_OF_MEMORY) {
+        emulator->error_code = ERROR_BAD_STACK;
+        emulator->status = STATUS_HALTED;
+        return;
+    }
+    int cell = emulator_array_cell(emulator, array, emulator->memory[emulator->stack_pointer]);
+    if (cell < 0) return;
+    emulator->memory[emulator->stack_pointer] = emulator->memory[cell];
+}
+
+void emulator_i_sstx(emulator_t *emulator, int array) {
+    if (!emulator_has_two_values_on_stack(emulator)) {
+        emulator->error_code = ERROR_BAD_STACK;
+        emulator->status = STATUS_HALTED;
+        return;
+    }
+    int cell = emulator_array_cell(emulator, array, emulator->memory[emulator->stack_pointer]);
+    if (cell < 0) return;
+    emulator->memory[cell] = emulator->memory[emulator->stack_pointer + 1];
+    emulator->stack_pointer += 2;
+}
+
 void emulator_i_push(emulator_t *emulator) {
     // TODO implement & check stack
     if (emulator->stack_pointer <= MIDDLE_OF_MEMORY) {
@@ -298,8 +400,8 @@ void emulator_i_scmpgt(emulator_t *emulator) {
 }
 
 void emulator_i_snot(emulator_t *emulator) {
-    // TODO implement, check stack has two values
-    if (emulator->stack_pointer >= TOP_OF_MEMORY) {
+    // one value on the stack, like SLDX
+    if (emulator->stack_pointer > TOP_OF_MEMORY) {
         emulator->error_code = ERROR_BAD_STACK;
         emulator->status = STATUS_HALTED;
         return;
@@ -388,6 +490,7 @@ void emulator_i_branch_if_positive(emulator_t *emulator, int location) {
 void emulator_step(emulator_t *emulator) {
     if (emulator->status != STATUS_HALTED) {
         int instruction = emulator->memory[emulator->program_counter];
+        if (emulator->profile) emulator->profile[emulator->program_counter]++;
         emulator->program_counter++;
         emulator_exec_instruction(emulator, instruction);
     }
@@ -421,108 +524,53 @@ void emulator_debug(emulator_t *emulator) {
 void emulator_exec_instruction(emulator_t *emulator, int instruction) {
     // emulator_debug(emulator); // uncomment to print out the emulator state on each iteration
 
-    if (instruction == 0) {
-        emulator_i_halt(emulator);
-    }
-    else if (100 <= instruction && instruction <= 199) {
-        emulator_i_add(emulator, instruction - 100);
-    }
-    else if (200 <= instruction && instruction <= 299) {
-        emulator_i_sub(emulator, instruction - 200);
-    }
-    else if (300 <= instruction && instruction <= 399) {
-        emulator_i_store(emulator, instruction - 300);
-    }
-    else if (400 <= instruction && instruction <= 499) {
-        emulator_i_load_immediate(emulator, instruction - 400);
-    }
-    else if (500 <= instruction && instruction <= 599) {
-        emulator_i_load(emulator, instruction - 500);
-    }
-    else if (600 <= instruction && instruction <= 699) {
-        emulator_i_branch_unconditional(emulator, instruction - 600);
-    }
-    else if (700 <= instruction && instruction <= 799) {
-        emulator_i_branch_if_zero(emulator, instruction - 700);
-    }
-    else if (800 <= instruction && instruction <= 899) {
-        emulator_i_branch_if_positive(emulator, instruction - 800);
-    }
-    else if (instruction == 901) {
-        emulator_i_inp(emulator);
-    }
-    else if (instruction == 902) {
-        emulator_i_out(emulator);
-    }
-    else if (instruction == 910) {
-        emulator_i_jal(emulator);
-    }
-    else if (instruction == 911) {
-        emulator_i_ret(emulator);
-    }
-    else if (instruction == 920) {
-        emulator_i_push(emulator);
-    }
-    else if (instruction == 921) {
-        emulator_i_pop(emulator);
-    }
-    else if (instruction == 922) {
-        emulator_i_dup(emulator);
-    }
-    else if (instruction == 923) {
-        emulator_i_drop(emulator);
-    }
-    else if (instruction == 924) {
-        emulator_i_swap(emulator);
-    }
-    else if (instruction == 925) {
-        emulator_i_rpush(emulator);
-    }
-    else if (instruction == 926) {
-        emulator_i_rpop(emulator);
-    }
-    else if (instruction == 930) {
-        emulator_i_sadd(emulator);
-    }
-    else if (instruction == 931) {
-        emulator_i_ssub(emulator);
-    }
-    else if (instruction == 932) {
-        emulator_i_smul(emulator);
-    }
-    else if (instruction == 933) {
-        emulator_i_sdiv(emulator);
-    }
-    else if (instruction == 934) {
-        emulator_i_smax(emulator);
-    }
-    else if (instruction == 935) {
-        emulator_i_smin(emulator);
-    }
-    else if (instruction == 937) {
-        emulator_i_scmpgt(emulator);
-    }
-    else if (instruction == 938) {
-        emulator_i_scmplt(emulator);
-    }
-    else if (instruction == 939) {
-        emulator_i_snot(emulator);
-    }
-    else if (-99 <= instruction && instruction <= -1) {
-        emulator_i_spadd(emulator, -(instruction + 1));
-    }
-    else if (-199 <= instruction && instruction <= -100) {
-        emulator_i_spsub(emulator, -(instruction + 101));
-    }
-    else if (-299 <= instruction && instruction <= -200) {
-        emulator_i_slda(emulator, -(instruction + 201));
-    }
-    else if (-500 <= instruction && instruction <= -401) {
-        emulator_i_ssta(emulator, -(instruction + 401));
-    }
-    else {
+    int operand = 0;
+    const emulator_opcode_t *op = emulator_decode(instruction, &operand);
+    if (!op) {
         emulator->error_code = ERROR_UNKNOWN_INSTRUCTION;
         emulator->status = STATUS_HALTED;
+        emulator_cap_value(&emulator->accumulator);
+        return;
+    }
+
+    switch (op->code) {
+        case 0: emulator_i_halt(emulator); break;
+        case 100: emulator_i_add(emulator, operand); break;
+        case 200: emulator_i_sub(emulator, operand); break;
+        case 300: emulator_i_store(emulator, operand); break;
+        case 400: emulator_i_load_immediate(emulator, operand); break;
+        case 500: emulator_i_load(emulator, operand); break;
+        case 600: emulator_i_branch_unconditional(emulator, operand); break;
+        case 700: emulator_i_branch_if_zero(emulator, operand); break;
+        case 800: emulator_i_branch_if_positive(emulator, operand); break;
+        case 901: emulator_i_inp(emulator); break;
+        case 902: emulator_i_out(emulator); break;
+        case 910: emulator_i_jal(emulator); break;
+        case 911: emulator_i_ret(emulator); break;
+        case 920: emulator_i_push(emulator); break;
+        case 921: emulator_i_pop(emulator); break;
+        case 922: emulator_i_dup(emulator); break;
+        case 923: emulator_i_drop(emulator); break;
+        case 924: emulator_i_swap(emulator); break;
+        case 925: emulator_i_rpush(emulator); break;
+        case 926: emulator_i_rpop(emulator); break;
+        case 930: emulator_i_sadd(emulator); break;
+        case 931: emulator_i_ssub(emulator); break;
+        case 932: emulator_i_smul(emulator); break;
+        case 933: emulator_i_sdiv(emulator); break;
+        case 934: emulator_i_smax(emulator); break;
+        case 935: emulator_i_smin(emulator); break;
+        case 937: emulator_i_scmpgt(emulator); break;
+        case 938: emulator_i_scmplt(emulator); break;
+        case 939: emulator_i_snot(emulator); break;
+        case -1: emulator_i_spadd(emulator, operand); break;
+        case -101: emulator_i_spsub(emulator, operand); break;
+        case -201: emulator_i_slda(emulator, operand); break;
+        case -401: emulator_i_ssta(emulator, operand); break;
+        case -301: emulator_i_sldx(emulator, operand); break;
+        case -501: emulator_i_sstx(emulator, operand); break;
+        default:
+            assert(false && "opcode in the table without an implementation\n");
     }
 
     emulator_cap_value(&emulator->accumulator);
@@ -561,6 +609,7 @@ void emulator_run(emulator_t *emulator) {
 emulator_t *emulator_new() {
     emulator_t *emulator = malloc(sizeof(emulator_t));
     assert(emulator && "out of memory\n");
+    emulator->profile = NULL; // survives resets, the counts are the caller's
     emulator_init(emulator);
     return emulator;
 }
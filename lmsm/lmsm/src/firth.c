@@ -238,92 +238,91 @@ void fr_context_free(fr_context_t *ctx) {
     free(ctx);
 }
 
-void fr_compile_node(const parsenode_t *node, fr_context_t *ctx, msu_str_builder_t output) {
+void fr_compile_node(const parsenode_t *node, fr_context_t *ctx, asm_builder_t *output) {
     if (node->kind == FR_OP) {
         if (msu_str_eqs(node->token->content, ".")) {
-            msu_str_builder_pushs(output, "SDUP\nSPOP\nOUT\n");
+            asm_builder_op(output, "SDUP");
+            asm_builder_op(output, "SPOP");
+            asm_builder_op(output, "OUT");
         } else if (msu_str_eqs(node->token->content, "+")) {
-            msu_str_builder_pushs(output, "SADD\n");
+            asm_builder_op(output, "SADD");
         } else if (msu_str_eqs(node->token->content, "-")) {
-            msu_str_builder_pushs(output, "SSUB\n");
+            asm_builder_op(output, "SSUB");
         } else if (msu_str_eqs(node->token->content, "*")) {
-            msu_str_builder_pushs(output, "SMUL\n");
+            asm_builder_op(output, "SMUL");
         } else if (msu_str_eqs(node->token->content, "/")) {
-            msu_str_builder_pushs(output, "SDIV\n");
+            asm_builder_op(output, "SDIV");
         } else if (msu_str_eqs(node->token->content, "max")) {
-            msu_str_builder_pushs(output, "SMAX\n");
+            asm_builder_op(output, "SMAX");
         } else if (msu_str_eqs(node->token->content, "min")) {
-            msu_str_builder_pushs(output, "SMIN\n");
+            asm_builder_op(output, "SMIN");
         } else if (msu_str_eqs(node->token->content, "get")) {
-            msu_str_builder_pushs(output, "INP\nSPUSH\n");
+            asm_builder_op(output, "INP");
+            asm_builder_op(output, "SPUSH");
         } else if (msu_str_eqs(node->token->content, "pop")) {
-            msu_str_builder_pushs(output, "SPOP\n");
+            asm_builder_op(output, "SPOP");
         } else if (msu_str_eqs(node->token->content, "dup")) {
-            msu_str_builder_pushs(output, "SDUP\n");
+            asm_builder_op(output, "SDUP");
         } else if (msu_str_eqs(node->token->content, "swap")) {
-            msu_str_builder_pushs(output, "SSWAP\n");
+            asm_builder_op(output, "SSWAP");
         } else if (msu_str_eqs(node->token->content, "drop")) {
-            msu_str_builder_pushs(output, "SDROP\n");
+            asm_builder_op(output, "SDROP");
         } else if (msu_str_eqs(node->token->content, "exit")) {
-            msu_str_builder_pushs(output, "RET\n");
+            asm_builder_op(output, "RET");
         }
     } else if (node->kind == FR_INT) {
-        msu_str_builder_pushs(output, "LDI ");
-        msu_str_builder_pushstr(output, node->token->content);
-        msu_str_builder_pushs(output, "\n");
-        msu_str_builder_pushs(output, "SPUSH\n");
+        int value = 0;
+        msu_str_try_parse_int(node->token->content, &value);
+        asm_builder_op_value(output, "LDI", value);
+        asm_builder_op(output, "SPUSH");
     } else if (node->kind == FR_DO_LOOP) {
         int loop_label_num = ctx->label_num++;
-        msu_str_builder_printf(output, "loop_%d_start ADD ZERO\n", loop_label_num);
-
+        const msu_str_t *loop_label_start = msu_str_printf("loop_%d_start", loop_label_num);
         const msu_str_t *loop_label_end = msu_str_printf("loop_%d_end", loop_label_num);
+        const msu_str_t *zero = msu_str_new("ZERO");
+
+        asm_builder_label(output, loop_label_start);
+        asm_builder_op_ref(output, "ADD", zero);
+
         list_of_msu_strs_push(ctx->loop_label_stack, loop_label_end);
         for (size_t i = 0; i < node->children->len; i++) {
             parsenode_t *child = list_of_parsenodes_get(node->children, i);
             fr_compile_node(child, ctx, output);
         }
         list_of_msu_strs_pop(ctx->loop_label_stack);
-        msu_str_free(loop_label_end);
 
-        msu_str_builder_printf(output, "BRA loop_%d_start\n", loop_label_num);
-        msu_str_builder_printf(output, "loop_%d_end ADD ZERO\n", loop_label_num);
+        asm_builder_op_ref(output, "BRA", loop_label_start);
+        asm_builder_label(output, loop_label_end);
+        asm_builder_op_ref(output, "ADD", zero);
+
+        msu_str_free(loop_label_start);
+        msu_str_free(loop_label_end);
+        msu_str_free(zero);
     } else if (node->kind == FR_ZERO_TEST || node->kind == FR_POSITIVE_TEST) {
         int if_zero_label_num = ctx->label_num++;
+        const msu_str_t *if_label = msu_str_printf("if_%d", if_zero_label_num);
+        const msu_str_t *end_label = msu_str_printf("end_%d", if_zero_label_num);
 
-        // branch if top of stack zero
-        msu_str_builder_pushs(output, "SPOP\n");
-        if (node->kind == FR_ZERO_TEST) {
-            msu_str_builder_pushs(output, "BRZ ");
-        } else {
-            msu_str_builder_pushs(output, "BRP ");
-        }
         parsenode_t *true_branch = list_of_parsenodes_get(node->children, 0);
         parsenode_t *false_branch = list_of_parsenodes_get(node->children, 1);
 
-        if (true_branch->children->len > 0) {
-            msu_str_builder_printf(output, "if_%d", if_zero_label_num);
-        } else {
-            msu_str_builder_printf(output, "end_%d", if_zero_label_num);
-        }
-        msu_str_builder_pushs(output, "\n");
+        // branch if top of stack zero
+        asm_builder_op(output, "SPOP");
+        asm_builder_op_ref(output, node->kind == FR_ZERO_TEST ? "BRZ" : "BRP",
+                           true_branch->children->len > 0 ? if_label : end_label);
 
         // generate else
-        if (false_branch->children->len > 0) {
-            for (size_t i = 0; i < false_branch->children->len; i++) {
-                parsenode_t *child = list_of_parsenodes_get(false_branch->children, i);
-                fr_compile_node(child, ctx, output);
-            }
+        for (size_t i = 0; i < false_branch->children->len; i++) {
+            parsenode_t *child = list_of_parsenodes_get(false_branch->children, i);
+            fr_compile_node(child, ctx, output);
         }
 
         // jump to end of zero condition
-        msu_str_builder_pushs(output, "BRA ");
-        msu_str_builder_printf(output, "end_%d", if_zero_label_num);
-        msu_str_builder_pushs(output, "\n");
+        asm_builder_op_ref(output, "BRA", end_label);
 
         // generate if zero condition
         if (true_branch->children->len > 0) {
-            msu_str_builder_printf(output, "if_%d", if_zero_label_num);
-            msu_str_builder_pushs(output, " ");
+            asm_builder_label(output, if_label);
             for (size_t i = 0; i < true_branch->children->len; i++) {
                 parsenode_t *child = list_of_parsenodes_get(true_branch->children, i);
                 fr_compile_node(child, ctx, output);
@@ -331,32 +330,33 @@ void fr_compile_node(const parsenode_t *node, fr_context_t *ctx, msu_str_builder
         }
 
         // label end of zero conditional
-        msu_str_builder_printf(output, "end_%d", if_zero_label_num);
-        msu_str_builder_pushs(output, " ADD ZERO\n");
+        const msu_str_t *zero = msu_str_new("ZERO");
+        asm_builder_label(output, end_label);
+        asm_builder_op_ref(output, "ADD", zero);
+
+        msu_str_free(zero);
+        msu_str_free(if_label);
+        msu_str_free(end_label);
     } else if (node->kind == FR_WORD) {
         if (msu_str_ends_with(node->token->content, "!")) {
-            msu_str_builder_pushs(output, "SPOP\nSTA ");
             const msu_str_t *variable_name = msu_str_slice_right(node->token->content, 1);
-            msu_str_builder_pushstr(output, variable_name);
+            asm_builder_op(output, "SPOP");
+            asm_builder_op_ref(output, "STA", variable_name);
             msu_str_free(variable_name);
-            msu_str_builder_pushs(output, "\n");
         } else if (list_of_msu_strs_contains(ctx->variables, node->token->content)) {
-            msu_str_builder_pushs(output, "LDA ");
-            msu_str_builder_pushstr(output, node->token->content);
-            msu_str_builder_pushs(output, "\nSPUSH\n");
+            asm_builder_op_ref(output, "LDA", node->token->content);
+            asm_builder_op(output, "SPUSH");
         } else {
-            msu_str_builder_pushs(output, "RPUSH\n");
-            msu_str_builder_pushs(output, "CALL ");
-            msu_str_builder_pushstr(output, node->token->content);
-            msu_str_builder_pushs(output, "\n");
-            msu_str_builder_pushs(output, "RPOP\n");
+            asm_builder_op(output, "RPUSH");
+            asm_builder_op_ref(output, "CALL", node->token->content);
+            asm_builder_op(output, "RPOP");
         }
     } else if(node->kind == FR_VAR) {
         // ignore
     } else if(node->kind == FR_STOP) {
         if (ctx->loop_label_stack->len > 0) {
             const msu_str_t *label = list_of_msu_strs_get_const(ctx->loop_label_stack, ctx->loop_label_stack->len - 1);
-            msu_str_builder_printf(output, "BRA %s\n", msu_str_data(label));
+            asm_builder_op_ref(output, "BRA", label);
         } else {
             printf("\nNo Loop To Break: %s\n", msu_str_data(node->token->content));
         }
@@ -365,43 +365,46 @@ void fr_compile_node(const parsenode_t *node, fr_context_t *ctx, msu_str_builder
     }
 }
 
-void fr_code_gen_top_level(const parsenode_t *program, fr_context_t *ctx, msu_str_builder_t output) {
+void fr_code_gen_top_level(const parsenode_t *program, fr_context_t *ctx, asm_builder_t *output) {
     for (size_t i = 0; i < program->children->len; i++) {
         parsenode_t *child = list_of_parsenodes_get(program->children, i);
         if (child->kind != FR_FUNCTION_DEF) {
             fr_compile_node(child, ctx, output);
         }
     }
-    msu_str_builder_pushs(output, "ZERO HLT\n"); // label the halt so we can use it for no-ops
+    // label the halt so we can use it for no-ops
+    const msu_str_t *zero = msu_str_new("ZERO");
+    asm_builder_label(output, zero);
+    asm_builder_op(output, "HLT");
+    msu_str_free(zero);
 }
 
-void fr_code_gen_functions(const parsenode_t *program, fr_context_t *ctx, msu_str_builder_t output) {
+void fr_code_gen_functions(const parsenode_t *program, fr_context_t *ctx, asm_builder_t *output) {
     for (size_t i = 0; i < program->children->len; i++) {
         parsenode_t *child = list_of_parsenodes_get(program->children, i);
         if (child->kind == FR_FUNCTION_DEF) {
             parsenode_t *function = child;
             // function label
-            msu_str_builder_pushstr(output, function->token->content);
-            msu_str_builder_pushs(output, " ");
+            asm_builder_label(output, function->token->content);
             // function body
             for (size_t i = 0; i < function->children->len; i++) {
                 parsenode_t *child = list_of_parsenodes_get(function->children, i);
                 fr_compile_node(child, ctx, output);
             }
             // always append a RET
-            msu_str_builder_pushs(output, "RET\n");
+            asm_builder_op(output, "RET");
         }
     }
 }
 
-void fr_code_gen_variables(const parsenode_t *program, fr_context_t *ctx, msu_str_builder_t output) {
+void fr_code_gen_variables(const parsenode_t *program, fr_context_t *ctx, asm_builder_t *output) {
     (void) ctx;
     for (size_t i = 0; i < program->children->len; i++) {
         parsenode_t *child = list_of_parsenodes_get(program->children, i);
         if (child->kind == FR_VAR) {
             // variable label
-            msu_str_builder_pushstr(output, child->token->content);
-            msu_str_builder_pushs(output, " DAT 0\n");
+            asm_builder_label(output, child->token->content);
+            asm_builder_op_value(output, "DAT", 0);
         }
     }
 }
@@ -415,7 +418,7 @@ void firth_code_collect_vars(const parsenode_t *program, fr_context_t *ctx) {
     }
 }
 
-void firth_code_gen(const parsenode_t *program, fr_context_t *ctx, msu_str_builder_t output) {
+void firth_code_gen(const parsenode_t *program, fr_context_t *ctx, asm_builder_t *output) {
     firth_code_collect_vars(program, ctx);
     fr_code_gen_top_level(program, ctx, output);
     fr_code_gen_functions(program, ctx, output);
@@ -448,12 +451,20 @@ const msu_str_t *fr_compile(const msu_str_t *src) {
     return fr_compile_impl(src, false);
 }
 
+list_of_asm_insrs_t *fr_compile_program_ir(const parsenode_t *program) {
+    asm_builder_t *builder = asm_builder_new();
+    if (program->kind == FR_PROGRAM) {
+        fr_context_t *ctx = fr_context_new();
+        firth_code_gen(program, ctx, builder);
+        fr_context_free(ctx);
+    }
+    return asm_builder_finish(builder);
+}
+
 const msu_str_t *fr_compile_program(const parsenode_t *program) {
     if (program->kind != FR_PROGRAM) return EMPTY_STRING;
-    msu_str_builder_t sb = msu_str_builder_new();
-    fr_context_t *ctx = fr_context_new();
-    firth_code_gen(program, ctx, sb);
-    fr_context_free(ctx);
-    const msu_str_t *asm_src = msu_str_builder_into_string_and_free(sb);
+    list_of_asm_insrs_t *insrs = fr_compile_program_ir(program);
+    const msu_str_t *asm_src = asm_print(insrs);
+    list_of_asm_insrs_free(insrs, true);
     return asm_src;
 }
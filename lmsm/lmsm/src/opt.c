@@ -1,205 +1,1414 @@
 
 #include "lmsm/opt.h"
 #include "lmsm/asm.h"
+#include "lmsm/cfg.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//======================================================
+//  Labels
+//
+//  when an instruction is dropped its label moves to the next
+//  one, and if that already has a label the two are merged.
+//  merged labels form a union-find over a hash map from each
+//  label to the one it was merged into, so renaming every
+//  reference at the end is a near constant lookup per label
+//======================================================
+
+#define BT_IMPL
+#define BT_NAME label_map
+#define BT_KEY const msu_str_t *
+#define BT_VALUE const msu_str_t *
+#define BT_HASHFUNC(x) msu_str_hash(x, 42)
+#define BT_EQFUNC msu_str_eq
+#define BT_FREE_KEY(k) msu_str_free(k)
+#define BT_FREE_VALUE(v) msu_str_free(v)
+#include "templates/btree.h"
+#undef bt_getv
 
 typedef struct label {
-    const msu_str_t *name;
-    const msu_str_t *alias;
-    struct label *next;
+    label_map_t *parent; // owns its keys and values
 } label_t;
 
-void label_add(label_t **label, const msu_str_t *name, const msu_str_t *alias) {
-    label_t *new_label = malloc(sizeof(label_t));
-    new_label->name = msu_str_clone(name);
-    new_label->alias = msu_str_clone(alias);
-    new_label->next = *label;
-    *label = new_label;
+label_t *label_new() {
+    label_t *out = malloc(sizeof(label_t));
+    assert(out && "out of memory!\n");
+    out->parent = label_map_new();
+    return out;
+}
+
+// the label `name` ended up as, borrowed from the map or `name` itself
+const msu_str_t *label_find(label_t *labels, const msu_str_t *name) {
+    const msu_str_t *root = name;
+    const msu_str_t **parent;
+    while ((parent = label_map_getv(labels->parent, root))) {
+        root = *parent;
+    }
+
+    // point everything on the way straight at the root, so the next lookup is one step
+    const msu_str_t *replaced = NULL;
+    while ((parent = label_map_getv(labels->parent, name)) && !msu_str_eq(*parent, root)) {
+        name = *parent;
+        *parent = msu_str_clone(root);
+        msu_str_free(replaced);
+        replaced = name; // still the key of the next lookup
+    }
+    msu_str_free(replaced);
+    return root;
+}
+
+// merges `name` into `alias`
+void label_add(label_t *labels, const msu_str_t *name, const msu_str_t *alias) {
+    const msu_str_t *from = label_find(labels, name);
+    const msu_str_t *to = label_find(labels, alias);
+    if (msu_str_eq(from, to)) return;
+    label_map_insert(labels->parent, msu_str_clone(from), msu_str_clone(to));
+}
+
+void label_rename(label_t *labels, asm_insr_t *insr) {
+    if (msu_str_is_empty(insr->label_reference) || label_map_size(labels->parent) == 0) return;
+    const msu_str_t *name = label_find(labels, insr->label_reference);
+    if (name != insr->label_reference) {
+        name = msu_str_clone(name);
+        msu_str_free(insr->label_reference);
+        insr->label_reference = name;
+    }
+}
+
+void label_free_all(label_t *labels) {
+    if (labels) {
+        label_map_free(labels->parent);
+        free(labels);
+    }
+}
+
+// a number for each label, the labels borrowed from the instructions they're on
+#define BT_NAME label_table
+#define BT_KEY const msu_str_t *
+#define BT_VALUE int
+#define BT_HASHFUNC(x) msu_str_hash(x, 42)
+#define BT_EQFUNC msu_str_eq
+#include "templates/btree.h"
+#undef bt_getv
+
+
+//======================================================
+//  Rules
+//======================================================
+
+// every rule has to make the code smaller, that is what keeps the matcher from looping
+const char *OPT_DEFAULT_RULES =
+    "SPUSH; SPOP =>\n"
+    "SPUSH; SDROP =>\n"
+    "SDUP; SDROP =>\n"
+    "SSWAP; SSWAP =>\n"
+    "RPUSH; RPOP =>\n"
+    "CALL a; RPOP; RET => RPOP; BRA a\n"
+    "LDI a; SPUSH => SPUSHI a\n"
+    "SPUSHI a; SPOP => LDI a\n"
+    "STA a; LDA a => STA a\n";
+
+opt_rules_t *opt_rules_new() {
+    opt_rules_t *out = calloc(1, sizeof(opt_rules_t));
+    assert(out && "out of memory!\n");
+    return out;
+}
+
+void opt_rules_free(opt_rules_t *rules) {
+    if (rules) {
+        free(rules->rules);
+        free(rules);
+    }
+}
+
+int opt_step_size(const opt_step_t *step) {
+    return strcmp(step->insr, "CALL") == 0 || strcmp(step->insr, "SPUSHI") == 0 ? 2 : 1;
 }
 
-const msu_str_t *label_substitute(label_t *labels, const msu_str_t *name) {
-    const msu_str_t *original_name = name;
-    label_t *current = labels;
-    while (current) {
-        if (msu_str_eq(current->name, name)) {
-            name = current->alias;
+const char *opt_parse_steps(char *text, opt_step_t *steps, size_t *len) {
+    *len = 0;
+    while (text) {
+        char *end = strchr(text, ';');
+        if (end) *end = '\0';
+
+        char name[16], arg[16], extra[2];
+        int n = sscanf(text, "%15s %15s %1s", name, arg, extra);
+        if (n == 3) return "too many arguments";
+        if (n == 1 || n == 2) {
+            if (*len == OPT_WINDOW_MAX) return "too many instructions";
+            opt_step_t *step = &steps[(*len)++];
+            if (!asm_is_insr(name) || strlen(name) >= sizeof(step->insr)) return "unknown instruction";
+            strcpy(step->insr, name);
+
+            if ((n == 2) != asm_is_arg_insr(name)) {
+                return n == 2 ? "unexpected argument" : "missing argument";
+            }
+            step->arg = OPT_ARG_NONE;
+            step->value = 0;
+            if (n == 2 && islower((unsigned char) arg[0]) && arg[1] == '\0') {
+                step->arg = OPT_ARG_VAR;
+                step->value = arg[0] - 'a';
+            } else if (n == 2) {
+                char *endptr;
+                step->arg = OPT_ARG_INT;
+                step->value = (int) strtol(arg, &endptr, 10);
+                if (*endptr != '\0') return "arguments are a letter or a number";
+            }
+        } else if (end || *len > 0) {
+            return "empty instruction";
         }
-        current = current->next;
+
+        text = end ? end + 1 : NULL;
+    }
+    return NULL;
+}
+
+const char *opt_parse_rule(char *line, opt_rule_t *rule) {
+    char *arrow = strstr(line, "=>");
+    if (!arrow) return "expected '=>'";
+    *arrow = '\0';
+
+    const char *err = opt_parse_steps(line, rule->pattern, &rule->pattern_len);
+    if (!err) err = opt_parse_steps(arrow + 2, rule->rewrite, &rule->rewrite_len);
+    if (err) return err;
+    if (rule->pattern_len == 0) return "empty pattern";
+
+    bool bound[26] = {false};
+    int pattern_cells = 0, rewrite_cells = 0;
+    for (size_t i = 0; i < rule->pattern_len; i++) {
+        if (rule->pattern[i].arg == OPT_ARG_VAR) bound[rule->pattern[i].value] = true;
+        pattern_cells += opt_step_size(&rule->pattern[i]);
+    }
+    for (size_t i = 0; i < rule->rewrite_len; i++) {
+        if (rule->rewrite[i].arg == OPT_ARG_VAR && !bound[rule->rewrite[i].value]) return "unbound variable";
+        rewrite_cells += opt_step_size(&rule->rewrite[i]);
     }
-    if (name == original_name) {
-        return NULL;
+    if (rule->rewrite_len > rule->pattern_len
+        || (rule->rewrite_len == rule->pattern_len && rewrite_cells >= pattern_cells)) {
+        return "the rewrite has to be smaller than the pattern";
+    }
+    return NULL;
+}
+
+asm_error_t *opt_rules_parse(opt_rules_t *rules, const msu_str_t *src) {
+    asm_error_t *errors = NULL;
+    asm_error_t **tail = &errors;
+
+    list_of_msu_strs_t *lines = msu_str_splitlines(src);
+    for (size_t i = 0; i < lines->len; i++) {
+        const msu_str_t *text = list_of_msu_strs_get_const(lines, i);
+        char *line = strdup(msu_str_data(text));
+        assert(line && "out of memory!\n");
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        bool blank = true;
+        for (char *c = line; *c; c++) blank = blank && isspace((unsigned char) *c);
+
+        opt_rule_t rule = {0};
+        const char *err = blank ? NULL : opt_parse_rule(line, &rule);
+        if (err) {
+            asm_error_t *e = asm_error_new(ASM_ERROR_BAD_DIRECTIVE, msu_str_printf("%s in rule '%s'\n", err,
+                                                                                msu_str_data(text)));
+            e->span.line = i + 1;
+            e->span.len = msu_str_len(text);
+            tail = asm_error_append(tail, e);
+        } else if (!blank) {
+            if (rules->len == rules->cap) {
+                rules->cap = rules->cap ? rules->cap * 2 : 16;
+                rules->rules = realloc(rules->rules, rules->cap * sizeof(opt_rule_t));
+                assert(rules->rules && "out of memory!\n");
+            }
+            rules->rules[rules->len++] = rule;
+        }
+        free(line);
+    }
+    list_of_msu_strs_free(lines, true);
+    return errors;
+}
+
+//======================================================
+//  Peephole matcher
+//======================================================
+
+typedef struct opt_binding {
+    bool bound;
+    int value;
+    const msu_str_t *label_reference;
+} opt_binding_t;
+
+bool opt_step_matches(const opt_step_t *step, const asm_insr_t *insr, opt_binding_t *vars) {
+    if (!msu_str_eqs(insr->instruction, step->insr)) return false;
+    if (step->arg == OPT_ARG_INT) {
+        return msu_str_is_empty(insr->label_reference) && insr->value == step->value;
+    }
+    if (step->arg == OPT_ARG_VAR) {
+        opt_binding_t *var = &vars[step->value];
+        if (!var->bound) {
+            var->bound = true;
+            var->value = insr->value;
+            var->label_reference = insr->label_reference;
+            return true;
+        }
+        if (!msu_str_is_empty(var->label_reference) || !msu_str_is_empty(insr->label_reference)) {
+            return msu_str_eq(var->label_reference, insr->label_reference);
+        }
+        return var->value == insr->value;
+    }
+    return true;
+}
+
+// whether `rule` matches the last instructions of `out`. only the first instruction of the
+// window may have a label, anything jumped into from outside has to stay as it is
+bool opt_rule_matches(const opt_rule_t *rule, const list_of_asm_insrs_t *out, opt_binding_t *vars) {
+    if (rule->pattern_len > out->len) return false;
+    size_t start = out->len - rule->pattern_len;
+    for (size_t i = 0; i < rule->pattern_len; i++) {
+        const asm_insr_t *insr = list_of_asm_insrs_get_const(out, start + i);
+        if (insr->error || (i > 0 && !msu_str_is_empty(insr->label))) return false;
+        if (!opt_step_matches(&rule->pattern[i], insr, vars)) return false;
+    }
+    return true;
+}
+
+asm_insr_t *opt_rewrite_insr(const opt_step_t *step, const opt_binding_t *vars, asm_span_t span) {
+    asm_insr_t *out = calloc(1, sizeof(asm_insr_t));
+    assert(out && "out of memory!\n");
+    out->instruction = msu_str_new(step->insr);
+    if (step->arg == OPT_ARG_VAR) {
+        out->value = vars[step->value].value;
+        out->label_reference = msu_str_clone(vars[step->value].label_reference);
+    } else {
+        out->value = step->value;
+    }
+    out->span = span;
+    return out;
+}
+
+// puts `label` on `insr`, or makes it an alias if `insr` already has one. takes `label`
+void opt_move_label(asm_insr_t *insr, const msu_str_t *label, label_t *subs) {
+    if (msu_str_is_empty(insr->label)) {
+        msu_str_free(insr->label);
+        insr->label = label;
+    } else {
+        label_add(subs, label, insr->label);
+        msu_str_free(label);
+    }
+}
+
+// keeps the label of a dropped instruction in *carry, for the next instruction that is kept
+void opt_carry_label(const asm_insr_t *dropped, const msu_str_t **carry, label_t *subs) {
+    if (msu_str_is_empty(dropped->label)) return;
+    if (*carry) {
+        label_add(subs, dropped->label, *carry);
     } else {
-        return name;
+        *carry = msu_str_clone(dropped->label);
+    }
+}
+
+// appends `insr`, giving it the carried label if there is one
+void opt_append_carried(list_of_asm_insrs_t *out, asm_insr_t *insr, const msu_str_t **carry, label_t *subs) {
+    if (*carry) {
+        opt_move_label(insr, *carry, subs);
+        *carry = NULL;
+    }
+    list_of_asm_insrs_append(out, insr);
+}
+
+// gives a label left over at the end a cell and points references to moved labels at
+// where they went. takes `carry` and `subs`
+void opt_finish_labels(list_of_asm_insrs_t *out, const msu_str_t *carry, label_t *subs) {
+    if (carry) {
+        // a label at the very end still needs a cell
+        asm_insr_t *insr = calloc(1, sizeof(asm_insr_t));
+        assert(insr && "out of memory!\n");
+        insr->instruction = msu_str_new("DAT");
+        insr->label = carry;
+        list_of_asm_insrs_append(out, insr);
+    }
+
+    for (size_t i = 0; i < out->len; i++) {
+        label_rename(subs, list_of_asm_insrs_get(out, i));
     }
+    label_free_all(subs);
 }
 
-void label_rename(label_t *label, asm_insr_t *insr) {
-    if (!insr->label_reference) return;
-    while (label) {
-        const msu_str_t *new_label_ref = label_substitute(label, insr->label_reference);
-        if (new_label_ref) {
-            insr->label_reference = new_label_ref;
-            return;
+// tries the rules on the end of `out`; on a match the window is replaced by pushing its
+// rewrite onto `pending`, or if the rewrite is empty its label is left in *carry
+bool opt_rewrite_tail(const opt_rules_t *rules, list_of_asm_insrs_t *out, list_of_asm_insrs_t *pending,
+                      const msu_str_t **carry) {
+    for (size_t r = 0; r < rules->len; r++) {
+        const opt_rule_t *rule = &rules->rules[r];
+        opt_binding_t vars[26] = {0};
+        if (!opt_rule_matches(rule, out, vars)) continue;
+
+        size_t start = out->len - rule->pattern_len;
+        asm_insr_t *first = list_of_asm_insrs_get(out, start);
+        for (size_t i = rule->rewrite_len; i > 0; i--) {
+            list_of_asm_insrs_append(pending, opt_rewrite_insr(&rule->rewrite[i - 1], vars, first->span));
+        }
+
+        const msu_str_t *label = first->label;
+        first->label = NULL;
+        if (!msu_str_is_empty(label)) {
+            if (rule->rewrite_len > 0) {
+                list_of_asm_insrs_get(pending, pending->len - 1)->label = label;
+            } else {
+                *carry = label;
+            }
+        } else {
+            msu_str_free(label);
+        }
+
+        while (out->len > start) {
+            asm_insr_free(list_of_asm_insrs_pop(out));
         }
-        label = label->next;
+        return true;
     }
+    return false;
 }
 
-void label_free_one(label_t *label) {
-    if (label) {
-        msu_str_free(label->name);
-        msu_str_free(label->alias);
+// opt_peephole, counting the rewrites in *rewrites
+list_of_asm_insrs_t *opt_peephole_counted(const list_of_asm_insrs_t *insrs, const opt_rules_t *rules, int *rewrites) {
+    list_of_asm_insrs_t *out = list_of_asm_insrs_new();
+    list_of_asm_insrs_t *pending = list_of_asm_insrs_new(); // a stack, the top is the next instruction
+    label_t *subs = label_new();
+    const msu_str_t *carry = NULL;
+
+    size_t next = 0;
+    while (pending->len > 0 || next < insrs->len) {
+        asm_insr_t *insr = pending->len > 0
+                           ? list_of_asm_insrs_pop(pending)
+                           : asm_insr_clone(list_of_asm_insrs_get_const(insrs, next++));
+        opt_append_carried(out, insr, &carry, subs);
+        if (opt_rewrite_tail(rules, out, pending, &carry)) (*rewrites)++;
     }
+
+    opt_finish_labels(out, carry, subs);
+    list_of_asm_insrs_free(pending, true);
+    return out;
 }
 
-void label_free_all(label_t *label) {
-    while (label) {
-        label_free_one(label);
-        label = label->next;
+list_of_asm_insrs_t *opt_peephole(const list_of_asm_insrs_t *insrs, const opt_rules_t *rules) {
+    int rewrites = 0;
+    return opt_peephole_counted(insrs, rules, &rewrites);
+}
+
+//======================================================
+//  Constants
+//======================================================
+
+bool opt_is_branch(const asm_insr_t *insr) {
+    const msu_str_t *name = insr->instruction;
+    return !insr->error && !msu_str_is_empty(insr->label_reference)
+           && (msu_str_eqs(name, "BRA") || msu_str_eqs(name, "BRZ") || msu_str_eqs(name, "BRP"));
+}
+
+#define OPT_READ 1   // a label some instruction reads or writes
+#define OPT_JUMPED 2 // a label something branches to or calls
+#define OPT_STORED 4 // a label some STA writes, besides OPT_READ
+
+// how each label is referred to, OPT_READ, OPT_JUMPED and OPT_STORED
+label_table_t *opt_references(const list_of_asm_insrs_t *insrs) {
+    label_table_t *out = label_table_new();
+    for (size_t i = 0; i < insrs->len; i++) {
+        const asm_insr_t *insr = list_of_asm_insrs_get_const(insrs, i);
+        if (msu_str_is_empty(insr->label_reference)) continue;
+        int use = opt_is_branch(insr) || msu_str_eqs(insr->instruction, "CALL") ? OPT_JUMPED : OPT_READ;
+        if (msu_str_eqs(insr->instruction, "STA")) use |= OPT_STORED;
+        int *uses = label_table_getv(out, insr->label_reference);
+        if (uses) *uses |= use;
+        else label_table_insert(out, insr->label_reference, use);
     }
+    return out;
 }
 
+// DAT cells the program never stores into, pooled by value with any the optimizer adds
+typedef struct opt_consts {
+    asm_consts_t pool;
+    label_table_t *values;     // the value of every constant cell by label
+    label_table_t *labels;     // the index of the first instruction with each label
+    label_table_t *references; // how each label is referred to
+} opt_consts_t;
 
-void transfer_errors(const asm_insr_t *removed[], size_t len_removed, asm_insr_t *next) {
-    for (int i = 0; i < len_removed; ++i) {
-        const asm_insr_t *insr = removed[i];
-        if (insr->error) {
-            next->error = asm_error_clone(insr->error);
-            return;
+void opt_consts_init(opt_consts_t *consts, const list_of_asm_insrs_t *insrs) {
+    asm_consts_init(&consts->pool);
+    consts->values = label_table_new();
+    consts->labels = label_table_new();
+    consts->references = opt_references(insrs);
+    for (size_t i = 0; i < insrs->len; i++) {
+        const asm_insr_t *insr = list_of_asm_insrs_get_const(insrs, i);
+        if (!msu_str_is_empty(insr->label) && !label_table_contains(consts->labels, insr->label)) {
+            label_table_insert(consts->labels, insr->label, (int) i);
+        }
+        if (!msu_str_eqs(insr->instruction, "DAT") || msu_str_is_empty(insr->label) || insr->error) continue;
+        if (!msu_str_is_empty(insr->label_reference) || insr->value < -999 || insr->value > 999) continue;
+        const int *uses = label_table_getv(consts->references, insr->label);
+        if (uses && (*uses & OPT_STORED)) continue;
+        if (!label_table_contains(consts->values, insr->label)) {
+            label_table_insert(consts->values, insr->label, insr->value);
         }
+        asm_consts_adopt(&consts->pool, insr->value, insr->label);
     }
 }
 
-void transfer_labels(const asm_insr_t *removed[], size_t len_removed, asm_insr_t *next, label_t **subs) {
-    for (int i = 0; i < len_removed; ++i) {
-        const asm_insr_t *insr = removed[i];
-        if (msu_str_is_empty(insr->label)) continue;
+// a label for a cell holding `value`, added to the end of the program if there isn't one
+const msu_str_t *opt_consts_get(opt_consts_t *consts, int value) {
+    size_t added = consts->pool.added->len;
+    const msu_str_t *label = asm_consts_get(&consts->pool, value);
+    if (consts->pool.added->len > added) {
+        const asm_insr_t *cell = list_of_asm_insrs_get_const(consts->pool.added, added);
+        label_table_insert(consts->values, cell->label, cell->value);
+    }
+    return label;
+}
 
-        if (msu_str_is_empty(next->label)) {
-            next->label = msu_str_clone(insr->label);
-        } else {
-            label_add(subs, insr->label, next->label);
+// the value of the constant cell `label`, if it is one
+bool opt_consts_value(const opt_consts_t *consts, const msu_str_t *label, int *value) {
+    const int *found = msu_str_is_empty(label) ? NULL : label_table_getv(consts->values, label);
+    if (found) *value = *found;
+    return found != NULL;
+}
+
+bool opt_consts_is(const opt_consts_t *consts, const msu_str_t *label, int value) {
+    int actual;
+    return opt_consts_value(consts, label, &actual) && actual == value;
+}
+
+// moves the added constants onto the end of `out`
+void opt_consts_finish(opt_consts_t *consts, list_of_asm_insrs_t *out) {
+    asm_consts_finish(&consts->pool, out);
+    label_table_free(consts->values);
+    consts->values = NULL;
+    label_table_free(consts->labels);
+    consts->labels = NULL;
+    label_table_free(consts->references);
+    consts->references = NULL;
+}
+
+//======================================================
+//  Accumulator caching
+//
+//  compiled code keeps everything on the memory stack, even
+//  when the value it just popped is still in the accumulator.
+//  this pass walks the code knowing when the top of the stack
+//  is also in the accumulator and uses ADD/SUB against constant
+//  cells instead of going through the stack
+//======================================================
+
+// the index of the instruction `label` is on in the code `consts` was made from, or -1
+int opt_find_label(const opt_consts_t *consts, const msu_str_t *label) {
+    const int *index = msu_str_is_empty(label) ? NULL : label_table_getv(consts->labels, label);
+    return index ? *index : -1;
+}
+
+// whether the accumulator is overwritten before it is read when running from `index`.
+// follows BRA, anything it is not sure about (returns, other branches, errors) counts as read
+bool opt_acc_is_dead(const list_of_asm_insrs_t *insrs, const opt_consts_t *consts, size_t index) {
+    int jumps = 0;
+    for (size_t steps = 0; index < insrs->len && steps < insrs->len; steps++) {
+        const asm_insr_t *insr = list_of_asm_insrs_get_const(insrs, index);
+        const msu_str_t *name = insr->instruction;
+        if (insr->error) return false;
+
+        if (msu_str_eqs(name, "LDI") || msu_str_eqs(name, "LDA") || msu_str_eqs(name, "SPOP")
+            || msu_str_eqs(name, "INP") || msu_str_eqs(name, "SPUSHI") || msu_str_eqs(name, "CALL")
+            || msu_str_eqs(name, "HLT") || msu_str_eqs(name, "COB")) {
+            return true;
+        }
+        if ((msu_str_eqs(name, "ADD") || msu_str_eqs(name, "SUB")) && opt_consts_is(consts, insr->label_reference, 0)) {
+            index++; // the landing pads compilers put on labels
+            continue;
         }
+        if (msu_str_eqs(name, "BRA")) {
+            int target = opt_find_label(consts, insr->label_reference);
+            if (target < 0 || ++jumps > 8) return false;
+            index = target;
+            continue;
+        }
+
+        const emulator_opcode_t *op = emulator_find_opcode(msu_str_data(name));
+        if (op && (op->code < 0 || op->code > 920)) {
+            index++; // stack instructions leave the accumulator alone, except SPUSH which reads it
+            continue;
+        }
+        return false;
     }
+    return false;
+}
+
+// whether the `len` instructions from `i` are one straight run: no labels after the first, no errors
+bool opt_is_window(const list_of_asm_insrs_t *insrs, size_t i, size_t len) {
+    if (i + len > insrs->len) return false;
+    for (size_t j = 0; j < len; j++) {
+        const asm_insr_t *insr = list_of_asm_insrs_get_const(insrs, i + j);
+        if (insr->error || (j > 0 && !msu_str_is_empty(insr->label))) return false;
+    }
+    return true;
+}
+
+bool opt_is(const list_of_asm_insrs_t *insrs, size_t i, const char *name) {
+    return msu_str_eqs(list_of_asm_insrs_get_const(insrs, i)->instruction, name);
 }
 
-void push_pop_pass(const list_of_asm_insrs_t *insrs, list_of_asm_insrs_t *out) {
-    label_t *subs = NULL;
+bool opt_is_const(const list_of_asm_insrs_t *insrs, size_t i, const char *name) {
+    const asm_insr_t *insr = list_of_asm_insrs_get_const(insrs, i);
+    return msu_str_eqs(insr->instruction, name) && msu_str_is_empty(insr->label_reference);
+}
 
-    asm_insr_t *next = NULL;
-    for (int i = 1; i < insrs->len; ++i) {
-        const asm_insr_t *prev = list_of_asm_insrs_get_const(insrs, i - 1);
-        const asm_insr_t *current = next ? next : list_of_asm_insrs_get_const(insrs, i);
-        next = NULL;
+asm_insr_t *opt_new_insr(const char *name, int value, const msu_str_t *ref, const asm_insr_t *from) {
+    asm_insr_t *out = calloc(1, sizeof(asm_insr_t));
+    assert(out && "out of memory!\n");
+    out->label = msu_str_clone(from->label);
+    out->instruction = msu_str_new(name);
+    out->value = value;
+    out->label_reference = msu_str_clone(ref);
+    out->span = from->span;
+    return out;
+}
 
-        if (!(
-                msu_str_eqs(prev->instruction, "SPUSH") && msu_str_eqs(current->instruction, "SPOP")
-                || msu_str_eqs(prev->instruction, "SPOP") && msu_str_eqs(current->instruction, "SPUSH")
-        )) {
-            if (i == 1) {
-                list_of_asm_insrs_append(out, asm_insr_clone(list_of_asm_insrs_get_const(insrs, 0)));
+// whether the top of the stack is still in the accumulator after `insr`, given it was before
+bool opt_keeps_tos(const asm_insr_t *insr, bool cached) {
+    const msu_str_t *name = insr->instruction;
+    if (msu_str_eqs(name, "SPUSH") || msu_str_eqs(name, "SPUSHI")) return true;
+    if (msu_str_eqs(name, "SDUP") || msu_str_eqs(name, "OUT") || msu_str_eqs(name, "STA")
+        || msu_str_eqs(name, "BRZ") || msu_str_eqs(name, "BRP")) {
+        return cached;
+    }
+    return false;
+}
+
+list_of_asm_insrs_t *opt_cache_tos(const list_of_asm_insrs_t *insrs) {
+    list_of_asm_insrs_t *out = list_of_asm_insrs_new();
+    opt_consts_t consts;
+    opt_consts_init(&consts, insrs);
+
+    bool cached = false; // the accumulator holds the top of the stack
+    size_t i = 0;
+    while (i < insrs->len) {
+        const asm_insr_t *insr = list_of_asm_insrs_get_const(insrs, i);
+        if (!msu_str_is_empty(insr->label)) cached = false;
+
+        // with the top of the stack in the accumulator, these just copy it there again.
+        // a label resets `cached`, so the first one never has a label to move
+        if (cached && opt_is_window(insrs, i, 2) && opt_is(insrs, i + 1, "SPOP")
+            && (opt_is(insrs, i, "SDUP") || (opt_is_const(insrs, i, "SLDA") && insr->value == 0))) {
+            i += 2;
+            continue;
+        }
+        if (cached && opt_is_window(insrs, i, 2) && opt_is(insrs, i, "SPOP") && opt_is(insrs, i + 1, "SPUSH")) {
+            i += 2;
+            continue;
+        }
+
+        // SPUSHI c / SADD / SPOP  ->  SPOP / ADD c
+        if (opt_is_window(insrs, i, 3) && opt_is_const(insrs, i, "SPUSHI") && opt_is(insrs, i + 2, "SPOP")
+            && (opt_is(insrs, i + 1, "SADD") || opt_is(insrs, i + 1, "SSUB"))) {
+            const char *op = opt_is(insrs, i + 1, "SADD") ? "ADD" : "SUB";
+            list_of_asm_insrs_append(out, opt_new_insr("SPOP", 0, NULL, insr));
+            list_of_asm_insrs_append(out, opt_new_insr(op, 0, opt_consts_get(&consts, insr->value),
+                                                       list_of_asm_insrs_get_const(insrs, i + 1)));
+            cached = false;
+            i += 3;
+            continue;
+        }
+
+        // SPUSHI c / SCMPLT / SPOP / BRZ L  ->  SPOP / SUB c / BRP L, which leaves x - c instead
+        // of the comparison in the accumulator, so it has to be dead on both sides
+        if (opt_is_window(insrs, i, 4) && opt_is_const(insrs, i, "SPUSHI") && opt_is(insrs, i + 1, "SCMPLT")
+            && opt_is(insrs, i + 2, "SPOP") && opt_is(insrs, i + 3, "BRZ")) {
+            const asm_insr_t *branch = list_of_asm_insrs_get_const(insrs, i + 3);
+            int target = opt_find_label(&consts, branch->label_reference);
+            if (target >= 0 && opt_acc_is_dead(insrs, &consts, target) && opt_acc_is_dead(insrs, &consts, i + 4)) {
+                list_of_asm_insrs_append(out, opt_new_insr("SPOP", 0, NULL, insr));
+                list_of_asm_insrs_append(out, opt_new_insr("SUB", 0, opt_consts_get(&consts, insr->value),
+                                                           list_of_asm_insrs_get_const(insrs, i + 1)));
+                list_of_asm_insrs_append(out, opt_new_insr("BRP", branch->value, branch->label_reference, branch));
+                cached = false;
+                i += 4;
+                continue;
             }
-            list_of_asm_insrs_append(out, asm_insr_clone(current));
+        }
+
+        list_of_asm_insrs_append(out, asm_insr_clone(insr));
+        cached = !insr->error && opt_keeps_tos(insr, cached);
+        i++;
+    }
+
+    opt_consts_finish(&consts, out);
+    return out;
+}
+
+//======================================================
+//  Constant folding
+//======================================================
+
+// the value pushed by the instructions ending at out[end - 1], if it is a known constant.
+// *start is where the push begins, only that instruction may have a label
+bool opt_pushed_const(const list_of_asm_insrs_t *out, const opt_consts_t *consts, size_t end, int *value,
+                      size_t *start) {
+    if (end == 0) return false;
+    const asm_insr_t *insr = list_of_asm_insrs_get_const(out, end - 1);
+    if (insr->error) return false;
+    if (msu_str_eqs(insr->instruction, "SPUSHI") && msu_str_is_empty(insr->label_reference)) {
+        *value = insr->value;
+        *start = end - 1;
+        return true;
+    }
+    if (!msu_str_eqs(insr->instruction, "SPUSH") || !msu_str_is_empty(insr->label) || end < 2) return false;
+
+    const asm_insr_t *load = list_of_asm_insrs_get_const(out, end - 2);
+    if (load->error) return false;
+    if (msu_str_eqs(load->instruction, "LDI") && msu_str_is_empty(load->label_reference)) {
+        *value = load->value;
+    } else if (!msu_str_eqs(load->instruction, "LDA") || !opt_consts_value(consts, load->label_reference, value)) {
+        return false;
+    }
+    *start = end - 2;
+    return true;
+}
+
+// what the stack instruction `name` leaves for `a` below `b`, with the emulator's clamping
+bool opt_fold(const msu_str_t *name, int a, int b, int *result) {
+    if (msu_str_eqs(name, "SADD")) *result = a + b;
+    else if (msu_str_eqs(name, "SSUB")) *result = a - b;
+    else if (msu_str_eqs(name, "SMUL")) *result = a * b;
+    else if (msu_str_eqs(name, "SDIV") && b != 0) *result = a / b;
+    else if (msu_str_eqs(name, "SMAX")) *result = a > b ? a : b;
+    else if (msu_str_eqs(name, "SMIN")) *result = a < b ? a : b;
+    else if (msu_str_eqs(name, "SCMPGT")) *result = a > b;
+    else if (msu_str_eqs(name, "SCMPLT")) *result = a < b;
+    else return false;
+
+    if (*result > 999) *result = 999;
+    if (*result < -999) *result = -999;
+    return true;
+}
+
+// replaces out[start..] with a push of `value`, keeping the label of out[start]
+void opt_replace_with_push(list_of_asm_insrs_t *out, opt_consts_t *consts, size_t start, int value) {
+    asm_insr_t *push = opt_new_insr("SPUSHI", value, NULL, list_of_asm_insrs_get_const(out, start));
+    while (out->len > start) {
+        asm_insr_free(list_of_asm_insrs_pop(out));
+    }
+    list_of_asm_insrs_append(out, push);
+
+    if (value < 0 || value > 99) {
+        // too big for an immediate, load it from a constant cell instead
+        msu_str_free(push->instruction);
+        push->instruction = msu_str_new("LDA");
+        push->label_reference = msu_str_clone(opt_consts_get(consts, value));
+        push->value = 0;
+        asm_insr_t *spush = opt_new_insr("SPUSH", 0, NULL, push);
+        msu_str_free(spush->label);
+        spush->label = NULL;
+        list_of_asm_insrs_append(out, spush);
+    }
+}
+
+// folds arithmetic on constant pushes, e.g. SPUSHI 2 / SPUSHI 3 / SMUL -> SPUSHI 6. the result
+// stays at the end of the output, so whole constant expressions fold one operator at a time.
+// the pushes leave the last operand in the accumulator and the folded one leaves the result,
+// so a fold that changes it is only done where nothing reads the accumulator afterwards
+list_of_asm_insrs_t *opt_fold_constants(const list_of_asm_insrs_t *insrs) {
+    list_of_asm_insrs_t *out = list_of_asm_insrs_new();
+    opt_consts_t consts;
+    opt_consts_init(&consts, insrs);
+
+    for (size_t i = 0; i < insrs->len; i++) {
+        const asm_insr_t *insr = list_of_asm_insrs_get_const(insrs, i);
+        size_t start_b, start_a;
+        int a, b, result;
+        bool plain = !insr->error && msu_str_is_empty(insr->label);
+
+        if (plain && opt_pushed_const(out, &consts, out->len, &b, &start_b)
+            && msu_str_eqs(insr->instruction, "SNOT") && opt_acc_is_dead(insrs, &consts, i + 1)) {
+            opt_replace_with_push(out, &consts, start_b, b == 0);
+            continue;
+        }
+        if (plain && opt_pushed_const(out, &consts, out->len, &b, &start_b)
+            && msu_str_is_empty(list_of_asm_insrs_get_const(out, start_b)->label)
+            && opt_pushed_const(out, &consts, start_b, &a, &start_a)
+            && opt_fold(insr->instruction, a, b, &result)
+            && (result == b || opt_acc_is_dead(insrs, &consts, i + 1))) {
+            opt_replace_with_push(out, &consts, start_a, result);
             continue;
         }
+        list_of_asm_insrs_append(out, asm_insr_clone(insr));
+    }
 
-        if (i + 1 < insrs->len) {
-            next = asm_insr_clone(list_of_asm_insrs_get_const(insrs, i + 1));
-        } else {
-            next = malloc(sizeof(asm_insr_t));
-            assert(next && "out of memory!\n");
-            next->label = EMPTY_STRING;
-            next->instruction = msu_str_new("NOP");
-            next->label_reference = EMPTY_STRING;
-            next->value = 0;
-            next->error = NULL;
+    opt_consts_finish(&consts, out);
+    return out;
+}
+
+//======================================================
+//  Branch threading
+//
+//  compilers land every jump on an ADD of zero and like to
+//  branch to branches. this pass deletes the landing pads,
+//  walks each branch through the chain of branches it would
+//  take to where it really ends up, and drops the branches
+//  that go to the next instruction anyway
+//======================================================
+
+#define OPT_MAX_HOPS 8
+
+int opt_branch_target(const list_of_asm_insrs_t *insrs, const opt_consts_t *consts, size_t i) {
+    const asm_insr_t *insr = list_of_asm_insrs_get_const(insrs, i);
+    return opt_is_branch(insr) ? opt_find_label(consts, insr->label_reference) : -1;
+}
+
+// an ADD or SUB of a zero cell that only branches and calls refer to, so it can be skipped
+bool opt_is_landing_pad(const list_of_asm_insrs_t *insrs, const opt_consts_t *consts, size_t i) {
+    const asm_insr_t *insr = list_of_asm_insrs_get_const(insrs, i);
+    if (insr->error || !(msu_str_eqs(insr->instruction, "ADD") || msu_str_eqs(insr->instruction, "SUB"))) return false;
+    if (!opt_consts_is(consts, insr->label_reference, 0)) return false;
+    if (msu_str_is_empty(insr->label)) return true;
+
+    const int *uses = label_table_getv(consts->references, insr->label);
+    return !uses || !(*uses & OPT_READ);
+}
+
+// where the branch at `i` ends up after the branches it lands on. the accumulator is the same
+// all along, so BRZ can go through BRZ and BRP (zero is positive) and BRP through BRP
+const msu_str_t *opt_thread(const list_of_asm_insrs_t *insrs, const opt_consts_t *consts, size_t i) {
+    const asm_insr_t *insr = list_of_asm_insrs_get_const(insrs, i);
+    const msu_str_t *ref = insr->label_reference;
+    for (int hops = 0; hops < OPT_MAX_HOPS; hops++) {
+        int target = opt_find_label(consts, ref);
+        if (target < 0) break;
+        const asm_insr_t *next = list_of_asm_insrs_get_const(insrs, target);
+        if (!opt_is_branch(next)) break;
+        if (!msu_str_eqs(next->instruction, "BRA") && !msu_str_eq(next->instruction, insr->instruction)
+            && !(msu_str_eqs(insr->instruction, "BRZ") && msu_str_eqs(next->instruction, "BRP"))) {
+            break;
+        }
+        ref = next->label_reference;
+    }
+    return ref;
+}
+
+list_of_asm_insrs_t *opt_thread_once(const list_of_asm_insrs_t *insrs, opt_consts_t *consts, bool *changed) {
+    list_of_asm_insrs_t *out = list_of_asm_insrs_new();
+    label_t *subs = label_new();
+    const msu_str_t *carry = NULL;
+
+    for (size_t i = 0; i < insrs->len; i++) {
+        const asm_insr_t *insr = list_of_asm_insrs_get_const(insrs, i);
+
+        // the last instruction keeps its cell, whatever jumps to it has to land somewhere
+        if (i + 1 < insrs->len && opt_is_landing_pad(insrs, consts, i)) {
+            opt_carry_label(insr, &carry, subs);
+            *changed = true;
+            continue;
         }
 
-        const asm_insr_t *removed[] = {prev, current};
-        const size_t len_removed = sizeof(removed) / sizeof(removed[0]);
+        // SNOT / SPOP / BRZ A / BRA B / A:  ->  SPOP / BRZ B / A:. there is no branch on
+        // nonzero, so a test can only be turned around by dropping the SNOT in front of it,
+        // which leaves the opposite truth value in the accumulator on both sides
+        if (opt_is_window(insrs, i, 4) && opt_is(insrs, i, "SNOT") && opt_is(insrs, i + 1, "SPOP")
+            && opt_is(insrs, i + 2, "BRZ") && opt_is(insrs, i + 3, "BRA")
+            && opt_branch_target(insrs, consts, i + 2) == (int) i + 4) {
+            int other = opt_branch_target(insrs, consts, i + 3);
+            if (other >= 0 && opt_acc_is_dead(insrs, consts, i + 4) && opt_acc_is_dead(insrs, consts, other)) {
+                const asm_insr_t *branch = list_of_asm_insrs_get_const(insrs, i + 3);
+                opt_append_carried(out, opt_new_insr("SPOP", 0, NULL, insr), &carry, subs);
+                list_of_asm_insrs_append(out, opt_new_insr("BRZ", 0, branch->label_reference,
+                                                           list_of_asm_insrs_get_const(insrs, i + 2)));
+                *changed = true;
+                i += 3;
+                continue;
+            }
+        }
 
-        transfer_errors(removed, len_removed, next);
-        transfer_labels(removed, len_removed, next, &subs);
+        if (opt_is_branch(insr)) {
+            const msu_str_t *ref = opt_thread(insrs, consts, i);
+            if (opt_find_label(consts, ref) == (int) i + 1) {
+                opt_carry_label(insr, &carry, subs);
+                *changed = true;
+                continue;
+            }
+            if (!msu_str_eq(ref, insr->label_reference)) {
+                opt_append_carried(out, opt_new_insr(msu_str_data(insr->instruction), 0, ref, insr), &carry, subs);
+                *changed = true;
+                continue;
+            }
+        }
+
+        opt_append_carried(out, asm_insr_clone(insr), &carry, subs);
     }
 
-    for (size_t i = 0; i < out->len; i++) {
-        asm_insr_t *insr = list_of_asm_insrs_get(out, i);
-        label_rename(subs, insr);
+    opt_finish_labels(out, carry, subs);
+    return out;
+}
+
+// each round can uncover more (a landing pad gone makes a branch go to a branch), so this
+// repeats until nothing changes. *rounds is how many it took
+list_of_asm_insrs_t *opt_thread_branches(const list_of_asm_insrs_t *insrs, int *rounds) {
+    list_of_asm_insrs_t *out = list_of_asm_insrs_new();
+    for (size_t i = 0; i < insrs->len; i++) {
+        list_of_asm_insrs_append(out, asm_insr_clone(list_of_asm_insrs_get_const(insrs, i)));
     }
 
-    label_free_all(subs);
+    bool changed = true;
+    for (*rounds = 0; changed && *rounds < OPT_MAX_HOPS; (*rounds)++) {
+        changed = false;
+        opt_consts_t consts;
+        opt_consts_init(&consts, out);
+        list_of_asm_insrs_t *next = opt_thread_once(out, &consts, &changed);
+        opt_consts_finish(&consts, next);
+        list_of_asm_insrs_free(out, true);
+        out = next;
+    }
+    return out;
 }
 
-void pushi_pop_pass(const list_of_asm_insrs_t *insrs, list_of_asm_insrs_t *out) {
-    label_t *subs = NULL;
+//======================================================
+//  Dead code
+//======================================================
+
+// drops instructions after BRA, HLT or RET up to the next label something refers to, and
+// named DAT cells nothing refers to there. a cell that's only read doesn't make what follows
+// it reachable. DAT without a name is kept, it could be padding
+list_of_asm_insrs_t *opt_remove_dead(const list_of_asm_insrs_t *insrs) {
+    list_of_asm_insrs_t *out = list_of_asm_insrs_new();
+    label_table_t *references = opt_references(insrs);
 
-    for (int i = 1; i < insrs->len; ++i) {
-        const asm_insr_t *prev = list_of_asm_insrs_get_const(insrs, i - 1);
-        const asm_insr_t *current = list_of_asm_insrs_get_const(insrs, i);
+    bool dead = false;
+    for (size_t i = 0; i < insrs->len; i++) {
+        const asm_insr_t *insr = list_of_asm_insrs_get_const(insrs, i);
+        bool is_data = msu_str_eqs(insr->instruction, "DAT");
+        int *uses = msu_str_is_empty(insr->label) ? NULL : label_table_getv(references, insr->label);
+        if (uses && (!is_data || (*uses & OPT_JUMPED))) dead = false;
 
-        if (!(msu_str_eqs(prev->instruction, "SPUSHI") && msu_str_eqs(current->instruction, "SPOP"))) {
-            if (i == 1) {
-                list_of_asm_insrs_append(out, asm_insr_clone(list_of_asm_insrs_get_const(insrs, 0)));
+        if (dead && !insr->error && (!is_data || (!msu_str_is_empty(insr->label) && !uses))) continue;
+
+        list_of_asm_insrs_append(out, asm_insr_clone(insr));
+        if (!insr->error && (msu_str_eqs(insr->instruction, "BRA") || msu_str_eqs(insr->instruction, "HLT")
+                             || msu_str_eqs(insr->instruction, "COB") || msu_str_eqs(insr->instruction, "RET"))) {
+            dead = true;
+        }
+    }
+    label_table_free(references);
+    return out;
+}
+
+//======================================================
+//  Calls
+//
+//  CALL overwrites $ra, so code that still needs it saves it
+//  on the return stack around the call (RPUSH; CALL f; RPOP),
+//  or a function saves it on the way in and restores it on
+//  the way out. neither is needed where $ra is dead after the
+//  call, or in a function that never calls, which is most of
+//  them. tail calls, `CALL f; RPOP; RET`, are a peephole rule
+//======================================================
+
+typedef struct opt_funcs {
+    const cfg_t *cfg;
+    bool *is_entry; // blocks something CALLs
+    int *owner; // the entry of the function each block is in, or -1
+    bool *keep; // by entry, whether the function has to save $ra
+    int *stack;
+} opt_funcs_t;
+
+// whether the block restores $ra and then returns, or jumps into another function
+bool opt_leaves_function(const opt_funcs_t *funcs, int b) {
+    const cfg_block_t *block = &funcs->cfg->blocks[b];
+    const list_of_asm_insrs_t *insrs = funcs->cfg->insrs;
+    if (block->end - block->start < 2 || !opt_is(insrs, block->end - 2, "RPOP")) return false;
+    return opt_is(insrs, block->end - 1, "RET")
+           || (opt_is(insrs, block->end - 1, "BRA") && block->succ[0] >= 0 && funcs->is_entry[block->succ[0]]);
+}
+
+// takes the blocks reachable from `entry` for its function. the function has to keep its
+// save if it calls, touches the return stack anywhere else, or shares a block with another
+void opt_claim_function(opt_funcs_t *funcs, int entry) {
+    const cfg_t *cfg = funcs->cfg;
+    size_t top = 0;
+    funcs->stack[top++] = entry;
+    funcs->owner[entry] = entry;
+    if (!opt_is(cfg->insrs, cfg->blocks[entry].start, "RPUSH")) funcs->keep[entry] = true;
+
+    while (top > 0) {
+        int b = funcs->stack[--top];
+        const cfg_block_t *block = &cfg->blocks[b];
+        bool leaves = opt_leaves_function(funcs, b);
+        if (block->exits && !leaves) funcs->keep[entry] = true;
+
+        for (size_t i = block->start; i < block->end; i++) {
+            if (opt_is(cfg->insrs, i, "CALL") || opt_is(cfg->insrs, i, "JAL")
+                || (opt_is(cfg->insrs, i, "RPUSH") && i != cfg->blocks[entry].start)
+                || (opt_is(cfg->insrs, i, "RPOP") && !(leaves && i == block->end - 2))) {
+                funcs->keep[entry] = true;
             }
-            list_of_asm_insrs_append(out, asm_insr_clone(current));
-            continue;
         }
 
-        int value = prev->value;
-        const msu_str_t *label_ref = prev->label_reference;
+        for (int k = 0; k < 2; k++) {
+            int s = block->succ[k];
+            if (s < 0 || (funcs->owner[s] == entry && !funcs->is_entry[s])) continue;
+            if (funcs->is_entry[s]) {
+                // a tail call is fine once $ra is back as it was, otherwise it would be saved twice
+                if (!leaves) funcs->keep[entry] = true;
+            } else if (funcs->owner[s] >= 0) {
+                funcs->keep[entry] = funcs->keep[funcs->owner[s]] = true;
+            } else {
+                funcs->owner[s] = entry;
+                funcs->stack[top++] = s;
+            }
+        }
+    }
+}
 
-        asm_insr_t *new_insr = malloc(sizeof(asm_insr_t));
-        assert(new_insr && "out of memory!\n");
-        new_insr->label = EMPTY_STRING;
-        new_insr->instruction = msu_str_new("LDI");
-        new_insr->label_reference = msu_str_clone(label_ref);
-        new_insr->value = value;
-        new_insr->error = ASM_ERROR_NONE;
-        list_of_asm_insrs_append(out, new_insr);
+// whether the instruction at `i` saves or restores $ra for nothing
+bool opt_is_needless_save(const opt_funcs_t *funcs, size_t i) {
+    const cfg_t *cfg = funcs->cfg;
+    int entry = funcs->owner[cfg->block_of[i]];
+    if (entry >= 0 && !funcs->keep[entry]
+        && (i == cfg->blocks[entry].start || opt_is(cfg->insrs, i, "RPOP"))) {
+        return true;
+    }
 
-        const asm_insr_t *removed[] = {prev, current};
-        const size_t len_removed = sizeof(removed) / sizeof(removed[0]);
+    // around a call, with nothing needing $ra afterwards
+    bool push = opt_is(cfg->insrs, i, "RPUSH"), pop = opt_is(cfg->insrs, i, "RPOP");
+    if (!push && !(pop && i >= 2)) return false;
+    size_t start = push ? i : i - 2;
+    if (!opt_is_window(cfg->insrs, start, 3) || !opt_is(cfg->insrs, start, "RPUSH")
+        || !opt_is(cfg->insrs, start + 1, "CALL") || !opt_is(cfg->insrs, start + 2, "RPOP")) {
+        return false;
+    }
+    return start + 3 >= cfg->insrs->len || !cfg_is_live(cfg, start + 3, CFG_RA);
+}
 
-        transfer_errors(removed, len_removed, new_insr);
-        transfer_labels(removed, len_removed, new_insr, &subs);
+list_of_asm_insrs_t *opt_calls(const list_of_asm_insrs_t *insrs) {
+    // the targets of a JAL aren't known, so neither are the functions
+    bool jumps_and_links = false;
+    for (size_t i = 0; i < insrs->len; i++) {
+        if (opt_is(insrs, i, "JAL")) jumps_and_links = true;
     }
 
-    for (size_t i = 0; i < out->len; i++) {
-        asm_insr_t *insr = list_of_asm_insrs_get(out, i);
-        label_rename(subs, insr);
+    cfg_t *cfg = cfg_build(insrs);
+    size_t n = cfg->len;
+    opt_funcs_t funcs = {
+        .cfg = cfg,
+        .is_entry = calloc(n + 1, sizeof(bool)),
+        .owner = malloc((n + 1) * sizeof(int)),
+        .keep = calloc(n + 1, sizeof(bool)),
+        .stack = malloc((n + 1) * sizeof(int)),
+    };
+    assert(funcs.is_entry && funcs.owner && funcs.keep && funcs.stack && "out of memory!\n");
+
+    for (size_t b = 0; b < n; b++) {
+        funcs.owner[b] = -1;
+        if (cfg->blocks[b].callee >= 0) funcs.is_entry[cfg->blocks[b].callee] = true;
+    }
+    for (size_t b = 0; b < n && !jumps_and_links; b++) {
+        if (funcs.is_entry[b]) opt_claim_function(&funcs, (int) b);
+    }
+    // a function can only be entered at the top
+    for (size_t b = 0; b < n; b++) {
+        for (int k = 0; k < 2; k++) {
+            int s = cfg->blocks[b].succ[k];
+            if (s >= 0 && funcs.owner[s] >= 0 && s != funcs.owner[s] && funcs.owner[b] != funcs.owner[s]) {
+                funcs.keep[funcs.owner[s]] = true;
+            }
+        }
     }
 
-    label_free_all(subs);
+    list_of_asm_insrs_t *out = list_of_asm_insrs_new();
+    label_t *subs = label_new();
+    const msu_str_t *carry = NULL;
+    for (size_t i = 0; i < insrs->len; i++) {
+        const asm_insr_t *insr = list_of_asm_insrs_get_const(insrs, i);
+        if (opt_is_needless_save(&funcs, i)) {
+            opt_carry_label(insr, &carry, subs);
+        } else {
+            opt_append_carried(out, asm_insr_clone(insr), &carry, subs);
+        }
+    }
+    opt_finish_labels(out, carry, subs);
+
+    free(funcs.is_entry);
+    free(funcs.owner);
+    free(funcs.keep);
+    free(funcs.stack);
+    cfg_free(cfg);
+    return out;
 }
 
-typedef void (*optimizer_func)(const list_of_asm_insrs_t *, list_of_asm_insrs_t *);
+//======================================================
+//  Block layout
+//
+//  with a profile from the emulator the blocks can be put
+//  in the order they usually run in, so the hot path falls
+//  through instead of branching. blocks are joined into
+//  chains along the hottest edges that can become fall
+//  throughs, and cold chains go last
+//======================================================
 
-list_of_asm_insrs_t *asm_optimize(const list_of_asm_insrs_t *insrs) {
-    const size_t seed = 42;
-    size_t hash = list_of_asm_insrs_hash(insrs, seed);
+typedef struct opt_layout {
+    const cfg_t *cfg;
+    int *count;  // how often each block ran
+    int *fall;   // the block each one falls into, -1 if it doesn't
+    int *jump;   // the block a BRA at its end goes to, or -1
+    int *after, *before; // the chains
+    bool *rotated;
+    const msu_str_t **labels; // for blocks that didn't have one
+} opt_layout_t;
+
+typedef struct opt_edge {
+    int from, to, weight;
+} opt_edge_t;
+
+// heavier first, then the original fall throughs, then in program order
+int opt_edge_cmp(const void *a, const void *b) {
+    const opt_edge_t *x = a, *y = b;
+    if (x->weight != y->weight) return x->weight > y->weight ? -1 : 1;
+    bool x_falls = x->to == x->from + 1, y_falls = y->to == y->from + 1;
+    if (x_falls != y_falls) return x_falls ? -1 : 1;
+    return x->from - y->from;
+}
+
+const asm_insr_t *opt_block_insr(const opt_layout_t *layout, int block, size_t offset) {
+    return list_of_asm_insrs_get_const(layout->cfg->insrs, layout->cfg->blocks[block].start + offset);
+}
+
+const asm_insr_t *opt_block_last(const opt_layout_t *layout, int block) {
+    const cfg_block_t *b = &layout->cfg->blocks[block];
+    return list_of_asm_insrs_get_const(layout->cfg->insrs, b->end - 1);
+}
+
+bool opt_is_data_block(const opt_layout_t *layout, int block) {
+    return msu_str_eqs(opt_block_insr(layout, block, 0)->instruction, "DAT");
+}
+
+const msu_str_t *opt_block_label(opt_layout_t *layout, int block) {
+    const asm_insr_t *first = opt_block_insr(layout, block, 0);
+    if (!msu_str_is_empty(first->label)) return first->label;
+    if (!layout->labels[block]) layout->labels[block] = msu_str_printf("$layout.%d", block);
+    return layout->labels[block];
+}
+
+// a loop test `SNOT / SPOP / BRZ out` can move below the body as `SPOP / BRZ body`, which saves
+// the SNOT and the BRA back up on every round. there's no branch on nonzero, so tests without
+// the SNOT stay where they are
+bool opt_can_rotate(const opt_layout_t *layout, int block) {
+    const cfg_t *cfg = layout->cfg;
+    const cfg_block_t *b = &cfg->blocks[block];
+    if (b->end - b->start < 3 || layout->fall[block] < 0 || b->succ[0] < 0 || layout->count[block] < 2) return false;
+    if (!msu_str_eqs(opt_block_insr(layout, block, b->end - b->start - 3)->instruction, "SNOT")
+        || !msu_str_eqs(opt_block_insr(layout, block, b->end - b->start - 2)->instruction, "SPOP")
+        || !msu_str_eqs(opt_block_last(layout, block)->instruction, "BRZ")) {
+        return false;
+    }
+
+    bool looped = false;
+    for (size_t j = 0; j < cfg->len; j++) {
+        looped = looped || (layout->jump[j] == block && layout->count[j] > 0);
+    }
+    // the accumulator ends up holding the opposite truth value on both sides
+    return looped && !opt_is_data_block(layout, b->succ[0]) && !cfg_is_live(cfg, cfg->blocks[layout->fall[block]].start, CFG_ACC)
+           && !cfg_is_live(cfg, cfg->blocks[b->succ[0]].start, CFG_ACC);
+}
+
+// puts `to` right after `from`, if they are the ends of two different chains
+void opt_chain(opt_layout_t *layout, int from, int to) {
+    if (to == 0 || layout->after[from] >= 0 || layout->before[to] >= 0) return;
+    for (int b = to; b >= 0; b = layout->after[b]) {
+        if (b == from) return;
+    }
+    layout->after[from] = to;
+    layout->before[to] = from;
+}
+
+void opt_emit_block(const opt_layout_t *layout, int block, list_of_asm_insrs_t *out) {
+    const cfg_block_t *b = &layout->cfg->blocks[block];
+    size_t end = layout->rotated[block] ? b->end - 3 : b->end;
+    for (size_t i = b->start; i < end; i++) {
+        asm_insr_t *insr = asm_insr_clone(list_of_asm_insrs_get_const(layout->cfg->insrs, i));
+        if (i == b->start && layout->labels[block]) {
+            msu_str_free(insr->label);
+            insr->label = msu_str_clone(layout->labels[block]);
+        }
+        list_of_asm_insrs_append(out, insr);
+    }
+    if (layout->rotated[block]) {
+        // SNOT / SPOP / BRZ out  ->  SPOP / BRZ body, falling through to `out`
+        asm_insr_t *spop = opt_new_insr("SPOP", 0, NULL, opt_block_insr(layout, block, end - b->start));
+        if (end == b->start && layout->labels[block]) {
+            msu_str_free(spop->label);
+            spop->label = msu_str_clone(layout->labels[block]);
+        }
+        list_of_asm_insrs_append(out, spop);
+        list_of_asm_insrs_append(out, opt_new_insr("BRZ", 0, layout->labels[block + 1]
+                                                             ? layout->labels[block + 1]
+                                                             : opt_block_insr(layout, block + 1, 0)->label,
+                                                   opt_block_last(layout, block)));
+    }
+}
 
-    const optimizer_func OPTIMIZERS[] = {push_pop_pass, pushi_pop_pass};
-    const size_t LEN_OPTIMIZERS = sizeof(OPTIMIZERS) / sizeof(OPTIMIZERS[0]);
+list_of_asm_insrs_t *opt_layout(const list_of_asm_insrs_t *insrs, const int *profile) {
+    list_of_asm_insrs_t *out = list_of_asm_insrs_new();
+    cfg_t *cfg = cfg_build(insrs);
+    size_t n = cfg->len;
+    opt_layout_t layout = {
+        .cfg = cfg,
+        .count = calloc(n + 1, sizeof(int)),
+        .fall = malloc((n + 1) * sizeof(int)),
+        .jump = malloc((n + 1) * sizeof(int)),
+        .after = malloc((n + 1) * sizeof(int)),
+        .before = malloc((n + 1) * sizeof(int)),
+        .rotated = calloc(n + 1, sizeof(bool)),
+        .labels = calloc(n + 1, sizeof(msu_str_t *)),
+    };
+    opt_edge_t *edges = malloc((2 * n + 1) * sizeof(opt_edge_t));
+    assert(layout.count && layout.fall && layout.jump && layout.after && layout.before && layout.rotated
+           && layout.labels && edges && "out of memory!\n");
 
-    list_of_asm_insrs_t *inp = list_of_asm_insrs_clone(insrs);
-    list_of_asm_insrs_t *modified = list_of_asm_insrs_new();
-    while (1) {
-        for (size_t i = 0; i < LEN_OPTIMIZERS; i++) {
-            optimizer_func func = OPTIMIZERS[i];
-            func(inp, modified);
+    // what runs after what, and how often each block ran
+    bool movable = true;
+    int pc = 0;
+    for (size_t b = 0, i = 0; b < n; b++) {
+        const cfg_block_t *block = &cfg->blocks[b];
+        for (; i < block->end; i++) {
+            const asm_insr_t *insr = list_of_asm_insrs_get_const(insrs, i);
+            if (i == block->start && pc <= TOP_OF_MEMORY) layout.count[b] = profile[pc];
+            movable = movable && !insr->error && (i == block->start || !msu_str_eqs(insr->instruction, "DAT"));
+            pc += asm_insr_size(insr);
+        }
+
+        const msu_str_t *name = opt_block_last(&layout, (int) b)->instruction;
+        bool stops = msu_str_eqs(name, "BRA") || msu_str_eqs(name, "HLT") || msu_str_eqs(name, "COB")
+                     || msu_str_eqs(name, "RET") || msu_str_eqs(name, "DAT");
+        layout.fall[b] = stops ? -1 : (int) b + 1;
+        layout.jump[b] = msu_str_eqs(name, "BRA") ? block->succ[0] : -1;
+        layout.after[b] = layout.before[b] = -1;
+        // code running off the end or into data has to stay where it is
+        movable = movable && (stops || (b + 1 < n && !opt_is_data_block(&layout, (int) b + 1)));
+    }
+
+    if (!movable) {
+        for (size_t i = 0; i < insrs->len; i++) {
+            list_of_asm_insrs_append(out, asm_insr_clone(list_of_asm_insrs_get_const(insrs, i)));
+        }
+    } else {
+        size_t edge_count = 0;
+        for (size_t b = 0; b < n; b++) {
+            if (opt_is_data_block(&layout, (int) b)) continue;
+            if (opt_can_rotate(&layout, (int) b)) {
+                layout.rotated[b] = true;
+                layout.fall[b] = cfg->blocks[b].succ[0];
+            }
 
-            // swap(inp, modified);
-            list_of_asm_insrs_t *tmp = inp;
-            inp = modified;
-            modified = tmp;
+            const msu_str_t *name = opt_block_last(&layout, (int) b)->instruction;
+            bool calls = msu_str_eqs(name, "CALL") || msu_str_eqs(name, "JAL");
+            int targets[] = {layout.fall[b], layout.jump[b]};
+            for (int t = 0; t < 2; t++) {
+                if (targets[t] < 0) continue;
+                int weight = layout.count[b] < layout.count[targets[t]] ? layout.count[b] : layout.count[targets[t]];
+                // a call comes back to the next cell, so that one can't move
+                edges[edge_count++] = (opt_edge_t) {(int) b, targets[t], calls ? INT_MAX : weight};
+            }
+        }
+        qsort(edges, edge_count, sizeof(opt_edge_t), opt_edge_cmp);
+        for (size_t e = 0; e < edge_count; e++) {
+            opt_chain(&layout, edges[e].from, edges[e].to);
+        }
 
-            modified->len = 0;
+        // every block jumped to from somewhere new needs a label
+        for (size_t b = 0; b < n; b++) {
+            if (layout.fall[b] >= 0 && layout.after[b] != layout.fall[b]) opt_block_label(&layout, layout.fall[b]);
+            if (layout.rotated[b]) opt_block_label(&layout, (int) b + 1);
         }
 
-        size_t newhash = list_of_asm_insrs_hash(inp, seed);
-        if (hash == newhash) break;
-        hash = newhash;
+        // the entry first, then the chains that ran, then the ones that didn't, then data
+        for (int pass = 0; pass < 4; pass++) {
+            for (size_t head = 0; head < n; head++) {
+                if (layout.before[head] >= 0) continue;
+                bool hot = false;
+                for (int b = (int) head; b >= 0; b = layout.after[b]) hot = hot || layout.count[b] > 0;
+                bool data = opt_is_data_block(&layout, (int) head);
+                int kind = head == 0 ? 0 : data ? 3 : hot ? 1 : 2;
+                if (kind != pass) continue;
+
+                for (int b = (int) head; b >= 0; b = layout.after[b]) {
+                    opt_emit_block(&layout, b, out);
+                    if (layout.fall[b] >= 0 && layout.after[b] != layout.fall[b]) {
+                        asm_insr_t *bra = opt_new_insr("BRA", 0, opt_block_label(&layout, layout.fall[b]),
+                                                       opt_block_last(&layout, b));
+                        msu_str_free(bra->label);
+                        bra->label = NULL;
+                        list_of_asm_insrs_append(out, bra);
+                    }
+                }
+            }
+        }
     }
 
-    list_of_asm_insrs_free(modified, true);
-    return inp;
-}
\ No newline at end of file
+    for (size_t b = 0; b < n; b++) msu_str_free(layout.labels[b]);
+    free(layout.labels);
+    free(layout.rotated);
+    free(layout.before);
+    free(layout.after);
+    free(layout.jump);
+    free(layout.fall);
+    free(layout.count);
+    free(edges);
+    cfg_free(cfg);
+    return out;
+}
+
+list_of_asm_insrs_t *asm_optimize_profiled(const list_of_asm_insrs_t *insrs, const int *profile) {
+    list_of_asm_insrs_t *laid_out = opt_layout(insrs, profile);
+    list_of_asm_insrs_t *out = asm_optimize(laid_out);
+    list_of_asm_insrs_free(laid_out, true);
+    return out;
+}
+
+//======================================================
+//  Pipeline
+//======================================================
+
+// a pass in the pipeline. *iterations is how often it went round: rewrites for the
+// peephole pass, rounds to a fixpoint for branch threading and 1 for the rest
+typedef list_of_asm_insrs_t *(*opt_pass_t)(const list_of_asm_insrs_t *insrs, const opt_rules_t *rules,
+                                           int *iterations);
+
+list_of_asm_insrs_t *opt_pass_calls(const list_of_asm_insrs_t *insrs, const opt_rules_t *rules, int *iterations) {
+    (void) rules;
+    *iterations = 1;
+    return opt_calls(insrs);
+}
+
+list_of_asm_insrs_t *opt_pass_fold(const list_of_asm_insrs_t *insrs, const opt_rules_t *rules, int *iterations) {
+    (void) rules;
+    *iterations = 1;
+    return opt_fold_constants(insrs);
+}
+
+list_of_asm_insrs_t *opt_pass_cache(const list_of_asm_insrs_t *insrs, const opt_rules_t *rules, int *iterations) {
+    (void) rules;
+    *iterations = 1;
+    return opt_cache_tos(insrs);
+}
+
+list_of_asm_insrs_t *opt_pass_thread(const list_of_asm_insrs_t *insrs, const opt_rules_t *rules, int *iterations) {
+    (void) rules;
+    return opt_thread_branches(insrs, iterations);
+}
+
+list_of_asm_insrs_t *opt_pass_dead(const list_of_asm_insrs_t *insrs, const opt_rules_t *rules, int *iterations) {
+    (void) rules;
+    *iterations = 1;
+    return opt_remove_dead(insrs);
+}
+
+const struct {
+    const char *name;
+    opt_pass_t run;
+} OPT_PASSES[] = {
+    {"peephole", opt_peephole_counted},
+    {"calls", opt_pass_calls},
+    {"fold", opt_pass_fold},
+    {"cache-tos", opt_pass_cache},
+    {"thread", opt_pass_thread},
+    {"dead", opt_pass_dead},
+    {"peephole", opt_peephole_counted}, // again, for what the other passes uncovered
+};
+static_assert(sizeof(OPT_PASSES) / sizeof(OPT_PASSES[0]) <= OPT_MAX_PASSES, "raise OPT_MAX_PASSES");
+
+double opt_now_ms() {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+void opt_measure(const list_of_asm_insrs_t *insrs, size_t *cells, size_t *labels) {
+    *cells = *labels = 0;
+    for (size_t i = 0; i < insrs->len; i++) {
+        const asm_insr_t *insr = list_of_asm_insrs_get_const(insrs, i);
+        *cells += asm_insr_size(insr);
+        if (!msu_str_is_empty(insr->label)) (*labels)++;
+    }
+}
+
+// the default and searched rules, parsed by the first optimize and kept after that
+opt_rules_t *OPT_BUILTIN_RULES = NULL;
+pthread_once_t OPT_BUILTIN_RULES_ONCE = PTHREAD_ONCE_INIT;
+
+void opt_parse_builtin_rules(void) {
+    OPT_BUILTIN_RULES = opt_rules_new();
+    const char *RULE_SETS[] = {OPT_DEFAULT_RULES, OPT_SEARCHED_RULES};
+    for (size_t i = 0; i < sizeof(RULE_SETS) / sizeof(RULE_SETS[0]); i++) {
+        const msu_str_t *src = msu_str_new(RULE_SETS[i]);
+        asm_error_t *err = opt_rules_parse(OPT_BUILTIN_RULES, src);
+        assert(!err && "bad built in peephole rule\n");
+        msu_str_free(src);
+    }
+}
+
+const opt_rules_t *opt_builtin_rules() {
+    pthread_once(&OPT_BUILTIN_RULES_ONCE, opt_parse_builtin_rules);
+    return OPT_BUILTIN_RULES;
+}
+
+list_of_asm_insrs_t *asm_optimize(const list_of_asm_insrs_t *insrs) {
+    return asm_optimize_stats(insrs, NULL);
+}
+
+list_of_asm_insrs_t *asm_optimize_stats(const list_of_asm_insrs_t *insrs, opt_stats_t *stats) {
+    double start = opt_now_ms();
+    const opt_rules_t *rules = opt_builtin_rules();
+
+    opt_stats_t ignored;
+    if (!stats) stats = &ignored;
+    memset(stats, 0, sizeof(opt_stats_t));
+    stats->rules_ms = opt_now_ms() - start;
+
+    const size_t PASS_COUNT = sizeof(OPT_PASSES) / sizeof(OPT_PASSES[0]);
+
+    list_of_asm_insrs_t *out = NULL;
+    for (size_t i = 0; i < PASS_COUNT; i++) {
+        const list_of_asm_insrs_t *in = out ? out : insrs;
+        opt_pass_stats_t *pass = &stats->passes[stats->len++];
+        pass->name = OPT_PASSES[i].name;
+        pass->insrs_before = in->len;
+        size_t labels_before;
+        opt_measure(in, &pass->cells_before, &labels_before);
+
+        double pass_start = opt_now_ms();
+        list_of_asm_insrs_t *next = OPT_PASSES[i].run(in, rules, &pass->iterations);
+        pass->ms = opt_now_ms() - pass_start;
+
+        size_t labels_after;
+        pass->insrs_after = next->len;
+        opt_measure(next, &pass->cells_after, &labels_after);
+        pass->labels_merged = labels_before > labels_after ? labels_before - labels_after : 0;
+
+        list_of_asm_insrs_free(out, true);
+        out = next;
+    }
+
+    stats->ms = opt_now_ms() - start;
+    return out;
+}
+
+const msu_str_t *opt_stats_print(const opt_stats_t *stats) {
+    msu_str_builder_t out = msu_str_builder_new();
+    msu_str_builder_printf(out, "%-10s %-14s %-14s %7s %6s %9s\n", "pass", "insrs", "cells", "labels", "iters", "ms");
+    for (size_t i = 0; i < stats->len; i++) {
+        const opt_pass_stats_t *pass = &stats->passes[i];
+        msu_str_builder_printf(out, "%-10s %-5zu -> %-5zu %-5zu -> %-5zu %7zu %6d %9.3f\n", pass->name,
+                               pass->insrs_before, pass->insrs_after, pass->cells_before, pass->cells_after,
+                               pass->labels_merged, pass->iterations, pass->ms);
+    }
+    msu_str_builder_printf(out, "rules parsed in %.3f ms, %.3f ms in all\n", stats->rules_ms, stats->ms);
+    return msu_str_builder_into_string_and_free(out);
+}
@@ -0,0 +1,15 @@
+// generated by superopt from superopt/corpus, do not edit
+
+#include "lmsm/opt.h"
+
+const char *OPT_SEARCHED_RULES =
+        "# found by superopt, do not edit\n"
+        "SPUSH; SDUP; SPOP => SPUSH  # seen 2 times\n"
+        "SLDA 0; SSTA 2; SPADD 1 => SSTA 0; SSTA 0  # seen 1 times\n"
+        "SPSUB 2; SPUSHI 0; SSTA 0 => SPSUB 1; SPUSHI 0  # seen 1 times\n"
+        "SPUSHI 0; SSTA 0; SPUSHI 0 => SPOP; SPUSHI 0; SPUSH  # seen 1 times\n"
+        "SPUSHI 1; SADD; SPUSHI 1 => SPUSHI 1; SADD; SPUSH  # seen 1 times\n"
+        "SLDA 1; SSTA 3; SLDA 0; SSTA 2 => SSTA 1; SSTA 1; SPSUB 1  # seen 1 times\n"
+        "SLDA 0; SPUSHI a; SSUB; SSTA 0 => SPUSHI a; SSUB  # seen 1 times\n"
+        "# 158 patterns searched\n"
+        "";
@@ -1,5 +1,7 @@
 #include "lmsm/sea.h"
 
+#include <pthread.h>
+
 token *sea_tokenize(const msu_str_t *src) {
     return tokenize(src, STRLIT("//"));
 }
@@ -161,6 +163,51 @@ parsenode_t *sea_parse_decl(parser *pk) {
 
         parsenode_add_child(decl, type);
         parsenode_add_child(decl, value);
+    } else if (parser_take_kind(pk, TT_LBRACKET)) {
+        decl = parsenode_new(SEA_ARRAY, name);
+        parsenode_add_child(decl, type);
+
+        parsenode_t *length;
+        if (parser_peek_kind(pk, TT_INT)) {
+            length = parsenode_new(SEA_INT, parser_take(pk));
+        } else {
+            length = parsenode_new(SEA_ERROR, parser_take(pk));
+            parsenode_set_error(length, msu_str_new("expected array length"));
+        }
+        parsenode_add_child(decl, length);
+
+        if (!parser_take_kind(pk, TT_RBRACKET)) {
+            parsenode_set_error(decl, msu_str_new("expected ']' after array length"));
+            return decl;
+        }
+
+        // the values, if any, follow the length
+        if (parser_take_kind(pk, TT_EQ)) {
+            if (!parser_take_kind(pk, TT_LBRACE)) {
+                parsenode_set_error(decl, msu_str_new("expected '{' before array values"));
+                return decl;
+            }
+            while (parser_has_next(pk) && !parser_peek_kind(pk, TT_RBRACE)) {
+                parsenode_t *value = sea_parse_expr_impl(pk);
+                if (!value) {
+                    value = parsenode_new(SEA_ERROR, parser_take(pk));
+                    parsenode_set_error(value, msu_str_new("expected array value"));
+                }
+                parsenode_add_child(decl, value);
+
+                if (!parser_take_kind(pk, TT_COMMA)) {
+                    break;
+                }
+            }
+            if (!parser_take_kind(pk, TT_RBRACE)) {
+                parsenode_set_error(decl, msu_str_new("expected '}' after array values"));
+                return decl;
+            }
+        }
+
+        if (!parser_take_kind(pk, TT_SEMICOLON)) {
+            parsenode_set_error(decl, msu_str_new("expected ';' after array"));
+        }
     } else {
         decl = parsenode_new(SEA_ERROR, parser_take(pk));
         parsenode_set_error(decl, msu_str_new("expected variable of function declaration"));
@@ -514,6 +561,10 @@ parsenode_t *sea_parse_var(parser *pk) {
 
 parsenode_t *sea_parse_assign(parser *pk);
 
+parsenode_t *sea_parse_or(parser *pk);
+
+parsenode_t *sea_parse_and(parser *pk);
+
 parsenode_t *sea_parse_cmp(parser *pk);
 
 parsenode_t *sea_parse_equality(parser *pk);
@@ -533,13 +584,55 @@ parsenode_t *sea_parse_expr_impl(parser *pk) {
 }
 
 parsenode_t *sea_parse_assign(parser *pk) {
-    parsenode_t *out = sea_parse_cmp(pk);
+    parsenode_t *out = sea_parse_or(pk);
     if (!out) return NULL;
 
     while (parser_peek_kind(pk, TT_EQ)) {
         parsenode_t *expr = parsenode_new(SEA_BINARY, parser_take(pk));
         parsenode_add_child(expr, out);
 
+        parsenode_t *rhs = sea_parse_or(pk);
+        if (!rhs) {
+            rhs = parsenode_new(TT_ERROR, parser_take(pk));
+            parsenode_set_error(rhs, msu_str_new("expected expression"));
+        }
+        parsenode_add_child(expr, rhs);
+
+        out = expr;
+    }
+
+    return out;
+}
+
+parsenode_t *sea_parse_or(parser *pk) {
+    parsenode_t *out = sea_parse_and(pk);
+    if (!out) return NULL;
+
+    while (parser_peek_kind(pk, TT_PIPE2)) {
+        parsenode_t *expr = parsenode_new(SEA_BINARY, parser_take(pk));
+        parsenode_add_child(expr, out);
+
+        parsenode_t *rhs = sea_parse_and(pk);
+        if (!rhs) {
+            rhs = parsenode_new(TT_ERROR, parser_take(pk));
+            parsenode_set_error(rhs, msu_str_new("expected expression"));
+        }
+        parsenode_add_child(expr, rhs);
+
+        out = expr;
+    }
+
+    return out;
+}
+
+parsenode_t *sea_parse_and(parser *pk) {
+    parsenode_t *out = sea_parse_cmp(pk);
+    if (!out) return NULL;
+
+    while (parser_peek_kind(pk, TT_AMP2)) {
+        parsenode_t *expr = parsenode_new(SEA_BINARY, parser_take(pk));
+        parsenode_add_child(expr, out);
+
         parsenode_t *rhs = sea_parse_cmp(pk);
         if (!rhs) {
             rhs = parsenode_new(TT_ERROR, parser_take(pk));
@@ -676,6 +769,21 @@ parsenode_t *sea_parse_call(parser *pk) {
         parsenode_add_child(expr, out);
         parsenode_add_child(expr, args);
         out = expr;
+    } else if (parser_take_kind(pk, TT_LBRACKET)) {
+        parsenode_t *index = sea_parse_expr_impl(pk);
+        if (!index) {
+            index = parsenode_new(SEA_ERROR, parser_take(pk));
+            parsenode_set_error(index, msu_str_new("expected index"));
+        }
+
+        if (!parser_take_kind(pk, TT_RBRACKET)) {
+            parsenode_set_error(out, msu_str_new("expected ']' after index"));
+        }
+
+        parsenode_t *expr = parsenode_new(SEA_INDEX, NULL);
+        parsenode_add_child(expr, out);
+        parsenode_add_child(expr, index);
+        out = expr;
     }
 
     return out;
@@ -704,11 +812,33 @@ parsenode_t *sea_parse_primary(parser *pk) {
     return NULL;
 }
 
+//======================================================
+//  Symbols
+//
+//  every name is interned once to a small id, and what the
+//  name means (the function, the global, the innermost
+//  variable) hangs off the id. a variable that shadows
+//  another remembers it and puts it back when its scope ends,
+//  so looking a name up costs one hash no matter how deep
+//  the scopes go
+//======================================================
+
+#define BT_IMPL
+#define BT_NAME sea_symbol_ids
+#define BT_KEY const msu_str_t *
+#define BT_VALUE size_t
+#define BT_HASHFUNC(x) msu_str_hash(x, 42)
+#define BT_EQFUNC msu_str_eq
+#define BT_FREE_KEY(k) msu_str_free(k)
+#include "templates/btree.h"
+#undef bt_getv
+
 typedef struct var {
-    const msu_str_t *name;
+    size_t id;
     size_t frame_offset;
-    bool is_global;
-    struct var *next;
+    const msu_str_t *cell; // a fixed cell, instead of the frame, borrowed from ctx->cells
+    struct var *next;     // declared earlier in the same scope
+    struct var *shadowed; // the variable the name meant before this one
 } var_t;
 
 typedef struct scope {
@@ -716,180 +846,444 @@ typedef struct scope {
     struct scope *parent;
 } scope_t;
 
-void var_free(var_t *var) {
-    if (var) {
-        msu_str_free(var->name);
-        free(var);
+typedef struct sea_symbol {
+    var_t *var; // innermost in scope, if any
+    const sea_funcdef_t *function;
+    size_t function_no; // its place in ctx->functions
+    const sea_var_t *global;
+    const sea_array_t *array;
+    const msu_str_t *array_cell; // its first cell, which holds the length
+} sea_symbol_t;
+
+typedef struct sea_compile_ctx {
+    sea_symbol_ids_t *ids;
+    sea_symbol_t *symbols; // by id
+    size_t symbol_count, symbol_cap;
+    const sea_funcdef_t **functions; // in the order they are defined
+    size_t n_functions;
+    const sea_var_t **globals;
+    size_t n_globals;
+    const sea_array_t **arrays;
+    size_t n_arrays;
+    asm_consts_t *constants; // emitted after the code
+    list_of_msu_strs_t *cells; // fixed cells for variables, emitted after the code
+    list_of_msu_strs_t *hidden; // names of the variables the loop optimizations add
+    sea_ast_t *ast;
+    const sea_options_t *options;
+    bool *recursive; // by function_no, whether a function can be called while it runs
+    const sea_funcdef_t *function; // being compiled
+    bool static_frame; // the current function keeps its variables in fixed cells
+    int labelno;
+    scope_t *scope;
+    size_t max_var_offset;
+    size_t imm_offset;
+    size_t var_offset;
+    size_t frame_size; // locals and params of the current function
+    const msu_str_t *return_label;
+} sea_compile_ctx;
+
+sea_compile_ctx sea_compile_ctx_new(const sea_program_t *program) {
+    sea_compile_ctx out = {
+            .ids = sea_symbol_ids_new(),
+            .symbols = NULL,
+            .symbol_count = 0,
+            .symbol_cap = 0,
+            .functions = calloc(program->len + 1, sizeof(sea_funcdef_t *)),
+            .n_functions = 0,
+            .globals = calloc(program->len + 1, sizeof(sea_var_t *)),
+            .n_globals = 0,
+            .arrays = calloc(program->len + 1, sizeof(sea_array_t *)),
+            .n_arrays = 0,
+            .constants = malloc(sizeof(asm_consts_t)),
+            .cells = list_of_msu_strs_new(),
+            .hidden = list_of_msu_strs_new(),
+            .ast = NULL,
+            .options = NULL,
+            .recursive = NULL,
+            .function = NULL,
+            .static_frame = false,
+            .labelno = 0,
+            .scope = NULL,
+            .max_var_offset = 0,
+            .imm_offset = 0,
+            .var_offset = 0,
+            .frame_size = 0,
+            .return_label = NULL,
+    };
+    assert(out.functions && out.globals && out.arrays && out.constants && "out of memory!\n");
+    asm_consts_init(out.constants);
+    return out;
+}
+
+void sea_compile_ctx_pop_scope(sea_compile_ctx *me);
+
+void sea_compile_ctx_free(sea_compile_ctx *me) {
+    while (me->scope) sea_compile_ctx_pop_scope(me);
+    if (me->constants->added) asm_consts_finish(me->constants, NULL);
+    free(me->constants);
+    list_of_msu_strs_free(me->cells, true);
+    list_of_msu_strs_free(me->hidden, true);
+    free(me->recursive);
+    free(me->functions);
+    free(me->globals);
+    free(me->arrays);
+    sea_symbol_ids_free(me->ids);
+    free(me->symbols);
+}
+
+// a context for compiling one function on its own: the program's, with its own copy of
+// the symbols to bind variables in and its own constants, cells and labels
+sea_compile_ctx sea_compile_ctx_fork(const sea_compile_ctx *program) {
+    sea_compile_ctx out = *program;
+    out.symbols = malloc((program->symbol_count + 1) * sizeof(sea_symbol_t));
+    out.constants = malloc(sizeof(asm_consts_t));
+    assert(out.symbols && out.constants && "out of memory!\n");
+    memcpy(out.symbols, program->symbols, program->symbol_count * sizeof(sea_symbol_t));
+    out.symbol_cap = program->symbol_count;
+    asm_consts_init(out.constants);
+    out.cells = list_of_msu_strs_new();
+    out.labelno = 0;
+    out.scope = NULL;
+    return out;
+}
+
+// moves the constants and cells of `fork` into `program`, in the order `fork` made them, and frees it
+void sea_compile_ctx_join(sea_compile_ctx *program, sea_compile_ctx *fork) {
+    while (fork->scope) sea_compile_ctx_pop_scope(fork);
+    for (size_t i = 0; i < fork->constants->added->len; i++) {
+        asm_consts_get(program->constants, list_of_asm_insrs_get(fork->constants->added, i)->value);
     }
+    asm_consts_finish(fork->constants, NULL);
+    free(fork->constants);
+    for (size_t i = 0; i < fork->cells->len; i++) {
+        list_of_msu_strs_append(program->cells, list_of_msu_strs_get(fork->cells, i));
+    }
+    list_of_msu_strs_free(fork->cells, false);
+    free(fork->symbols);
 }
 
-void vars_free(var_t *vars) {
-    while (vars) {
-        var_t *next = vars->next;
-        var_free(vars);
-        vars = next;
+// the symbol for `name`, interning it the first time it's seen
+sea_symbol_t *sea_compile_ctx_symbol(sea_compile_ctx *me, const msu_str_t *name, size_t *idout) {
+    size_t *id = sea_symbol_ids_getv(me->ids, name);
+    if (id) {
+        if (idout) *idout = *id;
+        return &me->symbols[*id];
+    }
+
+    if (me->symbol_count == me->symbol_cap) {
+        me->symbol_cap = me->symbol_cap ? me->symbol_cap * 2 : 32;
+        me->symbols = realloc(me->symbols, me->symbol_cap * sizeof(sea_symbol_t));
+        assert(me->symbols && "out of memory!\n");
     }
+    size_t next = me->symbol_count++;
+    me->symbols[next] = (sea_symbol_t) {0};
+    sea_symbol_ids_insert(me->ids, msu_str_clone(name), next);
+    if (idout) *idout = next;
+    return &me->symbols[next];
+}
+
+void sea_compile_ctx_push_scope(sea_compile_ctx *me) {
+    scope_t *next = malloc(sizeof(scope_t));
+    assert(next && "out of memory!\n");
+    next->vars = NULL;
+    next->parent = me->scope;
+    me->scope = next;
 }
 
-void scope_free(scope_t *scope) {
-    if (scope) {
-        vars_free(scope->vars);
+void sea_compile_ctx_pop_scope(sea_compile_ctx *me) {
+    scope_t *scope = me->scope;
+    if (!scope) return;
+    var_t *var = scope->vars;
+    while (var) {
+        var_t *next = var->next;
+        me->symbols[var->id].var = var->shadowed;
+        free(var);
+        var = next;
     }
+    me->scope = scope->parent;
+    free(scope);
 }
 
-var_t *scope_add_var(scope_t *scope, const msu_str_t *name, size_t offset, bool is_global) {
+// `cell` is where the variable lives if it doesn't live in the frame
+var_t *sea_compile_ctx_add_var(sea_compile_ctx *me, const msu_str_t *name, size_t frame_offset, const msu_str_t *cell) {
     var_t *var = malloc(sizeof(var_t));
-    var->name = msu_str_clone(name);
-    var->frame_offset = offset;
-    var->next = scope->vars;
-    var->is_global = is_global;
-    scope->vars = var;
+    assert(var && "out of memory!\n");
+    sea_symbol_t *symbol = sea_compile_ctx_symbol(me, name, &var->id);
+    var->frame_offset = frame_offset;
+    var->cell = cell;
+    var->next = me->scope->vars;
+    var->shadowed = symbol->var;
+    me->scope->vars = var;
+    symbol->var = var;
     return var;
 }
 
-var_t *scope_find_var(scope_t *scope, const msu_str_t *name) {
-    while (scope) {
-        var_t *var = scope->vars;
-        while (var) {
-            if (msu_str_eq(var->name, name)) {
-                return var;
-            }
-            var = var->next;
-        }
-        scope = scope->parent;
-    }
-    return NULL;
+var_t *sea_compile_ctx_find_var(sea_compile_ctx *me, const msu_str_t *name) {
+    size_t *id = sea_symbol_ids_getv(me->ids, name);
+    return id ? me->symbols[*id].var : NULL;
 }
 
-void scope_push(scope_t **scope) {
-    scope_t *next = malloc(sizeof(scope_t));
-    next->vars = NULL;
-    next->parent = *scope;
-    *scope = next;
+bool sea_compile_ctx_add_global(sea_compile_ctx *me, const sea_var_t *node) {
+    sea_symbol_t *symbol = sea_compile_ctx_symbol(me, node->name, NULL);
+    if (symbol->global || symbol->array) return false;
+    symbol->global = node;
+    me->globals[me->n_globals++] = node;
+    return true;
 }
 
-void scope_pop(scope_t **scope) {
-    if (*scope) {
-        scope_t *next = (*scope)->parent;
-        scope_free(*scope);
-        *scope = next;
-    }
+bool sea_compile_ctx_add_array(sea_compile_ctx *me, const sea_array_t *node) {
+    sea_symbol_t *symbol = sea_compile_ctx_symbol(me, node->name, NULL);
+    if (symbol->global || symbol->array) return false;
+    symbol->array = node;
+    me->arrays[me->n_arrays++] = node;
+    return true;
 }
 
-typedef struct constval {
-    const msu_str_t *label;
-    int value;
-    struct constval *next;
-} constval_t;
+bool sea_compile_ctx_add_function(sea_compile_ctx *me, const sea_funcdef_t *node) {
+    sea_symbol_t *symbol = sea_compile_ctx_symbol(me, node->name, NULL);
+    if (symbol->function) return false;
+    symbol->function = node;
+    symbol->function_no = me->n_functions;
+    me->functions[me->n_functions++] = node;
+    return true;
+}
 
-typedef struct sea_compile_ctx {
-    list_of_parsenodes_t *functions;
-    list_of_parsenodes_t *globals;
-    constval_t *constants;
-    int labelno;
-    scope_t *scope;
-    size_t max_var_offset;
-    size_t imm_offset;
-    size_t var_offset;
-    const msu_str_t *return_label;
-} sea_compile_ctx;
+const msu_str_t *sea_compile_ctx_ensure_constant(sea_compile_ctx *me, int value) {
+    return asm_consts_get(me->constants, value);
+}
 
-sea_compile_ctx sea_compile_ctx_new() {
-    return (sea_compile_ctx) {
-            .functions = list_of_parsenodes_new(),
-            .globals = list_of_parsenodes_new(),
-            .constants = NULL,
-            .labelno = 0,
-            .scope = NULL,
-            .max_var_offset = 0,
-            .imm_offset = 0,
-            .var_offset = 0,
-            .return_label = NULL,
-    };
+const sea_funcdef_t *sea_compile_ctx_find_function(sea_compile_ctx *ctx, const msu_str_t *name) {
+    size_t *id = sea_symbol_ids_getv(ctx->ids, name);
+    return id ? ctx->symbols[*id].function : NULL;
 }
 
-void sea_compile_ctx_add_var(sea_compile_ctx *me, const msu_str_t *name, size_t frame_offset, bool is_global) {
-    scope_add_var(me->scope, name, frame_offset, is_global);
+// a fresh fixed cell for the variable `name` of `func`
+const msu_str_t *sea_compile_ctx_new_cell(sea_compile_ctx *me, const sea_funcdef_t *func, const msu_str_t *name) {
+    const msu_str_t *cell = msu_str_printf("$%s.%s.%d", msu_str_data(func->name), msu_str_data(name), me->labelno++);
+    list_of_msu_strs_append(me->cells, cell);
+    return cell;
 }
 
-size_t sea_compile_ctx_get_var_offset(sea_compile_ctx *me, const msu_str_t *name) {
-    return me->imm_offset + scope_find_var(me->scope, name)->frame_offset;
+// a label in the function being compiled, which has labels of its own so that functions
+// can be compiled apart
+const msu_str_t *sea_compile_ctx_label(sea_compile_ctx *me, const char *kind, int labelno) {
+    return msu_str_printf("$%s.%s%d", msu_str_data(me->function->name), kind, labelno);
 }
 
-bool sea_compile_ctx_add_global(sea_compile_ctx *me, parsenode_t *node) {
-    for (int i = 0; i < me->globals->len; ++i) {
-        parsenode_t *func = list_of_parsenodes_get(me->globals, i);
-        if (msu_str_eq(func->token->content, node->token->content)) {
-            return false;
+// the function `functor` names, if it names one
+const sea_funcdef_t *sea_compile_ctx_callee(sea_compile_ctx *ctx, const sea_node_t *functor) {
+    if (functor->kind != SEA_IDENT) return NULL;
+    return sea_compile_ctx_find_function(ctx, ((const sea_ident_t *) functor)->name);
+}
+
+// calls `visit` with the place of each part of `node`, parts that are left out included
+void sea_node_visit(sea_node_t *node, void (*visit)(sea_node_t **slot, void *data), void *data) {
+    switch (node->kind) {
+        case SEA_BINARY:
+            visit(&((sea_binary_t *) node)->lhs, data);
+            visit(&((sea_binary_t *) node)->rhs, data);
+            break;
+        case SEA_UNARY:
+            visit(&((sea_unary_t *) node)->operand, data);
+            break;
+        case SEA_CALL: {
+            sea_call_t *call = (sea_call_t *) node;
+            for (size_t i = 0; i < call->n_args; i++) visit(&call->args[i], data);
+            break;
+        }
+        case SEA_INDEX:
+            visit(&((sea_index_t *) node)->index, data);
+            break;
+        case SEA_VAR:
+            visit(&((sea_var_t *) node)->value, data);
+            break;
+        case SEA_BLOCK: {
+            sea_block_t *block = (sea_block_t *) node;
+            for (size_t i = 0; i < block->len; i++) visit(&block->stmts[i], data);
+            break;
         }
+        case SEA_IF:
+            visit(&((sea_if_t *) node)->cond, data);
+            visit(&((sea_if_t *) node)->then, data);
+            visit(&((sea_if_t *) node)->else_, data);
+            break;
+        case SEA_FOR:
+        case SEA_WHILE:
+        case SEA_DO_WHILE:
+            visit(&((sea_loop_t *) node)->init, data);
+            visit(&((sea_loop_t *) node)->cond, data);
+            visit(&((sea_loop_t *) node)->incr, data);
+            visit(&((sea_loop_t *) node)->body, data);
+            break;
+        case SEA_RETURN:
+            visit(&((sea_return_t *) node)->value, data);
+            break;
+        default:
+            break;
     }
-    list_of_parsenodes_append(me->globals, node);
-    return true;
 }
 
-bool sea_compile_ctx_add_function(sea_compile_ctx *me, parsenode_t *node) {
-    for (int i = 0; i < me->functions->len; ++i) {
-        parsenode_t *func = list_of_parsenodes_get(me->functions, i);
-        if (msu_str_eq(func->token->content, node->token->content)) {
-            return false;
+//======================================================
+//  Call graph
+//
+//  a function can keep its variables in fixed cells as long
+//  as it can't be called again before it returns, that is
+//  as long as it isn't on a cycle of calls. the cycles are
+//  the strongly connected components of the call graph
+//======================================================
+
+typedef struct sea_calls {
+    size_t *to; // function numbers
+    size_t len, cap;
+} sea_calls_t;
+
+void sea_calls_add(sea_calls_t *calls, size_t to) {
+    if (calls->len == calls->cap) {
+        calls->cap = calls->cap ? calls->cap * 2 : 4;
+        calls->to = realloc(calls->to, calls->cap * sizeof(size_t));
+        assert(calls->to && "out of memory!\n");
+    }
+    calls->to[calls->len++] = to;
+}
+
+void sea_find_calls(sea_compile_ctx *ctx, const sea_node_t *node, sea_calls_t *calls) {
+    if (!node) return;
+    switch (node->kind) {
+        case SEA_FUNCDEF:
+            sea_find_calls(ctx, ((const sea_funcdef_t *) node)->body, calls);
+            break;
+        case SEA_VAR:
+            sea_find_calls(ctx, ((const sea_var_t *) node)->value, calls);
+            break;
+        case SEA_BLOCK: {
+            const sea_block_t *block = (const sea_block_t *) node;
+            for (size_t i = 0; i < block->len; i++) sea_find_calls(ctx, block->stmts[i], calls);
+            break;
         }
+        case SEA_IF: {
+            const sea_if_t *if_ = (const sea_if_t *) node;
+            sea_find_calls(ctx, if_->cond, calls);
+            sea_find_calls(ctx, if_->then, calls);
+            sea_find_calls(ctx, if_->else_, calls);
+            break;
+        }
+        case SEA_FOR:
+        case SEA_WHILE:
+        case SEA_DO_WHILE: {
+            const sea_loop_t *loop = (const sea_loop_t *) node;
+            sea_find_calls(ctx, loop->init, calls);
+            sea_find_calls(ctx, loop->cond, calls);
+            sea_find_calls(ctx, loop->incr, calls);
+            sea_find_calls(ctx, loop->body, calls);
+            break;
+        }
+        case SEA_RETURN:
+            sea_find_calls(ctx, ((const sea_return_t *) node)->value, calls);
+            break;
+        case SEA_BINARY:
+            sea_find_calls(ctx, ((const sea_binary_t *) node)->lhs, calls);
+            sea_find_calls(ctx, ((const sea_binary_t *) node)->rhs, calls);
+            break;
+        case SEA_UNARY:
+            sea_find_calls(ctx, ((const sea_unary_t *) node)->operand, calls);
+            break;
+        case SEA_INDEX:
+            sea_find_calls(ctx, ((const sea_index_t *) node)->index, calls);
+            break;
+        case SEA_CALL: {
+            const sea_call_t *call = (const sea_call_t *) node;
+            const sea_funcdef_t *callee = sea_compile_ctx_callee(ctx, call->functor);
+            if (callee) {
+                sea_calls_add(calls, ctx->symbols[*sea_symbol_ids_getv(ctx->ids, callee->name)].function_no);
+            }
+            for (size_t i = 0; i < call->n_args; i++) sea_find_calls(ctx, call->args[i], calls);
+            break;
+        }
+        default:
+            break;
     }
-    list_of_parsenodes_append(me->functions, node);
-    return true;
 }
 
-const msu_str_t *sea_compile_ctx_ensure_constant(sea_compile_ctx *me, int value) {
-    constval_t *val = me->constants;
-    while (val) {
-        if (val->value) return val->label;
-        val = val->next;
+typedef struct sea_tarjan {
+    const sea_calls_t *calls;
+    size_t *index, *low; // index 0 is unvisited
+    size_t *stack, len, next;
+    bool *on_stack, *recursive;
+} sea_tarjan_t;
+
+void sea_tarjan_visit(sea_tarjan_t *t, size_t v) {
+    t->index[v] = t->low[v] = ++t->next;
+    t->stack[t->len++] = v;
+    t->on_stack[v] = true;
+
+    for (size_t i = 0; i < t->calls[v].len; i++) {
+        size_t w = t->calls[v].to[i];
+        if (w == v) t->recursive[v] = true;
+        if (!t->index[w]) {
+            sea_tarjan_visit(t, w);
+            if (t->low[w] < t->low[v]) t->low[v] = t->low[w];
+        } else if (t->on_stack[w] && t->index[w] < t->low[v]) {
+            t->low[v] = t->index[w];
+        }
     }
 
-    val = malloc(sizeof(constval_t));
-    val->label = msu_str_printf("$%d", value);
-    val->value = value;
-    val->next = me->constants;
-    me->constants = val;
-    return val->label;
+    if (t->low[v] != t->index[v]) return;
+    size_t start = t->len;
+    do {
+        t->on_stack[t->stack[--start]] = false;
+    } while (t->stack[start] != v);
+    for (size_t i = start; i < t->len && t->len - start > 1; i++) t->recursive[t->stack[i]] = true;
+    t->len = start;
 }
 
-const parsenode_t *sea_compile_ctx_find_function(sea_compile_ctx *ctx, const msu_str_t *name) {
-    for (int i = 0; i < ctx->functions->len; ++i) {
-        const parsenode_t *func = list_of_parsenodes_get(ctx->functions, i);
-        if (msu_str_eq(func->token->content, name)) {
-            return func;
-        }
+// fills in ctx->recursive
+void sea_compile_ctx_find_recursion(sea_compile_ctx *ctx) {
+    size_t n = ctx->n_functions;
+    sea_calls_t *calls = calloc(n + 1, sizeof(sea_calls_t));
+    sea_tarjan_t t = {
+        .calls = calls,
+        .index = calloc(n + 1, sizeof(size_t)),
+        .low = calloc(n + 1, sizeof(size_t)),
+        .stack = calloc(n + 1, sizeof(size_t)),
+        .on_stack = calloc(n + 1, sizeof(bool)),
+        .recursive = calloc(n + 1, sizeof(bool)),
+    };
+    assert(calls && t.index && t.low && t.stack && t.on_stack && t.recursive && "out of memory!\n");
+
+    for (size_t i = 0; i < n; i++) {
+        sea_find_calls(ctx, &ctx->functions[i]->base, &calls[i]);
     }
-    return NULL;
+    for (size_t i = 0; i < n; i++) {
+        if (!t.index[i]) sea_tarjan_visit(&t, i);
+    }
+
+    for (size_t i = 0; i < n; i++) free(calls[i].to);
+    free(calls);
+    free(t.index);
+    free(t.low);
+    free(t.stack);
+    free(t.on_stack);
+    ctx->recursive = t.recursive;
 }
 
-bool sea_function_always_returns(const parsenode_t *node) {
-    if (node->kind == SEA_FUNCDEF) {
-        parsenode_t *block = list_of_parsenodes_get(node->children, 2);
-        return sea_function_always_returns(block);
+bool sea_function_always_returns(const sea_node_t *node) {
+    if (!node) {
+        return false;
+    } else if (node->kind == SEA_FUNCDEF) {
+        return sea_function_always_returns(((const sea_funcdef_t *) node)->body);
     } else if (node->kind == SEA_BLOCK) {
-        for (int i = 0; i < node->children->len; ++i) {
-            if (sea_function_always_returns(list_of_parsenodes_get(node->children, i))) {
+        const sea_block_t *block = (const sea_block_t *) node;
+        for (size_t i = 0; i < block->len; ++i) {
+            if (sea_function_always_returns(block->stmts[i])) {
                 return true;
             }
         }
         return false;
     } else if (node->kind == SEA_IF) {
-        parsenode_t *then_body = list_of_parsenodes_get(node->children, 1);
-        parsenode_t *else_body = list_of_parsenodes_get(node->children, 2);
-
-        bool then_returns = sea_function_always_returns(then_body);
-        bool else_returns = else_body == NULL ? false : sea_function_always_returns(else_body);
-        return then_returns && else_returns;
-    } else if (node->kind == SEA_FOR) {
-        parsenode_t *body = list_of_parsenodes_get(node->children, 3);
-        return sea_function_always_returns(body);
-    } else if (node->kind == SEA_WHILE) {
-        parsenode_t *body = list_of_parsenodes_get(node->children, 1);
-        return sea_function_always_returns(body);
-    } else if (node->kind == SEA_DO_WHILE) {
-        parsenode_t *body = list_of_parsenodes_get(node->children, 0);
-        return sea_function_always_returns(body);
+        const sea_if_t *if_ = (const sea_if_t *) node;
+        return sea_function_always_returns(if_->then) && sea_function_always_returns(if_->else_);
+    } else if (node->kind == SEA_FOR || node->kind == SEA_WHILE || node->kind == SEA_DO_WHILE) {
+        return sea_function_always_returns(((const sea_loop_t *) node)->body);
     } else if (node->kind == SEA_RETURN) {
         return true;
     } else {
@@ -897,45 +1291,32 @@ bool sea_function_always_returns(const parsenode_t *node) {
     }
 }
 
-size_t sea_count_max_locals(const parsenode_t *node) {
+size_t sea_count_max_locals(const sea_node_t *node) {
+    if (!node) {
+        return 0;
+    }
+
     if (node->kind == SEA_BLOCK) {
+        const sea_block_t *block = (const sea_block_t *) node;
         size_t locals = 0;
-        for (int i = 0; i < node->children->len; ++i) {
-            const parsenode_t *child = list_of_parsenodes_get_const(node->children, i);
-            locals += sea_count_max_locals(child);
+        for (size_t i = 0; i < block->len; ++i) {
+            locals += sea_count_max_locals(block->stmts[i]);
         }
         return locals;
     }
 
     if (node->kind == SEA_IF) {
-        const parsenode_t *then_body = list_of_parsenodes_get_const(node->children, 1);
-        const parsenode_t *else_body = list_of_parsenodes_get_const(node->children, 2);
-
-        size_t then_body_size = sea_count_max_locals(then_body);
-        size_t else_body_size = else_body == NULL ? 0 : sea_count_max_locals(else_body);
-        return then_body_size + else_body_size;
+        const sea_if_t *if_ = (const sea_if_t *) node;
+        return sea_count_max_locals(if_->then) + sea_count_max_locals(if_->else_);
     }
 
     if (node->kind == SEA_FOR) {
-        size_t locals = 0;
-
-        const parsenode_t *init = list_of_parsenodes_get(node->children, 0);
-        if (init) locals += 1;
-
-        const parsenode_t *body = list_of_parsenodes_get(node->children, 3);
-        locals += sea_count_max_locals(body);
-
-        return locals;
-    }
-
-    if (node->kind == SEA_WHILE) {
-        const parsenode_t *body = list_of_parsenodes_get(node->children, 1);
-        return sea_count_max_locals(body);
+        const sea_loop_t *loop = (const sea_loop_t *) node;
+        return (loop->init ? 1 : 0) + sea_count_max_locals(loop->body);
     }
 
-    if (node->kind == SEA_DO_WHILE) {
-        const parsenode_t *body = list_of_parsenodes_get(node->children, 0);
-        return sea_count_max_locals(body);
+    if (node->kind == SEA_WHILE || node->kind == SEA_DO_WHILE) {
+        return sea_count_max_locals(((const sea_loop_t *) node)->body);
     }
 
     if (node->kind == SEA_VAR) {
@@ -955,405 +1336,1557 @@ sea_error_t *sea_error_new(const parsenode_t *node, const msu_str_t *msg) {
     return out;
 }
 
-void sea_compile_impl(const parsenode_t *node, sea_compile_ctx *ctx, msu_str_builder_t out, sea_error_t **errout) {
-    if (node->kind == SEA_PROGRAM) {
-        msu_str_builder_pushs(out, "CALL main\nHLT\n");
+void sea_compile_impl(const sea_node_t *node, sea_compile_ctx *ctx, asm_builder_t *out, sea_error_t **errout);
 
-        for (int i = 0; i < ctx->globals->len; i++) {
-            parsenode_t *global = list_of_parsenodes_get(ctx->globals, i);
-            parsenode_print(global);
-            assert(false && "unimplemented");
-        }
-
-        for (int i = 0; i < ctx->functions->len; ++i) {
-            parsenode_t *func = list_of_parsenodes_get(ctx->functions, i);
+bool sea_ir_is_pure(const sea_node_t *node, size_t *count);
 
-            if (!sea_function_always_returns(func)) {
-                *errout = sea_error_new(func, msu_str_printf("function '%s' does not always return",
-                                                             msu_str_data(func->token->content)));
-                return;
-            }
+// whether `value` is a call whose result can be returned as it is
+bool sea_is_tail_call(sea_compile_ctx *ctx, const sea_node_t *value) {
+    if (value->kind != SEA_CALL) return false;
+    const sea_call_t *call = (const sea_call_t *) value;
+    const sea_funcdef_t *func = sea_compile_ctx_callee(ctx, call->functor);
+    return func && func->returns_int && call->n_args == func->n_params;
+}
 
-            msu_str_builder_printf(out, "%s ", msu_str_data(func->token->content));
+// pushes the value of `var`
+void sea_compile_load(const var_t *var, sea_compile_ctx *ctx, asm_builder_t *out) {
+    if (var->cell) {
+        asm_builder_op_ref(out, "LDA", var->cell);
+        asm_builder_op(out, "SPUSH");
+    } else {
+        asm_builder_op_value(out, "SLDA", (int) (ctx->imm_offset + var->frame_offset));
+    }
+    ctx->imm_offset += 1;
+}
 
-            const parsenode_t *ret = list_of_parsenodes_get(func->children, 0);
-            const parsenode_t *params = list_of_parsenodes_get(func->children, 1);
-            const parsenode_t *body = list_of_parsenodes_get(func->children, 2);
+// pops into `var`
+void sea_compile_store(const var_t *var, sea_compile_ctx *ctx, asm_builder_t *out) {
+    ctx->imm_offset -= 1;
+    if (var->cell) {
+        asm_builder_op(out, "SPOP");
+        asm_builder_op_ref(out, "STA", var->cell);
+    } else {
+        asm_builder_op_value(out, "SSTA", (int) (ctx->imm_offset + var->frame_offset));
+    }
+}
 
-            size_t locals = sea_count_max_locals(body);
-            ctx->scope = NULL;
-            scope_push(&ctx->scope);
-            ctx->max_var_offset = locals;
-            ctx->imm_offset = 0;
-            ctx->var_offset = 0;
-            ctx->return_label = msu_str_printf("$ret.%s", msu_str_data(func->token->content));
+// the error for `name`, which isn't a variable in scope
+sea_error_t *sea_undefined_variable(sea_compile_ctx *ctx, const sea_node_t *node, const msu_str_t *name) {
+    size_t *id = sea_symbol_ids_getv(ctx->ids, name);
+    if (id && ctx->symbols[*id].array) {
+        return sea_error_new(node->src, msu_str_printf("array '%s' has to be indexed", msu_str_data(name)));
+    }
+    return sea_error_new(node->src, msu_str_printf("undefined variable '%s'", msu_str_data(name)));
+}
 
-            if (locals > 0) {
-                msu_str_builder_printf(out, "SPSUB %zu\n", locals - 1);
-            }
+// the first cell of the array `node` indexes. an index known before the program runs is
+// checked here, any other by SLDX and SSTX when it runs
+const msu_str_t *sea_compile_array_cell(const sea_index_t *node, sea_compile_ctx *ctx, sea_error_t **errout) {
+    if (node->array->kind != SEA_IDENT) {
+        *errout = sea_error_new(node->array->src, msu_str_new("array name must be an identifier"));
+        return NULL;
+    }
+    const msu_str_t *name = ((const sea_ident_t *) node->array)->name;
+    size_t *id = sea_symbol_ids_getv(ctx->ids, name);
+    const sea_symbol_t *symbol = id ? &ctx->symbols[*id] : NULL;
+    if (symbol && symbol->var) {
+        *errout = sea_error_new(node->array->src, msu_str_printf("'%s' is not an array", msu_str_data(name)));
+        return NULL;
+    }
+    if (!symbol || !symbol->array) {
+        *errout = sea_error_new(node->array->src, msu_str_printf("undefined array '%s'", msu_str_data(name)));
+        return NULL;
+    }
 
-            for (int j = 0; j < params->children->len; ++j) {
-                const parsenode_t *param = list_of_parsenodes_get(params->children, j);
-                size_t offset = locals + params->children->len - j;
-                scope_add_var(ctx->scope, param->token->content, offset, false);
-            }
+    const sea_array_t *array = symbol->array;
+    if (node->index->kind == SEA_INT) {
+        int index = ((const sea_int_t *) node->index)->value;
+        if (index >= array->length) {
+            *errout = sea_error_new(node->index->src, msu_str_printf("index %d is past the end of '%s[%d]'", index,
+                                                                     msu_str_data(name), array->length));
+            return NULL;
+        }
+    }
+    return symbol->array_cell;
+}
 
-            sea_compile_impl(body, ctx, out, errout);
-            if (*errout) return;
+// a global's initial value, which has to be known before the program runs
+bool sea_constant_value(const sea_node_t *node, int *value) {
+    if (!node) {
+        *value = 0;
+        return true;
+    }
+    if (node->kind == SEA_UNARY && ((const sea_unary_t *) node)->op == SEA_OP_NEG) {
+        if (!sea_constant_value(((const sea_unary_t *) node)->operand, value)) return false;
+        *value = -*value;
+        return true;
+    }
+    if (node->kind == SEA_INT) {
+        *value = ((const sea_int_t *) node)->value;
+        return true;
+    }
+    return false;
+}
 
-            msu_str_builder_printf(out, "%s ", msu_str_data(ctx->return_label));
+// `return f(...)`: the arguments are moved down over this frame, which is dropped before
+// the call, so `CALL f; RPOP; RET` is all that's left and the optimizer makes it a jump
+void sea_compile_tail_call(const sea_call_t *call, sea_compile_ctx *ctx, asm_builder_t *out, sea_error_t **errout) {
+    size_t drop = ctx->frame_size + ctx->imm_offset;
 
-            if (msu_str_eqs(ret->token->content, "int")) {
-                msu_str_builder_printf(out, "SPOP\n");
-                if (locals > 0) {
-                    msu_str_builder_printf(out, "SPADD %zu\n", locals + params->children->len - 1);
-                }
-                ctx->imm_offset -= 1;
-            } else {
-                if (locals > 0) {
-                    msu_str_builder_printf(out, "SPADD %zu\n", locals + params->children->len - 1);
-                }
-            }
-            assert(ctx->imm_offset == 0);
-            msu_str_builder_pushs(out, "RET\n");
+    for (size_t i = 0; i < call->n_args; ++i) {
+        sea_compile_impl(call->args[i], ctx, out, errout);
+        if (*errout) return;
+    }
 
-            msu_str_free(ctx->return_label);
-            scope_pop(&ctx->scope);
+    if (drop > 0) {
+        // deepest first, a copy can only overwrite arguments that were already moved
+        for (size_t i = call->n_args; i > 0; i--) {
+            asm_builder_op_value(out, "SLDA", (int) (i - 1));
+            asm_builder_op_value(out, "SSTA", (int) (i - 1 + drop));
         }
+        asm_builder_op_value(out, "SPADD", (int) drop - 1);
+    }
 
-        for (int i = 0; i < ctx->globals->len; i++) {
-            parsenode_t *global = list_of_parsenodes_get(ctx->globals, i);
-            const msu_str_t *name = global->token->content;
-            msu_str_builder_printf(out, "$global.%s DAT 0\n", name);
-        }
-    } else if (node->kind == SEA_BLOCK) {
-        scope_push(&ctx->scope);
-        for (int i = 0; i < node->children->len; ++i) {
-            const parsenode_t *child = list_of_parsenodes_get_const(node->children, i);
-            sea_compile_impl(child, ctx, out, errout);
-            if (*errout) return;
-        }
-        scope_pop(&ctx->scope);
-    } else if (node->kind == SEA_FOR) {
-        const parsenode_t *init = list_of_parsenodes_get(node->children, 0);
-        const parsenode_t *cond = list_of_parsenodes_get(node->children, 1);
-        const parsenode_t *incr = list_of_parsenodes_get(node->children, 2);
-        const parsenode_t *body = list_of_parsenodes_get(node->children, 3);
+    ctx->imm_offset -= call->n_args;
+    asm_builder_op_ref(out, "CALL", ((const sea_ident_t *) call->functor)->name);
+    asm_builder_op(out, "RPOP");
+    asm_builder_op(out, "RET");
+}
 
-        int labelno = ctx->labelno++;
-        const msu_str_t *cont = msu_str_printf("$for.cond%d", labelno);
-        const msu_str_t *end = msu_str_printf("$for.end%d", labelno);
+void sea_compile_function(size_t i, sea_compile_ctx *ctx, asm_builder_t *out, sea_error_t **errout) {
+    const sea_funcdef_t *func = ctx->functions[i];
 
-        if (init) {
-            sea_compile_impl(init, ctx, out, errout);
-            if (*errout) return;
-        }
+    if (!sea_function_always_returns(&func->base)) {
+        *errout = sea_error_new(func->base.src, msu_str_printf("function '%s' does not always return",
+                                                               msu_str_data(func->name)));
+        return;
+    }
 
-        msu_str_builder_printf(out, "%s ", msu_str_data(cont));
+    asm_builder_label(out, func->name);
 
-        if (cond) {
-            sea_compile_impl(cond, ctx, out, errout);
-            if (*errout) return;
-        } else {
-            msu_str_builder_printf(out, "LDI 1\n");
-        }
+    // the variables of a function that can't be running twice at once get fixed
+    // cells, which the optimizer can keep in the accumulator. the parameters are
+    // pushed by the caller, they stay where they are
+    ctx->function = func;
+    ctx->static_frame = ctx->options->static_locals && !ctx->recursive[i];
+    size_t locals = ctx->static_frame ? 0 : sea_count_max_locals(func->body);
+    sea_compile_ctx_push_scope(ctx);
+    ctx->max_var_offset = locals;
+    ctx->imm_offset = 0;
+    ctx->var_offset = 0;
+    ctx->frame_size = locals + func->n_params;
+    ctx->return_label = msu_str_printf("$ret.%s", msu_str_data(func->name));
 
-        msu_str_builder_printf(out, "SPOP\n");
-        ctx->imm_offset -= 1;
-        msu_str_builder_printf(out, "BRZ %s\n", msu_str_data(end));
-        sea_compile_impl(body, ctx, out, errout);
+    // the caller's return address, the optimizer leaves it out of functions that don't call
+    asm_builder_op(out, "RPUSH");
+    if (locals > 0) {
+        asm_builder_op_value(out, "SPSUB", (int) locals - 1);
+    }
 
-        if (incr) {
-            sea_compile_impl(incr, ctx, out, errout);
-            if (*errout) return;
+    for (size_t j = 0; j < func->n_params; ++j) {
+        sea_compile_ctx_add_var(ctx, func->params[j], ctx->frame_size - 1 - j, NULL);
+    }
+
+    sea_compile_impl(func->body, ctx, out, errout);
+    if (!*errout) {
+        // the value of a return is on the stack here, it comes back in the accumulator
+        asm_builder_label(out, ctx->return_label);
+        if (func->returns_int) {
+            asm_builder_op(out, "SPOP");
+        }
+        if (ctx->frame_size > 0) {
+            asm_builder_op_value(out, "SPADD", (int) ctx->frame_size - 1);
         }
-        msu_str_builder_printf(out, "BRA %s\n", msu_str_data(cont));
+        assert(ctx->imm_offset == 0);
+        asm_builder_op(out, "RPOP");
+        asm_builder_op(out, "RET");
+    }
 
-        const msu_str_t *label0 = sea_compile_ctx_ensure_constant(ctx, 0);
-        msu_str_builder_printf(out, "%s ADD %s\n", msu_str_data(end), msu_str_data(label0));
+    msu_str_free(ctx->return_label);
+    sea_compile_ctx_pop_scope(ctx);
+}
 
-        msu_str_free(cont);
-        msu_str_free(end);
-    } else if (node->kind == SEA_WHILE) {
-        const parsenode_t *cond = list_of_parsenodes_get(node->children, 0);
-        const parsenode_t *body = list_of_parsenodes_get(node->children, 1);
+// every name a function declares is interned before the functions are compiled, so
+// compiling only reads ctx->ids
+void sea_compile_ctx_intern(sea_node_t **slot, void *data) {
+    if (!*slot) return;
+    if ((*slot)->kind == SEA_VAR) sea_compile_ctx_symbol(data, ((sea_var_t *) *slot)->name, NULL);
+    sea_node_visit(*slot, sea_compile_ctx_intern, data);
+}
 
-        int labelno = ctx->labelno++;
-        const msu_str_t *cont = msu_str_printf("$while.cond%d", labelno);
-        const msu_str_t *end = msu_str_printf("$while.end%d", labelno);
+typedef struct sea_function_job {
+    sea_compile_ctx ctx; // forked from the program's
+    list_of_asm_insrs_t *insrs;
+    sea_error_t *err;
+} sea_function_job_t;
+
+typedef struct sea_compile_job {
+    sea_function_job_t *functions; // by function_no
+    size_t len, next;
+    pthread_mutex_t lock;
+} sea_compile_job_t;
+
+void sea_compile_function_job(sea_compile_job_t *job, size_t i) {
+    sea_function_job_t *function = &job->functions[i];
+    asm_builder_t *out = asm_builder_new();
+    sea_compile_function(i, &function->ctx, out, &function->err);
+    if (function->err) {
+        asm_builder_free(out);
+    } else {
+        function->insrs = asm_builder_finish(out);
+    }
+}
 
-        msu_str_builder_printf(out, "%s ", msu_str_data(cont));
-        sea_compile_impl(cond, ctx, out, errout);
-        if (*errout) return;
-        msu_str_builder_printf(out, "SPOP\n");
-        ctx->imm_offset -= 1;
-        msu_str_builder_printf(out, "BRZ %s\n", msu_str_data(end));
+void *sea_compile_worker(void *arg) {
+    sea_compile_job_t *job = arg;
+    while (true) {
+        pthread_mutex_lock(&job->lock);
+        size_t i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (i >= job->len) return NULL;
+        sea_compile_function_job(job, i);
+    }
+}
 
-        sea_compile_impl(body, ctx, out, errout);
-        if (*errout) return;
-        msu_str_builder_printf(out, "BRA %s\n", msu_str_data(cont));
+// compiles each function apart, on up to options->threads threads, and puts them together
+// in the order they're defined, so the code is the same however many threads there are
+void sea_compile_functions(sea_compile_ctx *ctx, asm_builder_t *out, sea_error_t **errout) {
+    for (size_t i = 0; i < ctx->n_functions; i++) {
+        const sea_funcdef_t *func = ctx->functions[i];
+        for (size_t j = 0; j < func->n_params; j++) sea_compile_ctx_symbol(ctx, func->params[j], NULL);
+        sea_compile_ctx_intern((sea_node_t **) &func->body, ctx);
+    }
+
+    sea_compile_job_t job = {.functions = calloc(ctx->n_functions + 1, sizeof(sea_function_job_t)),
+                             .len = ctx->n_functions};
+    assert(job.functions && "out of memory!\n");
+    for (size_t i = 0; i < job.len; i++) job.functions[i].ctx = sea_compile_ctx_fork(ctx);
+
+    int threads = ctx->options->threads < (int) job.len ? ctx->options->threads : (int) job.len;
+    if (threads > 1) {
+        pthread_t *workers = malloc(threads * sizeof(pthread_t));
+        assert(workers && "out of memory!\n");
+        pthread_mutex_init(&job.lock, NULL);
+        int started = 0;
+        while (started < threads && pthread_create(&workers[started], NULL, sea_compile_worker, &job) == 0) started++;
+        // short of threads, this one takes what the others haven't from the same queue
+        if (started < threads) sea_compile_worker(&job);
+        for (int t = 0; t < started; t++) pthread_join(workers[t], NULL);
+        pthread_mutex_destroy(&job.lock);
+        free(workers);
+    } else {
+        for (size_t i = 0; i < job.len; i++) sea_compile_function_job(&job, i);
+    }
 
-        const msu_str_t *label0 = sea_compile_ctx_ensure_constant(ctx, 0);
-        msu_str_builder_printf(out, "%s ADD %s\n", msu_str_data(end), msu_str_data(label0));
+    for (size_t i = 0; i < job.len; i++) {
+        sea_function_job_t *function = &job.functions[i];
+        sea_compile_ctx_join(ctx, &function->ctx);
+        if (function->err && !*errout) {
+            *errout = function->err;
+        } else {
+            sea_error_free(function->err);
+        }
+        if (function->insrs) asm_builder_append(out, function->insrs);
+    }
+    free(job.functions);
+}
 
-        msu_str_free(cont);
-        msu_str_free(end);
-    } else if (node->kind == SEA_DO_WHILE) {
-        const parsenode_t *body = list_of_parsenodes_get(node->children, 0);
-        const parsenode_t *cond = list_of_parsenodes_get(node->children, 1);
+void sea_compile_program(sea_compile_ctx *ctx, asm_builder_t *out, sea_error_t **errout) {
+    const msu_str_t *main_label = msu_str_new("main");
+    asm_builder_op_ref(out, "CALL", main_label);
+    asm_builder_op(out, "HLT");
+    msu_str_free(main_label);
+
+    // globals are in scope everywhere, each in its own cell
+    list_of_msu_strs_t *global_cells = list_of_msu_strs_new();
+    sea_compile_ctx_push_scope(ctx);
+    for (size_t i = 0; i < ctx->n_globals; i++) {
+        const msu_str_t *cell = msu_str_printf("$global.%s", msu_str_data(ctx->globals[i]->name));
+        list_of_msu_strs_append(global_cells, cell);
+        sea_compile_ctx_add_var(ctx, ctx->globals[i]->name, 0, cell);
+    }
+    // arrays too, each a cell with its length and then one for each element
+    for (size_t i = 0; i < ctx->n_arrays; i++) {
+        const msu_str_t *cell = msu_str_printf("$global.%s", msu_str_data(ctx->arrays[i]->name));
+        list_of_msu_strs_append(global_cells, cell);
+        sea_compile_ctx_symbol(ctx, ctx->arrays[i]->name, NULL)->array_cell = cell;
+    }
+    if (ctx->options->static_locals) sea_compile_ctx_find_recursion(ctx);
+
+    sea_compile_functions(ctx, out, errout);
+
+    for (size_t i = 0; i < ctx->n_globals && !*errout; i++) {
+        const sea_var_t *global = ctx->globals[i];
+        int value;
+        if (!sea_constant_value(global->value, &value)) {
+            *errout = sea_error_new(global->base.src, msu_str_printf("global '%s' must start as a constant",
+                                                                     msu_str_data(global->name)));
+            break;
+        }
+        asm_builder_label(out, list_of_msu_strs_get(global_cells, i));
+        asm_builder_op_value(out, "DAT", value);
+    }
+    for (size_t i = 0; i < ctx->n_arrays && !*errout; i++) {
+        const sea_array_t *array = ctx->arrays[i];
+        if (array->length < 1) {
+            *errout = sea_error_new(array->base.src, msu_str_printf("array '%s' must have at least one element",
+                                                                    msu_str_data(array->name)));
+            break;
+        }
+        if ((size_t) array->length < array->n_values) {
+            *errout = sea_error_new(array->base.src, msu_str_printf("too many values for '%s[%d]'",
+                                                                    msu_str_data(array->name), array->length));
+            break;
+        }
+        asm_builder_label(out, list_of_msu_strs_get(global_cells, ctx->n_globals + i));
+        asm_builder_op_value(out, "DAT", array->length);
+        for (int j = 0; j < array->length && !*errout; j++) {
+            int value = 0;
+            if ((size_t) j < array->n_values && !sea_constant_value(array->values[j], &value)) {
+                *errout = sea_error_new(array->values[j]->src, msu_str_printf("values of '%s' must be constants",
+                                                                              msu_str_data(array->name)));
+            }
+            asm_builder_op_value(out, "DAT", value);
+        }
+    }
+    for (size_t i = 0; i < ctx->cells->len && !*errout; i++) {
+        asm_builder_label(out, list_of_msu_strs_get(ctx->cells, i));
+        asm_builder_op_value(out, "DAT", 0);
+    }
+    sea_compile_ctx_pop_scope(ctx);
+    list_of_msu_strs_free(global_cells, true);
+}
 
-        int labelno = ctx->labelno++;
-        const msu_str_t *start = msu_str_printf("$dowhile.start%d\n", labelno);
-        const msu_str_t *end = msu_str_printf("$dowhile.end%d\n", labelno);
+// jumps to `target` if the accumulator isn't zero
+void sea_compile_branch_nonzero(const msu_str_t *target, sea_compile_ctx *ctx, asm_builder_t *out) {
+    const msu_str_t *skip = sea_compile_ctx_label(ctx, "cond.skip", ctx->labelno++);
+    asm_builder_op_ref(out, "BRZ", skip);
+    asm_builder_op_ref(out, "BRA", target);
+    asm_builder_label(out, skip);
+    asm_builder_op_ref(out, "ADD", sea_compile_ctx_ensure_constant(ctx, 0));
+    msu_str_free(skip);
+}
 
-        const msu_str_t *label0 = sea_compile_ctx_ensure_constant(ctx, 0);
-        msu_str_builder_printf(out, "%s ADD %s\n", msu_str_data(start), msu_str_data(label0));
+// the comparison that's true when `op` is false
+bool sea_negate_compare(sea_op_t op, sea_op_t *out) {
+    switch (op) {
+        case SEA_OP_GT: *out = SEA_OP_LE; return true;
+        case SEA_OP_GE: *out = SEA_OP_LT; return true;
+        case SEA_OP_LT: *out = SEA_OP_GE; return true;
+        case SEA_OP_LE: *out = SEA_OP_GT; return true;
+        case SEA_OP_EQ: *out = SEA_OP_NE; return true;
+        case SEA_OP_NE: *out = SEA_OP_EQ; return true;
+        default: return false;
+    }
+}
 
-        sea_compile_impl(body, ctx, out, errout);
+// branches to `target` if `lhs op rhs`, on the difference of the operands in the accumulator
+// rather than a 0 or 1: a >= b is BRP on a - b, a > b is BRP on a - b - 1, and < and <= are
+// those with the operands the other way around. capping keeps the sign, so this can't overflow
+void sea_compile_compare_branch(const sea_binary_t *cmp, sea_op_t op, const msu_str_t *target,
+                                sea_compile_ctx *ctx, asm_builder_t *out, sea_error_t **errout) {
+    bool swap = op == SEA_OP_LT || op == SEA_OP_LE;
+    bool minus = op == SEA_OP_GT || op == SEA_OP_LT;
+    const sea_node_t *first = swap ? cmp->rhs : cmp->lhs, *second = swap ? cmp->lhs : cmp->rhs;
+
+    // the 1 goes into a constant operand when there is one, a > 4 is a - 5 >= 0
+    sea_int_t folded = {.base = {.kind = SEA_INT}};
+    if (minus && second->kind == SEA_INT && ((const sea_int_t *) second)->value < 99) {
+        folded.base.src = second->src;
+        folded.value = ((const sea_int_t *) second)->value + 1;
+        second = &folded.base;
+        minus = false;
+    } else if (minus && first->kind == SEA_INT && ((const sea_int_t *) first)->value > 0) {
+        folded.base.src = first->src;
+        folded.value = ((const sea_int_t *) first)->value - 1;
+        first = &folded.base;
+        minus = false;
+    }
+
+    size_t count = 0;
+    if (!swap || (sea_ir_is_pure(first, &count) && sea_ir_is_pure(second, &count))) {
+        sea_binary_t diff = {.base = {.kind = SEA_BINARY, .src = cmp->base.src}, .op = SEA_OP_SUB,
+                             .lhs = (sea_node_t *) first, .rhs = (sea_node_t *) second};
+        sea_compile_impl(&diff.base, ctx, out, errout);
+        if (*errout) return;
+    } else {
+        // side effects still happen in the order they're written
+        sea_compile_impl(second, ctx, out, errout);
         if (*errout) return;
-        sea_compile_impl(cond, ctx, out, errout);
+        sea_compile_impl(first, ctx, out, errout);
         if (*errout) return;
-
-        msu_str_builder_printf(out, "SPOP\n");
+        asm_builder_op(out, "SSWAP");
+        asm_builder_op(out, "SSUB");
         ctx->imm_offset -= 1;
-        msu_str_builder_printf(out, "BRZ %s\n", msu_str_data(end));
-        msu_str_builder_printf(out, "BRA %s\n", msu_str_data(start));
+    }
+    asm_builder_op(out, "SPOP");
+    ctx->imm_offset -= 1;
+    if (minus) asm_builder_op_ref(out, "SUB", sea_compile_ctx_ensure_constant(ctx, 1));
+
+    if (op == SEA_OP_EQ) {
+        asm_builder_op_ref(out, "BRZ", target);
+    } else if (op == SEA_OP_NE) {
+        sea_compile_branch_nonzero(target, ctx, out);
+    } else {
+        asm_builder_op_ref(out, "BRP", target);
+    }
+}
+
+// branches to `target` if `cond` is `when` and falls through if it isn't, without making a
+// 0 or 1 for it. a missing condition is true. && and || leave their right side alone once
+// the left one has decided
+void sea_compile_branch(const sea_node_t *cond, bool when, const msu_str_t *target, sea_compile_ctx *ctx,
+                        asm_builder_t *out, sea_error_t **errout) {
+    if (!cond || cond->kind == SEA_INT) {
+        bool value = !cond || ((const sea_int_t *) cond)->value != 0;
+        if (value == when) asm_builder_op_ref(out, "BRA", target);
+        return;
+    }
+    if (cond->kind == SEA_UNARY && ((const sea_unary_t *) cond)->op == SEA_OP_NOT) {
+        sea_compile_branch(((const sea_unary_t *) cond)->operand, !when, target, ctx, out, errout);
+        return;
+    }
+    if (cond->kind == SEA_BINARY) {
+        const sea_binary_t *binary = (const sea_binary_t *) cond;
+        sea_op_t op;
+        if (binary->op == SEA_OP_AND || binary->op == SEA_OP_OR) {
+            // the left side of || decides when it's true, the left side of && when it's false
+            bool decides = binary->op == SEA_OP_OR;
+            if (when == decides) {
+                sea_compile_branch(binary->lhs, when, target, ctx, out, errout);
+                if (!*errout) sea_compile_branch(binary->rhs, when, target, ctx, out, errout);
+                return;
+            }
+            const msu_str_t *skip = sea_compile_ctx_label(ctx, "cond.skip", ctx->labelno++);
+            sea_compile_branch(binary->lhs, decides, skip, ctx, out, errout);
+            if (!*errout) sea_compile_branch(binary->rhs, when, target, ctx, out, errout);
+            if (!*errout) {
+                asm_builder_label(out, skip);
+                asm_builder_op_ref(out, "ADD", sea_compile_ctx_ensure_constant(ctx, 0));
+            }
+            msu_str_free(skip);
+            return;
+        }
+        if (sea_negate_compare(binary->op, &op)) {
+            sea_compile_compare_branch(binary, when ? binary->op : op, target, ctx, out, errout);
+            return;
+        }
+    }
+
+    sea_compile_impl(cond, ctx, out, errout);
+    if (*errout) return;
+    asm_builder_op(out, "SPOP");
+    ctx->imm_offset -= 1;
+    if (when) {
+        sea_compile_branch_nonzero(target, ctx, out);
+    } else {
+        asm_builder_op_ref(out, "BRZ", target);
+    }
+}
+
+// a statement of a block, branch or loop, dropping the value an expression statement leaves
+void sea_compile_stmt(const sea_node_t *node, sea_compile_ctx *ctx, asm_builder_t *out, sea_error_t **errout) {
+    size_t imm_offset = ctx->imm_offset;
+    sea_compile_impl(node, ctx, out, errout);
+    if (*errout) return;
+    if (ctx->imm_offset > imm_offset) {
+        asm_builder_op_value(out, "SPADD", (int) (ctx->imm_offset - imm_offset - 1));
+        ctx->imm_offset = imm_offset;
+    }
+}
 
-        msu_str_builder_printf(out, "%s ADD %s\n", msu_str_data(end), msu_str_data(label0));
+void sea_compile_loop(const sea_loop_t *loop, sea_compile_ctx *ctx, asm_builder_t *out, sea_error_t **errout) {
+    int labelno = ctx->labelno++;
+    const msu_str_t *label0 = sea_compile_ctx_ensure_constant(ctx, 0);
+
+    if (loop->base.kind == SEA_DO_WHILE) {
+        const msu_str_t *start = sea_compile_ctx_label(ctx, "dowhile.start", labelno);
+
+        asm_builder_label(out, start);
+        asm_builder_op_ref(out, "ADD", label0);
+
+        sea_compile_stmt(loop->body, ctx, out, errout);
+        if (!*errout) sea_compile_branch(loop->cond, true, start, ctx, out, errout);
 
         msu_str_free(start);
-        msu_str_free(end);
-    } else if (node->kind == SEA_IF) {
-        const parsenode_t *cond = list_of_parsenodes_get(node->children, 0);
-        const parsenode_t *then = list_of_parsenodes_get(node->children, 1);
-        const parsenode_t *else_ = list_of_parsenodes_get(node->children, 2);
+        return;
+    }
+
+    bool for_ = loop->base.kind == SEA_FOR;
+    const msu_str_t *cont = sea_compile_ctx_label(ctx, for_ ? "for.cond" : "while.cond", labelno);
+    const msu_str_t *end = sea_compile_ctx_label(ctx, for_ ? "for.end" : "while.end", labelno);
+
+    if (loop->init) sea_compile_stmt(loop->init, ctx, out, errout);
+    if (!*errout) {
+        asm_builder_label(out, cont);
+        sea_compile_branch(loop->cond, false, end, ctx, out, errout);
+    }
+    if (!*errout) sea_compile_stmt(loop->body, ctx, out, errout);
+    if (!*errout && loop->incr) sea_compile_stmt(loop->incr, ctx, out, errout);
+    if (!*errout) {
+        asm_builder_op_ref(out, "BRA", cont);
+        asm_builder_label(out, end);
+        asm_builder_op_ref(out, "ADD", label0);
+    }
+
+    msu_str_free(cont);
+    msu_str_free(end);
+}
 
+// `x = x + c` or `x = x - c` with x in a fixed cell is done in the accumulator, the cell
+// is stepped where it is instead of going through the stack
+bool sea_compile_increment(const var_t *var, const sea_node_t *value, sea_compile_ctx *ctx, asm_builder_t *out) {
+    if (!var->cell || value->kind != SEA_BINARY) return false;
+    const sea_binary_t *binary = (const sea_binary_t *) value;
+    if (binary->op != SEA_OP_ADD && binary->op != SEA_OP_SUB) return false;
+
+    const sea_node_t *same = binary->lhs, *step = binary->rhs;
+    if (binary->op == SEA_OP_ADD && same->kind == SEA_INT) {
+        same = binary->rhs;
+        step = binary->lhs;
+    }
+    if (same->kind != SEA_IDENT || step->kind != SEA_INT
+        || sea_compile_ctx_find_var(ctx, ((const sea_ident_t *) same)->name) != var) {
+        return false;
+    }
+    // a step no cell can hold goes the long way, where the assembler reports it
+    int by = ((const sea_int_t *) step)->value;
+    if (by < -999 || by > 999) return false;
+
+    asm_builder_op_ref(out, "LDA", var->cell);
+    asm_builder_op_ref(out, binary->op == SEA_OP_ADD ? "ADD" : "SUB", sea_compile_ctx_ensure_constant(ctx, by));
+    asm_builder_op_ref(out, "STA", var->cell);
+    return true;
+}
+
+void sea_compile_binary(const sea_binary_t *node, sea_compile_ctx *ctx, asm_builder_t *out, sea_error_t **errout) {
+    if (node->op == SEA_OP_ASSIGN && node->lhs->kind == SEA_INDEX) {
+        // the value goes under the index, SSTX takes both
+        const sea_index_t *lhs = (const sea_index_t *) node->lhs;
+        const msu_str_t *cell = sea_compile_array_cell(lhs, ctx, errout);
+        if (*errout) return;
+        sea_compile_impl(node->rhs, ctx, out, errout);
+        if (*errout) return;
+        sea_compile_impl(lhs->index, ctx, out, errout);
+        if (*errout) return;
+        asm_builder_op_ref(out, "SSTX", cell);
+        ctx->imm_offset -= 2;
+        return;
+    }
+    if (node->op == SEA_OP_ASSIGN) {
+        if (node->lhs->kind != SEA_IDENT) {
+            *errout = sea_error_new(node->lhs->src, msu_str_new("cannot assign to non-var"));
+            return;
+        }
+        const msu_str_t *name = ((const sea_ident_t *) node->lhs)->name;
+        var_t *var = sea_compile_ctx_find_var(ctx, name);
+        if (!var) {
+            *errout = sea_undefined_variable(ctx, node->lhs, name);
+            return;
+        }
+
+        if (sea_compile_increment(var, node->rhs, ctx, out)) return;
+        sea_compile_impl(node->rhs, ctx, out, errout);
+        if (*errout) return;
+        sea_compile_store(var, ctx, out);
+        return;
+    }
+    if (node->op == SEA_OP_AND || node->op == SEA_OP_OR) {
+        // a 0 or 1 made by branching on it
         int labelno = ctx->labelno++;
-        const msu_str_t *end = msu_str_printf("$if.end%d", labelno);
-        const msu_str_t *false_label = msu_str_printf("$if.false%d", labelno);
+        const msu_str_t *false_label = sea_compile_ctx_label(ctx, "cond.false", labelno);
+        const msu_str_t *end = sea_compile_ctx_label(ctx, "cond.end", labelno);
+
+        sea_compile_branch(&node->base, false, false_label, ctx, out, errout);
+        if (!*errout) {
+            asm_builder_op_value(out, "SPUSHI", 1);
+            asm_builder_op_ref(out, "BRA", end);
+            asm_builder_label(out, false_label);
+            asm_builder_op_value(out, "SPUSHI", 0);
+            asm_builder_label(out, end);
+            asm_builder_op_ref(out, "ADD", sea_compile_ctx_ensure_constant(ctx, 0));
+            ctx->imm_offset += 1;
+        }
+
+        msu_str_free(false_label);
+        msu_str_free(end);
+        return;
+    }
+
+    sea_compile_impl(node->lhs, ctx, out, errout);
+    if (*errout) return;
+    sea_compile_impl(node->rhs, ctx, out, errout);
+    if (*errout) return;
+
+    switch (node->op) {
+        case SEA_OP_ADD:
+            asm_builder_op(out, "SADD");
+            break;
+        case SEA_OP_SUB:
+            asm_builder_op(out, "SSUB");
+            break;
+        case SEA_OP_MUL:
+            asm_builder_op(out, "SMUL");
+            break;
+        case SEA_OP_DIV:
+            asm_builder_op(out, "SDIV");
+            break;
+        case SEA_OP_GT:
+            asm_builder_op(out, "SCMPGT");
+            break;
+        case SEA_OP_LE:
+            asm_builder_op(out, "SCMPGT");
+            asm_builder_op(out, "SNOT");
+            break;
+        case SEA_OP_LT:
+            asm_builder_op(out, "SCMPLT");
+            break;
+        case SEA_OP_GE:
+            asm_builder_op(out, "SCMPLT");
+            asm_builder_op(out, "SNOT");
+            break;
+        case SEA_OP_EQ: // a - b is 0
+            asm_builder_op(out, "SSUB");
+            asm_builder_op(out, "SNOT");
+            break;
+        case SEA_OP_NE:
+            asm_builder_op(out, "SSUB");
+            asm_builder_op(out, "SNOT");
+            asm_builder_op(out, "SNOT");
+            break;
+        default:
+            assert(false && "operand unimplemented");
+    }
+    ctx->imm_offset -= 1;
+}
 
-        sea_compile_impl(cond, ctx, out, errout);
+void sea_compile_call(const sea_call_t *call, sea_compile_ctx *ctx, asm_builder_t *out, sea_error_t **errout) {
+    if (call->functor->kind != SEA_IDENT) {
+        *errout = sea_error_new(call->functor->src, msu_str_new("function name must be an identifier"));
+        return;
+    }
+    const msu_str_t *name = ((const sea_ident_t *) call->functor)->name;
+
+    for (size_t i = 0; i < call->n_args; ++i) {
+        sea_compile_impl(call->args[i], ctx, out, errout);
         if (*errout) return;
-        msu_str_builder_printf(out, "SPOP\n");
+    }
+
+    if (msu_str_eqs(name, "putn")) {
+        if (call->n_args != 1) {
+            *errout = sea_error_new(call->base.src, msu_str_new("invalid arguments for 'void putn(int)'"));
+            return;
+        }
+
+        asm_builder_op(out, "SPOP");
+        asm_builder_op(out, "OUT");
         ctx->imm_offset -= 1;
-        msu_str_builder_printf(out, "BRZ %s\n", msu_str_data(false_label));
-        sea_compile_impl(then, ctx, out, errout);
-        if (*errout) return;
+        return;
+    }
 
-        const msu_str_t *label0 = sea_compile_ctx_ensure_constant(ctx, 0);
-        if (else_) {
-            msu_str_builder_printf(out, "BRA %s\n", end);
+    if (msu_str_eqs(name, "getn")) {
+        if (call->n_args != 0) {
+            *errout = sea_error_new(call->base.src, msu_str_new("invalid arguments for 'int getn(void)'"));
+            return;
+        }
 
-            msu_str_builder_printf(out, "%s ADD %s\n", msu_str_data(false_label), msu_str_data(label0));
+        asm_builder_op(out, "INP");
+        asm_builder_op(out, "SPUSH");
+        ctx->imm_offset += 1;
+        return;
+    }
 
-            sea_compile_impl(else_, ctx, out, errout);
-            if (*errout) return;
+    const sea_funcdef_t *func = sea_compile_ctx_find_function(ctx, name);
+    if (!func) {
+        *errout = sea_error_new(call->functor->src, msu_str_printf("undefined reference to function '%s'",
+                                                                   msu_str_data(name)));
+        return;
+    }
+
+    ctx->imm_offset -= func->n_params; // subtract arguments
+    asm_builder_op_ref(out, "CALL", name);
+
+    if (func->returns_int) {
+        asm_builder_op(out, "SPUSH");
+        ctx->imm_offset += 1;
+    }
+}
+
+//======================================================
+//  Value numbering
+//
+//  an expression without calls or assignments is first put
+//  in three-address form, where every distinct value gets a
+//  number once: (a+b)*(a+b) is
+//
+//      v0 = load a; v1 = load b; v2 = v0 + v1; v3 = v2 * v2
+//
+//  emitting it keeps track of which value is in each stack
+//  slot, so a value that is still on the stack is copied
+//  (SDUP, SLDA) instead of computed again. a value that is
+//  gone by the time it's needed again and costs more to
+//  redo than to keep has a copy left under it when it's
+//  first computed. the operands of commutative ops go
+//  deepest first, which keeps the stack shallow
+//======================================================
+
+typedef enum sea_ir_kind {
+    SEA_IR_CONST,
+    SEA_IR_LOAD,
+    SEA_IR_UNARY,
+    SEA_IR_BINARY,
+    SEA_IR_INDEX,
+} sea_ir_kind_t;
+
+typedef struct sea_ir_value {
+    sea_ir_kind_t kind;
+    sea_op_t op;
+    int a, b;          // operand numbers, a is the constant of SEA_IR_CONST and the index of SEA_IR_INDEX
+    bool flipped;      // b came first in the source, where the order is free
+    const var_t *var;  // for SEA_IR_LOAD
+    const msu_str_t *array; // for SEA_IR_INDEX, its first cell
+    int uses;
+    int cost;          // instructions to compute it from nothing
+    int need;          // stack slots to compute it
+    bool keep;
+} sea_ir_value_t;
+
+typedef struct sea_ir {
+    sea_ir_value_t *values;
+    size_t len;
+    int *stack;   // the value in each slot the expression pushed, bottom first, -1 for a scratch value
+    bool *copy;   // whether a slot is a copy kept for later, not an operand waiting for its op
+    size_t depth;
+    int *left;     // uses of each value not emitted yet
+    int *computed; // times each value was computed
+} sea_ir_t;
+
+// whether `node` can be value numbered, counting its nodes into *count
+bool sea_ir_is_pure(const sea_node_t *node, size_t *count) {
+    *count += 1;
+    switch (node->kind) {
+        case SEA_INT:
+        case SEA_IDENT:
+            return true;
+        case SEA_UNARY:
+            return sea_ir_is_pure(((const sea_unary_t *) node)->operand, count);
+        case SEA_INDEX:
+            return sea_ir_is_pure(((const sea_index_t *) node)->index, count);
+        case SEA_BINARY: {
+            const sea_binary_t *binary = (const sea_binary_t *) node;
+            // && and || may not run their right side, so they're compiled as branches
+            return binary->op != SEA_OP_ASSIGN && binary->op != SEA_OP_AND && binary->op != SEA_OP_OR
+                   && sea_ir_is_pure(binary->lhs, count) && sea_ir_is_pure(binary->rhs, count);
+        }
+        default:
+            return false;
+    }
+}
+
+// the number of `value`, an existing one if it's been seen before
+int sea_ir_number(sea_ir_t *ir, sea_ir_value_t value) {
+    for (size_t i = 0; i < ir->len; i++) {
+        const sea_ir_value_t *seen = &ir->values[i];
+        if (seen->kind == value.kind && seen->op == value.op && seen->a == value.a && seen->b == value.b
+            && seen->var == value.var && seen->array == value.array) {
+            // emitted in the order it was first written
+            ir->values[i].uses += 1;
+            return (int) i;
+        }
+    }
+    value.uses = 1;
+    ir->values[ir->len] = value;
+    return (int) ir->len++;
+}
+
+int sea_ir_build(sea_ir_t *ir, const sea_node_t *node, sea_compile_ctx *ctx, sea_error_t **errout) {
+    sea_ir_value_t value = {0};
+    if (node->kind == SEA_INT) {
+        value.kind = SEA_IR_CONST;
+        value.a = ((const sea_int_t *) node)->value;
+        value.cost = 2; // LDI; SPUSH
+        value.need = 1;
+    } else if (node->kind == SEA_IDENT) {
+        const msu_str_t *name = ((const sea_ident_t *) node)->name;
+        value.kind = SEA_IR_LOAD;
+        value.var = sea_compile_ctx_find_var(ctx, name);
+        if (!value.var) {
+            *errout = sea_undefined_variable(ctx, node, name);
+            return -1;
+        }
+        value.cost = value.var->cell ? 2 : 1;
+        value.need = 1;
+    } else if (node->kind == SEA_UNARY) {
+        const sea_unary_t *unary = (const sea_unary_t *) node;
+        value.kind = SEA_IR_UNARY;
+        value.op = unary->op;
+        value.a = sea_ir_build(ir, unary->operand, ctx, errout);
+        if (*errout) return -1;
+        const sea_ir_value_t *a = &ir->values[value.a];
+        // -x is 0 - x
+        value.cost = a->cost + (value.op == SEA_OP_NEG ? 3 : 1);
+        value.need = a->need + (value.op == SEA_OP_NEG ? 1 : 0);
+    } else if (node->kind == SEA_INDEX) {
+        const sea_index_t *index = (const sea_index_t *) node;
+        value.kind = SEA_IR_INDEX;
+        value.array = sea_compile_array_cell(index, ctx, errout);
+        if (*errout) return -1;
+        value.a = sea_ir_build(ir, index->index, ctx, errout);
+        if (*errout) return -1;
+        value.cost = ir->values[value.a].cost + 1;
+        value.need = ir->values[value.a].need;
+    } else {
+        const sea_binary_t *binary = (const sea_binary_t *) node;
+        value.kind = SEA_IR_BINARY;
+        value.op = binary->op;
+        value.a = sea_ir_build(ir, binary->lhs, ctx, errout);
+        if (*errout) return -1;
+        value.b = sea_ir_build(ir, binary->rhs, ctx, errout);
+        if (*errout) return -1;
+
+        // one order for operands that can go either way, so a+b and b+a are the same value
+        bool commutes = value.op == SEA_OP_ADD || value.op == SEA_OP_MUL || value.op == SEA_OP_EQ
+                        || value.op == SEA_OP_NE;
+        if (value.op == SEA_OP_LT || value.op == SEA_OP_LE) {
+            value.op = value.op == SEA_OP_LT ? SEA_OP_GT : SEA_OP_GE;
+            value.flipped = true;
+        } else if (commutes && value.a > value.b) {
+            value.flipped = true;
+        }
+        if (value.flipped) {
+            int a = value.a;
+            value.a = value.b;
+            value.b = a;
+        }
+
+        const sea_ir_value_t *a = &ir->values[value.a], *b = &ir->values[value.b];
+        int ops = value.op == SEA_OP_NE ? 3 : (value.op == SEA_OP_GE || value.op == SEA_OP_EQ ? 2 : 1);
+        value.cost = a->cost + b->cost + ops;
+        value.need = a->need == b->need ? a->need + 1 : (a->need > b->need ? a->need : b->need);
+    }
+    return sea_ir_number(ir, value);
+}
 
-            msu_str_builder_printf(out, "%s ADD %s\n", msu_str_data(end), msu_str_data(label0));
+// emits an instruction, or only goes through the motions if `out` is NULL
+void sea_ir_op(asm_builder_t *out, const char *insr) {
+    if (out) asm_builder_op(out, insr);
+}
+
+void sea_ir_op_value(asm_builder_t *out, const char *insr, int value) {
+    if (out) asm_builder_op_value(out, insr, value);
+}
+
+void sea_ir_pushed(sea_ir_t *ir, int value, sea_compile_ctx *ctx) {
+    ir->stack[ir->depth] = value;
+    ir->copy[ir->depth] = false;
+    ir->depth += 1;
+    ctx->imm_offset += 1;
+}
+
+void sea_ir_popped(sea_ir_t *ir, size_t n, sea_compile_ctx *ctx) {
+    ir->depth -= n;
+    ctx->imm_offset -= n;
+}
+
+// pushes value `v`, either a copy of it from the stack or computed. an operand that goes on top of
+// another one is `taken` by its op right away, a copy kept over it would be taken instead
+void sea_ir_push(sea_ir_t *ir, int v, bool taken, sea_compile_ctx *ctx, asm_builder_t *out) {
+    ir->left[v] -= 1;
+
+    // a copy kept for this very use, already on top
+    if (ir->depth > 0 && ir->stack[ir->depth - 1] == v && ir->copy[ir->depth - 1] && ir->left[v] == 0) {
+        ir->copy[ir->depth - 1] = false;
+        return;
+    }
+    for (size_t d = 0; d < ir->depth; d++) {
+        if (ir->stack[ir->depth - 1 - d] != v) continue;
+        if (d == 0) sea_ir_op(out, "SDUP");
+        else sea_ir_op_value(out, "SLDA", (int) d);
+        sea_ir_pushed(ir, v, ctx);
+        return;
+    }
+
+    const sea_ir_value_t *value = &ir->values[v];
+    ir->computed[v] += 1;
+    if (value->kind == SEA_IR_CONST) {
+        sea_ir_op_value(out, "SPUSHI", value->a);
+        sea_ir_pushed(ir, v, ctx);
+    } else if (value->kind == SEA_IR_LOAD) {
+        if (out) {
+            sea_compile_load(value->var, ctx, out);
+            ctx->imm_offset -= 1; // counted below
+        }
+        sea_ir_pushed(ir, v, ctx);
+    } else if (value->kind == SEA_IR_UNARY) {
+        if (value->op == SEA_OP_NEG) {
+            sea_ir_op_value(out, "SPUSHI", 0);
+            sea_ir_pushed(ir, -1, ctx);
+            sea_ir_push(ir, value->a, true, ctx, out);
+            sea_ir_op(out, "SSUB");
+            sea_ir_popped(ir, 2, ctx);
         } else {
-            msu_str_builder_printf(out, "%s ADD %s\n", msu_str_data(false_label), msu_str_data(label0));
+            sea_ir_push(ir, value->a, false, ctx, out);
+            sea_ir_op(out, "SNOT");
+            sea_ir_popped(ir, 1, ctx);
+        }
+        sea_ir_pushed(ir, v, ctx);
+    } else if (value->kind == SEA_IR_INDEX) {
+        sea_ir_push(ir, value->a, false, ctx, out);
+        if (out) asm_builder_op_ref(out, "SLDX", value->array);
+        sea_ir_popped(ir, 1, ctx);
+        sea_ir_pushed(ir, v, ctx);
+    } else {
+        // as written, unless the order is free and the other one is shallower
+        int first_need = ir->values[value->flipped ? value->b : value->a].need;
+        int second_need = ir->values[value->flipped ? value->a : value->b].need;
+        bool free = value->op != SEA_OP_SUB && value->op != SEA_OP_DIV;
+        bool swap = value->flipped;
+        if (free && second_need > first_need) swap = !swap;
+        sea_ir_push(ir, swap ? value->b : value->a, false, ctx, out);
+        sea_ir_push(ir, swap ? value->a : value->b, true, ctx, out);
+        switch (value->op) {
+            case SEA_OP_ADD:
+                sea_ir_op(out, "SADD");
+                break;
+            case SEA_OP_SUB:
+                sea_ir_op(out, "SSUB");
+                break;
+            case SEA_OP_MUL:
+                sea_ir_op(out, "SMUL");
+                break;
+            case SEA_OP_DIV:
+                sea_ir_op(out, "SDIV");
+                break;
+            case SEA_OP_GT: // b < a when swapped
+                sea_ir_op(out, swap ? "SCMPLT" : "SCMPGT");
+                break;
+            case SEA_OP_GE: // !(b > a) when swapped
+                sea_ir_op(out, swap ? "SCMPGT" : "SCMPLT");
+                sea_ir_op(out, "SNOT");
+                break;
+            case SEA_OP_EQ: // a - b is 0 either way around
+                sea_ir_op(out, "SSUB");
+                sea_ir_op(out, "SNOT");
+                break;
+            case SEA_OP_NE:
+                sea_ir_op(out, "SSUB");
+                sea_ir_op(out, "SNOT");
+                sea_ir_op(out, "SNOT");
+                break;
+            default:
+                assert(false && "operand unimplemented");
         }
+        sea_ir_popped(ir, 2, ctx);
+        sea_ir_pushed(ir, v, ctx);
+    }
 
-        msu_str_free(end);
-        msu_str_free(false_label);
-    } else if (node->kind == SEA_VAR) {
-        size_t offset = ctx->var_offset++;
-        var_t *var = scope_add_var(ctx->scope, node->token->content, offset, false);
+    if (value->keep && !taken && ir->left[v] > 0) {
+        sea_ir_op(out, "SDUP");
+        ir->copy[ir->depth - 1] = true;
+        sea_ir_pushed(ir, v, ctx);
+    }
+}
 
-        const parsenode_t *value = list_of_parsenodes_get(node->children, 1);
-        if (value) {
-            sea_compile_impl(value, ctx, out, errout);
-            if (*errout) return;
-//            msu_str_builder_printf(out, "SPOP\n");
-            assert(ctx->imm_offset == 1);
-            ctx->imm_offset -= 1;
-            msu_str_builder_printf(out, "SSTA %zu\n", var->frame_offset);
+void sea_ir_reset(sea_ir_t *ir, size_t imm_offset, sea_compile_ctx *ctx) {
+    ir->depth = 0;
+    ctx->imm_offset = imm_offset;
+    for (size_t i = 0; i < ir->len; i++) ir->left[i] = ir->values[i].uses;
+}
+
+// compiles a pure expression of `count` nodes
+void sea_compile_expr(const sea_node_t *node, size_t count, sea_compile_ctx *ctx, asm_builder_t *out,
+                      sea_error_t **errout) {
+    sea_ir_t ir = {
+            .values = calloc(count, sizeof(sea_ir_value_t)),
+            .len = 0,
+            .stack = calloc(2 * count, sizeof(int)),
+            .copy = calloc(2 * count, sizeof(bool)),
+            .depth = 0,
+            .left = calloc(count, sizeof(int)),
+            .computed = calloc(count, sizeof(int)),
+    };
+    assert(ir.values && ir.stack && ir.copy && ir.left && ir.computed && "out of memory!\n");
+
+    int root = sea_ir_build(&ir, node, ctx, errout);
+    if (!*errout) {
+        // a dry run finds what gets computed more than once, then what's worth keeping is
+        size_t imm_offset = ctx->imm_offset;
+        sea_ir_reset(&ir, imm_offset, ctx);
+        sea_ir_push(&ir, root, false, ctx, NULL);
+        for (size_t i = 0; i < ir.len; i++) {
+            int redone = ir.computed[i] - 1;
+            // a copy costs an SDUP, an SLDA a use and its share of dropping the copies at the end
+            ir.values[i].keep = redone > 0 && ir.values[i].cost * redone > redone + 2;
         }
-    } else if (node->kind == SEA_RETURN) {
-        const parsenode_t *value = list_of_parsenodes_get(node->children, 0);
-        if (value) {
-            sea_compile_impl(value, ctx, out, errout);
-            if (*errout) return;
+
+        sea_ir_reset(&ir, imm_offset, ctx);
+        sea_ir_push(&ir, root, false, ctx, out);
+
+        // the copies left under the result
+        size_t copies = ir.depth - 1;
+        if (copies > 0) {
+            asm_builder_op_value(out, "SSTA", (int) copies - 1);
+            if (copies > 1) asm_builder_op_value(out, "SPADD", (int) copies - 2);
+            ctx->imm_offset -= copies;
         }
+    }
 
-        msu_str_builder_printf(out, "BRA %s\n", msu_str_data(ctx->return_label));
-    } else if (node->kind == SEA_BINARY) {
-        const parsenode_t *lhs = list_of_parsenodes_get(node->children, 0);
-        const parsenode_t *rhs = list_of_parsenodes_get(node->children, 1);
+    free(ir.values);
+    free(ir.stack);
+    free(ir.copy);
+    free(ir.left);
+    free(ir.computed);
+}
 
-        if (msu_str_eqs(node->token->content, "=")) {
-            if (lhs->kind != SEA_IDENT) {
-                *errout = sea_error_new(lhs, msu_str_new("cannot assign to non-var"));
-                return;
+//======================================================
+//  Loop optimizations
+//
+//  rewrite the AST of each loop before it's compiled,
+//  innermost loops first:
+//
+//  - an expression that only reads variables the loop
+//    doesn't change comes out the same every time around,
+//    so it's computed once before the loop into a hidden
+//    variable
+//  - i * c, where i goes up or down by the same constant
+//    once every time around, is kept in a hidden variable
+//    that starts at i * c and moves by step * c right after
+//    i does, an addition instead of a multiply. updating it
+//    costs about what two multiplies do, so it's only done
+//    for products used at least twice
+//
+//  whatever has to run before the loop goes in a block
+//  with it, after the for's init. the hidden variables are
+//  named with a $, which no name in a program can have
+//======================================================
+
+typedef struct sea_names {
+    const msu_str_t **names;
+    size_t len, cap;
+} sea_names_t;
+
+void sea_names_add(sea_names_t *me, const msu_str_t *name) {
+    if (me->len == me->cap) {
+        me->cap = me->cap ? me->cap * 2 : 8;
+        me->names = realloc(me->names, me->cap * sizeof(const msu_str_t *));
+        assert(me->names && "out of memory!\n");
+    }
+    me->names[me->len++] = name;
+}
+
+size_t sea_names_count(const sea_names_t *me, const msu_str_t *name) {
+    size_t count = 0;
+    for (size_t i = 0; i < me->len; i++) count += msu_str_eq(me->names[i], name);
+    return count;
+}
+
+typedef struct sea_loop_opt {
+    sea_names_t assigned; // a name once for every assignment to it in the loop
+    sea_names_t declared; // in the condition, increment or body
+    bool calls;           // calls a function, which can change any global
+    sea_node_t **before;  // what runs before the loop
+    size_t len, cap;
+    sea_compile_ctx *ctx;
+} sea_loop_opt_t;
+
+void sea_loop_scan(sea_node_t **slot, void *data) {
+    sea_loop_opt_t *me = data;
+    sea_node_t *node = *slot;
+    if (!node) return;
+    if (node->kind == SEA_BINARY && ((sea_binary_t *) node)->op == SEA_OP_ASSIGN
+        && ((sea_binary_t *) node)->lhs->kind == SEA_IDENT) {
+        sea_names_add(&me->assigned, ((sea_ident_t *) ((sea_binary_t *) node)->lhs)->name);
+    } else if (node->kind == SEA_VAR) {
+        sea_names_add(&me->declared, ((sea_var_t *) node)->name);
+    } else if (node->kind == SEA_CALL && sea_compile_ctx_callee(me->ctx, ((sea_call_t *) node)->functor)) {
+        me->calls = true;
+    }
+    sea_node_visit(node, sea_loop_scan, me);
+}
+
+// whether `name` is a global a function called in the loop could change
+bool sea_loop_calls_change(const sea_loop_opt_t *me, const msu_str_t *name) {
+    if (!me->calls) return false;
+    size_t *id = sea_symbol_ids_getv(me->ctx->ids, name);
+    return id && me->ctx->symbols[*id].global;
+}
+
+// whether the variable `name` can be different from one time around to the next
+bool sea_loop_changes(const sea_loop_opt_t *me, const msu_str_t *name) {
+    return sea_names_count(&me->assigned, name) > 0 || sea_names_count(&me->declared, name) > 0
+           || sea_loop_calls_change(me, name);
+}
+
+// whether `node` comes out the same every time around. it's worked out before the loop
+// even if the loop never runs, so it can't divide by anything that might be zero
+bool sea_loop_invariant(const sea_loop_opt_t *me, const sea_node_t *node) {
+    switch (node->kind) {
+        case SEA_INT:
+            return true;
+        case SEA_IDENT:
+            return !sea_loop_changes(me, ((const sea_ident_t *) node)->name);
+        case SEA_UNARY:
+            return sea_loop_invariant(me, ((const sea_unary_t *) node)->operand);
+        case SEA_BINARY: {
+            const sea_binary_t *binary = (const sea_binary_t *) node;
+            if (binary->op == SEA_OP_ASSIGN) return false;
+            if (binary->op == SEA_OP_DIV
+                && (binary->rhs->kind != SEA_INT || ((const sea_int_t *) binary->rhs)->value == 0)) {
+                return false;
             }
-            var_t *var = scope_find_var(ctx->scope, lhs->token->content);
+            return sea_loop_invariant(me, binary->lhs) && sea_loop_invariant(me, binary->rhs);
+        }
+        default:
+            return false;
+    }
+}
 
-            sea_compile_impl(rhs, ctx, out, errout);
-            if (*errout) return;
-//            msu_str_builder_printf(out, "SPOP\n");
-            ctx->imm_offset -= 1;
-            msu_str_builder_printf(out, "SSTA %zu\n", ctx->imm_offset + var->frame_offset);
-            return;
+bool sea_node_equal(const sea_node_t *a, const sea_node_t *b) {
+    if (a->kind != b->kind) return false;
+    switch (a->kind) {
+        case SEA_INT:
+            return ((const sea_int_t *) a)->value == ((const sea_int_t *) b)->value;
+        case SEA_IDENT:
+            return msu_str_eq(((const sea_ident_t *) a)->name, ((const sea_ident_t *) b)->name);
+        case SEA_UNARY: {
+            const sea_unary_t *x = (const sea_unary_t *) a, *y = (const sea_unary_t *) b;
+            return x->op == y->op && sea_node_equal(x->operand, y->operand);
         }
+        case SEA_BINARY: {
+            const sea_binary_t *x = (const sea_binary_t *) a, *y = (const sea_binary_t *) b;
+            return x->op == y->op && sea_node_equal(x->lhs, y->lhs) && sea_node_equal(x->rhs, y->rhs);
+        }
+        default:
+            return false;
+    }
+}
 
-        sea_compile_impl(lhs, ctx, out, errout);
-        if (*errout) return;
-        sea_compile_impl(rhs, ctx, out, errout);
-        if (*errout) return;
-        if (msu_str_eqs(node->token->content, "+")) {
-            msu_str_builder_printf(out, "SADD\n");
-            ctx->imm_offset -= 1;
-        } else if (msu_str_eqs(node->token->content, "-")) {
-            msu_str_builder_printf(out, "SSUB\n");
-            ctx->imm_offset -= 1;
-        } else if (msu_str_eqs(node->token->content, "*")) {
-            msu_str_builder_printf(out, "SMUL\n");
-            ctx->imm_offset -= 1;
-        } else if (msu_str_eqs(node->token->content, "/")) {
-            msu_str_builder_printf(out, "SDIV\n");
-            ctx->imm_offset -= 1;
-        } else if (msu_str_eqs(node->token->content, ">")) {
-            msu_str_builder_pushs(out, "SCMPGT\n");
-            ctx->imm_offset -= 1;
-        } else if (msu_str_eqs(node->token->content, "<=")) {
-            msu_str_builder_pushs(out, "SCMPGT\nSNOT\n");
-            ctx->imm_offset -= 1;
-        } else if (msu_str_eqs(node->token->content, "<")) {
-            msu_str_builder_pushs(out, "SCMPLT\n");
-            ctx->imm_offset -= 1;
-        } else if (msu_str_eqs(node->token->content, ">=")) {
-            msu_str_builder_pushs(out, "SCMPLT\nSNOT\n");
-            ctx->imm_offset -= 1;
-        } else if (msu_str_eqs(node->token->content, "==")) {
-            msu_str_builder_pushs(out, "SEQ\n");
-            ctx->imm_offset -= 1;
-        } else if (msu_str_eqs(node->token->content, "!=")) {
-            msu_str_builder_pushs(out, "SEQ\nSNOT\n");
-            ctx->imm_offset -= 1;
-        } else {
-            fprintf(stderr, "current op is '%s'\n", msu_str_data(node->token->content));
-            assert(false && "operand unimplemented");
+sea_node_t *sea_new_ident(sea_compile_ctx *ctx, const msu_str_t *name, const parsenode_t *src) {
+    sea_ident_t *out = sea_ast_new(ctx->ast, sizeof(sea_ident_t), SEA_IDENT, src);
+    out->name = name;
+    return &out->base;
+}
+
+sea_node_t *sea_new_int(sea_compile_ctx *ctx, int value, const parsenode_t *src) {
+    sea_int_t *out = sea_ast_new(ctx->ast, sizeof(sea_int_t), SEA_INT, src);
+    out->value = value;
+    return &out->base;
+}
+
+sea_node_t *sea_new_binary(sea_compile_ctx *ctx, sea_op_t op, sea_node_t *lhs, sea_node_t *rhs) {
+    sea_binary_t *out = sea_ast_new(ctx->ast, sizeof(sea_binary_t), SEA_BINARY, lhs->src);
+    out->op = op;
+    out->lhs = lhs;
+    out->rhs = rhs;
+    return &out->base;
+}
+
+// a block of `len` statements, filled in by the caller
+sea_block_t *sea_new_block(sea_compile_ctx *ctx, size_t len, const parsenode_t *src) {
+    sea_block_t *out = sea_ast_new(ctx->ast, sizeof(sea_block_t), SEA_BLOCK, src);
+    out->len = len;
+    out->stmts = MSU_ALLOC(ctx->ast->arena, len * sizeof(sea_node_t *));
+    assert(out->stmts && "out of memory!\n");
+    return out;
+}
+
+// a hidden variable set to `value` before the loop, the one already there if it's the same value
+const msu_str_t *sea_loop_hidden(sea_loop_opt_t *me, sea_node_t *value, const char *kind) {
+    for (size_t i = 0; i < me->len; i++) {
+        const sea_var_t *decl = (const sea_var_t *) me->before[i];
+        if (decl->base.kind == SEA_VAR && sea_node_equal(decl->value, value)) return decl->name;
+    }
+
+    const msu_str_t *name = msu_str_printf("$%s%d", kind, me->ctx->labelno++);
+    list_of_msu_strs_append(me->ctx->hidden, name);
+    sea_var_t *decl = sea_ast_new(me->ctx->ast, sizeof(sea_var_t), SEA_VAR, value->src);
+    decl->name = name;
+    decl->value = value;
+    if (me->len == me->cap) {
+        me->cap = me->cap ? me->cap * 2 : 8;
+        me->before = realloc(me->before, me->cap * sizeof(sea_node_t *));
+        assert(me->before && "out of memory!\n");
+    }
+    me->before[me->len++] = &decl->base;
+    return name;
+}
+
+// replaces the invariant expressions under *slot with hidden variables
+void sea_loop_hoist(sea_node_t **slot, void *data) {
+    sea_loop_opt_t *me = data;
+    sea_node_t *node = *slot;
+    if (!node) return;
+    if ((node->kind == SEA_BINARY || node->kind == SEA_UNARY) && sea_loop_invariant(me, node)) {
+        *slot = sea_new_ident(me->ctx, sea_loop_hidden(me, node, "inv"), node->src);
+    } else if (node->kind == SEA_BINARY && ((sea_binary_t *) node)->op == SEA_OP_ASSIGN) {
+        sea_node_t *lhs = ((sea_binary_t *) node)->lhs;
+        if (lhs->kind == SEA_INDEX) sea_loop_hoist(&((sea_index_t *) lhs)->index, me);
+        sea_loop_hoist(&((sea_binary_t *) node)->rhs, me);
+    } else {
+        sea_node_visit(node, sea_loop_hoist, me);
+    }
+}
+
+// whether `node` is `i = i + k` or `i = i - k`, with i into *name and the step into *step
+bool sea_loop_is_step(const sea_node_t *node, const msu_str_t **name, int *step) {
+    if (!node || node->kind != SEA_BINARY) return false;
+    const sea_binary_t *assign = (const sea_binary_t *) node;
+    if (assign->op != SEA_OP_ASSIGN || assign->lhs->kind != SEA_IDENT || assign->rhs->kind != SEA_BINARY) {
+        return false;
+    }
+    const sea_binary_t *value = (const sea_binary_t *) assign->rhs;
+    if ((value->op != SEA_OP_ADD && value->op != SEA_OP_SUB) || value->lhs->kind != SEA_IDENT
+        || value->rhs->kind != SEA_INT) {
+        return false;
+    }
+    *name = ((const sea_ident_t *) assign->lhs)->name;
+    if (!msu_str_eq(((const sea_ident_t *) value->lhs)->name, *name)) return false;
+    *step = ((const sea_int_t *) value->rhs)->value * (value->op == SEA_OP_ADD ? 1 : -1);
+    return true;
+}
+
+// the constant `node` multiplies the variable `name` by, 0 if it isn't such a product
+int sea_loop_product(const sea_node_t *node, const msu_str_t *name) {
+    if (node->kind != SEA_BINARY || ((const sea_binary_t *) node)->op != SEA_OP_MUL) return 0;
+    const sea_node_t *lhs = ((const sea_binary_t *) node)->lhs, *rhs = ((const sea_binary_t *) node)->rhs;
+    if (lhs->kind == SEA_INT) {
+        const sea_node_t *swap = lhs;
+        lhs = rhs;
+        rhs = swap;
+    }
+    if (lhs->kind != SEA_IDENT || rhs->kind != SEA_INT || !msu_str_eq(((const sea_ident_t *) lhs)->name, name)) {
+        return 0;
+    }
+    return ((const sea_int_t *) rhs)->value;
+}
+
+typedef struct sea_loop_products {
+    const msu_str_t *name;
+    int factors[8]; // the first few different ones
+    size_t counts[8];
+    size_t len;
+    const msu_str_t *hidden; // what the products of `factor` are replaced with
+    int factor;
+    sea_compile_ctx *ctx;
+} sea_loop_products_t;
+
+// counts the products of the variable under *slot by each factor, or replaces those by one
+void sea_loop_reduce(sea_node_t **slot, void *data) {
+    sea_loop_products_t *me = data;
+    sea_node_t *node = *slot;
+    if (!node) return;
+    int factor = sea_loop_product(node, me->name);
+    if (factor != 0 && me->hidden) {
+        if (factor == me->factor) *slot = sea_new_ident(me->ctx, me->hidden, node->src);
+        return;
+    }
+    if (factor != 0) {
+        size_t i = 0;
+        while (i < me->len && me->factors[i] != factor) i++;
+        if (i == me->len && me->len < sizeof(me->factors) / sizeof(me->factors[0])) {
+            me->factors[me->len] = factor;
+            me->counts[me->len++] = 0;
         }
-    } else if (node->kind == SEA_UNARY) {
-        const parsenode_t *operand = list_of_parsenodes_get(node->children, 0);
+        if (i < me->len) me->counts[i] += 1;
+        return;
+    }
+    sea_node_visit(node, sea_loop_reduce, me);
+}
 
-        if (msu_str_eqs(node->token->content, "-")) {
-            msu_str_builder_printf(out, "SPUSHI 0\n");
-            sea_compile_impl(operand, ctx, out, errout);
-            if (*errout) return;
-            msu_str_builder_printf(out, "SSUB\n");
-        } else if (msu_str_eqs(node->token->content, "!")) {
-            msu_str_builder_printf(out, "SNOT");
+// inserts `stmt` into the block `body` after statement `i`
+void sea_block_insert(sea_block_t *body, size_t i, sea_node_t *stmt, sea_compile_ctx *ctx) {
+    sea_node_t **stmts = MSU_ALLOC(ctx->ast->arena, (body->len + 1) * sizeof(sea_node_t *));
+    assert(stmts && "out of memory!\n");
+    memcpy(stmts, body->stmts, (i + 1) * sizeof(sea_node_t *));
+    stmts[i + 1] = stmt;
+    memcpy(stmts + i + 2, body->stmts + i + 1, (body->len - i - 1) * sizeof(sea_node_t *));
+    body->stmts = stmts;
+    body->len += 1;
+}
+
+// strength reduces the products of the variable stepped by *site, returns the statements added after it
+size_t sea_loop_strength_reduce(sea_loop_opt_t *me, sea_loop_t *loop, sea_node_t **site, sea_block_t *body,
+                                size_t at, sea_compile_ctx *ctx) {
+    const msu_str_t *name;
+    int step;
+    if (!sea_loop_is_step(*site, &name, &step) || sea_names_count(&me->assigned, name) != 1
+        || sea_names_count(&me->declared, name) > 0 || sea_loop_calls_change(me, name)) {
+        return 0;
+    }
+
+    sea_loop_products_t products = {.name = name, .ctx = ctx};
+    sea_loop_reduce(&loop->cond, &products);
+    sea_loop_reduce(&loop->body, &products);
+
+    size_t added = 0;
+    for (size_t i = 0; i < products.len; i++) {
+        int factor = products.factors[i];
+        // the update is a SPUSHI, so it has to fit in one, and a product used once is cheaper left alone
+        int delta = factor * step;
+        if (products.counts[i] < 2 || delta > 99 || delta < -99) continue;
+
+        const parsenode_t *src = (*site)->src;
+        sea_node_t *start = sea_new_binary(ctx, SEA_OP_MUL, sea_new_ident(ctx, name, src),
+                                           sea_new_int(ctx, factor, src));
+        products.hidden = sea_loop_hidden(me, start, "sr");
+        products.factor = factor;
+        sea_loop_reduce(&loop->cond, &products);
+        sea_loop_reduce(&loop->body, &products);
+
+        // hidden = hidden + step * factor, or hidden - the size of it going down, right after the step
+        sea_node_t *update = sea_new_binary(
+                ctx, SEA_OP_ASSIGN, sea_new_ident(ctx, products.hidden, src),
+                sea_new_binary(ctx, delta < 0 ? SEA_OP_SUB : SEA_OP_ADD, sea_new_ident(ctx, products.hidden, src),
+                               sea_new_int(ctx, delta < 0 ? -delta : delta, src)));
+        if (body) {
+            sea_block_insert(body, at + added, update, ctx);
         } else {
-            *errout = sea_error_new(node, msu_str_printf("invalid operand '%s'", msu_str_data(node->token->content)));
-            return;
+            sea_block_t *block = sea_new_block(ctx, 2, src);
+            block->stmts[0] = *site;
+            block->stmts[1] = update;
+            *site = &block->base;
         }
-    } else if (node->kind == SEA_CALL) {
-        const parsenode_t *functor = list_of_parsenodes_get(node->children, 0);
-        const parsenode_t *args = list_of_parsenodes_get(node->children, 1);
+        added += 1;
+    }
+    return added;
+}
 
-        if (functor->kind != SEA_IDENT) {
-            *errout = sea_error_new(functor, msu_str_new("function name must be an identifier"));
-            return;
+void sea_optimize_loop(sea_node_t **slot, sea_compile_ctx *ctx) {
+    sea_loop_t *loop = (sea_loop_t *) *slot;
+    sea_loop_opt_t me = {.ctx = ctx};
+    sea_loop_scan(&loop->cond, &me);
+    sea_loop_scan(&loop->incr, &me);
+    sea_loop_scan(&loop->body, &me);
+
+    sea_loop_hoist(&loop->cond, &me);
+    sea_loop_hoist(&loop->incr, &me);
+    sea_loop_hoist(&loop->body, &me);
+
+    // the steps that happen once every time around: the for's increment and the body's own statements
+    if (loop->incr) sea_loop_strength_reduce(&me, loop, &loop->incr, NULL, 0, ctx);
+    if (loop->body->kind == SEA_BLOCK) {
+        sea_block_t *body = (sea_block_t *) loop->body;
+        for (size_t i = 0; i < body->len; i++) {
+            i += sea_loop_strength_reduce(&me, loop, &body->stmts[i], body, i, ctx);
         }
+    }
+
+    if (me.len > 0) {
+        size_t init = loop->init ? 1 : 0;
+        sea_block_t *block = sea_new_block(ctx, init + me.len + 1, loop->base.src);
+        if (init) block->stmts[0] = loop->init;
+        memcpy(block->stmts + init, me.before, me.len * sizeof(sea_node_t *));
+        block->stmts[init + me.len] = &loop->base;
+        loop->init = NULL;
+        *slot = &block->base;
+    }
+    free(me.assigned.names);
+    free(me.declared.names);
+    free(me.before);
+}
 
-        for (int i = 0; i < args->children->len; ++i) {
-            const parsenode_t *arg = list_of_parsenodes_get(args->children, i);
-            sea_compile_impl(arg, ctx, out, errout);
+// optimizes the loops under *slot, innermost first
+void sea_optimize_loops_visit(sea_node_t **slot, void *data) {
+    sea_node_t *node = *slot;
+    if (!node) return;
+    sea_node_visit(node, sea_optimize_loops_visit, data);
+    if (node->kind == SEA_FOR || node->kind == SEA_WHILE || node->kind == SEA_DO_WHILE) {
+        sea_optimize_loop(slot, data);
+    }
+}
+
+void sea_optimize_loops(sea_node_t **body, sea_compile_ctx *ctx) {
+    sea_optimize_loops_visit(body, ctx);
+}
+
+void sea_compile_impl(const sea_node_t *node, sea_compile_ctx *ctx, asm_builder_t *out, sea_error_t **errout) {
+    size_t count = 0;
+    if ((node->kind == SEA_BINARY || node->kind == SEA_UNARY) && sea_ir_is_pure(node, &count)) {
+        sea_compile_expr(node, count, ctx, out, errout);
+        return;
+    }
+
+    if (node->kind == SEA_BLOCK) {
+        const sea_block_t *block = (const sea_block_t *) node;
+        sea_compile_ctx_push_scope(ctx);
+        for (size_t i = 0; i < block->len; ++i) {
+            sea_compile_stmt(block->stmts[i], ctx, out, errout);
             if (*errout) return;
         }
+        sea_compile_ctx_pop_scope(ctx);
+    } else if (node->kind == SEA_FOR || node->kind == SEA_WHILE || node->kind == SEA_DO_WHILE) {
+        sea_compile_loop((const sea_loop_t *) node, ctx, out, errout);
+    } else if (node->kind == SEA_IF) {
+        const sea_if_t *if_ = (const sea_if_t *) node;
 
-        if (msu_str_eqs(functor->token->content, "putn")) {
-            if (args->children->len != 1) {
-                *errout = sea_error_new(args, msu_str_new("invalid arguments for 'void putn(int)'"));
-                return;
-            }
+        int labelno = ctx->labelno++;
+        const msu_str_t *end = sea_compile_ctx_label(ctx, "if.end", labelno);
+        const msu_str_t *false_label = sea_compile_ctx_label(ctx, "if.false", labelno);
+        const msu_str_t *label0 = sea_compile_ctx_ensure_constant(ctx, 0);
 
-            msu_str_builder_printf(out, "SPOP\nOUT\n");
-            ctx->imm_offset -= 1;
-            return;
-        }
+        sea_compile_branch(if_->cond, false, false_label, ctx, out, errout);
+        if (!*errout) sea_compile_stmt(if_->then, ctx, out, errout);
+        if (!*errout && if_->else_) {
+            asm_builder_op_ref(out, "BRA", end);
 
-        if (msu_str_eqs(functor->token->content, "getn")) {
-            if (args->children->len != 0) {
-                *errout = sea_error_new(args, msu_str_new("invalid arguments for 'int getn(void)'"));
-                return;
+            asm_builder_label(out, false_label);
+            asm_builder_op_ref(out, "ADD", label0);
+
+            sea_compile_stmt(if_->else_, ctx, out, errout);
+            if (!*errout) {
+                asm_builder_label(out, end);
+                asm_builder_op_ref(out, "ADD", label0);
             }
+        } else if (!*errout) {
+            asm_builder_label(out, false_label);
+            asm_builder_op_ref(out, "ADD", label0);
+        }
 
-            msu_str_builder_printf(out, "INP\nSPUSH\n");
-            ctx->imm_offset += 1;
+        msu_str_free(end);
+        msu_str_free(false_label);
+    } else if (node->kind == SEA_VAR) {
+        const sea_var_t *decl = (const sea_var_t *) node;
+        size_t offset = ctx->var_offset++;
+        const msu_str_t *cell = ctx->static_frame ? sea_compile_ctx_new_cell(ctx, ctx->function, decl->name) : NULL;
+        var_t *var = sea_compile_ctx_add_var(ctx, decl->name, offset, cell);
+
+        if (decl->value) {
+            sea_compile_impl(decl->value, ctx, out, errout);
+            if (*errout) return;
+            assert(ctx->imm_offset == 1);
+            sea_compile_store(var, ctx, out);
+        }
+    } else if (node->kind == SEA_RETURN) {
+        const sea_node_t *value = ((const sea_return_t *) node)->value;
+        if (value && sea_is_tail_call(ctx, value)) {
+            sea_compile_tail_call((const sea_call_t *) value, ctx, out, errout);
             return;
         }
 
-        const parsenode_t *func = sea_compile_ctx_find_function(ctx, functor->token->content);
-        if (!func) {
-            *errout = sea_error_new(functor, msu_str_printf("undefined reference to function '%s'",
-                     msu_str_data(functor->token->content)));
-            return;
+        if (value) {
+            sea_compile_impl(value, ctx, out, errout);
+            if (*errout) return;
+            ctx->imm_offset -= 1; // taken along to the return label
         }
-        const parsenode_t *func_params = list_of_parsenodes_get(func->children, 1);
-        const parsenode_t *func_output = list_of_parsenodes_get(func->children, 0);
 
-        ctx->imm_offset -= func_params->children->len; // subtract arguments
-        msu_str_builder_printf(out, "CALL %s\n", msu_str_data(functor->token->content));
+        asm_builder_op_ref(out, "BRA", ctx->return_label);
+    } else if (node->kind == SEA_BINARY) {
+        sea_compile_binary((const sea_binary_t *) node, ctx, out, errout);
+    } else if (node->kind == SEA_UNARY) {
+        const sea_unary_t *unary = (const sea_unary_t *) node;
 
-        if (func_output) {
+        if (unary->op == SEA_OP_NEG) {
+            asm_builder_op_value(out, "SPUSHI", 0);
             ctx->imm_offset += 1;
+            sea_compile_impl(unary->operand, ctx, out, errout);
+            if (*errout) return;
+            asm_builder_op(out, "SSUB");
+            ctx->imm_offset -= 1;
+        } else {
+            sea_compile_impl(unary->operand, ctx, out, errout);
+            if (*errout) return;
+            asm_builder_op(out, "SNOT");
         }
+    } else if (node->kind == SEA_CALL) {
+        sea_compile_call((const sea_call_t *) node, ctx, out, errout);
+    } else if (node->kind == SEA_INDEX) {
+        const sea_index_t *index = (const sea_index_t *) node;
+        const msu_str_t *cell = sea_compile_array_cell(index, ctx, errout);
+        if (*errout) return;
+        sea_compile_impl(index->index, ctx, out, errout);
+        if (*errout) return;
+        asm_builder_op_ref(out, "SLDX", cell);
     } else if (node->kind == SEA_INT) {
-        msu_str_builder_printf(out, "SPUSHI %s\n", msu_str_data(node->token->content));
+        asm_builder_op_value(out, "SPUSHI", ((const sea_int_t *) node)->value);
         ctx->imm_offset += 1;
     } else if (node->kind == SEA_IDENT) {
-        var_t *var = scope_find_var(ctx->scope, node->token->content);
-        size_t offset = ctx->imm_offset + var->frame_offset;
-        msu_str_builder_printf(out, "SLDA %zu\n", offset);
-        ctx->imm_offset += 1;
-    } else if (node->kind == SEA_GROUP) {
-        const parsenode_t *child = list_of_parsenodes_get(node->children, 0);
-        sea_compile_impl(child, ctx, out, errout);
-        if (*errout) return;
+        const msu_str_t *name = ((const sea_ident_t *) node)->name;
+        var_t *var = sea_compile_ctx_find_var(ctx, name);
+        if (!var) {
+            *errout = sea_undefined_variable(ctx, node, name);
+            return;
+        }
+        sea_compile_load(var, ctx, out);
     } else {
-        fprintf(stderr, "current instruction kind is %d\n", node->kind);
-        *errout = sea_error_new(node, msu_str_printf("unimplemented: node->kind = %d", node->kind));
+        *errout = sea_error_new(node->src, msu_str_printf("unimplemented: node->kind = %d", node->kind));
         return;
     }
 }
 
-const msu_str_t *sea_compile(const parsenode_t *node, sea_error_t **errout) {
-    msu_str_builder_t out = msu_str_builder_new();
-    sea_compile_ctx ctx = sea_compile_ctx_new();
-
-    if (node->kind == SEA_PROGRAM) {
-        for (int i = 0; i < node->children->len; ++i) {
-            parsenode_t *def = list_of_parsenodes_get(node->children, i);
-            if (def->kind == SEA_FUNCDEF) {
-                if (!sea_compile_ctx_add_function(&ctx, def)) {
-                    msu_str_builder_free(out);
-                    return NULL;
-                }
-            } else if (def->kind == SEA_VAR) {
-                if (!sea_compile_ctx_add_global(&ctx, def)) {
-                    msu_str_builder_free(out);
-                    return NULL;
-                }
-            } else {
-                *errout = sea_error_new(def, msu_str_printf("unimplemented: def->kind = %d\n", def->kind));
-                return NULL;
+list_of_asm_insrs_t *sea_compile_ir(const parsenode_t *node, sea_error_t **errout) {
+    sea_options_t options = sea_default_options();
+    return sea_compile_ir_with(node, &options, errout);
+}
+
+sea_options_t sea_default_options() {
+    return (sea_options_t) {.static_locals = false, .optimize_loops = true, .threads = 1};
+}
+
+list_of_asm_insrs_t *sea_compile_ir_with(const parsenode_t *node, const sea_options_t *options, sea_error_t **errout) {
+    sea_ast_t *ast = sea_lower(node);
+    const sea_program_t *program = ast->program;
+    if (program->base.kind != SEA_PROGRAM) {
+        *errout = sea_error_new(node, msu_str_new("expected a program"));
+        sea_ast_free(ast);
+        return NULL;
+    }
+
+    asm_builder_t *out = asm_builder_new();
+    sea_compile_ctx ctx = sea_compile_ctx_new(program);
+    ctx.options = options;
+    ctx.ast = ast;
+
+    for (size_t i = 0; i < program->len && !*errout; ++i) {
+        const sea_node_t *def = program->decls[i];
+        if (def->kind == SEA_FUNCDEF) {
+            const sea_funcdef_t *func = (const sea_funcdef_t *) def;
+            if (!sea_compile_ctx_add_function(&ctx, func)) {
+                *errout = sea_error_new(def->src, msu_str_printf("redefinition of function '%s'",
+                                                                 msu_str_data(func->name)));
+            }
+        } else if (def->kind == SEA_VAR) {
+            const sea_var_t *global = (const sea_var_t *) def;
+            if (!sea_compile_ctx_add_global(&ctx, global)) {
+                *errout = sea_error_new(def->src, msu_str_printf("redefinition of global '%s'",
+                                                                 msu_str_data(global->name)));
             }
+        } else if (def->kind == SEA_ARRAY) {
+            const sea_array_t *array = (const sea_array_t *) def;
+            if (!sea_compile_ctx_add_array(&ctx, array)) {
+                *errout = sea_error_new(def->src, msu_str_printf("redefinition of global '%s'",
+                                                                 msu_str_data(array->name)));
+            }
+        } else {
+            *errout = sea_error_new(def->src, msu_str_printf("unimplemented: def->kind = %d\n", def->kind));
         }
     }
 
-    sea_compile_impl(node, &ctx, out, errout);
-    if (*errout) return NULL;
+    for (size_t i = 0; i < program->len && !*errout && options->optimize_loops; ++i) {
+        if (program->decls[i]->kind == SEA_FUNCDEF) {
+            sea_optimize_loops(&((sea_funcdef_t *) program->decls[i])->body, &ctx);
+        }
+    }
 
-    constval_t *constant = ctx.constants;
-    while (constant) {
-        msu_str_builder_printf(out, "%s DAT %d\n", msu_str_data(constant->label), constant->value);
-        constant = constant->next;
+    if (!*errout) sea_compile_program(&ctx, out, errout);
+    sea_ast_free(ast);
+    if (*errout) {
+        sea_compile_ctx_free(&ctx);
+        asm_builder_free(out);
+        return NULL;
     }
 
-    // TODO: free ctx
-    return msu_str_builder_into_string_and_free(out);
+    list_of_asm_insrs_t *insrs = asm_builder_finish(out);
+    asm_consts_finish(ctx.constants, insrs);
+    sea_compile_ctx_free(&ctx);
+    return insrs;
+}
+
+const msu_str_t *sea_compile(const parsenode_t *node, sea_error_t **errout) {
+    list_of_asm_insrs_t *insrs = sea_compile_ir(node, errout);
+    if (!insrs) return NULL;
+    const msu_str_t *out = asm_print(insrs);
+    list_of_asm_insrs_free(insrs, true);
+    return out;
 }
 
 void sea_error_free(sea_error_t *error) {
@@ -0,0 +1,252 @@
+#include "lmsm/sea.h"
+
+#include <assert.h>
+#include <string.h>
+
+typedef struct sea_lowering {
+    allocator_t arena;
+} sea_lowering_t;
+
+void *sea_lower_alloc(sea_lowering_t *me, size_t size, sea_kind_t kind, const parsenode_t *src) {
+    sea_node_t *out = MSU_ALLOC(me->arena, size);
+    assert(out && "out of memory!\n");
+    memset(out, 0, size);
+    out->kind = kind;
+    out->src = src;
+    return out;
+}
+
+sea_node_t *sea_lower_error(sea_lowering_t *me, const parsenode_t *src) {
+    return sea_lower_alloc(me, sizeof(sea_node_t), SEA_ERROR, src);
+}
+
+const parsenode_t *sea_lower_child(const parsenode_t *node, size_t i) {
+    return i < node->children->len ? list_of_parsenodes_get_const(node->children, i) : NULL;
+}
+
+sea_node_t *sea_lower_node(sea_lowering_t *me, const parsenode_t *node);
+
+// a part that may be left out, like the else of an if
+sea_node_t *sea_lower_optional(sea_lowering_t *me, const parsenode_t *node, size_t i) {
+    const parsenode_t *child = sea_lower_child(node, i);
+    return child ? sea_lower_node(me, child) : NULL;
+}
+
+// a part that has to be there, an error in its place if the parser didn't find it
+sea_node_t *sea_lower_required(sea_lowering_t *me, const parsenode_t *node, size_t i) {
+    const parsenode_t *child = sea_lower_child(node, i);
+    return child ? sea_lower_node(me, child) : sea_lower_error(me, node);
+}
+
+// all the children of `node`
+sea_node_t **sea_lower_list(sea_lowering_t *me, const parsenode_t *node, size_t *len) {
+    *len = node->children->len;
+    if (*len == 0) return NULL;
+    sea_node_t **out = MSU_ALLOC(me->arena, *len * sizeof(sea_node_t *));
+    assert(out && "out of memory!\n");
+    for (size_t i = 0; i < *len; i++) out[i] = sea_lower_required(me, node, i);
+    return out;
+}
+
+bool sea_lower_op(const msu_str_t *op, bool unary, sea_op_t *out) {
+    static const struct {
+        const char *text;
+        sea_op_t op;
+    } BINARY[] = {
+            {"=",  SEA_OP_ASSIGN},
+            {"+",  SEA_OP_ADD},
+            {"-",  SEA_OP_SUB},
+            {"*",  SEA_OP_MUL},
+            {"/",  SEA_OP_DIV},
+            {">",  SEA_OP_GT},
+            {">=", SEA_OP_GE},
+            {"<",  SEA_OP_LT},
+            {"<=", SEA_OP_LE},
+            {"==", SEA_OP_EQ},
+            {"!=", SEA_OP_NE},
+            {"&&", SEA_OP_AND},
+            {"||", SEA_OP_OR},
+    };
+    if (unary) {
+        if (msu_str_eqs(op, "-")) *out = SEA_OP_NEG;
+        else if (msu_str_eqs(op, "!")) *out = SEA_OP_NOT;
+        else return false;
+        return true;
+    }
+    for (size_t i = 0; i < sizeof(BINARY) / sizeof(BINARY[0]); i++) {
+        if (msu_str_eqs(op, BINARY[i].text)) {
+            *out = BINARY[i].op;
+            return true;
+        }
+    }
+    return false;
+}
+
+sea_node_t *sea_lower_funcdef(sea_lowering_t *me, const parsenode_t *node) {
+    const parsenode_t *type = sea_lower_child(node, 0);
+    const parsenode_t *params = sea_lower_child(node, 1);
+    if (!type || !type->token || !params || params->kind != SEA_PARAMS) return sea_lower_error(me, node);
+
+    sea_funcdef_t *out = sea_lower_alloc(me, sizeof(sea_funcdef_t), SEA_FUNCDEF, node);
+    out->name = node->token->content;
+    out->returns_int = msu_str_eqs(type->token->content, "int");
+    out->n_params = params->children->len;
+    if (out->n_params > 0) {
+        out->params = MSU_ALLOC(me->arena, out->n_params * sizeof(const msu_str_t *));
+        assert(out->params && "out of memory!\n");
+    }
+    for (size_t i = 0; i < out->n_params; i++) {
+        const parsenode_t *name = sea_lower_child(list_of_parsenodes_get_const(params->children, i), 1);
+        if (!name || name->kind != SEA_IDENT || !name->token) return sea_lower_error(me, node);
+        out->params[i] = name->token->content;
+    }
+    out->body = sea_lower_required(me, node, 2);
+    return &out->base;
+}
+
+sea_node_t *sea_lower_loop(sea_lowering_t *me, const parsenode_t *node) {
+    sea_loop_t *out = sea_lower_alloc(me, sizeof(sea_loop_t), node->kind, node);
+    if (node->kind == SEA_FOR) {
+        out->init = sea_lower_optional(me, node, 0);
+        out->cond = sea_lower_optional(me, node, 1);
+        out->incr = sea_lower_optional(me, node, 2);
+        out->body = sea_lower_required(me, node, 3);
+    } else if (node->kind == SEA_WHILE) {
+        out->cond = sea_lower_required(me, node, 0);
+        out->body = sea_lower_required(me, node, 1);
+    } else {
+        out->body = sea_lower_required(me, node, 0);
+        out->cond = sea_lower_required(me, node, 1);
+    }
+    return &out->base;
+}
+
+sea_node_t *sea_lower_array(sea_lowering_t *me, const parsenode_t *node) {
+    const parsenode_t *length = sea_lower_child(node, 1);
+    if (!length || length->kind != SEA_INT || !length->token) return sea_lower_error(me, node);
+
+    sea_array_t *out = sea_lower_alloc(me, sizeof(sea_array_t), SEA_ARRAY, node);
+    out->name = node->token->content;
+    msu_str_try_parse_int(length->token->content, &out->length);
+    out->n_values = node->children->len - 2;
+    if (out->n_values > 0) {
+        out->values = MSU_ALLOC(me->arena, out->n_values * sizeof(sea_node_t *));
+        assert(out->values && "out of memory!\n");
+    }
+    for (size_t i = 0; i < out->n_values; i++) out->values[i] = sea_lower_required(me, node, i + 2);
+    return &out->base;
+}
+
+sea_node_t *sea_lower_node(sea_lowering_t *me, const parsenode_t *node) {
+    switch (node->kind) {
+        case SEA_FUNCDEF:
+            if (!node->token) break;
+            return sea_lower_funcdef(me, node);
+        case SEA_VAR: {
+            if (!node->token) break;
+            sea_var_t *out = sea_lower_alloc(me, sizeof(sea_var_t), SEA_VAR, node);
+            out->name = node->token->content;
+            out->value = sea_lower_optional(me, node, 1);
+            return &out->base;
+        }
+        case SEA_ARRAY:
+            if (!node->token) break;
+            return sea_lower_array(me, node);
+        case SEA_BLOCK: {
+            sea_block_t *out = sea_lower_alloc(me, sizeof(sea_block_t), SEA_BLOCK, node);
+            out->stmts = sea_lower_list(me, node, &out->len);
+            return &out->base;
+        }
+        case SEA_IF: {
+            sea_if_t *out = sea_lower_alloc(me, sizeof(sea_if_t), SEA_IF, node);
+            out->cond = sea_lower_required(me, node, 0);
+            out->then = sea_lower_required(me, node, 1);
+            out->else_ = sea_lower_optional(me, node, 2);
+            return &out->base;
+        }
+        case SEA_FOR:
+        case SEA_WHILE:
+        case SEA_DO_WHILE:
+            return sea_lower_loop(me, node);
+        case SEA_RETURN: {
+            sea_return_t *out = sea_lower_alloc(me, sizeof(sea_return_t), SEA_RETURN, node);
+            out->value = sea_lower_optional(me, node, 0);
+            return &out->base;
+        }
+        case SEA_BINARY: {
+            sea_op_t op;
+            if (!node->token || !sea_lower_op(node->token->content, false, &op)) break;
+            sea_binary_t *out = sea_lower_alloc(me, sizeof(sea_binary_t), SEA_BINARY, node);
+            out->op = op;
+            out->lhs = sea_lower_required(me, node, 0);
+            out->rhs = sea_lower_required(me, node, 1);
+            return &out->base;
+        }
+        case SEA_UNARY: {
+            sea_op_t op;
+            if (!node->token || !sea_lower_op(node->token->content, true, &op)) break;
+            sea_unary_t *out = sea_lower_alloc(me, sizeof(sea_unary_t), SEA_UNARY, node);
+            out->op = op;
+            out->operand = sea_lower_required(me, node, 0);
+            return &out->base;
+        }
+        case SEA_CALL: {
+            const parsenode_t *args = sea_lower_child(node, 1);
+            if (!args) break;
+            sea_call_t *out = sea_lower_alloc(me, sizeof(sea_call_t), SEA_CALL, node);
+            out->functor = sea_lower_required(me, node, 0);
+            out->args = sea_lower_list(me, args, &out->n_args);
+            return &out->base;
+        }
+        case SEA_INDEX: {
+            sea_index_t *out = sea_lower_alloc(me, sizeof(sea_index_t), SEA_INDEX, node);
+            out->array = sea_lower_required(me, node, 0);
+            out->index = sea_lower_required(me, node, 1);
+            return &out->base;
+        }
+        case SEA_INT: {
+            if (!node->token) break;
+            sea_int_t *out = sea_lower_alloc(me, sizeof(sea_int_t), SEA_INT, node);
+            msu_str_try_parse_int(node->token->content, &out->value);
+            return &out->base;
+        }
+        case SEA_IDENT: {
+            if (!node->token) break;
+            sea_ident_t *out = sea_lower_alloc(me, sizeof(sea_ident_t), SEA_IDENT, node);
+            out->name = node->token->content;
+            return &out->base;
+        }
+        case SEA_GROUP:
+            return sea_lower_required(me, node, 0);
+        default:
+            break;
+    }
+    return sea_lower_error(me, node);
+}
+
+sea_ast_t *sea_lower(const parsenode_t *program) {
+    sea_ast_t *out = malloc(sizeof(sea_ast_t));
+    assert(out && "out of memory!\n");
+    sea_lowering_t lowering = {.arena = arena_alloc_new()};
+
+    out->program = sea_lower_alloc(&lowering, sizeof(sea_program_t), SEA_PROGRAM, program);
+    if (program->kind == SEA_PROGRAM) {
+        out->program->decls = sea_lower_list(&lowering, program, &out->program->len);
+    } else {
+        // something other than a program, which the compiler reports
+        out->program->base.kind = SEA_ERROR;
+    }
+    out->arena = lowering.arena;
+    return out;
+}
+
+void *sea_ast_new(sea_ast_t *ast, size_t size, sea_kind_t kind, const parsenode_t *src) {
+    sea_lowering_t lowering = {.arena = ast->arena};
+    return sea_lower_alloc(&lowering, size, kind, src);
+}
+
+void sea_ast_free(sea_ast_t *ast) {
+    if (!ast) return;
+    arena_alloc_free(&ast->arena);
+    free(ast);
+}
@@ -0,0 +1,219 @@
+#include "lmsm/sea.h"
+
+#include "msulib/fs.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BT_IMPL
+#define BT_NAME sea_cache_index
+#define BT_KEY hash_t
+#define BT_VALUE sea_cache_entry_t *
+#define BT_HASHFUNC(x) ((size_t) (x))
+#define BT_EQFUNC(a, b) ((a) == (b))
+#include "templates/btree.h"
+#undef bt_getv
+
+// the options that change the code, the thread count doesn't
+int sea_cache_flags(const sea_options_t *options) {
+    return (options->static_locals ? 1 : 0) | (options->optimize_loops ? 2 : 0);
+}
+
+hash_t sea_cache_key(const msu_str_t *src, int flags) {
+    int header[] = {SEA_CACHE_VERSION, flags};
+    hash_t seed = murmurhash(header, sizeof(header), 366);
+    return murmurhash(msu_str_data(src), msu_str_len(src), seed);
+}
+
+sea_cache_t *sea_cache_new(size_t max, const char *dir) {
+    sea_cache_t *out = calloc(1, sizeof(sea_cache_t));
+    assert(out && "out of memory!\n");
+    out->max = max > 0 ? max : 1;
+    out->index = sea_cache_index_new();
+    out->dir = dir ? msu_str_new(dir) : NULL;
+    return out;
+}
+
+void sea_cache_entry_free(sea_cache_entry_t *entry) {
+    msu_str_free(entry->src);
+    msu_str_free(entry->assembly);
+    free(entry);
+}
+
+void sea_cache_free(sea_cache_t *cache) {
+    if (!cache) return;
+    sea_cache_entry_t *entry = cache->newest;
+    while (entry) {
+        sea_cache_entry_t *older = entry->older;
+        sea_cache_entry_free(entry);
+        entry = older;
+    }
+    sea_cache_index_free(cache->index);
+    msu_str_free(cache->dir);
+    free(cache);
+}
+
+void sea_cache_unlink(sea_cache_t *cache, sea_cache_entry_t *entry) {
+    if (entry->newer) entry->newer->older = entry->older;
+    else cache->newest = entry->older;
+    if (entry->older) entry->older->newer = entry->newer;
+    else cache->oldest = entry->newer;
+    entry->newer = entry->older = NULL;
+    cache->len -= 1;
+}
+
+// puts `entry` in front, dropping the least recently used one if the cache is full
+void sea_cache_push(sea_cache_t *cache, sea_cache_entry_t *entry) {
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if (cache->newest) cache->newest->newer = entry;
+    else cache->oldest = entry;
+    cache->newest = entry;
+    cache->len += 1;
+
+    while (cache->len > cache->max) {
+        sea_cache_entry_t *oldest = cache->oldest;
+        sea_cache_unlink(cache, oldest);
+        sea_cache_index_remove(cache->index, oldest->key, NULL);
+        sea_cache_entry_free(oldest);
+    }
+}
+
+// adds `entry` in front, in place of whatever had its key
+void sea_cache_add(sea_cache_t *cache, sea_cache_entry_t *entry) {
+    sea_cache_entry_t **seen = sea_cache_index_getv(cache->index, entry->key);
+    if (seen) {
+        sea_cache_unlink(cache, *seen);
+        sea_cache_entry_free(*seen);
+    }
+    sea_cache_index_insert(cache->index, entry->key, entry);
+    sea_cache_push(cache, entry);
+}
+
+const msu_str_t *sea_cache_path(const sea_cache_t *cache, hash_t key) {
+    return msu_str_printf("%s/%08x.seacache", msu_str_data(cache->dir), (unsigned) key);
+}
+
+//======================================================
+//  Files
+//
+//  an entry on disk is text:
+//
+//      version 1
+//      flags 1
+//      src 27
+//      <the source>
+//      asm 410
+//      <the assembly>
+//      code 901 ... (MIDDLE_OF_MEMORY numbers)
+//
+//  a file that doesn't read back, or that another version
+//  of the compiler wrote, is as good as none
+//======================================================
+
+void sea_cache_write(const sea_cache_t *cache, const sea_cache_entry_t *entry) {
+    const msu_str_t *path = sea_cache_path(cache, entry->key);
+    FILE *file = fopen(msu_str_data(path), "w");
+    msu_str_free(path);
+    if (!file) return;
+
+    fprintf(file, "version %d\nflags %d\nsrc %zu\n", SEA_CACHE_VERSION, entry->flags, msu_str_len(entry->src));
+    fwrite(msu_str_data(entry->src), 1, msu_str_len(entry->src), file);
+    fprintf(file, "\nasm %zu\n", msu_str_len(entry->assembly));
+    fwrite(msu_str_data(entry->assembly), 1, msu_str_len(entry->assembly), file);
+    fprintf(file, "\ncode");
+    for (size_t i = 0; i < MIDDLE_OF_MEMORY; i++) fprintf(file, " %d", entry->code[i]);
+    fprintf(file, "\n");
+    fclose(file);
+}
+
+// reads `tag len\n` and the `len` bytes after it, moving *at past them
+const msu_str_t *sea_cache_read_text(const char **at, const char *end, const char *tag) {
+    size_t tag_len = strlen(tag);
+    if ((size_t) (end - *at) < tag_len + 1 || strncmp(*at, tag, tag_len) != 0 || (*at)[tag_len] != ' ') return NULL;
+    char *after;
+    size_t len = strtoul(*at + tag_len + 1, &after, 10);
+    if (*after != '\n' || (size_t) (end - after - 1) < len + 1) return NULL;
+    const msu_str_t *out = msu_str_new_substring(after + 1, len);
+    *at = after + 1 + len + 1;
+    return out;
+}
+
+sea_cache_entry_t *sea_cache_read(const sea_cache_t *cache, hash_t key, const msu_str_t *src, int flags) {
+    const msu_str_t *path = sea_cache_path(cache, key), *text = NULL;
+    fs_error_t err = fs_read_to_string(path, &text);
+    msu_str_free(path);
+    if (err != FS_ERROR_NONE) return NULL;
+
+    const char *at = msu_str_data(text), *end = at + msu_str_len(text);
+    sea_cache_entry_t *entry = calloc(1, sizeof(sea_cache_entry_t));
+    assert(entry && "out of memory!\n");
+    entry->key = key;
+    int version = 0, header_len = 0;
+    bool ok = sscanf(at, "version %d\nflags %d%n", &version, &entry->flags, &header_len) == 2
+              && version == SEA_CACHE_VERSION && entry->flags == flags && at[header_len] == '\n';
+    if (ok) {
+        at += header_len + 1;
+        entry->src = sea_cache_read_text(&at, end, "src");
+        // a different source with the same hash is a miss
+        ok = entry->src && msu_str_eq(entry->src, src);
+    }
+    if (ok) {
+        entry->assembly = sea_cache_read_text(&at, end, "asm");
+        ok = entry->assembly && strncmp(at, "code", 4) == 0;
+        at += 4;
+    }
+    for (size_t i = 0; ok && i < MIDDLE_OF_MEMORY; i++) {
+        char *after;
+        entry->code[i] = (int) strtol(at, &after, 10);
+        ok = after != at;
+        at = after;
+    }
+
+    msu_str_free(text);
+    if (!ok) {
+        sea_cache_entry_free(entry);
+        return NULL;
+    }
+    return entry;
+}
+
+//======================================================
+//  Lookups
+//======================================================
+
+const sea_cache_entry_t *sea_cache_lookup(sea_cache_t *cache, const msu_str_t *src, const sea_options_t *options) {
+    int flags = sea_cache_flags(options);
+    hash_t key = sea_cache_key(src, flags);
+    sea_cache_entry_t **seen = sea_cache_index_getv(cache->index, key);
+    if (seen && (*seen)->flags == flags && msu_str_eq((*seen)->src, src)) {
+        sea_cache_unlink(cache, *seen);
+        sea_cache_push(cache, *seen);
+        cache->hits += 1;
+        return *seen;
+    }
+
+    sea_cache_entry_t *entry = cache->dir ? sea_cache_read(cache, key, src, flags) : NULL;
+    if (!entry) {
+        cache->misses += 1;
+        return NULL;
+    }
+    sea_cache_add(cache, entry);
+    cache->hits += 1;
+    return entry;
+}
+
+void sea_cache_store(sea_cache_t *cache, const msu_str_t *src, const sea_options_t *options,
+                     const msu_str_t *assembly, const int *code) {
+    sea_cache_entry_t *entry = calloc(1, sizeof(sea_cache_entry_t));
+    assert(entry && "out of memory!\n");
+    entry->flags = sea_cache_flags(options);
+    entry->key = sea_cache_key(src, entry->flags);
+    entry->src = msu_str_clone(src);
+    entry->assembly = msu_str_clone(assembly);
+    memcpy(entry->code, code, sizeof(entry->code));
+
+    if (cache->dir) sea_cache_write(cache, entry);
+    sea_cache_add(cache, entry);
+}
@@ -0,0 +1,570 @@
+#include "lmsm/superopt.h"
+#include "lmsm/asm_insrlist.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BT_IMPL
+#define BT_NAME superopt_pattern_index
+#define BT_KEY const msu_str_t *
+#define BT_VALUE size_t
+#define BT_HASHFUNC(x) msu_str_hash(x, 42)
+#define BT_EQFUNC msu_str_eq
+#define BT_FREE_KEY(k) msu_str_free(k)
+#include "templates/btree.h"
+#undef bt_getv
+
+//======================================================
+//  Sequences
+//======================================================
+
+const char *SUPEROPT_STACK_INSRS[] = {"SPUSH", "SPOP", "SDUP", "SDROP", "SSWAP", "SADD", "SSUB", "SMUL",
+                                      "SDIV", "SMAX", "SMIN", "SCMPGT", "SCMPLT", "SNOT"};
+const char *SUPEROPT_VALUE_INSRS[] = {"LDI", "SPUSHI"};
+const char *SUPEROPT_OFFSET_INSRS[] = {"SLDA", "SSTA", "SPADD", "SPSUB"};
+
+#define SUPEROPT_COUNT(xs) (sizeof(xs) / sizeof((xs)[0]))
+#define SUPEROPT_MAX_OFFSET 8 // offsets past this reach beyond the stack the tests set up
+
+bool superopt_is_one_of(const char *name, const char **names, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (strcmp(name, names[i]) == 0) return true;
+    }
+    return false;
+}
+
+bool superopt_seq_is_cheaper(const superopt_seq_t *seq, const superopt_seq_t *than) {
+    if (seq->len != than->len) return seq->len < than->len;
+    int cells = 0, than_cells = 0;
+    for (size_t i = 0; i < seq->len; i++) cells += opt_step_size(&seq->steps[i]);
+    for (size_t i = 0; i < than->len; i++) than_cells += opt_step_size(&than->steps[i]);
+    return cells < than_cells;
+}
+
+const msu_str_t *superopt_seq_print(const superopt_seq_t *seq) {
+    msu_str_builder_t out = msu_str_builder_new();
+    for (size_t i = 0; i < seq->len; i++) {
+        const opt_step_t *step = &seq->steps[i];
+        msu_str_builder_printf(out, "%s%s", i > 0 ? "; " : "", step->insr);
+        if (step->arg == OPT_ARG_VAR) msu_str_builder_printf(out, " %c", 'a' + step->value);
+        if (step->arg == OPT_ARG_INT) msu_str_builder_printf(out, " %d", step->value);
+    }
+    return msu_str_builder_into_string_and_free(out);
+}
+
+//======================================================
+//  Patterns
+//======================================================
+
+superopt_patterns_t *superopt_patterns_new() {
+    superopt_patterns_t *out = calloc(1, sizeof(superopt_patterns_t));
+    assert(out && "out of memory!\n");
+    out->index = superopt_pattern_index_new();
+    return out;
+}
+
+void superopt_patterns_free(superopt_patterns_t *patterns) {
+    if (patterns) {
+        superopt_pattern_index_free(patterns->index);
+        free(patterns->patterns);
+        free(patterns);
+    }
+}
+
+// the step `insr` is in a pattern, with `values` the constants seen so far in the window
+bool superopt_step_of(const asm_insr_t *insr, opt_step_t *step, int *values, size_t *value_count) {
+    const char *name = msu_str_data(insr->instruction);
+    if (insr->error || strlen(name) >= sizeof(step->insr)) return false;
+    strcpy(step->insr, name);
+    step->arg = OPT_ARG_NONE;
+    step->value = 0;
+
+    if (superopt_is_one_of(name, SUPEROPT_STACK_INSRS, SUPEROPT_COUNT(SUPEROPT_STACK_INSRS))) return true;
+    if (!msu_str_is_empty(insr->label_reference) || insr->value < 0) return false;
+
+    if (superopt_is_one_of(name, SUPEROPT_OFFSET_INSRS, SUPEROPT_COUNT(SUPEROPT_OFFSET_INSRS))) {
+        step->arg = OPT_ARG_INT;
+        step->value = insr->value;
+        return insr->value < SUPEROPT_MAX_OFFSET;
+    }
+    if (!superopt_is_one_of(name, SUPEROPT_VALUE_INSRS, SUPEROPT_COUNT(SUPEROPT_VALUE_INSRS))) return false;
+
+    if (insr->value <= 1) {
+        step->arg = OPT_ARG_INT;
+        step->value = insr->value;
+        return true;
+    }
+    // the same constant is the same variable
+    step->arg = OPT_ARG_VAR;
+    for (step->value = 0; step->value < (int) *value_count; step->value++) {
+        if (values[step->value] == insr->value) return true;
+    }
+    values[(*value_count)++] = insr->value;
+    return true;
+}
+
+void superopt_patterns_count(superopt_patterns_t *patterns, const superopt_seq_t *seq) {
+    const msu_str_t *key = superopt_seq_print(seq);
+    size_t *index = superopt_pattern_index_getv(patterns->index, key);
+    if (index) {
+        patterns->patterns[*index].count++;
+        msu_str_free(key);
+        return;
+    }
+
+    if (patterns->len == patterns->cap) {
+        patterns->cap = patterns->cap ? patterns->cap * 2 : 64;
+        patterns->patterns = realloc(patterns->patterns, patterns->cap * sizeof(superopt_pattern_t));
+        assert(patterns->patterns && "out of memory!\n");
+    }
+    patterns->patterns[patterns->len] = (superopt_pattern_t) {.seq = *seq, .count = 1};
+    superopt_pattern_index_insert(patterns->index, key, patterns->len++);
+}
+
+void superopt_patterns_add(superopt_patterns_t *patterns, const list_of_asm_insrs_t *insrs, size_t max_len) {
+    if (max_len > OPT_WINDOW_MAX) max_len = OPT_WINDOW_MAX;
+    for (size_t start = 0; start < insrs->len; start++) {
+        superopt_seq_t seq = {0};
+        int values[OPT_WINDOW_MAX];
+        size_t value_count = 0;
+        for (size_t i = start; i < insrs->len && seq.len < max_len; i++) {
+            const asm_insr_t *insr = list_of_asm_insrs_get_const(insrs, i);
+            // like the peephole matcher, nothing may jump into the window
+            if (i > start && !msu_str_is_empty(insr->label)) break;
+            if (!superopt_step_of(insr, &seq.steps[seq.len], values, &value_count)) break;
+            seq.len++;
+            if (seq.len >= 2) superopt_patterns_count(patterns, &seq);
+        }
+    }
+}
+
+//======================================================
+//  Running
+//
+//  the tests run with SUPEROPT_DEPTH cells on the stack and
+//  SUPEROPT_BELOW cells of garbage under it, deep enough that
+//  only dividing by zero can fault
+//======================================================
+
+#define SUPEROPT_DEPTH 16
+#define SUPEROPT_BELOW 8
+#define SUPEROPT_CELLS (SUPEROPT_BELOW + SUPEROPT_DEPTH)
+#define SUPEROPT_SP (TOP_OF_MEMORY + 1 - SUPEROPT_DEPTH)
+#define SUPEROPT_FIRST_CELL (SUPEROPT_SP - SUPEROPT_BELOW)
+
+typedef struct superopt_state {
+    int acc;
+    int cells[SUPEROPT_CELLS]; // from SUPEROPT_FIRST_CELL up
+    int vars[OPT_WINDOW_MAX];
+} superopt_state_t;
+
+typedef struct superopt_result {
+    bool faulted;
+    int acc, sp;
+    int cells[SUPEROPT_CELLS];
+} superopt_result_t;
+
+// a sequence with its opcodes looked up, and SPUSHI split up like the assembler does
+typedef struct superopt_code {
+    struct {
+        const emulator_opcode_t *op;
+        opt_arg_kind_t arg;
+        int value;
+    } insrs[2 * OPT_WINDOW_MAX];
+    size_t len;
+} superopt_code_t;
+
+superopt_code_t superopt_compile(const superopt_seq_t *seq) {
+    superopt_code_t out = {0};
+    for (size_t i = 0; i < seq->len; i++) {
+        const opt_step_t *step = &seq->steps[i];
+        bool push = strcmp(step->insr, "SPUSHI") == 0;
+        out.insrs[out.len].op = emulator_find_opcode(push ? "LDI" : step->insr);
+        out.insrs[out.len].arg = step->arg;
+        out.insrs[out.len].value = step->value;
+        assert(out.insrs[out.len].op && "not a machine instruction\n");
+        out.len++;
+        if (push) {
+            out.insrs[out.len].op = emulator_find_opcode("SPUSH");
+            out.insrs[out.len].arg = OPT_ARG_NONE;
+            out.len++;
+        }
+    }
+    return out;
+}
+
+void superopt_run(emulator_t *em, const superopt_code_t *code, const superopt_state_t *state,
+                  superopt_result_t *out) {
+    em->status = STATUS_RUNNING;
+    em->error_code = ERROR_NONE;
+    em->accumulator = state->acc;
+    em->stack_pointer = SUPEROPT_SP;
+    memcpy(&em->memory[SUPEROPT_FIRST_CELL], state->cells, sizeof(state->cells));
+
+    out->faulted = false;
+    for (size_t i = 0; i < code->len && !out->faulted; i++) {
+        int operand = code->insrs[i].arg == OPT_ARG_VAR ? state->vars[code->insrs[i].value] : code->insrs[i].value;
+        emulator_exec_instruction(em, emulator_encode(code->insrs[i].op, operand));
+        out->faulted = em->status == STATUS_HALTED;
+    }
+    out->acc = em->accumulator;
+    out->sp = em->stack_pointer;
+    memcpy(out->cells, &em->memory[SUPEROPT_FIRST_CELL], sizeof(out->cells));
+}
+
+bool superopt_same_result(const superopt_result_t *a, const superopt_result_t *b) {
+    if (a->faulted || b->faulted) return a->faulted == b->faulted;
+    if (a->acc != b->acc || a->sp != b->sp) return false;
+    // below the stack pointer is garbage
+    size_t from = a->sp > SUPEROPT_FIRST_CELL ? a->sp - SUPEROPT_FIRST_CELL : 0;
+    return memcmp(&a->cells[from], &b->cells[from], (SUPEROPT_CELLS - from) * sizeof(int)) == 0;
+}
+
+//======================================================
+//  States
+//======================================================
+
+unsigned superopt_rand(unsigned *seed) {
+    // xorshift, the same stream on every platform
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+// mostly anything, but the values where arithmetic goes wrong come up often
+int superopt_rand_value(unsigned *seed) {
+    static const int EDGES[] = {0, 1, -1, 2, -2, 999, -999, 998, -998, 500, -500};
+    if (superopt_rand(seed) % 4 == 0) return EDGES[superopt_rand(seed) % SUPEROPT_COUNT(EDGES)];
+    return (int) (superopt_rand(seed) % 1999) - 999;
+}
+
+// LDI only takes 0 to 99
+int superopt_rand_var(unsigned *seed) {
+    return superopt_rand(seed) % 4 == 0 ? (int) (superopt_rand(seed) % 3) : (int) (superopt_rand(seed) % 100);
+}
+
+void superopt_rand_state(superopt_state_t *state, unsigned *seed) {
+    state->acc = superopt_rand_value(seed);
+    for (size_t i = 0; i < SUPEROPT_CELLS; i++) state->cells[i] = superopt_rand_value(seed);
+    for (size_t i = 0; i < OPT_WINDOW_MAX; i++) state->vars[i] = superopt_rand_var(seed);
+}
+
+// the inputs a sweep goes through: the accumulator, each cell on the stack and each variable
+int *superopt_input(superopt_state_t *state, size_t input, int *lo, int *hi) {
+    *lo = -999;
+    *hi = 999;
+    if (input == 0) return &state->acc;
+    if (input <= SUPEROPT_DEPTH) return &state->cells[SUPEROPT_BELOW + input - 1];
+    *lo = 0;
+    *hi = 99;
+    return &state->vars[input - 1 - SUPEROPT_DEPTH];
+}
+
+#define SUPEROPT_INPUTS (1 + SUPEROPT_DEPTH + OPT_WINDOW_MAX)
+
+//======================================================
+//  Search
+//======================================================
+
+superopt_options_t superopt_default_options() {
+    return (superopt_options_t) {
+        .max_len = 3,
+        .min_count = 2,
+        .tests = 64,
+        .exhaustive = false,
+        .threads = 4,
+        .seed = 366,
+    };
+}
+
+bool superopt_agree(emulator_t *em, const superopt_code_t *a, const superopt_code_t *b,
+                    const superopt_state_t *state) {
+    superopt_result_t ra, rb;
+    superopt_run(em, a, state, &ra);
+    superopt_run(em, b, state, &rb);
+    return superopt_same_result(&ra, &rb);
+}
+
+bool superopt_equivalent(const superopt_seq_t *a, const superopt_seq_t *b, const superopt_options_t *options) {
+    superopt_code_t code_a = superopt_compile(a), code_b = superopt_compile(b);
+    emulator_t *em = emulator_new();
+    unsigned seed = options->seed | 1;
+    superopt_state_t state;
+    bool same = true;
+
+    for (int t = 0; t < options->tests && same; t++) {
+        superopt_rand_state(&state, &seed);
+        same = superopt_agree(em, &code_a, &code_b, &state);
+    }
+
+    // every value of each input, with the rest random
+    for (size_t input = 0; input < SUPEROPT_INPUTS && same; input++) {
+        int lo, hi;
+        for (int v = -999; v <= 999 && same; v++) {
+            superopt_rand_state(&state, &seed);
+            int *x = superopt_input(&state, input, &lo, &hi);
+            if (v < lo || v > hi) continue;
+            *x = v;
+            same = superopt_agree(em, &code_a, &code_b, &state);
+        }
+    }
+
+    // every pair, where most of what a short sequence reads is
+    const size_t PAIRS[][2] = {{0, 1}, {1, 2}, {0, 2}};
+    for (size_t p = 0; p < SUPEROPT_COUNT(PAIRS) && options->exhaustive && same; p++) {
+        superopt_rand_state(&state, &seed);
+        int lo, hi;
+        int *x = superopt_input(&state, PAIRS[p][0], &lo, &hi);
+        int *y = superopt_input(&state, PAIRS[p][1], &lo, &hi);
+        for (*x = -999; *x <= 999 && same; (*x)++) {
+            for (*y = -999; *y <= 999 && same; (*y)++) {
+                same = superopt_agree(em, &code_a, &code_b, &state);
+            }
+        }
+    }
+
+    emulator_free(em);
+    return same;
+}
+
+typedef struct superopt_alphabet {
+    opt_step_t steps[64];
+    size_t len;
+} superopt_alphabet_t;
+
+void superopt_alphabet_add(superopt_alphabet_t *alphabet, const char *name, opt_arg_kind_t arg, int value) {
+    for (size_t i = 0; i < alphabet->len; i++) {
+        const opt_step_t *step = &alphabet->steps[i];
+        if (strcmp(step->insr, name) == 0 && step->arg == arg && step->value == value) return;
+    }
+    assert(alphabet->len < SUPEROPT_COUNT(alphabet->steps));
+    opt_step_t *step = &alphabet->steps[alphabet->len++];
+    strcpy(step->insr, name);
+    step->arg = arg;
+    step->value = value;
+}
+
+// what candidates for `pattern` are made of: the stack instructions, and the constants,
+// variables and offsets the pattern uses plus 0 and 1
+superopt_alphabet_t superopt_alphabet(const superopt_seq_t *pattern) {
+    superopt_alphabet_t out = {0};
+    for (size_t i = 0; i < SUPEROPT_COUNT(SUPEROPT_STACK_INSRS); i++) {
+        superopt_alphabet_add(&out, SUPEROPT_STACK_INSRS[i], OPT_ARG_NONE, 0);
+    }
+
+    opt_step_t args[OPT_WINDOW_MAX + 2] = {{.arg = OPT_ARG_INT, .value = 0}, {.arg = OPT_ARG_INT, .value = 1}};
+    size_t arg_count = 2;
+    for (size_t i = 0; i < pattern->len; i++) {
+        if (pattern->steps[i].arg != OPT_ARG_NONE) args[arg_count++] = pattern->steps[i];
+    }
+
+    for (size_t a = 0; a < arg_count; a++) {
+        for (size_t i = 0; i < SUPEROPT_COUNT(SUPEROPT_VALUE_INSRS); i++) {
+            superopt_alphabet_add(&out, SUPEROPT_VALUE_INSRS[i], args[a].arg, args[a].value);
+        }
+        for (size_t i = 0; i < SUPEROPT_COUNT(SUPEROPT_OFFSET_INSRS) && args[a].arg == OPT_ARG_INT; i++) {
+            superopt_alphabet_add(&out, SUPEROPT_OFFSET_INSRS[i], OPT_ARG_INT, args[a].value);
+        }
+    }
+    return out;
+}
+
+bool superopt_search(const superopt_seq_t *pattern, const superopt_options_t *options, superopt_seq_t *out) {
+    superopt_alphabet_t alphabet = superopt_alphabet(pattern);
+    superopt_code_t pattern_code = superopt_compile(pattern);
+    emulator_t *em = emulator_new();
+
+    // what the pattern does on the random states, every candidate is held against these first
+    size_t tests = options->tests > 0 ? (size_t) options->tests : 1;
+    superopt_state_t *states = malloc(tests * sizeof(superopt_state_t));
+    superopt_result_t *expected = malloc(tests * sizeof(superopt_result_t));
+    assert(states && expected && "out of memory!\n");
+    unsigned seed = options->seed | 1;
+    for (size_t t = 0; t < tests; t++) {
+        superopt_rand_state(&states[t], &seed);
+        superopt_run(em, &pattern_code, &states[t], &expected[t]);
+    }
+
+    // fewer instructions always wins, so the first length with a match is the last one tried
+    bool found = false;
+    for (size_t len = 0; len <= pattern->len && !found; len++) {
+        size_t digits[OPT_WINDOW_MAX] = {0};
+        superopt_seq_t candidate = {.len = len};
+        bool more = true;
+        while (more) {
+            for (size_t i = 0; i < len; i++) candidate.steps[i] = alphabet.steps[digits[i]];
+
+            bool better = superopt_seq_is_cheaper(&candidate, pattern) && (!found || superopt_seq_is_cheaper(&candidate, out));
+            if (better) {
+                superopt_code_t code = superopt_compile(&candidate);
+                bool same = true;
+                for (size_t t = 0; t < tests && same; t++) {
+                    superopt_result_t result;
+                    superopt_run(em, &code, &states[t], &result);
+                    same = superopt_same_result(&result, &expected[t]);
+                }
+                if (same && superopt_equivalent(pattern, &candidate, options)) {
+                    *out = candidate;
+                    found = true;
+                }
+            }
+
+            // the next candidate, like an odometer
+            more = false;
+            for (size_t i = len; i > 0 && !more; i--) {
+                more = ++digits[i - 1] < alphabet.len;
+                if (!more) digits[i - 1] = 0;
+            }
+        }
+    }
+
+    free(states);
+    free(expected);
+    emulator_free(em);
+    return found;
+}
+
+//======================================================
+//  Searching everything
+//======================================================
+
+typedef struct superopt_job {
+    const superopt_seq_t **patterns;
+    superopt_seq_t *found;
+    bool *has_found;
+    size_t len, next;
+    const superopt_options_t *options;
+    pthread_mutex_t lock;
+} superopt_job_t;
+
+void *superopt_worker(void *arg) {
+    superopt_job_t *job = arg;
+    while (true) {
+        pthread_mutex_lock(&job->lock);
+        size_t i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (i >= job->len) return NULL;
+        job->has_found[i] = superopt_search(job->patterns[i], job->options, &job->found[i]);
+    }
+}
+
+// an instance of `seq`, with variables as constants no literal in a rule could match
+list_of_asm_insrs_t *superopt_instantiate(const superopt_seq_t *seq) {
+    asm_builder_t *builder = asm_builder_new();
+    for (size_t i = 0; i < seq->len; i++) {
+        const opt_step_t *step = &seq->steps[i];
+        if (step->arg == OPT_ARG_NONE) {
+            asm_builder_op(builder, step->insr);
+        } else {
+            asm_builder_op_value(builder, step->insr, step->arg == OPT_ARG_VAR ? 50 + step->value : step->value);
+        }
+    }
+    return asm_builder_finish(builder);
+}
+
+bool superopt_is_rewritten(const superopt_seq_t *seq, const opt_rules_t *rules) {
+    list_of_asm_insrs_t *insrs = superopt_instantiate(seq);
+    list_of_asm_insrs_t *rewritten = opt_peephole(insrs, rules);
+    const msu_str_t *before = asm_print(insrs), *after = asm_print(rewritten);
+    bool out = !msu_str_eq(before, after);
+    msu_str_free(before);
+    msu_str_free(after);
+    list_of_asm_insrs_free(insrs, true);
+    list_of_asm_insrs_free(rewritten, true);
+    return out;
+}
+
+void superopt_rules_add(opt_rules_t *rules, const superopt_seq_t *pattern, const superopt_seq_t *rewrite) {
+    if (rules->len == rules->cap) {
+        rules->cap = rules->cap ? rules->cap * 2 : 16;
+        rules->rules = realloc(rules->rules, rules->cap * sizeof(opt_rule_t));
+        assert(rules->rules && "out of memory!\n");
+    }
+    opt_rule_t *rule = &rules->rules[rules->len++];
+    memcpy(rule->pattern, pattern->steps, sizeof(rule->pattern));
+    rule->pattern_len = pattern->len;
+    memcpy(rule->rewrite, rewrite->steps, sizeof(rule->rewrite));
+    rule->rewrite_len = rewrite->len;
+}
+
+// shortest first, then the most common
+int superopt_pattern_cmp(const void *a, const void *b) {
+    const superopt_pattern_t *x = *(const superopt_pattern_t **) a, *y = *(const superopt_pattern_t **) b;
+    if (x->seq.len != y->seq.len) return x->seq.len < y->seq.len ? -1 : 1;
+    if (x->count != y->count) return x->count > y->count ? -1 : 1;
+    return x < y ? -1 : x > y;
+}
+
+const msu_str_t *superopt_search_all(const superopt_patterns_t *patterns, const opt_rules_t *rules,
+                                     const superopt_options_t *options) {
+    size_t n = patterns->len;
+    const superopt_pattern_t **order = malloc((n + 1) * sizeof(superopt_pattern_t *));
+    const superopt_seq_t **batch = malloc((n + 1) * sizeof(superopt_seq_t *));
+    const superopt_pattern_t **batch_of = malloc((n + 1) * sizeof(superopt_pattern_t *));
+    superopt_seq_t *found = malloc((n + 1) * sizeof(superopt_seq_t));
+    bool *has_found = malloc((n + 1) * sizeof(bool));
+    int threads = options->threads > 0 ? options->threads : 1;
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    assert(order && batch && batch_of && found && has_found && workers && "out of memory!\n");
+    for (size_t i = 0; i < n; i++) order[i] = &patterns->patterns[i];
+    qsort(order, n, sizeof(superopt_pattern_t *), superopt_pattern_cmp);
+
+    // the rules so far, the given ones and then everything found
+    opt_rules_t known = {0};
+    for (size_t r = 0; r < rules->len; r++) {
+        superopt_seq_t pattern = {.len = rules->rules[r].pattern_len}, rewrite = {.len = rules->rules[r].rewrite_len};
+        memcpy(pattern.steps, rules->rules[r].pattern, sizeof(pattern.steps));
+        memcpy(rewrite.steps, rules->rules[r].rewrite, sizeof(rewrite.steps));
+        superopt_rules_add(&known, &pattern, &rewrite);
+    }
+
+    msu_str_builder_t out = msu_str_builder_new();
+    msu_str_builder_printf(out, "# found by superopt, do not edit\n");
+    size_t searched = 0, start = 0;
+    while (start < n) {
+        // one length at a time, so longer patterns see the rules for the shorter ones
+        size_t end = start, len = 0;
+        while (end < n && order[end]->seq.len == order[start]->seq.len) {
+            const superopt_pattern_t *pattern = order[end++];
+            if (pattern->count < options->min_count || pattern->seq.len > options->max_len) continue;
+            if (superopt_is_rewritten(&pattern->seq, &known)) continue;
+            batch_of[len] = pattern;
+            batch[len++] = &pattern->seq;
+        }
+
+        superopt_job_t job = {.patterns = batch, .found = found, .has_found = has_found, .len = len,
+                              .options = options};
+        pthread_mutex_init(&job.lock, NULL);
+        int started = 0;
+        while (started < threads && pthread_create(&workers[started], NULL, superopt_worker, &job) == 0) started++;
+        // short of threads, this one searches what the others haven't taken
+        if (started < threads) superopt_worker(&job);
+        for (int t = 0; t < started; t++) pthread_join(workers[t], NULL);
+        pthread_mutex_destroy(&job.lock);
+
+        for (size_t i = 0; i < len; i++) {
+            if (!has_found[i]) continue;
+            superopt_rules_add(&known, batch[i], &found[i]);
+            const msu_str_t *pattern = superopt_seq_print(batch[i]), *rewrite = superopt_seq_print(&found[i]);
+            msu_str_builder_printf(out, "%s =>%s%s  # seen %d times\n", msu_str_data(pattern),
+                                   found[i].len ? " " : "", msu_str_data(rewrite), batch_of[i]->count);
+            msu_str_free(pattern);
+            msu_str_free(rewrite);
+        }
+        searched += len;
+        start = end;
+    }
+    msu_str_builder_printf(out, "# %zu patterns searched\n", searched);
+
+    free(known.rules);
+    free(order);
+    free(batch);
+    free(batch_of);
+    free(found);
+    free(has_found);
+    free(workers);
+    return msu_str_builder_into_string_and_free(out);
+}
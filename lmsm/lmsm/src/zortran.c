@@ -241,36 +241,37 @@ const msu_str_t *zt_context_ensure_val(zt_context_t *vars, token *val) {
     return name;
 }
 
-void zt_compile_impl(parsenode_t *node, zt_context_t *ctx, msu_str_builder_t sb) {
+void zt_compile_impl(parsenode_t *node, zt_context_t *ctx, asm_builder_t *out) {
     if (node->kind == ZT_PROGRAM) {
         for (size_t i = 0; i < node->children->len; i++) {
             parsenode_t *child = list_of_parsenodes_get(node->children, i);
-            zt_compile_impl(child, ctx, sb);
+            zt_compile_impl(child, ctx, out);
         }
-        msu_str_builder_pushs(sb, "HLT\n");
+        asm_builder_op(out, "HLT");
         zt_var_t *var = ctx->vhead;
         while (var) {
-            const msu_str_t *name = var->name;
-            const char *value = var->value ? msu_str_data(var->value->content) : "0";
-            msu_str_builder_printf(sb, "%s DAT %s\n", msu_str_data(name), value);
+            int value = 0;
+            if (var->value) msu_str_try_parse_int(var->value->content, &value);
+            asm_builder_label(out, var->name);
+            asm_builder_op_value(out, "DAT", value);
             var = var->next;
         }
     } else if (node->kind == ZT_BLOCK) {
         for (size_t i = 0; i < node->children->len; i++) {
             parsenode_t *child = list_of_parsenodes_get(node->children, i);
-            zt_compile_impl(child, ctx, sb);
+            zt_compile_impl(child, ctx, out);
         }
     } else if (node->kind == ZT_ASSIGN) {
         zt_context_ensure_var(ctx, node->token->content);
-        zt_compile_impl(list_of_parsenodes_get(node->children, 0), ctx, sb);
-        msu_str_builder_printf(sb, "STA %s\n", msu_str_data(node->token->content));
+        zt_compile_impl(list_of_parsenodes_get(node->children, 0), ctx, out);
+        asm_builder_op_ref(out, "STA", node->token->content);
     } else if (node->kind == ZT_WHILE) {
         int label_num = ctx->label_num++;
         const msu_str_t *head_label = msu_str_printf("_$head%d", label_num);
         const msu_str_t *body_label = msu_str_printf("_$body%d", label_num);
         const msu_str_t *end_label = msu_str_printf("_$end%d", label_num);
 
-        msu_str_builder_printf(sb, "%s\n", msu_str_data(head_label));
+        asm_builder_label(out, head_label);
 
         parsenode_t *cond = list_of_parsenodes_get(node->children, 0);
         parsenode_t *lhs = list_of_parsenodes_get(cond->children, 0);
@@ -281,28 +282,28 @@ void zt_compile_impl(parsenode_t *node, zt_context_t *ctx, msu_str_builder_t sb)
 
         if (lhs_simple && rhs_simple) {
             zt_context_ensure_var(ctx, lhs->token->content);
-            msu_str_builder_printf(sb, "LDA %s\n", msu_str_data(lhs->token->content));
+            asm_builder_op_ref(out, "LDA", lhs->token->content);
 
             if (rhs->kind == ZT_INT) {
                 const msu_str_t *val = zt_context_ensure_val(ctx, rhs->token);
-                msu_str_builder_printf(sb, "SUB %s\n", msu_str_data(val));
+                asm_builder_op_ref(out, "SUB", val);
             } else {
                 zt_context_ensure_var(ctx, rhs->token->content);
-                msu_str_builder_printf(sb, "SUB %s\n", msu_str_data(rhs->token->content));
+                asm_builder_op_ref(out, "SUB", rhs->token->content);
             }
         } else {
             const msu_str_t *tmpL = msu_str_printf("$tmp%d", ctx->label_num++);
-            zt_compile_impl(lhs, ctx, sb);
-            msu_str_builder_printf(sb, "STA %s\n", msu_str_data(tmpL));
+            zt_compile_impl(lhs, ctx, out);
+            asm_builder_op_ref(out, "STA", tmpL);
             zt_context_ensure_var(ctx, tmpL);
 
             const msu_str_t *tmpR = msu_str_printf("$tmp%d", ctx->label_num++);
-            zt_compile_impl(rhs, ctx, sb);
-            msu_str_builder_printf(sb, "STA %s\n", msu_str_data(tmpR));
+            zt_compile_impl(rhs, ctx, out);
+            asm_builder_op_ref(out, "STA", tmpR);
             zt_context_ensure_var(ctx, tmpR);
 
-            msu_str_builder_printf(sb, "LDA %s\n", msu_str_data(tmpL));
-            msu_str_builder_printf(sb, "SUB %s\n", msu_str_data(tmpR));
+            asm_builder_op_ref(out, "LDA", tmpL);
+            asm_builder_op_ref(out, "SUB", tmpR);
         }
 
         const char *insr = NULL;
@@ -314,65 +315,71 @@ void zt_compile_impl(parsenode_t *node, zt_context_t *ctx, msu_str_builder_t sb)
             msu_str_printf("error: invalid op %s", cond->token->content);
         }
 
-        msu_str_builder_printf(sb, "%s %s\n", insr, msu_str_data(body_label));
-        msu_str_builder_printf(sb, "BRA %s\n", msu_str_data(end_label));
+        asm_builder_op_ref(out, insr, body_label);
+        asm_builder_op_ref(out, "BRA", end_label);
 
-        // --- FIXED THESE TWO LINES ---
-        msu_str_builder_printf(sb, "%s\nADD 0\n", msu_str_data(body_label));
+        asm_builder_label(out, body_label);
+        asm_builder_op_value(out, "ADD", 0);
         parsenode_t *block = list_of_parsenodes_get(node->children, 1);
-        zt_compile_impl(block, ctx, sb);
-        msu_str_builder_printf(sb, "BRA %s\n", msu_str_data(head_label));
-        msu_str_builder_printf(sb, "%s\nADD 0\n", msu_str_data(end_label));
+        zt_compile_impl(block, ctx, out);
+        asm_builder_op_ref(out, "BRA", head_label);
+        asm_builder_label(out, end_label);
+        asm_builder_op_value(out, "ADD", 0);
+
+        msu_str_free(head_label);
+        msu_str_free(body_label);
+        msu_str_free(end_label);
     } else if (node->kind == ZT_INT) {
         const msu_str_t *label = zt_context_ensure_val(ctx, node->token);
-        msu_str_builder_printf(sb, "LDA %s\n", msu_str_data(label));
+        asm_builder_op_ref(out, "LDA", label);
     } else if (node->kind == ZT_WRITE) {
         parsenode_t *value = list_of_parsenodes_get(node->children, 0);
-        zt_compile_impl(value, ctx, sb);
-        msu_str_builder_pushs(sb, "OUT\n");
+        zt_compile_impl(value, ctx, out);
+        asm_builder_op(out, "OUT");
     } else if (node->kind == ZT_VAR) {
         zt_context_ensure_var(ctx, node->token->content);
-        msu_str_builder_printf(sb, "LDA %s\n", msu_str_data(node->token->content));
+        asm_builder_op_ref(out, "LDA", node->token->content);
     } else if (node->kind == ZT_OP) {
         parsenode_t *lhs = list_of_parsenodes_get(node->children, 0);
         parsenode_t *rhs = list_of_parsenodes_get(node->children, 1);
+        const char *insr = msu_str_eqs(node->token->content, "+") ? "ADD" : "SUB";
 
         if (lhs->kind == ZT_VAR && rhs->kind == ZT_VAR) {
             zt_context_ensure_var(ctx, lhs->token->content);
             zt_context_ensure_var(ctx, rhs->token->content);
-            msu_str_builder_printf(sb, "LDA %s\n", msu_str_data(lhs->token->content));
-            if (msu_str_eqs(node->token->content, "+")) {
-                msu_str_builder_printf(sb, "ADD %s\n", msu_str_data(rhs->token->content));
-            } else if (msu_str_eqs(node->token->content, "-")) {
-                msu_str_builder_printf(sb, "SUB %s\n", msu_str_data(rhs->token->content));
-            }
+            asm_builder_op_ref(out, "LDA", lhs->token->content);
+            asm_builder_op_ref(out, insr, rhs->token->content);
         } else {
-            zt_compile_impl(lhs, ctx, sb);
+            zt_compile_impl(lhs, ctx, out);
             const msu_str_t *tmp = msu_str_printf("$tmp%d", ctx->label_num++);
-            msu_str_builder_printf(sb, "STA %s\n", msu_str_data(tmp));
+            asm_builder_op_ref(out, "STA", tmp);
             zt_context_ensure_var(ctx, tmp);
-            zt_compile_impl(rhs, ctx, sb);
-            if (msu_str_eqs(node->token->content, "+")) {
-                msu_str_builder_printf(sb, "ADD %s\n", msu_str_data(tmp));
-            } else if (msu_str_eqs(node->token->content, "-")) {
-                msu_str_builder_printf(sb, "SUB %s\n", msu_str_data(tmp));
-            }
+            zt_compile_impl(rhs, ctx, out);
+            asm_builder_op_ref(out, insr, tmp);
         }
     } else if (node->kind == ZT_READ) {
-        msu_str_builder_printf(sb, "INP\n");
+        asm_builder_op(out, "INP");
     } else {
         printf("Unknown parse element type: %d\n", node->kind);
     }
 }
-const msu_str_t *zt_compile(parsenode_t *node) {
-    msu_str_builder_t sb = msu_str_builder_new();
+
+list_of_asm_insrs_t *zt_compile_ir(parsenode_t *node) {
+    asm_builder_t *builder = asm_builder_new();
     zt_context_t ctx = {
         .vhead = NULL,
         .vtail = NULL,
         .label_num = 0,
     };
-    zt_compile_impl(node, &ctx, sb);
+    zt_compile_impl(node, &ctx, builder);
     zt_context_free(&ctx);
 
-    return msu_str_builder_into_string_and_free(sb);
+    return asm_builder_finish(builder);
+}
+
+const msu_str_t *zt_compile(parsenode_t *node) {
+    list_of_asm_insrs_t *insrs = zt_compile_ir(node);
+    const msu_str_t *out = asm_print(insrs);
+    list_of_asm_insrs_free(insrs, true);
+    return out;
 }
@@ -0,0 +1,148 @@
+/*
+ * superopt - finds peephole rules for the optimizer
+ *
+ *   superopt [-n maxlen] [-k mincount] [-t threads] [-s tests] [-x] [-c] [-o out] files...
+ *
+ * compiles every .sea, .firth, .zt and .asm file given, collects
+ * the stack code they turn into and searches it for rewrites. the
+ * rules go to stdout, or `out`, in the format opt_rules_parse
+ * reads. with -c they come out as the C file the optimizer builds
+ * in, which is how src/opt_searched.c is made:
+ *
+ *   superopt -n 4 -k 1 -x -c -o src/opt_searched.c <each file in superopt/corpus>
+*/
+
+#include "msulib/fs.h"
+#include "msulib/parser.h"
+
+#include "lmsm/firth.h"
+#include "lmsm/sea.h"
+#include "lmsm/superopt.h"
+#include "lmsm/zortran.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void usage() {
+    fprintf(stderr, "usage: superopt [-n maxlen] [-k mincount] [-t threads] [-s tests] [-x] [-c] [-o out] files...\n");
+    exit(EXIT_FAILURE);
+}
+
+bool has_errors(const parsenode_t *program, const char *path) {
+    list_of_parsenodes_t *errors = list_of_parsenodes_new();
+    parsenode_collect_errors(program, errors);
+    bool out = errors->len > 0;
+    if (out) fprintf(stderr, "%s: does not parse\n", path);
+    list_of_parsenodes_free(errors, false);
+    return out;
+}
+
+// the instructions `path` compiles to, NULL if it doesn't
+list_of_asm_insrs_t *compile_file(const char *path) {
+    const msu_str_t *name = msu_str_new(path), *src = NULL;
+    if (fs_read_to_string(name, &src) != FS_ERROR_NONE) {
+        fprintf(stderr, "%s: cannot read\n", path);
+        msu_str_free(name);
+        return NULL;
+    }
+    msu_str_free(name);
+
+    const char *ext = strrchr(path, '.');
+    ext = ext ? ext + 1 : "";
+    list_of_asm_insrs_t *out = NULL;
+    parsenode_t *program = NULL;
+    if (strcmp(ext, "asm") == 0) {
+        out = asm_parse(src);
+    } else if (strcmp(ext, "sea") == 0) {
+        program = sea_parse(src);
+        sea_error_t *err = NULL;
+        if (!has_errors(program, path)) out = sea_compile_ir(program, &err);
+        if (err) fprintf(stderr, "%s: %s\n", path, msu_str_data(err->message));
+        sea_error_free(err);
+    } else if (strcmp(ext, "firth") == 0) {
+        program = fr_parse(src);
+        if (!has_errors(program, path)) out = fr_compile_program_ir(program);
+    } else if (strcmp(ext, "zt") == 0) {
+        program = zt_parse(src);
+        if (!has_errors(program, path)) out = zt_compile_ir(program);
+    } else {
+        fprintf(stderr, "%s: not a .sea, .firth, .zt or .asm file\n", path);
+    }
+
+    parsenode_free(program);
+    msu_str_free(src);
+    return out;
+}
+
+// the rules as a C string literal, a line at a time
+void print_c(FILE *out, const msu_str_t *rules) {
+    fprintf(out, "// generated by superopt from superopt/corpus, do not edit\n\n");
+    fprintf(out, "#include \"lmsm/opt.h\"\n\n");
+    fprintf(out, "const char *OPT_SEARCHED_RULES =\n");
+    const char *line = msu_str_data(rules);
+    while (*line) {
+        const char *end = strchr(line, '\n');
+        size_t len = end ? (size_t) (end - line) : strlen(line);
+        fprintf(out, "        \"%.*s\\n\"\n", (int) len, line);
+        line += len + (end != NULL);
+    }
+    fprintf(out, "        \"\";\n");
+}
+
+int main(int argc, char **argv) {
+    superopt_options_t options = superopt_default_options();
+    bool as_c = false;
+    const char *out_path = NULL;
+
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        const char *flag = argv[arg];
+        bool has_value = strchr("nkts", flag[1]) && flag[1] && !flag[2];
+        if (has_value && arg + 1 >= argc) usage();
+        if (strcmp(flag, "-n") == 0) options.max_len = atoi(argv[++arg]);
+        else if (strcmp(flag, "-k") == 0) options.min_count = atoi(argv[++arg]);
+        else if (strcmp(flag, "-t") == 0) options.threads = atoi(argv[++arg]);
+        else if (strcmp(flag, "-s") == 0) options.tests = atoi(argv[++arg]);
+        else if (strcmp(flag, "-x") == 0) options.exhaustive = true;
+        else if (strcmp(flag, "-c") == 0) as_c = true;
+        else if (strcmp(flag, "-o") == 0 && arg + 1 < argc) out_path = argv[++arg];
+        else usage();
+    }
+    if (arg == argc || options.max_len < 2 || options.max_len > OPT_WINDOW_MAX) usage();
+
+    superopt_patterns_t *patterns = superopt_patterns_new();
+    for (; arg < argc; arg++) {
+        list_of_asm_insrs_t *insrs = compile_file(argv[arg]);
+        if (!insrs) {
+            superopt_patterns_free(patterns);
+            return EXIT_FAILURE;
+        }
+        superopt_patterns_add(patterns, insrs, options.max_len);
+        list_of_asm_insrs_free(insrs, true);
+    }
+    fprintf(stderr, "%zu distinct patterns\n", patterns->len);
+
+    // nothing the optimizer already knows is searched again
+    opt_rules_t *rules = opt_rules_new();
+    const msu_str_t *defaults = msu_str_new(OPT_DEFAULT_RULES);
+    asm_error_t *err = opt_rules_parse(rules, defaults);
+    msu_str_free(defaults);
+    asm_error_free(err);
+
+    const msu_str_t *found = superopt_search_all(patterns, rules, &options);
+    FILE *out = out_path ? fopen(out_path, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "%s: cannot write\n", out_path);
+    } else if (as_c) {
+        print_c(out, found);
+    } else {
+        fputs(msu_str_data(found), out);
+    }
+    if (out && out != stdout) fclose(out);
+
+    msu_str_free(found);
+    opt_rules_free(rules);
+    superopt_patterns_free(patterns);
+    return out ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -2,9 +2,11 @@
 #include "main.h"
 
 #include "msulib/fs.h"
+#include "lmsm/asm.h"
 #include "lang.h"
 
 const msu_str_t *explain_insr(int insr);
+void explain_memory(const int *memory, const msu_str_t **out);
 
 
 const msu_str_t *replace(const msu_str_t *haystack, const msu_str_t *needle, const msu_str_t *thread) {
@@ -37,11 +39,16 @@ const msu_str_t *build_memory_view() {
         err = "output exhausted";
     } else if (the_one_emulator->error_code == ERROR_UNKNOWN_INSTRUCTION) {
         err = "unknown instruction";
+    } else if (the_one_emulator->error_code == ERROR_BAD_INDEX) {
+        err = "bad index";
     } else {
         err = "(nil)";
     }
     status_line = msu_str_printf("status: %s | error: %s\n", status, err);
 
+    const msu_str_t *titles[MIDDLE_OF_MEMORY];
+    explain_memory(the_one_emulator->memory, titles);
+
     msu_str_builder_t memory = msu_str_builder_new();
     msu_str_builder_pushs(memory, "<div id='memory-table'>");
 
@@ -74,9 +81,8 @@ const msu_str_t *build_memory_view() {
 
             const msu_str_t *title;
             if (idx < MIDDLE_OF_MEMORY) {
-                const msu_str_t *expl = explain_insr(the_one_emulator->memory[idx]);
-                title = msu_str_printf("title='%s'", msu_str_data(expl));
-                msu_str_free(expl);
+                title = msu_str_printf("title='%s'", msu_str_data(titles[idx]));
+                msu_str_free(titles[idx]);
             } else {
                 title = EMPTY_STRING;
             }
@@ -612,85 +618,49 @@ end:
 }
 
 const msu_str_t *explain_insr(int insr) {
-    if (insr >= -500 && insr <= -401) {
-        int value = -401 - insr;
-        return msu_str_printf("SSTA %03d - Stack Store: mem[$sp+%d+1] = mem[$sp], $sp--", value, value);
-    } else if (insr >= -300 && insr <= -201) {
-        int value = -201 - insr;
-        return msu_str_printf("SLDA %03d - Stack Load: mem[$sp-1]=mem[$sp+d], $sp--", value, value);
-    } else if (insr >= -200 && insr <= -101) {
-        int value = -101 - insr;
-        return msu_str_printf("SPSUB %03d - SP Sub: $sp -= 1 + %d", value, value);
-    } else if (insr >= -100 && insr <= -001) {
-        int value = -001 - insr;
-        return msu_str_printf("SPADD %03d - SP Add: $sp += 1 + %d", value, value);
-    } else if (insr == 0) {
-        return msu_str_new("HLT/COB - Halt the machine");
-    } else if (insr >= 100 && insr <= 199) {
-        int value = insr - 100;
-        return msu_str_printf("ADD %03d - Add: $acc += mem[%d]", value, value);
-    } else if (insr >= 200 && insr <= 299) {
-        int value = insr - 200;
-        return msu_str_printf("SUB %03d - Sub: $acc -= mem[%d]", value, value);
-    } else if (insr >= 300 && insr <= 399) {
-        int value = insr - 300;
-        return msu_str_printf("STA %03d - Store: mem[%d] = $acc", value, value);
-    } else if (insr >= 400 && insr <= 499) {
-        int value = insr - 400;
-        return msu_str_printf("LDI %03d - Load Immediate: $acc = %d", value, value);
-    } else if (insr >= 500 && insr <= 599) {
-        int value = insr - 500;
-        return msu_str_printf("LDA %03d - Load: acc = $mem[%d]", value, value);
-    } else if (insr >= 600 && insr <= 699) {
-        int value = insr - 600;
-        return msu_str_printf("BRA %03d - Branch Always: jump to %d", value, value);
-    } else if (insr >= 700 && insr <= 799) {
-        int value = insr - 700;
-        return msu_str_printf("BRZ %03d - Branch If Zero: if $acc == 0, jump to %d", value, value);
-    } else if (insr >= 800 && insr <= 899) {
-        int value = insr - 800;
-        return msu_str_printf("BRP %03d - Branch If Positive: if $acc >= 0, jump to %d", value, value);
-    } else if (insr == 901) {
-        return msu_str_new("INP - Input: $acc = input()");
-    } else if (insr == 902) {
-        return msu_str_new("OUT - Output: print($acc)");
-    } else if (insr == 910) {
-        return msu_str_new("JAL - Jump And Link: $ra = $pc, $pc = $acc");
-    } else if (insr == 911) {
-        return msu_str_new("RET - Return: $pc = $ra");
-    } else if (insr == 920) {
-        return msu_str_new("SPUSH - Stack Push: mem[$sp] = $acc, $sp--");
-    } else if (insr == 921) {
-        return msu_str_new("SPOP - Stack Pop: $acc = mem[$sp], $sp++");
-    } else if (insr == 922) {
-        return msu_str_new("SDUP - Stack Duplicate: mem[$sp-1] = mem[$sp], $sp--");
-    } else if (insr == 923) {
-        return msu_str_new("SDROP - Stack Drop: $sp += 1");
-    } else if (insr == 924) {
-        return msu_str_new("SSWAP - Stack Swap: mem[$sp] <> mem[$sp+1]");
-    } else if (insr == 925) {
-        return msu_str_new("RPUSH - Return Stack Push: mem[$rp] = $acc, rp++");
-    } else if (insr == 926) {
-        return msu_str_new("RPOP - Return Stack Pop: $acc = mem[$rp], $rp--");
-    } else if (insr == 930) {
-        return msu_str_new("SADD - Stack Add: mem[$sp+1]=mem[$sp]+mem[$sp+1], $sp++");
-    } else if (insr == 931) {
-        return msu_str_new("SSUB - Stack Subtract: mem[$sp+1]=mem[$sp]-mem[$sp+1], $sp++");
-    } else if (insr == 932) {
-        return msu_str_new("SMUL - Stack Multiply: mem[$sp+1]=mem[$sp]*mem[$sp+1], $sp++");
-    } else if (insr == 933) {
-        return msu_str_new("SDIV - Stack Divide: mem[$sp+1]=mem[$sp]*mem[$sp+1], $sp++");
-    } else if (insr == 934) {
-        return msu_str_new("SMAX - Stack Max: mem[$sp+1]=max(mem[$sp], mem[$sp+1]), $sp++");
-    } else if (insr == 935) {
-        return msu_str_new("SMIN - Stack Min: mem[$sp+1]=min(mem[$sp], mem[$sp+1]), $sp++");
-    } else if (insr == 936) {
-        return msu_str_new("SCMPGT - Stack Compare Greater: mem[$sp+1]=mem[$sp]>mem[$sp+1], $sp++");
-    } else if (insr == 937) {
-        return msu_str_new("SCMPLT - Stack Compare Less:  mem[$sp+1]=mem[$sp]<mem[$sp+1], $sp++");
-    } else if (insr == 938) {
-        return msu_str_new("SNOT - Stack Not: mem[$sp] = mem[$sp]==0");
-    } else {
+    int operand;
+    const emulator_opcode_t *op = emulator_decode(insr, &operand);
+    if (!op) {
         return msu_str_new("unknown instruction");
     }
+
+    const msu_str_t *description = msu_str_printf(op->description, operand);
+    const msu_str_t *out;
+    if (op->has_operand) {
+        out = msu_str_printf("%s %03d - %s", op->name, operand, msu_str_data(description));
+    } else {
+        out = msu_str_printf("%s - %s", op->name, msu_str_data(description));
+    }
+    msu_str_free(description);
+    return out;
+}
+
+// a tooltip for each of the MIDDLE_OF_MEMORY program cells, from one disassembly
+// so that data that happens to look like an instruction is shown as data
+void explain_memory(const int *memory, const msu_str_t **out) {
+    list_of_asm_insrs_t *insrs = asm_disassemble(memory, MIDDLE_OF_MEMORY);
+
+    size_t idx = 0;
+    for (size_t i = 0; i < insrs->len; i++) {
+        const asm_insr_t *insr = list_of_asm_insrs_get_const(insrs, i);
+        for (int j = 0; j < asm_insr_size(insr) && idx < MIDDLE_OF_MEMORY; j++, idx++) {
+            const msu_str_t *expl;
+            if (msu_str_eqs(insr->instruction, "DAT")) {
+                expl = msu_str_printf("DAT %d - Data", memory[idx]);
+            } else {
+                expl = explain_insr(memory[idx]);
+            }
+            if (j == 0 && !msu_str_is_empty(insr->label)) {
+                const msu_str_t *labelled = msu_str_printf("%s: %s", msu_str_data(insr->label), msu_str_data(expl));
+                msu_str_free(expl);
+                expl = labelled;
+            }
+            out[idx] = expl;
+        }
+    }
+    for (; idx < MIDDLE_OF_MEMORY; idx++) {
+        out[idx] = msu_str_printf("DAT %d - Data", memory[idx]);
+    }
+
+    list_of_asm_insrs_free(insrs, true);
 }
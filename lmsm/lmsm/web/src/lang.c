@@ -13,6 +13,11 @@
 const msu_str_t *build_memory_view();
 const msu_str_t *build_register_view();
 
+// the compilers hand instructions over directly, hand-written assembly goes through
+// an incremental assembler so that re-assembling after a small edit only re-parses
+// the lines that actually changed
+asm_session_t *asm_session = NULL;
+
 bool find_and_report_errors(
     http_conn_t *conn,
     http_error_t *errout,
@@ -43,12 +48,19 @@ bool find_and_report_errors(
 }
 
 void reply_err_asm(http_conn_t *conn, http_error_t *errout, asm_error_t *asm_err, const msu_str_t *bytecode) {
-    const char *el = (
-            "<div hx-swap-oob='innerHTML:#code-output'>%s</div>"
-            "<div hx-swap-oob='innerHTML:#assembly-code'>%s</div>"
-    );
-    const msu_str_t *res = msu_str_printf(el, msu_str_data(asm_err->message), msu_str_data(bytecode));
-    reply_html(conn, errout, HTTP_STATUS_OK, res);
+    msu_str_builder_t sb = msu_str_builder_new();
+    msu_str_builder_pushs(sb, "<div hx-swap-oob='innerHTML:#code-output'>");
+    for (const asm_error_t *err = asm_err; err; err = err->next) {
+        if (err->span.line) {
+            msu_str_builder_printf(sb, "(at line %zu) ", err->span.line);
+        }
+        msu_str_builder_pushstr(sb, err->message);
+        msu_str_builder_push(sb, '\n');
+    }
+    msu_str_builder_pushs(sb, "</div><div hx-swap-oob='innerHTML:#assembly-code'>");
+    msu_str_builder_pushstr(sb, bytecode);
+    msu_str_builder_pushs(sb, "</div>");
+    reply_html(conn, errout, HTTP_STATUS_OK, msu_str_builder_into_string_and_free(sb));
 }
 
 void reply_err_compilation(http_conn_t *conn, http_error_t *errout, const char *lang, const msu_str_t *error_msg) {
@@ -86,12 +98,28 @@ void reply_success(http_conn_t *conn, http_error_t *errout, const char *lang, co
     msu_str_free(output);
 }
 
+// what compiled before comes straight back, the same programs get submitted over and over.
+// LMSM_SEA_CACHE names a directory to keep it in between runs
+sea_cache_t *sea_cache = NULL;
+
 bool compile_sea(http_conn_t *conn, http_error_t *errout, const msu_str_t *src, bool load) {
+    sea_options_t options = sea_default_options();
+    if (!sea_cache) sea_cache = sea_cache_new(SEA_CACHE_DEFAULT_MAX, getenv("LMSM_SEA_CACHE"));
+    const sea_cache_entry_t *cached = sea_cache_lookup(sea_cache, src, &options);
+    if (cached) {
+        if (load) {
+            emulator_load(the_one_emulator, (int *) cached->code, MIDDLE_OF_MEMORY);
+        }
+        reply_success(conn, errout, "sea", cached->assembly);
+        return true;
+    }
+
     bool out = true;
     parsenode_t *program = NULL;
     const msu_str_t *bytecode = NULL;
     sea_error_t *sea_err = NULL;
     asm_error_t *asm_err = NULL;
+    list_of_asm_insrs_t *insrs = NULL;
     int *code = NULL;
 
     program = sea_parse(src);
@@ -100,14 +128,15 @@ bool compile_sea(http_conn_t *conn, http_error_t *errout, const msu_str_t *src,
         goto end;
     }
 
-    bytecode = sea_compile(program, &sea_err);
+    insrs = sea_compile_ir_with(program, &options, &sea_err);
     if (sea_err) {
         reply_err_compilation(conn, errout, "sea", sea_err->message);
         out = false;
         goto end;
     }
 
-    code = asm_assemble(bytecode, &asm_err);
+    bytecode = asm_print(insrs);
+    code = asm_assemble_insrs(insrs, &asm_err);
     if (asm_err) {
         reply_err_asm(conn, errout, asm_err, bytecode);
         out = false;
@@ -118,12 +147,14 @@ bool compile_sea(http_conn_t *conn, http_error_t *errout, const msu_str_t *src,
         emulator_load(the_one_emulator, code, MIDDLE_OF_MEMORY);
     }
 
+    sea_cache_store(sea_cache, src, &options, bytecode, code);
     reply_success(conn, errout, "sea", bytecode);
 end:
     parsenode_free(program);
     msu_str_free(bytecode);
     sea_error_free(sea_err);
     asm_error_free(asm_err);
+    list_of_asm_insrs_free(insrs, true);
     free(code);
     return out;
 }
@@ -133,6 +164,7 @@ bool compile_firth(http_conn_t *conn, http_error_t *errout, const msu_str_t *src
     parsenode_t *program = NULL;
     const msu_str_t *bytecode = NULL;
     asm_error_t *asm_err = NULL;
+    list_of_asm_insrs_t *insrs = NULL;
     int *code = NULL;
 
     program = fr_parse(src);
@@ -141,9 +173,10 @@ bool compile_firth(http_conn_t *conn, http_error_t *errout, const msu_str_t *src
         goto end;
     }
 
-    bytecode = fr_compile_program(program);
+    insrs = fr_compile_program_ir(program);
 
-    code = asm_assemble(bytecode, &asm_err);
+    bytecode = asm_print(insrs);
+    code = asm_assemble_insrs(insrs, &asm_err);
     if (asm_err) {
         reply_err_asm(conn, errout, asm_err, bytecode);
         out = false;
@@ -159,6 +192,7 @@ end:
     parsenode_free(program);
     msu_str_free(bytecode);
     asm_error_free(asm_err);
+    list_of_asm_insrs_free(insrs, true);
     free(code);
     return out;
 }
@@ -168,6 +202,7 @@ bool compile_zortran(http_conn_t *conn, http_error_t *errout, const msu_str_t *s
     parsenode_t *program = NULL;
     const msu_str_t *bytecode = NULL;
     asm_error_t *asm_err = NULL;
+    list_of_asm_insrs_t *insrs = NULL;
     int *code = NULL;
 
     program = zt_parse(src);
@@ -176,9 +211,10 @@ bool compile_zortran(http_conn_t *conn, http_error_t *errout, const msu_str_t *s
         goto end;
     }
 
-    bytecode = zt_compile(program);
+    insrs = zt_compile_ir(program);
 
-    code = asm_assemble(bytecode, &asm_err);
+    bytecode = asm_print(insrs);
+    code = asm_assemble_insrs(insrs, &asm_err);
     if (asm_err) {
         reply_err_asm(conn, errout, asm_err, bytecode);
         out = false;
@@ -194,6 +230,7 @@ end:
     parsenode_free(program);
     msu_str_free(bytecode);
     asm_error_free(asm_err);
+    list_of_asm_insrs_free(insrs, true);
     free(code);
     return out;
 }
@@ -201,9 +238,10 @@ end:
 bool compile_asm(http_conn_t *conn, http_error_t *errout, const msu_str_t *src, bool load) {
     bool out = true;
     asm_error_t *asm_err = NULL;
-    int *code = NULL;
+    const int *code = NULL;
 
-    code = asm_assemble(src, &asm_err);
+    if (!asm_session) asm_session = asm_session_new();
+    code = asm_session_assemble(asm_session, src, &asm_err);
     if (asm_err) {
         reply_err_asm(conn, errout, asm_err, src);
         out = false;
@@ -211,12 +249,11 @@ bool compile_asm(http_conn_t *conn, http_error_t *errout, const msu_str_t *src,
     }
 
     if (load) {
-        emulator_load(the_one_emulator, code, MIDDLE_OF_MEMORY);
+        emulator_load(the_one_emulator, (int *) code, MIDDLE_OF_MEMORY);
     }
 
     reply_success(conn, errout, "asm", src);
 end:
     asm_error_free(asm_err);
-    free(code);
     return out;
 }
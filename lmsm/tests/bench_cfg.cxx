@@ -0,0 +1,65 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+extern "C" {
+#include "lmsm/cfg.h"
+#include "lmsm/asm.h"
+}
+
+// a program of `blocks` loops and branches over `cells` variables, shaped like compiled code
+list_of_asm_insrs_t *GenerateProgram(int blocks, int cells) {
+    asm_builder_t *builder = asm_builder_new();
+    for (int b = 0; b < blocks; b++) {
+        const msu_str_t *label = msu_str_printf("L%d", b);
+        const msu_str_t *target = msu_str_printf("L%d", (b * 7 + 3) % blocks);
+        const msu_str_t *in = msu_str_printf("v%d", (b * 13) % cells);
+        const msu_str_t *out = msu_str_printf("v%d", (b * 5 + 1) % cells);
+
+        asm_builder_label(builder, label);
+        asm_builder_op_ref(builder, "LDA", in);
+        asm_builder_op(builder, "SPUSH");
+        asm_builder_op_value(builder, "SPUSHI", b % 100);
+        asm_builder_op(builder, "SADD");
+        asm_builder_op(builder, "SPOP");
+        asm_builder_op_ref(builder, "STA", out);
+        asm_builder_op_ref(builder, b % 3 == 0 ? "BRP" : "BRZ", target);
+        if (b % 17 == 0) asm_builder_op_ref(builder, "CALL", target);
+
+        msu_str_free(label);
+        msu_str_free(target);
+        msu_str_free(in);
+        msu_str_free(out);
+    }
+    asm_builder_op(builder, "HLT");
+    for (int c = 0; c < cells; c++) {
+        const msu_str_t *label = msu_str_printf("v%d", c);
+        asm_builder_label(builder, label);
+        asm_builder_op_value(builder, "DAT", c);
+        msu_str_free(label);
+    }
+    return asm_builder_finish(builder);
+}
+
+int main(int argc, char **argv) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 5;
+    const int sizes[][2] = {{100, 16}, {1000, 64}, {10000, 256}, {50000, 1024}};
+
+    printf("%10s %8s %8s %12s\n", "insrs", "blocks", "cells", "ms/build");
+    for (const auto &size : sizes) {
+        list_of_asm_insrs_t *insrs = GenerateProgram(size[0], size[1]);
+        size_t blocks = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) {
+            cfg_t *cfg = cfg_build(insrs);
+            blocks = cfg->len;
+            cfg_free(cfg);
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+        printf("%10zu %8zu %8d %12.2f\n", insrs->len, blocks, size[1], elapsed.count() / rounds);
+        list_of_asm_insrs_free(insrs, true);
+    }
+    return 0;
+}
@@ -650,6 +650,325 @@ TEST(code_generation, bad_label_causes_error) {
     msu_str_free(src);
 }
 
+TEST(code_generation, every_error_is_reported_with_its_line) {
+    const msu_str_t *src = msu_str_new("LDA x\nOUT\n\nBRA y\nHLT\n");
+    asm_error_t *err = nullptr;
+    int *code = asm_assemble(src, &err);
+
+    ASSERT_NE(err, nullptr) << "expected 'BAD_LABEL'";
+    ASSERT_EQ(err->kind, ASM_ERROR_BAD_LABEL);
+    ASSERT_EQ(err->span.line, 1);
+    ASSERT_EQ(err->span.offset, 0);
+    ASSERT_NE(err->next, nullptr) << "expected a second error";
+    ASSERT_EQ(err->next->kind, ASM_ERROR_BAD_LABEL);
+    ASSERT_EQ(err->next->span.line, 4);
+    ASSERT_EQ(err->next->span.offset, 11);
+    ASSERT_EQ(err->next->span.len, 5);
+    ASSERT_EQ(err->next->next, nullptr);
+
+    free(code);
+    asm_error_free(err);
+    msu_str_free(src);
+}
+
+TEST(code_generation, parse_errors_are_reported_instead_of_printed) {
+    const msu_str_t *src = msu_str_new("LDA\r\nFOO BAR\r\nHLT\r\n");
+    asm_error_t *err = nullptr;
+    int *code = asm_assemble(src, &err);
+
+    ASSERT_NE(err, nullptr) << "expected 'BAD_ARG'";
+    ASSERT_EQ(err->kind, ASM_ERROR_BAD_ARG);
+    ASSERT_EQ(err->span.line, 1);
+    ASSERT_NE(err->next, nullptr) << "expected 'BAD_INSR'";
+    ASSERT_EQ(err->next->kind, ASM_ERROR_BAD_INSR);
+    ASSERT_EQ(err->next->span.line, 2);
+    ASSERT_EQ(err->next->span.offset, 5);
+
+    free(code);
+    asm_error_free(err);
+    msu_str_free(src);
+}
+
+//==========================================================================
+// Directive tests
+//==========================================================================
+
+TEST(directives, equ_substitutes_constants) {
+    const msu_str_t *src = msu_str_new(".equ TEN 10\n.equ LIMIT TEN\nLDI TEN\nADD LIMIT\nHLT\n");
+    asm_error_t *err = nullptr;
+    int *code = asm_assemble(src, &err);
+
+    ASSERT_EQ(err, nullptr) << msu_str_to_cpp(err->message);
+    ASSERT_EQ(code[0], 410);
+    ASSERT_EQ(code[1], 110);
+    ASSERT_EQ(code[2], 0);
+
+    free(code);
+    msu_str_free(src);
+}
+
+TEST(directives, macros_expand_with_arguments) {
+    const msu_str_t *src = msu_str_new(
+            ".macro INC x one\n"
+            "LDA x\n"
+            "ADD one\n"
+            "STA x\n"
+            ".endm\n"
+            "start INC count one\n"
+            "INC count one\n"
+            "BRA start\n"
+            "count DAT 0\n"
+            "one DAT 1\n");
+    asm_error_t *err = nullptr;
+    int *code = asm_assemble(src, &err);
+
+    ASSERT_EQ(err, nullptr) << msu_str_to_cpp(err->message);
+    ASSERT_EQ(code[0], 507);
+    ASSERT_EQ(code[1], 108);
+    ASSERT_EQ(code[2], 307);
+    ASSERT_EQ(code[3], 507);
+    ASSERT_EQ(code[6], 600) << "the label on the invocation marks the first expanded line";
+    ASSERT_EQ(code[8], 1);
+
+    free(code);
+    msu_str_free(src);
+}
+
+TEST(directives, macro_labels_are_local_to_each_expansion) {
+    const msu_str_t *src = msu_str_new(
+            ".macro COUNTDOWN\n"
+            "loop SUB one\n"
+            "BRP loop\n"
+            ".endm\n"
+            "LDI 2\n"
+            "COUNTDOWN\n"
+            "LDI 3\n"
+            "COUNTDOWN\n"
+            "HLT\n"
+            "one DAT 1\n");
+    asm_error_t *err = nullptr;
+    int *code = asm_assemble(src, &err);
+
+    ASSERT_EQ(err, nullptr) << msu_str_to_cpp(err->message);
+    ASSERT_EQ(code[2], 801);
+    ASSERT_EQ(code[5], 804) << "the second loop branches to its own label";
+
+    free(code);
+    msu_str_free(src);
+}
+
+TEST(directives, org_and_align_pad_with_zeros) {
+    const msu_str_t *src = msu_str_new("LDA x\nLDA y\nHLT\nx .align 4\nDAT 7\ny .org 10\nDAT 8\n");
+    asm_error_t *err = nullptr;
+    int *code = asm_assemble(src, &err);
+
+    ASSERT_EQ(err, nullptr) << msu_str_to_cpp(err->message);
+    // the labels are on the addresses the directives move to
+    ASSERT_EQ(code[0], 504);
+    ASSERT_EQ(code[1], 510);
+    ASSERT_EQ(code[3], 0);
+    ASSERT_EQ(code[4], 7);
+    ASSERT_EQ(code[5], 0);
+    ASSERT_EQ(code[9], 0);
+    ASSERT_EQ(code[10], 8);
+
+    free(code);
+    msu_str_free(src);
+}
+
+TEST(directives, bad_directives_are_errors) {
+    const msu_str_t *src = msu_str_new("LDA x\nOUT\n.org 1\n.frob 2\n.macro M\nHLT\n");
+    asm_error_t *err = nullptr;
+    int *code = asm_assemble(src, &err);
+
+    ASSERT_NE(err, nullptr);
+    ASSERT_EQ(err->kind, ASM_ERROR_BAD_DIRECTIVE) << "'.org' behind the current address";
+    ASSERT_EQ(err->span.line, 3);
+    ASSERT_NE(err->next, nullptr);
+    ASSERT_EQ(err->next->kind, ASM_ERROR_BAD_DIRECTIVE) << "unknown directive";
+    ASSERT_NE(err->next->next, nullptr);
+    ASSERT_EQ(err->next->next->kind, ASM_ERROR_BAD_DIRECTIVE) << "missing '.endm'";
+    ASSERT_EQ(err->next->next->span.line, 5);
+
+    free(code);
+    asm_error_free(err);
+    msu_str_free(src);
+}
+
+//==========================================================================
+// Instruction builder tests
+//==========================================================================
+
+TEST(builder, builds_the_same_code_as_parsing_its_printout) {
+    const msu_str_t *loop = msu_str_new("loop");
+    const msu_str_t *x = msu_str_new("x");
+
+    asm_builder_t *builder = asm_builder_new();
+    asm_builder_label(builder, loop);
+    asm_builder_op_ref(builder, "LDA", x);
+    asm_builder_op(builder, "OUT");
+    asm_builder_op_value(builder, "SUB", 1);
+    asm_builder_op_ref(builder, "BRP", loop);
+    asm_builder_op(builder, "HLT");
+    asm_builder_label(builder, x);
+    asm_builder_op_value(builder, "DAT", 3);
+    list_of_asm_insrs_t *insrs = asm_builder_finish(builder);
+
+    const msu_str_t *text = asm_print(insrs);
+    ASSERT_MSU_STREQ(text, "loop LDA x\nOUT\nSUB 1\nBRP loop\nHLT\nx DAT 3\n");
+
+    asm_error_t *err = nullptr;
+    int *built = asm_assemble_insrs(insrs, &err);
+    ASSERT_EQ(err, nullptr) << msu_str_to_cpp(err->message);
+    int *parsed = asm_assemble(text, &err);
+    ASSERT_EQ(err, nullptr) << msu_str_to_cpp(err->message);
+    for (int i = 0; i < MIDDLE_OF_MEMORY; i++) {
+        ASSERT_EQ(built[i], parsed[i]) << "mismatch at " << i;
+    }
+
+    free(built);
+    free(parsed);
+    msu_str_free(text);
+    list_of_asm_insrs_free(insrs, true);
+    msu_str_free(loop);
+    msu_str_free(x);
+}
+
+TEST(builder, second_label_on_an_instruction_becomes_an_alias) {
+    const msu_str_t *a = msu_str_new("a");
+    const msu_str_t *b = msu_str_new("b");
+
+    asm_builder_t *builder = asm_builder_new();
+    asm_builder_op_ref(builder, "BRA", b);
+    asm_builder_label(builder, a);
+    asm_builder_label(builder, b);
+    asm_builder_op(builder, "HLT");
+    list_of_asm_insrs_t *insrs = asm_builder_finish(builder);
+
+    asm_error_t *err = nullptr;
+    int *code = asm_assemble_insrs(insrs, &err);
+    ASSERT_EQ(err, nullptr) << msu_str_to_cpp(err->message);
+    ASSERT_EQ(code[0], 601);
+
+    free(code);
+    list_of_asm_insrs_free(insrs, true);
+    msu_str_free(a);
+    msu_str_free(b);
+}
+
+TEST(builder, aliases_of_aliases_are_followed) {
+    const msu_str_t *a = msu_str_new("a");
+    const msu_str_t *b = msu_str_new("b");
+    const msu_str_t *c = msu_str_new("c");
+
+    // b is merged into a, then a into c, the label of what's appended
+    asm_builder_t *part = asm_builder_new();
+    asm_builder_label(part, c);
+    asm_builder_op(part, "HLT");
+    asm_builder_t *builder = asm_builder_new();
+    asm_builder_op_ref(builder, "BRA", b);
+    asm_builder_label(builder, a);
+    asm_builder_label(builder, b);
+    asm_builder_append(builder, asm_builder_finish(part));
+    list_of_asm_insrs_t *insrs = asm_builder_finish(builder);
+
+    asm_error_t *err = nullptr;
+    int *code = asm_assemble_insrs(insrs, &err);
+    ASSERT_EQ(err, nullptr) << msu_str_to_cpp(err->message);
+    ASSERT_EQ(code[0], 601);
+
+    free(code);
+    list_of_asm_insrs_free(insrs, true);
+    msu_str_free(a);
+    msu_str_free(b);
+    msu_str_free(c);
+}
+
+TEST(builder, bad_instructions_are_errors) {
+    asm_builder_t *builder = asm_builder_new();
+    asm_builder_op(builder, "SFROB");
+    asm_builder_op_value(builder, "LDI", 1000);
+    list_of_asm_insrs_t *insrs = asm_builder_finish(builder);
+
+    asm_error_t *err = nullptr;
+    int *code = asm_assemble_insrs(insrs, &err);
+    ASSERT_NE(err, nullptr);
+    ASSERT_EQ(err->kind, ASM_ERROR_BAD_INSR);
+    ASSERT_NE(err->next, nullptr);
+    ASSERT_EQ(err->next->kind, ASM_ERROR_BAD_ARG);
+
+    free(code);
+    asm_error_free(err);
+    list_of_asm_insrs_free(insrs, true);
+}
+
+//==========================================================================
+// Disassembler tests
+//==========================================================================
+
+void AssertRoundTrips(const char *s) {
+    const msu_str_t *src = msu_str_new(s);
+    asm_error_t *err = nullptr;
+    int *code = asm_assemble(src, &err);
+    ASSERT_EQ(err, nullptr) << msu_str_to_cpp(err->message);
+
+    list_of_asm_insrs_t *insrs = asm_disassemble(code, MIDDLE_OF_MEMORY);
+    const msu_str_t *text = asm_print(insrs);
+    int *again = asm_assemble_insrs(insrs, &err);
+    ASSERT_EQ(err, nullptr) << msu_str_to_cpp(err->message) << "\n" << msu_str_to_cpp(text);
+    for (int i = 0; i < MIDDLE_OF_MEMORY; i++) {
+        ASSERT_EQ(again[i], code[i]) << "mismatch at " << i << " in\n" << msu_str_to_cpp(text);
+    }
+
+    free(again);
+    msu_str_free(text);
+    list_of_asm_insrs_free(insrs, true);
+    free(code);
+    msu_str_free(src);
+}
+
+TEST(disassembler, programs_round_trip) {
+    AssertRoundTrips("INP\nOUT\nHLT\n");
+    AssertRoundTrips("LDA x\nloop SUB one\nOUT\nBRP loop\nHLT\nx DAT 5\none DAT 1\n");
+    AssertRoundTrips("SPUSHI 3\nCALL f\nSPOP\nOUT\nHLT\n"
+                     "f RPUSH\nSLDA 1\nSDUP\nSMUL\nSSTA 1\nSPADD 0\nSPSUB 0\nRPOP\nRET\n");
+    AssertRoundTrips("SPUSHI 1\nSPUSHI 2\nSCMPGT\nSPUSHI 1\nSCMPLT\nSNOT\nSSWAP\nSDROP\nSMAX\nSMIN\nSDIV\n"
+                     "SSUB\nSADD\nSPOP\nBRZ done\nSTA x\ndone HLT\nx DAT -7\n");
+}
+
+TEST(disassembler, labels_are_rebuilt_from_targets) {
+    const msu_str_t *src = msu_str_new("LDA x\nloop SUB one\nBRP loop\nCALL f\nHLT\nf OUT\nRET\nx DAT 5\none DAT 1\n");
+    asm_error_t *err = nullptr;
+    int *code = asm_assemble(src, &err);
+    ASSERT_EQ(err, nullptr) << msu_str_to_cpp(err->message);
+
+    list_of_asm_insrs_t *insrs = asm_disassemble(code, MIDDLE_OF_MEMORY);
+    const msu_str_t *text = asm_print(insrs);
+    ASSERT_MSU_STREQ(text, "LDA D8\nL1 SUB D9\nBRP L1\nCALL fn_6\nHLT\nfn_6 OUT\nRET\nD8 DAT 5\nD9 DAT 1\n");
+
+    msu_str_free(text);
+    list_of_asm_insrs_free(insrs, true);
+    free(code);
+    msu_str_free(src);
+}
+
+TEST(disassembler, unreachable_cells_are_data) {
+    // 901 and 600 look like INP and BRA but nothing branches to them
+    const msu_str_t *src = msu_str_new("BRA start\nDAT 901\nDAT 600\nstart LDA 1\nHLT\n");
+    asm_error_t *err = nullptr;
+    int *code = asm_assemble(src, &err);
+    ASSERT_EQ(err, nullptr) << msu_str_to_cpp(err->message);
+
+    list_of_asm_insrs_t *insrs = asm_disassemble(code, MIDDLE_OF_MEMORY);
+    const msu_str_t *text = asm_print(insrs);
+    ASSERT_MSU_STREQ(text, "BRA L3\nD1 DAT 901\nDAT 600\nL3 LDA D1\nHLT\n");
+
+    msu_str_free(text);
+    list_of_asm_insrs_free(insrs, true);
+    free(code);
+    msu_str_free(src);
+}
+
 //==========================================================================
 // Complete assembly tests
 //==========================================================================
@@ -669,3 +988,100 @@ TEST(end_to_end, bootstrap){
     asm_error_free(err);
     msu_str_free(src);
 }
+
+//==========================================================================
+// Incremental assembly tests
+//==========================================================================
+
+void AssertSessionMatches(asm_session_t *session, const char *s) {
+    const msu_str_t *src = msu_str_new(s);
+    asm_error_t *err = nullptr;
+    const int *code = asm_session_assemble(session, src, &err);
+    ASSERT_EQ(err, nullptr) << msu_str_to_cpp(err->message);
+
+    asm_error_t *expected_err = nullptr;
+    int *expected = asm_assemble(src, &expected_err);
+    ASSERT_EQ(expected_err, nullptr);
+    for (int i = 0; i < MIDDLE_OF_MEMORY; i++) {
+        ASSERT_EQ(code[i], expected[i]) << "mismatch at " << i << " for:\n" << s;
+    }
+
+    free(expected);
+    msu_str_free(src);
+}
+
+TEST(incremental, only_changed_lines_are_reparsed) {
+    asm_session_t *session = asm_session_new();
+
+    AssertSessionMatches(session, "LDA x\nOUT\nHLT\nx DAT 5\n");
+    ASSERT_EQ(session->reparsed, 4);
+
+    AssertSessionMatches(session, "LDA x\nADD x\nOUT\nHLT\nx DAT 5\n");
+    ASSERT_EQ(session->reparsed, 1);
+
+    AssertSessionMatches(session, "LDA x\nADD x\nOUT\nHLT\nx DAT 5\n");
+    ASSERT_EQ(session->reparsed, 0);
+
+    asm_session_free(session);
+}
+
+TEST(incremental, edits_patch_label_addresses) {
+    asm_session_t *session = asm_session_new();
+
+    AssertSessionMatches(session, "loop LDA x\nBRZ done\nSUB one\nSTA x\nBRA loop\ndone HLT\nx DAT 3\none DAT 1\n");
+    AssertSessionMatches(session, "loop LDA x\nOUT\nBRZ done\nSUB one\nSTA x\nBRA loop\ndone HLT\nx DAT 3\none DAT 1\n");
+    AssertSessionMatches(session, "loop LDA x\nOUT\nBRZ done\nSUB one\nSTA x\nSPUSHI 4\nSPOP\nBRA loop\ndone HLT\nx DAT 3\none DAT 1\n");
+    AssertSessionMatches(session, "LDA x\nBRA done\ndone HLT\nx DAT 3\n");
+    AssertSessionMatches(session, "\nLDA y\n\nBRA done\ndone HLT\ny DAT 3\n");
+
+    asm_session_free(session);
+}
+
+TEST(incremental, recovers_after_an_error) {
+    asm_session_t *session = asm_session_new();
+    const msu_str_t *src = msu_str_new("LDA x\nHLT\n");
+    asm_error_t *err = nullptr;
+
+    asm_session_assemble(session, src, &err);
+    ASSERT_NE(err, nullptr) << "expected 'BAD_LABEL'";
+    ASSERT_EQ(err->kind, ASM_ERROR_BAD_LABEL);
+    asm_error_free(err);
+
+    AssertSessionMatches(session, "LDA x\nHLT\nx DAT 7\n");
+
+    msu_str_free(src);
+    asm_session_free(session);
+}
+
+TEST(incremental, errors_carry_the_current_line) {
+    asm_session_t *session = asm_session_new();
+    AssertSessionMatches(session, "LDA x\nOUT\nHLT\nx DAT 5\n");
+
+    const msu_str_t *src = msu_str_new("OUT\nLDA x\nOUT\nBRA y\nHLT\nx DAT 5\n");
+    asm_error_t *err = nullptr;
+    asm_session_assemble(session, src, &err);
+
+    ASSERT_NE(err, nullptr) << "expected 'BAD_LABEL'";
+    ASSERT_EQ(err->kind, ASM_ERROR_BAD_LABEL);
+    ASSERT_EQ(err->span.line, 4);
+    ASSERT_EQ(err->span.offset, 14);
+    ASSERT_EQ(err->next, nullptr);
+
+    asm_error_free(err);
+    msu_str_free(src);
+    asm_session_free(session);
+}
+
+TEST(incremental, directives_are_expanded) {
+    asm_session_t *session = asm_session_new();
+
+    AssertSessionMatches(session, ".equ N 3\nLDI N\nOUT\nHLT\n");
+    AssertSessionMatches(session, "LDI 3\nOUT\nHLT\n");
+    ASSERT_EQ(session->reparsed, 3);
+    AssertSessionMatches(session, "LDI 3\nOUT\nOUT\nHLT\n");
+    ASSERT_EQ(session->reparsed, 1);
+    AssertSessionMatches(session, "LDI 3\nOUT\nHLT\n");
+    ASSERT_EQ(session->reparsed, 0);
+
+    asm_session_free(session);
+}
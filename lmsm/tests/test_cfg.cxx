@@ -0,0 +1,115 @@
+#include <gtest/gtest.h>
+#include "testbase.hxx"
+
+extern "C" {
+#include "lmsm/cfg.h"
+#include "lmsm/asm.h"
+}
+
+// parses `s` and builds its graph, the instructions are freed with the graph by FreeCfg
+cfg_t *BuildCfg(const char *s) {
+    const msu_str_t *src = msu_str_new(s);
+    list_of_asm_insrs_t *insrs = asm_parse(src);
+    msu_str_free(src);
+    return cfg_build(insrs);
+}
+
+void FreeCfg(cfg_t *cfg) {
+    list_of_asm_insrs_t *insrs = (list_of_asm_insrs_t *) cfg->insrs;
+    cfg_free(cfg);
+    list_of_asm_insrs_free(insrs, true);
+}
+
+bool IsLive(const cfg_t *cfg, size_t index, const char *cell) {
+    if (!cell) return cfg_is_live(cfg, index, CFG_ACC);
+    const msu_str_t *label = msu_str_new(cell);
+    int bit = cfg_cell(cfg, label);
+    msu_str_free(label);
+    EXPECT_GE(bit, 0) << cell;
+    return bit >= 0 && cfg_is_live(cfg, index, bit);
+}
+
+//==========================================================================
+// Blocks
+//==========================================================================
+
+TEST(cfg_blocks, blocks_start_at_labels_and_after_branches) {
+    cfg_t *cfg = BuildCfg("INP\nBRZ a\nOUT\na OUT\nBRA a\n");
+    ASSERT_EQ(cfg->len, 3);
+    ASSERT_EQ(cfg->blocks[0].start, 0);
+    ASSERT_EQ(cfg->blocks[0].end, 2);
+    ASSERT_EQ(cfg->blocks[0].succ[0], 2);
+    ASSERT_EQ(cfg->blocks[0].succ[1], 1);
+    ASSERT_EQ(cfg->blocks[1].succ[0], 2);
+    ASSERT_EQ(cfg->blocks[2].succ[0], 2);
+    ASSERT_EQ(cfg->blocks[2].succ[1], -1);
+    FreeCfg(cfg);
+}
+
+TEST(cfg_blocks, calls_come_back_and_returns_exit) {
+    cfg_t *cfg = BuildCfg("CALL f\nHLT\nf OUT\nRET\n");
+    ASSERT_EQ(cfg->len, 3);
+    ASSERT_EQ(cfg->blocks[0].succ[0], 1);
+    ASSERT_EQ(cfg->blocks[0].callee, 2);
+    ASSERT_EQ(cfg->blocks[1].succ[0], -1);
+    ASSERT_FALSE(cfg->blocks[1].exits);
+    ASSERT_TRUE(cfg->blocks[2].exits);
+    FreeCfg(cfg);
+}
+
+TEST(cfg_blocks, unknown_targets_exit) {
+    cfg_t *cfg = BuildCfg("BRA nowhere\nDAT 3\n");
+    ASSERT_TRUE(cfg->blocks[0].exits);
+    ASSERT_TRUE(cfg->blocks[1].exits);
+    FreeCfg(cfg);
+}
+
+//==========================================================================
+// Liveness
+//==========================================================================
+
+TEST(cfg_liveness, straight_line_code) {
+    cfg_t *cfg = BuildCfg("INP\nSTA x\nLDI 1\nOUT\nLDA x\nOUT\nHLT\nx DAT 0\n");
+    ASSERT_TRUE(IsLive(cfg, 1, nullptr));
+    ASSERT_FALSE(IsLive(cfg, 2, nullptr));
+    ASSERT_FALSE(IsLive(cfg, 1, "x"));
+    ASSERT_TRUE(IsLive(cfg, 2, "x"));
+    ASSERT_FALSE(IsLive(cfg, 5, "x"));
+    FreeCfg(cfg);
+}
+
+TEST(cfg_liveness, loops_keep_values_live) {
+    cfg_t *cfg = BuildCfg("LDI 3\nSTA n\nloop LDA n\nSUB one\nSTA n\nBRP loop\nLDA n\nHLT\nn DAT 0\none DAT 1\n");
+    ASSERT_TRUE(IsLive(cfg, 0, "one"));
+    ASSERT_FALSE(IsLive(cfg, 0, "n"));
+    ASSERT_TRUE(IsLive(cfg, 5, "one"));
+    ASSERT_TRUE(IsLive(cfg, 5, "n"));
+    ASSERT_FALSE(IsLive(cfg, 6, nullptr));
+    FreeCfg(cfg);
+}
+
+TEST(cfg_liveness, calls_and_returns_are_conservative) {
+    cfg_t *cfg = BuildCfg("LDI 1\nSTA x\nCALL f\nHLT\nf LDI 2\nSTA y\nRET\nx DAT 0\ny DAT 0\n");
+    // the function might read x, and whoever it returns to might read y
+    ASSERT_TRUE(IsLive(cfg, 2, "x"));
+    ASSERT_TRUE(IsLive(cfg, 6, "y"));
+    ASSERT_TRUE(IsLive(cfg, 6, nullptr));
+    // but nothing is passed in the accumulator
+    ASSERT_FALSE(IsLive(cfg, 2, nullptr));
+    FreeCfg(cfg);
+}
+
+TEST(cfg_liveness, return_addresses) {
+    cfg_t *cfg = BuildCfg("RPUSH\nCALL f\nRPOP\nHLT\nf RPUSH\nCALL g\nRPOP\nRET\ng RET\n");
+    // a saved call leaves $ra as it was, and nothing after the first one returns
+    ASSERT_FALSE(cfg_is_live(cfg, 0, CFG_RA));
+    ASSERT_TRUE(cfg_is_live(cfg, 4, CFG_RA));
+    ASSERT_TRUE(cfg_is_live(cfg, 8, CFG_RA));
+    FreeCfg(cfg);
+
+    // without the save CALL sets it
+    cfg = BuildCfg("OUT\nCALL f\nOUT\nRET\nf RET\n");
+    ASSERT_FALSE(cfg_is_live(cfg, 0, CFG_RA));
+    ASSERT_TRUE(cfg_is_live(cfg, 2, CFG_RA));
+    FreeCfg(cfg);
+}
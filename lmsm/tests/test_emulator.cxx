@@ -568,3 +568,56 @@ TEST(emulator_machine_suite,test_stack_store_instruction_works){
     emulator_free(emulator);
 }
 
+TEST(emulator_machine_suite,test_indexed_load_and_store_instructions_work){
+    emulator_t *emulator = emulator_new();
+    emulator->memory[40] = 3; // an array of three at 40
+    emulator->memory[41] = 7;
+    emulator->memory[42] = 8;
+    emulator->memory[43] = 9;
+    emulator->stack_pointer = 198;
+    emulator->memory[198] = 2;
+    emulator_exec_instruction(emulator, -341); // SLDX 40
+    ASSERT_EQ(emulator->stack_pointer, 198);
+    ASSERT_EQ(emulator->memory[198], 9);
+
+    emulator->memory[197] = 0;
+    emulator->stack_pointer = 197;
+    emulator_exec_instruction(emulator, -541); // SSTX 40
+    ASSERT_EQ(emulator->stack_pointer, 199);
+    ASSERT_EQ(emulator->memory[41], 9);
+    ASSERT_EQ(emulator->status, emulator_machine_status::STATUS_READY);
+    emulator_free(emulator);
+}
+
+TEST(emulator_machine_suite,test_indexed_load_enters_error_state_past_the_end){
+    emulator_t *emulator = emulator_new();
+    emulator->memory[40] = 3;
+    emulator->stack_pointer = 199;
+    emulator->memory[199] = 3;
+    emulator_exec_instruction(emulator, -341); // SLDX 40
+    ASSERT_EQ(emulator->status, emulator_machine_status::STATUS_HALTED);
+    ASSERT_EQ(emulator->error_code, emulator_error_code::ERROR_BAD_INDEX);
+
+    emulator_reset(emulator);
+    emulator->memory[40] = 3;
+    emulator->stack_pointer = 198;
+    emulator->memory[198] = -1;
+    emulator_exec_instruction(emulator, -541); // SSTX 40
+    ASSERT_EQ(emulator->error_code, emulator_error_code::ERROR_BAD_INDEX);
+    ASSERT_EQ(emulator->stack_pointer, 198);
+    emulator_free(emulator);
+}
+
+TEST(emulator_machine_suite,test_opcode_table_decodes_what_it_encodes){
+    for (size_t i = 0; i < EMULATOR_OPCODE_COUNT; i++) {
+        const emulator_opcode_t *op = &EMULATOR_OPCODES[i];
+        ASSERT_EQ(emulator_find_opcode(op->name), op);
+        for (int n = 0; n <= op->max_operand; n++) {
+            int operand = -1;
+            ASSERT_EQ(emulator_decode(emulator_encode(op, n), &operand), op) << op->name << " " << n;
+            ASSERT_EQ(operand, n);
+        }
+    }
+    ASSERT_EQ(emulator_decode(936, NULL), nullptr);
+    ASSERT_EQ(emulator_find_opcode("SCMPGT")->code, 937);
+}
@@ -0,0 +1,462 @@
+#include <gtest/gtest.h>
+#include "testbase.hxx"
+
+extern "C" {
+#include "lmsm/opt.h"
+#include "lmsm/asm.h"
+#include "lmsm/emulator.h"
+#include "lmsm/sea.h"
+}
+
+void AssertOptimizesTo(const char *s, const char *expected) {
+    const msu_str_t *src = msu_str_new(s);
+    list_of_asm_insrs_t *insrs = asm_parse(src);
+    list_of_asm_insrs_t *optimized = asm_optimize(insrs);
+
+    const msu_str_t *text = asm_print(optimized);
+    ASSERT_MSU_STREQ(text, expected);
+
+    msu_str_free(text);
+    list_of_asm_insrs_free(optimized, true);
+    list_of_asm_insrs_free(insrs, true);
+    msu_str_free(src);
+}
+
+//==========================================================================
+// Peephole tests
+//==========================================================================
+
+// the peephole pass alone, with the default rules
+void AssertPeepholesTo(const char *s, const char *expected) {
+    const msu_str_t *rules_src = msu_str_new(OPT_DEFAULT_RULES);
+    opt_rules_t *rules = opt_rules_new();
+    ASSERT_EQ(opt_rules_parse(rules, rules_src), nullptr);
+
+    const msu_str_t *src = msu_str_new(s);
+    list_of_asm_insrs_t *insrs = asm_parse(src);
+    list_of_asm_insrs_t *optimized = opt_peephole(insrs, rules);
+
+    const msu_str_t *text = asm_print(optimized);
+    ASSERT_MSU_STREQ(text, expected);
+
+    msu_str_free(text);
+    list_of_asm_insrs_free(optimized, true);
+    list_of_asm_insrs_free(insrs, true);
+    msu_str_free(src);
+    opt_rules_free(rules);
+    msu_str_free(rules_src);
+}
+
+TEST(peephole, windows_are_rewritten) {
+    AssertOptimizesTo("SPUSHI 4\nSPOP\nOUT\n", "LDI 4\nOUT\n");
+    AssertOptimizesTo("SPUSH\nSPOP\nOUT\n", "OUT\n");
+    AssertOptimizesTo("SDUP\nSSWAP\nSSWAP\nSDROP\nOUT\n", "OUT\n");
+}
+
+TEST(peephole, rewrites_cascade) {
+    AssertOptimizesTo("LDI 1\nSPUSH\nSPUSH\nSPOP\nSPOP\nOUT\n", "LDI 1\nOUT\n");
+}
+
+TEST(peephole, labels_stay_on_the_first_instruction) {
+    AssertOptimizesTo("x SPUSHI 1\nSPOP\nBRA x\n", "x LDI 1\nBRA x\n");
+    // jumping into the middle of a window keeps it from matching
+    AssertOptimizesTo("SPUSH\ny SPOP\nBRA y\n", "SPUSH\ny SPOP\nBRA y\n");
+}
+
+TEST(peephole, labels_of_deleted_windows_move_to_the_next_instruction) {
+    AssertPeepholesTo("BRA a\na SPUSH\nSPOP\nOUT\n", "BRA a\na OUT\n");
+    AssertPeepholesTo("BRA a\na SPUSH\nSPOP\nb OUT\nBRA b\n", "BRA b\nb OUT\nBRA b\n");
+    AssertPeepholesTo("BRA a\na SPUSH\nSPOP\n", "BRA a\na DAT 0\n");
+    // merged labels chain, every reference ends up at the last one
+    AssertPeepholesTo("BRA a\na SPUSH\nSPOP\nb SPUSH\nSPOP\nc OUT\nBRA a\nBRA b\n", "BRA c\nc OUT\nBRA c\nBRA c\n");
+}
+
+TEST(peephole, custom_rules) {
+    const msu_str_t *src = msu_str_new("# drop balanced stack adjustments\nSPADD a; SPSUB a =>\n\nSPUSHI 0; SADD =>\n");
+    opt_rules_t *rules = opt_rules_new();
+    asm_error_t *err = opt_rules_parse(rules, src);
+    ASSERT_EQ(err, nullptr) << msu_str_to_cpp(err->message);
+    ASSERT_EQ(rules->len, 2);
+
+    const msu_str_t *code = msu_str_new("SPADD 2\nSPSUB 2\nSPADD 1\nSPSUB 2\nSPUSHI 0\nSADD\nOUT\n");
+    list_of_asm_insrs_t *insrs = asm_parse(code);
+    list_of_asm_insrs_t *optimized = opt_peephole(insrs, rules);
+    const msu_str_t *text = asm_print(optimized);
+    ASSERT_MSU_STREQ(text, "SPADD 1\nSPSUB 2\nOUT\n");
+
+    msu_str_free(text);
+    list_of_asm_insrs_free(optimized, true);
+    list_of_asm_insrs_free(insrs, true);
+    msu_str_free(code);
+    opt_rules_free(rules);
+    msu_str_free(src);
+}
+
+TEST(peephole, bad_rules_are_errors) {
+    const msu_str_t *src = msu_str_new("SPUSH SPOP =>\nLDI a => LDI b\nSPUSH => SPUSH\nSFROB =>\nSPOP\nSPUSH; SPOP =>\n");
+    opt_rules_t *rules = opt_rules_new();
+    asm_error_t *err = opt_rules_parse(rules, src);
+
+    size_t lines[] = {1, 2, 3, 4, 5};
+    const asm_error_t *e = err;
+    for (size_t line : lines) {
+        ASSERT_NE(e, nullptr);
+        ASSERT_EQ(e->span.line, line);
+        e = e->next;
+    }
+    ASSERT_EQ(e, nullptr);
+    ASSERT_EQ(rules->len, 1);
+
+    asm_error_free(err);
+    opt_rules_free(rules);
+    msu_str_free(src);
+}
+
+TEST(accumulator_caching, stack_round_trips_are_skipped) {
+    AssertOptimizesTo("SPUSHI 1\nSDUP\nSPOP\nOUT\nSPOP\nOUT\nHLT\n", "SPUSHI 1\nOUT\nSPOP\nOUT\nHLT\n");
+    // after a label the accumulator could hold anything
+    AssertOptimizesTo("SPUSHI 1\nx SDUP\nSPOP\nOUT\nBRA x\n", "SPUSHI 1\nx SDUP\nSPOP\nOUT\nBRA x\n");
+}
+
+TEST(accumulator_caching, constant_operands_use_constant_cells) {
+    AssertOptimizesTo("SLDA 2\nSPUSHI 5\nSADD\nSPOP\nOUT\nHLT\n",
+                      "SLDA 2\nSPOP\nADD $const.5\nOUT\nHLT\n$const.5 DAT 5\n");
+    AssertOptimizesTo("SLDA 2\nSPUSHI 5\nSSUB\nSPOP\nOUT\nHLT\nfive DAT 5\n",
+                      "SLDA 2\nSPOP\nSUB five\nOUT\nHLT\nfive DAT 5\n");
+}
+
+TEST(accumulator_caching, comparisons_branch_on_the_difference) {
+    AssertOptimizesTo("loop SLDA 0\nSPUSHI 3\nSCMPLT\nSPOP\nBRZ end\nLDI 1\nBRA loop\nend HLT\n",
+                      "loop SLDA 0\nSPOP\nSUB $const.3\nBRP end\nLDI 1\nBRA loop\nend HLT\n$const.3 DAT 3\n");
+    // the comparison result is printed, so it has to stay
+    AssertOptimizesTo("SLDA 0\nSPUSHI 3\nSCMPLT\nSPOP\nBRZ end\nOUT\nend HLT\n",
+                      "SLDA 0\nSPUSHI 3\nSCMPLT\nSPOP\nBRZ end\nOUT\nend HLT\n");
+}
+
+TEST(constant_folding, constant_expressions_fold) {
+    AssertOptimizesTo("SPUSHI 2\nSPUSHI 3\nSMUL\nSPUSHI 4\nSADD\nSPOP\nOUT\nHLT\n", "LDI 10\nOUT\nHLT\n");
+    AssertOptimizesTo("SPUSHI 4\nSPUSHI 5\nSCMPLT\nSNOT\nSPOP\nOUT\nHLT\n", "LDI 0\nOUT\nHLT\n");
+}
+
+TEST(constant_folding, results_are_clamped_like_the_emulator) {
+    AssertOptimizesTo("SPUSHI 50\nSPUSHI 30\nSMUL\nSPOP\nOUT\nHLT\n",
+                      "LDA $const.999\nOUT\nHLT\n$const.999 DAT 999\n");
+    AssertOptimizesTo("SPUSHI 3\nSPUSHI 5\nSSUB\nSPOP\nOUT\nHLT\n",
+                      "LDA $const.-2\nOUT\nHLT\n$const.-2 DAT -2\n");
+}
+
+TEST(constant_folding, things_that_cannot_fold_are_left_alone) {
+    // dividing by zero halts the machine
+    AssertOptimizesTo("SPUSHI 3\nSPUSHI 0\nSDIV\nSDROP\nHLT\n", "SPUSHI 3\nSPUSHI 0\nSDIV\nSDROP\nHLT\n");
+    AssertOptimizesTo("SPUSHI 3\nx SPUSHI 1\nSADD\nSDROP\nBRA x\n", "SPUSHI 3\nx SPUSHI 1\nSADD\nSDROP\nBRA x\n");
+    // the accumulator still holds the 3 that was pushed last, which is printed
+    AssertOptimizesTo("SPUSHI 2\nSPUSHI 3\nSADD\nOUT\nHLT\n", "SPUSHI 2\nSPUSHI 3\nSADD\nOUT\nHLT\n");
+}
+
+TEST(branch_threading, landing_pads_are_removed) {
+    AssertOptimizesTo("INP\nBRZ a\nOUT\na ADD zero\nHLT\nzero DAT 0\n", "INP\nBRZ a\nOUT\na HLT\n");
+    // code that reads the cell needs it to stay where it is
+    AssertOptimizesTo("LDA a\nOUT\na ADD zero\nHLT\nzero DAT 0\n", "LDA a\nOUT\na ADD zero\nHLT\nzero DAT 0\n");
+}
+
+TEST(branch_threading, branches_to_branches_are_threaded) {
+    AssertOptimizesTo("INP\nBRZ a\nOUT\nHLT\na BRA b\nOUT\nb HLT\n", "INP\nBRZ b\nOUT\nHLT\nb HLT\n");
+    AssertOptimizesTo("INP\nBRZ a\nOUT\nHLT\na BRP b\nOUT\nb HLT\n", "INP\nBRZ b\nOUT\nHLT\nb HLT\n");
+    // only zero goes on through a BRZ, BRP has to stop there
+    AssertOptimizesTo("INP\nBRP a\nOUT\nHLT\na BRZ b\nOUT\nb HLT\n", "INP\nBRP a\nOUT\nHLT\na BRZ b\nOUT\nb HLT\n");
+    AssertOptimizesTo("INP\nBRZ a\na OUT\nHLT\n", "INP\na OUT\nHLT\n");
+}
+
+TEST(branch_threading, negated_tests_are_inverted) {
+    AssertOptimizesTo("INP\nSPUSH\nSNOT\nSPOP\nBRZ a\nBRA b\na LDI 1\nOUT\nHLT\nb LDI 2\nOUT\nHLT\n",
+                      "INP\nBRZ b\na LDI 1\nOUT\nHLT\nb LDI 2\nOUT\nHLT\n");
+    // the accumulator is printed after b, so the truth value has to be the real one
+    AssertOptimizesTo("INP\nSPUSH\nSNOT\nSPOP\nBRZ a\nBRA b\na LDI 1\nOUT\nHLT\nb OUT\nHLT\n",
+                      "INP\nSPUSH\nSNOT\nSPOP\nBRZ a\nBRA b\na LDI 1\nOUT\nHLT\nb OUT\nHLT\n");
+}
+
+TEST(block_layout, hot_paths_fall_through) {
+    const msu_str_t *src = msu_str_new("INP\nBRZ else\nOUT\nBRA end\nelse LDI 0\nOUT\nend HLT\n");
+    list_of_asm_insrs_t *insrs = asm_parse(src);
+    int profile[TOP_OF_MEMORY + 1] = {10, 10, 10, 10, 0, 0, 10};
+    list_of_asm_insrs_t *laid_out = opt_layout(insrs, profile);
+
+    const msu_str_t *text = asm_print(laid_out);
+    ASSERT_MSU_STREQ(text, "INP\nBRZ else\nOUT\nBRA end\nend HLT\nelse LDI 0\nOUT\nBRA end\n");
+
+    msu_str_free(text);
+    list_of_asm_insrs_free(laid_out, true);
+    list_of_asm_insrs_free(insrs, true);
+    msu_str_free(src);
+}
+
+TEST(block_layout, loops_are_rotated) {
+    const msu_str_t *src = msu_str_new("SPUSHI 0\nloop SDUP\nSPUSHI 2\nSCMPGT\nSNOT\nSPOP\nBRZ done\n"
+                                       "SPUSHI 1\nSADD\nBRA loop\ndone HLT\n");
+    list_of_asm_insrs_t *insrs = asm_parse(src);
+    int profile[TOP_OF_MEMORY + 1] = {1, 1, 4, 4, 4, 4, 4, 4, 4, 3, 3, 3, 3, 1};
+    list_of_asm_insrs_t *laid_out = opt_layout(insrs, profile);
+
+    const msu_str_t *text = asm_print(laid_out);
+    ASSERT_MSU_STREQ(text, "SPUSHI 0\nBRA loop\n$layout.2 SPUSHI 1\nSADD\nBRA loop\n"
+                           "loop SDUP\nSPUSHI 2\nSCMPGT\nSPOP\nBRZ $layout.2\ndone HLT\n");
+
+    msu_str_free(text);
+    list_of_asm_insrs_free(laid_out, true);
+    list_of_asm_insrs_free(insrs, true);
+    msu_str_free(src);
+}
+
+TEST(dead_code, unreachable_code_and_unused_constants_are_removed) {
+    AssertOptimizesTo("LDA x\nBRA end\nOUT\nskip OUT\nend OUT\nHLT\nSUB x\nunused DAT 4\nx DAT 5\nDAT 6\n",
+                      "LDA x\nBRA end\nend OUT\nHLT\nx DAT 5\nDAT 6\n");
+    AssertOptimizesTo("CALL f\nHLT\nf OUT\nRET\nOUT\n", "CALL f\nHLT\nf OUT\nRET\n");
+    // a cell that's used doesn't keep the unused ones after it
+    AssertOptimizesTo("LDA x\nOUT\nHLT\nx DAT 5\ny DAT 6\nz DAT 7\n", "LDA x\nOUT\nHLT\nx DAT 5\n");
+}
+
+TEST(calls, leaf_functions_dont_save_the_return_address) {
+    AssertOptimizesTo("CALL f\nHLT\nf RPUSH\nOUT\nRPOP\nRET\n", "CALL f\nHLT\nf OUT\nRET\n");
+    // f calls g, which changes $ra
+    AssertOptimizesTo("CALL f\nHLT\nf RPUSH\nCALL g\nOUT\nRPOP\nRET\ng RPUSH\nOUT\nRPOP\nRET\n",
+                      "CALL f\nHLT\nf RPUSH\nCALL g\nOUT\nRPOP\nRET\ng OUT\nRET\n");
+    // jumping into the middle of f would skip its save
+    AssertOptimizesTo("CALL f\nBRA x\nf RPUSH\nx OUT\nRPOP\nRET\n", "CALL f\nBRA x\nf RPUSH\nx OUT\nRPOP\nRET\n");
+}
+
+TEST(calls, saves_around_calls_are_dropped_when_nothing_returns_after) {
+    AssertOptimizesTo("RPUSH\nCALL w\nRPOP\nRPUSH\nCALL w\nRPOP\nHLT\nw OUT\nRET\n",
+                      "CALL w\nCALL w\nHLT\nw OUT\nRET\n");
+    // v returns after calling w, so it needs its $ra back
+    AssertOptimizesTo("CALL v\nHLT\nv RPUSH\nCALL w\nRPOP\nOUT\nRET\nw OUT\nRET\n",
+                      "CALL v\nHLT\nv RPUSH\nCALL w\nRPOP\nOUT\nRET\nw OUT\nRET\n");
+}
+
+TEST(calls, tail_calls_become_jumps) {
+    AssertPeepholesTo("CALL w\nRPOP\nRET\n", "RPOP\nBRA w\n");
+    AssertPeepholesTo("v RPUSH\nCALL w\nRPOP\nRET\n", "v BRA w\n");
+    // something else returns through the RET
+    AssertPeepholesTo("CALL w\nRPOP\nr RET\nBRA r\n", "CALL w\nRPOP\nr RET\nBRA r\n");
+}
+
+//==========================================================================
+// Statistics tests
+//==========================================================================
+
+TEST(statistics, every_pass_is_accounted_for) {
+    const msu_str_t *src = msu_str_new("LDI 0\nBRZ skip\nSPUSHI 2\nSPUSHI 3\nSADD\nSPOP\nOUT\nskip ADD zero\n"
+                                       "HLT\nzero DAT 0\n");
+    list_of_asm_insrs_t *insrs = asm_parse(src);
+    opt_stats_t stats;
+    list_of_asm_insrs_t *optimized = asm_optimize_stats(insrs, &stats);
+
+    ASSERT_EQ(stats.len, 7);
+    ASSERT_STREQ(stats.passes[0].name, "peephole");
+    ASSERT_STREQ(stats.passes[4].name, "thread");
+    // each pass starts from what the last one left
+    ASSERT_EQ(stats.passes[0].insrs_before, insrs->len);
+    for (size_t i = 1; i < stats.len; i++) {
+        ASSERT_EQ(stats.passes[i].insrs_before, stats.passes[i - 1].insrs_after);
+        ASSERT_EQ(stats.passes[i].cells_before, stats.passes[i - 1].cells_after);
+    }
+    ASSERT_EQ(stats.passes[stats.len - 1].insrs_after, optimized->len);
+
+    // 2 + 3 folds, and the landing pad takes threading at least a round
+    ASSERT_GT(stats.passes[2].insrs_before, stats.passes[2].insrs_after);
+    ASSERT_GE(stats.passes[4].iterations, 1);
+    double ms = stats.rules_ms;
+    for (size_t i = 0; i < stats.len; i++) ms += stats.passes[i].ms;
+    ASSERT_LE(ms, stats.ms + 0.001);
+
+    // and the same code comes out without them
+    list_of_asm_insrs_t *plain = asm_optimize(insrs);
+    const msu_str_t *text = asm_print(optimized), *plain_text = asm_print(plain);
+    ASSERT_MSU_STREQ(text, msu_str_data(plain_text));
+
+    const msu_str_t *report = opt_stats_print(&stats);
+    ASSERT_EQ(strncmp(msu_str_data(report), "pass ", 5), 0);
+
+    msu_str_free(report);
+    msu_str_free(text);
+    msu_str_free(plain_text);
+    list_of_asm_insrs_free(plain, true);
+    list_of_asm_insrs_free(optimized, true);
+    list_of_asm_insrs_free(insrs, true);
+    msu_str_free(src);
+}
+
+//==========================================================================
+// Optimized programs
+//==========================================================================
+
+// runs `code` to the end, returning how many instructions it took
+int RunCounting(int *code, std::string &output, int *profile = nullptr) {
+    emulator_t *em = emulator_new();
+    em->profile = profile;
+    emulator_load(em, code, MIDDLE_OF_MEMORY);
+    em->status = STATUS_RUNNING;
+    int steps = 0;
+    while (em->status != STATUS_HALTED && steps < 100000) {
+        emulator_step(em);
+        steps++;
+    }
+    output = em->output_buffer;
+    emulator_free(em);
+    return steps;
+}
+
+// returns the share of the executed instructions the optimizer saved. `profiled` lays the
+// blocks out by how often they ran in the unoptimized program
+double AssertSameBehaviour(const char *s, const char *output, bool profiled = false) {
+    const msu_str_t *src = msu_str_new(s);
+    parsenode_t *program = sea_parse(src);
+    report_errors(src, program);
+
+    sea_error_t *sea_err = nullptr;
+    list_of_asm_insrs_t *insrs = sea_compile_ir(program, &sea_err);
+    EXPECT_EQ(sea_err, nullptr) << msu_str_to_cpp(sea_err->message);
+
+    asm_error_t *err = nullptr;
+    int *plain = asm_assemble_insrs(insrs, &err);
+    EXPECT_EQ(err, nullptr) << msu_str_to_cpp(err->message);
+    std::string plain_output, optimized_output;
+    int profile[TOP_OF_MEMORY + 1] = {0};
+    int plain_steps = RunCounting(plain, plain_output, profile);
+
+    list_of_asm_insrs_t *optimized = profiled ? asm_optimize_profiled(insrs, profile) : asm_optimize(insrs);
+    int *code = asm_assemble_insrs(optimized, &err);
+    const msu_str_t *text = asm_print(optimized);
+    EXPECT_EQ(err, nullptr) << msu_str_to_cpp(err->message) << "\n" << msu_str_to_cpp(text);
+
+    int optimized_steps = RunCounting(code, optimized_output);
+    EXPECT_EQ(plain_output, output);
+    EXPECT_EQ(optimized_output, output) << msu_str_to_cpp(text);
+    EXPECT_LE(optimized_steps, plain_steps) << msu_str_to_cpp(text);
+
+    free(plain);
+    free(code);
+    msu_str_free(text);
+    list_of_asm_insrs_free(optimized, true);
+    list_of_asm_insrs_free(insrs, true);
+    parsenode_free(program);
+    msu_str_free(src);
+    return 1.0 - (double) optimized_steps / plain_steps;
+}
+
+TEST(optimized_programs, behave_the_same) {
+    AssertSameBehaviour("int main() { putn(13); return 0; }", "13 ");
+    AssertSameBehaviour("int main() { if (4 < 5) { putn(9); } return 0; }", "9 ");
+    AssertSameBehaviour("int main() { int x = 3; putn(x); return 0; }", "3 ");
+    AssertSameBehaviour("int main() { for (int x = 0; x < 3; x = x + 1) { putn(x); } return 0; }", "0 1 2 ");
+    AssertSameBehaviour("int main() { int x = 0; do { putn(x); x = x + 1; } while (x <= 2); return 0; }", "0 1 2 ");
+    AssertSameBehaviour("int main() { int x = 5; if (x < 3) { putn(1); } else { putn(2); } putn(3); return 0; }",
+                        "2 3 ");
+    AssertSameBehaviour("int t[3] = {4, 5}; int main() { for (int i = 0; i < 3; i = i + 1) { t[2] = t[2] + t[i]; } "
+                        "putn(t[2]); return 0; }", "18 ");
+    AssertSameBehaviour("int main() { int x = 0; while (x != 4 && (x < 2 || x == 3)) { putn(x); x = x + 1; } "
+                        "putn(x == 2 || x > 3); return 0; }", "0 1 1 ");
+}
+
+TEST(optimized_programs, loops_run_fewer_instructions) {
+    double saved = AssertSameBehaviour(
+        "int main() { for (int x = 0; x < 9; x = x + 1) { putn(x + 1); } return 0; }", "1 2 3 4 5 6 7 8 9 ");
+    ASSERT_GT(saved, 0.15);
+}
+
+TEST(optimized_programs, constant_expressions_cost_nothing) {
+    AssertSameBehaviour("int main() { putn(2 * 3 + 4 - 20 / 5); return 0; }", "6 ");
+    AssertSameBehaviour("int main() { putn(60 * 30); return 0; }", "999 ");
+}
+
+TEST(optimized_programs, profiles_make_loops_cheaper) {
+    const char *src = "int main() { for (int x = 0; x <= 8; x = x + 1) { if (x < 7) { putn(x); } else { putn(0); } }"
+                      " return 0; }";
+    double saved = AssertSameBehaviour(src, "0 1 2 3 4 5 6 0 0 ");
+    double saved_profiled = AssertSameBehaviour(src, "0 1 2 3 4 5 6 0 0 ", true);
+    ASSERT_GT(saved_profiled, saved);
+}
+
+TEST(optimized_programs, calls_are_cheaper) {
+    AssertSameBehaviour("int sq(int n) { return n * n; } int main() { putn(sq(9)); return 0; }", "81 ");
+    AssertSameBehaviour("int fact(int n) { if (n < 2) { return 1; } return n * fact(n - 1); }"
+                        " int main() { putn(fact(5)); return 0; }", "120 ");
+    // the recursion is a tail call, so it runs as a loop
+    double saved = AssertSameBehaviour("int sum(int n, int acc) { if (n < 1) { return acc; } return sum(n - 1, acc + n); }"
+                                       " int main() { putn(sum(10, 0)); return 0; }", "55 ");
+    ASSERT_GT(saved, 0.15);
+}
+
+// what the optimized program prints and how many instructions that took
+int RunOptimized(const char *s, const sea_options_t *options, std::string &output) {
+    const msu_str_t *src = msu_str_new(s);
+    parsenode_t *program = sea_parse(src);
+    report_errors(src, program);
+
+    sea_error_t *sea_err = nullptr;
+    list_of_asm_insrs_t *insrs = sea_compile_ir_with(program, options, &sea_err);
+    EXPECT_EQ(sea_err, nullptr) << msu_str_to_cpp(sea_err->message);
+    list_of_asm_insrs_t *optimized = asm_optimize(insrs);
+    asm_error_t *err = nullptr;
+    int *code = asm_assemble_insrs(optimized, &err);
+    EXPECT_EQ(err, nullptr) << msu_str_to_cpp(err->message);
+    int steps = RunCounting(code, output);
+
+    free(code);
+    list_of_asm_insrs_free(optimized, true);
+    list_of_asm_insrs_free(insrs, true);
+    parsenode_free(program);
+    msu_str_free(src);
+    return steps;
+}
+
+TEST(optimized_programs, static_locals_are_cheaper) {
+    // fact recurses so it keeps its frame, the rest get fixed cells
+    const char *src = "int g = -2;"
+                      " int fact(int n) { if (n < 2) { return 1; } return n * fact(n - 1); }"
+                      " int step(int a, int b) { int t = a * b; return t - g; }"
+                      " int main() { int total = 0; for (int x = 0; x < 9; x = x + 1) { total = total + step(x, 2); }"
+                      " putn(total); g = 1; putn(step(fact(4), 3)); return 0; }";
+    sea_options_t stack = sea_default_options(), fixed = sea_default_options();
+    fixed.static_locals = true;
+    std::string stack_output, fixed_output;
+    int stack_steps = RunOptimized(src, &stack, stack_output);
+    int fixed_steps = RunOptimized(src, &fixed, fixed_output);
+    ASSERT_EQ(stack_output, "90 71 ");
+    ASSERT_EQ(fixed_output, stack_output);
+    ASSERT_LT(fixed_steps, stack_steps);
+}
+
+TEST(optimized_programs, loop_optimizations_are_cheaper) {
+    // n * n is the same every time around and i * 3 goes up by 3, in either kind of frame
+    const char *src = "int main() { int n = 4; int s = 0;"
+                      " for (int i = 0; i < 10; i = i + 1) { s = s + i * 3 + n * n; putn(i * 3); }"
+                      " putn(s); return 0; }";
+    for (bool static_locals : {false, true}) {
+        sea_options_t plain = sea_default_options(), loops = sea_default_options();
+        plain.optimize_loops = false;
+        plain.static_locals = loops.static_locals = static_locals;
+        std::string plain_output, loops_output;
+        int plain_steps = RunOptimized(src, &plain, plain_output);
+        int loops_steps = RunOptimized(src, &loops, loops_output);
+        ASSERT_EQ(plain_output, "0 3 6 9 12 15 18 21 24 27 295 ");
+        ASSERT_EQ(loops_output, plain_output);
+        ASSERT_LT(loops_steps, plain_steps);
+    }
+}
+
+TEST(optimized_programs, loops_that_count_down_are_reduced) {
+    // i * 2 goes down by 6, which is taken off rather than pushed as -6
+    const char *src = "int main() { int s = 0;"
+                      " for (int i = 9; i > 0; i = i - 3) { s = s + i * 2 + i * 2; }"
+                      " putn(s); return 0; }";
+    for (bool static_locals : {false, true}) {
+        sea_options_t plain = sea_default_options(), loops = sea_default_options();
+        plain.optimize_loops = false;
+        plain.static_locals = loops.static_locals = static_locals;
+        std::string plain_output, loops_output;
+        RunOptimized(src, &plain, plain_output);
+        RunOptimized(src, &loops, loops_output);
+        ASSERT_EQ(plain_output, "72 ");
+        ASSERT_EQ(loops_output, plain_output);
+    }
+}
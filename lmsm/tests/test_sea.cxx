@@ -22,6 +22,134 @@ TEST(sea_tests, test_simple) {
     parsenode_free(expr);
 }
 
+TEST(sea_tests, lowers_to_typed_nodes) {
+    const msu_str_t *src = msu_str_new("int g = 4; int f(int a, int b) { for (int i = 0; i < a; i = i + 1) { } return -b; }");
+    parsenode_t *program = sea_parse(src);
+    report_errors(src, program);
+    sea_ast_t *ast = sea_lower(program);
+
+    ASSERT_EQ(ast->program->len, 2);
+    ASSERT_EQ(ast->program->decls[0]->kind, SEA_VAR);
+    auto *g = (sea_var_t *) ast->program->decls[0];
+    ASSERT_MSU_STREQ(g->name, "g");
+    ASSERT_EQ(g->value->kind, SEA_INT);
+    ASSERT_EQ(((sea_int_t *) g->value)->value, 4);
+
+    ASSERT_EQ(ast->program->decls[1]->kind, SEA_FUNCDEF);
+    auto *f = (sea_funcdef_t *) ast->program->decls[1];
+    ASSERT_TRUE(f->returns_int);
+    ASSERT_EQ(f->n_params, 2);
+    ASSERT_MSU_STREQ(f->params[1], "b");
+
+    auto *body = (sea_block_t *) f->body;
+    ASSERT_EQ(body->len, 2);
+    ASSERT_EQ(body->stmts[0]->kind, SEA_FOR);
+    auto *loop = (sea_loop_t *) body->stmts[0];
+    ASSERT_EQ(loop->init->kind, SEA_VAR);
+    ASSERT_EQ(((sea_binary_t *) loop->cond)->op, SEA_OP_LT);
+    ASSERT_EQ(((sea_binary_t *) loop->incr)->op, SEA_OP_ASSIGN);
+    ASSERT_EQ(((sea_block_t *) loop->body)->len, 0);
+    auto *ret = (sea_return_t *) body->stmts[1];
+    ASSERT_EQ(((sea_unary_t *) ret->value)->op, SEA_OP_NEG);
+
+    // the whole tree is one arena
+    ASSERT_LT(arena_alloc_used(&ast->arena), 1024);
+    sea_ast_free(ast);
+    parsenode_free(program);
+    msu_str_free(src);
+}
+
+TEST(sea_tests, threads_give_the_same_code) {
+    const msu_str_t *src = msu_str_new("int g = 2;"
+                                       " int sq(int a) { if (a > 3) { return a * a; } return a + 7; }"
+                                       " int sum(int n) { int s = 0; while (n > 0) { s = s + sq(n); n = n - 1; } return s; }"
+                                       " void show(int x) { putn(x * 99); return; }"
+                                       " int main() { for (int i = 0; i < 3; i = i + 1) { show(sum(i) - g); } return 0; }");
+    parsenode_t *program = sea_parse(src);
+    report_errors(src, program);
+
+    sea_options_t one = sea_default_options(), many = sea_default_options();
+    many.threads = 4;
+    sea_error_t *err = nullptr;
+    list_of_asm_insrs_t *serial = sea_compile_ir_with(program, &one, &err);
+    ASSERT_EQ(err, nullptr);
+    list_of_asm_insrs_t *parallel = sea_compile_ir_with(program, &many, &err);
+    ASSERT_EQ(err, nullptr);
+
+    // labels are per function and constants are merged in the order the functions are
+    const msu_str_t *serial_text = asm_print(serial), *parallel_text = asm_print(parallel);
+    ASSERT_MSU_STREQ(parallel_text, msu_str_data(serial_text));
+
+    msu_str_free(serial_text);
+    msu_str_free(parallel_text);
+    list_of_asm_insrs_free(serial, true);
+    list_of_asm_insrs_free(parallel, true);
+    parsenode_free(program);
+    msu_str_free(src);
+}
+
+// compiles and assembles `src` into `cache`
+void store_compiled(sea_cache_t *cache, const msu_str_t *src, const sea_options_t *options) {
+    parsenode_t *program = sea_parse(src);
+    sea_error_t *err = nullptr;
+    list_of_asm_insrs_t *insrs = sea_compile_ir_with(program, options, &err);
+    ASSERT_EQ(err, nullptr);
+    asm_error_t *asm_err = nullptr;
+    int *code = asm_assemble_insrs(insrs, &asm_err);
+    ASSERT_EQ(asm_err, nullptr);
+    const msu_str_t *assembly = asm_print(insrs);
+    sea_cache_store(cache, src, options, assembly, code);
+
+    msu_str_free(assembly);
+    free(code);
+    list_of_asm_insrs_free(insrs, true);
+    parsenode_free(program);
+}
+
+TEST(sea_tests, compile_cache) {
+    const msu_str_t *a = msu_str_new("int main() { putn(1); return 0; }");
+    const msu_str_t *b = msu_str_new("int main() { putn(2); return 0; }");
+    const msu_str_t *c = msu_str_new("int main() { putn(3); return 0; }");
+    sea_options_t options = sea_default_options(), fixed = sea_default_options();
+    fixed.static_locals = true;
+
+    sea_cache_t *cache = sea_cache_new(2, nullptr);
+    ASSERT_EQ(sea_cache_lookup(cache, a, &options), nullptr);
+    store_compiled(cache, a, &options);
+    const sea_cache_entry_t *hit = sea_cache_lookup(cache, a, &options);
+    ASSERT_NE(hit, nullptr);
+    ASSERT_EQ(msu_str_data(hit->assembly)[0], 'C'); // CALL main
+    // other options are another entry
+    ASSERT_EQ(sea_cache_lookup(cache, a, &fixed), nullptr);
+
+    // a was used last, so b goes when c comes in
+    store_compiled(cache, b, &options);
+    ASSERT_NE(sea_cache_lookup(cache, a, &options), nullptr);
+    store_compiled(cache, c, &options);
+    ASSERT_EQ(cache->len, 2);
+    ASSERT_EQ(sea_cache_lookup(cache, b, &options), nullptr);
+    ASSERT_NE(sea_cache_lookup(cache, a, &options), nullptr);
+    ASSERT_EQ(cache->hits, 3);
+    sea_cache_free(cache);
+
+    // what's written to a directory is there for the next cache
+    std::string dir = testing::TempDir();
+    sea_cache_t *first = sea_cache_new(2, dir.c_str());
+    store_compiled(first, b, &fixed);
+    sea_cache_t *second = sea_cache_new(2, dir.c_str());
+    const sea_cache_entry_t *warm = sea_cache_lookup(second, b, &fixed);
+    const sea_cache_entry_t *stored = sea_cache_lookup(first, b, &fixed);
+    ASSERT_NE(warm, nullptr);
+    ASSERT_MSU_STREQ(warm->assembly, msu_str_data(stored->assembly));
+    ASSERT_EQ(memcmp(warm->code, stored->code, sizeof(warm->code)), 0);
+    sea_cache_free(first);
+    sea_cache_free(second);
+
+    msu_str_free(a);
+    msu_str_free(b);
+    msu_str_free(c);
+}
+
 class check_node {
 private:
     parsenode_t *node;
@@ -220,3 +348,476 @@ int main() {
     parsenode_free(program);
 }
 
+
+TEST(sea_tests_e2e, functions) {
+    const msu_str_t *src = msu_str_new(R"(
+int sub(int a, int b) {
+    return a - b;
+}
+
+int fact(int n) {
+    if (n < 2) {
+        return 1;
+    }
+    return n * fact(n - 1);
+}
+
+int main() {
+    putn(sub(9, 2));
+    fact(3);
+    putn(fact(4));
+    return 0;
+}
+)");
+
+    parsenode_t *program = sea_parse(src);
+    report_errors(src, program);
+    msu_str_free(src);
+
+    sea_error_t *sea_error = NULL;
+    const msu_str_t *bytecode = sea_compile(program, &sea_error);
+    ASSERT_EQ(sea_error, nullptr) << msu_str_data(sea_error->message);
+    std::cout << msu_str_to_cpp(bytecode) << std::endl;
+
+    asm_error_t *asm_err = nullptr;
+    int *code = asm_assemble(bytecode, &asm_err);
+    ASSERT_EQ(asm_err, nullptr) << msu_str_to_cpp(asm_err->message);
+    msu_str_free(bytecode);
+
+    emulator_t *em = emulator_exec(code);
+    ASSERT_STREQ(em->output_buffer, "7 24 ");
+
+    emulator_free(em);
+    free(code);
+
+    parsenode_free(program);
+}
+
+TEST(sea_tests_e2e, shadowing) {
+    const msu_str_t *src = msu_str_new(R"(
+int x(int x) {
+    return x + 1;
+}
+
+int main() {
+    int x = 1;
+    for (int i = 0; i < 2; i = i + 1) {
+        int x = 5;
+        putn(x + i);
+    }
+    putn(x(x));
+    return 0;
+}
+)");
+
+    parsenode_t *program = sea_parse(src);
+    report_errors(src, program);
+    msu_str_free(src);
+
+    sea_error_t *sea_error = NULL;
+    const msu_str_t *bytecode = sea_compile(program, &sea_error);
+    ASSERT_EQ(sea_error, nullptr) << msu_str_data(sea_error->message);
+
+    asm_error_t *asm_err = nullptr;
+    int *code = asm_assemble(bytecode, &asm_err);
+    ASSERT_EQ(asm_err, nullptr) << msu_str_to_cpp(asm_err->message);
+    msu_str_free(bytecode);
+
+    emulator_t *em = emulator_exec(code);
+    ASSERT_STREQ(em->output_buffer, "5 6 2 ");
+
+    emulator_free(em);
+    free(code);
+
+    parsenode_free(program);
+}
+
+TEST(sea_tests_e2e, bad_names) {
+    const char *programs[][2] = {
+        {"int f() { return 1; } int f() { return 2; } int main() { return 0; }", "redefinition of function 'f'"},
+        {"int main() { int x = 1; { int y = 2; } return y; }", "undefined variable 'y'"},
+        {"int main() { z = 1; return 0; }", "undefined variable 'z'"},
+        {"int g = 1 + 2; int main() { return g; }", "global 'g' must start as a constant"},
+        {"int t[2]; int main() { return t; }", "array 't' has to be indexed"},
+        {"int main() { int t = 1; return t[0]; }", "'t' is not an array"},
+        {"int main() { return t[0]; }", "undefined array 't'"},
+        {"int t[2]; int main() { return t[2]; }", "index 2 is past the end of 't[2]'"},
+        {"int t[2] = {1, 2, 3}; int main() { return 0; }", "too many values for 't[2]'"},
+        {"int t[2]; int t; int main() { return 0; }", "redefinition of global 't'"},
+    };
+
+    for (const auto &program_and_error : programs) {
+        const msu_str_t *src = msu_str_new(program_and_error[0]);
+        parsenode_t *program = sea_parse(src);
+        report_errors(src, program);
+        msu_str_free(src);
+
+        sea_error_t *sea_error = NULL;
+        const msu_str_t *bytecode = sea_compile(program, &sea_error);
+        ASSERT_EQ(bytecode, nullptr);
+        ASSERT_NE(sea_error, nullptr);
+        ASSERT_MSU_STREQ(sea_error->message, program_and_error[1]);
+
+        sea_error_free(sea_error);
+        parsenode_free(program);
+    }
+}
+
+TEST(sea_tests_e2e, arrays) {
+    const msu_str_t *src = msu_str_new(R"(
+int days[6] = {31, 28, 31, 30, 31, 30};
+int seen[3];
+
+int main() {
+    int total = 1;
+    for (int m = 0; m < 2; m = m + 1) {
+        total = total + days[m];
+    }
+    putn(total);
+    for (int i = 0; i < 6; i = i + 1) {
+        seen[i / 2] = seen[i / 2] + days[i];
+    }
+    putn(seen[2]);
+    putn(seen[total - 57]);
+    return 0;
+}
+)");
+
+    parsenode_t *program = sea_parse(src);
+    report_errors(src, program);
+    msu_str_free(src);
+
+    sea_error_t *sea_error = NULL;
+    const msu_str_t *bytecode = sea_compile(program, &sea_error);
+    ASSERT_EQ(sea_error, nullptr) << msu_str_data(sea_error->message);
+
+    asm_error_t *asm_err = nullptr;
+    int *code = asm_assemble(bytecode, &asm_err);
+    ASSERT_EQ(asm_err, nullptr) << msu_str_to_cpp(asm_err->message);
+    msu_str_free(bytecode);
+
+    // seen[3] is one past the end, which stops the machine
+    emulator_t *em = emulator_exec(code);
+    ASSERT_STREQ(em->output_buffer, "60 61 ");
+    ASSERT_EQ(em->error_code, ERROR_BAD_INDEX);
+
+    emulator_free(em);
+    free(code);
+
+    parsenode_free(program);
+}
+
+TEST(sea_tests_e2e, conditions_branch_on_the_difference) {
+    const msu_str_t *src = msu_str_new(R"(
+int said(int x) {
+    putn(x);
+    return x;
+}
+
+int main() {
+    int a = 3;
+    if (a == 4 && said(8)) putn(1);
+    if (!(a != 3) && 5 <= a || said(0)) putn(2);
+    putn(a > 2 || said(9));
+    return 0;
+}
+)");
+
+    parsenode_t *program = sea_parse(src);
+    report_errors(src, program);
+    msu_str_free(src);
+
+    sea_error_t *sea_error = NULL;
+    const msu_str_t *bytecode = sea_compile(program, &sea_error);
+    ASSERT_EQ(sea_error, nullptr) << msu_str_data(sea_error->message);
+
+    // no condition is made into a 0 or 1 to test it
+    std::string text = msu_str_to_cpp(bytecode);
+    ASSERT_EQ(text.find("SCMP"), std::string::npos) << text;
+    ASSERT_EQ(text.find("SEQ"), std::string::npos) << text;
+
+    asm_error_t *asm_err = nullptr;
+    int *code = asm_assemble(bytecode, &asm_err);
+    ASSERT_EQ(asm_err, nullptr) << msu_str_to_cpp(asm_err->message);
+    msu_str_free(bytecode);
+
+    // the right sides that are needed run, the others don't
+    emulator_t *em = emulator_exec(code);
+    ASSERT_STREQ(em->output_buffer, "0 1 ");
+
+    emulator_free(em);
+    free(code);
+
+    parsenode_free(program);
+}
+
+TEST(sea_tests_e2e, constants_get_one_cell) {
+    const msu_str_t *src = msu_str_new(R"(
+int main() {
+    int x = 0;
+    while (x < 3) {
+        if (x > 1) {
+            putn(x);
+        }
+        x = x + 1;
+    }
+    do {
+        x = x - 1;
+    } while (x > 0);
+    return x;
+}
+)");
+
+    parsenode_t *program = sea_parse(src);
+    report_errors(src, program);
+    msu_str_free(src);
+
+    sea_error_t *sea_error = NULL;
+    const msu_str_t *bytecode = sea_compile(program, &sea_error);
+    ASSERT_EQ(sea_error, nullptr) << msu_str_data(sea_error->message);
+
+    // every landing pad adds zero from the same cell
+    std::string text = msu_str_to_cpp(bytecode);
+    ASSERT_EQ(text.find("DAT"), text.rfind("DAT")) << text;
+    ASSERT_NE(text.find("$const.0 DAT 0"), std::string::npos) << text;
+
+    asm_error_t *asm_err = nullptr;
+    int *code = asm_assemble(bytecode, &asm_err);
+    ASSERT_EQ(asm_err, nullptr) << msu_str_to_cpp(asm_err->message);
+    msu_str_free(bytecode);
+
+    emulator_t *em = emulator_exec(code);
+    ASSERT_STREQ(em->output_buffer, "2 ");
+
+    emulator_free(em);
+    free(code);
+
+    parsenode_free(program);
+}
+
+TEST(sea_tests_e2e, common_subexpressions_are_computed_once) {
+    const msu_str_t *src = msu_str_new(R"(
+int main() {
+    int a = 3;
+    int b = 4;
+    putn((a * b - 1) * (a * b - 1));
+    putn(a * a + a * a);
+    putn((a + b) * 2 - (a + b) / 7 + (a + b));
+    putn(b - a < a - b);
+    return 0;
+}
+)");
+
+    parsenode_t *program = sea_parse(src);
+    report_errors(src, program);
+    msu_str_free(src);
+
+    sea_error_t *sea_error = NULL;
+    const msu_str_t *bytecode = sea_compile(program, &sea_error);
+    ASSERT_EQ(sea_error, nullptr) << msu_str_data(sea_error->message);
+
+    std::string text = msu_str_to_cpp(bytecode);
+    auto count = [&](const std::string &insr) {
+        size_t n = 0;
+        for (size_t at = text.find(insr); at != std::string::npos; at = text.find(insr, at + 1)) n++;
+        return n;
+    };
+    ASSERT_EQ(count("SMUL"), 4) << text;
+    ASSERT_EQ(count("SADD"), 3) << text;
+
+    asm_error_t *asm_err = nullptr;
+    int *code = asm_assemble(bytecode, &asm_err);
+    ASSERT_EQ(asm_err, nullptr) << msu_str_to_cpp(asm_err->message);
+    msu_str_free(bytecode);
+
+    emulator_t *em = emulator_exec(code);
+    ASSERT_STREQ(em->output_buffer, "121 18 20 0 ");
+
+    emulator_free(em);
+    free(code);
+
+    parsenode_free(program);
+}
+
+TEST(sea_tests_e2e, kept_copies_stay_under_operands) {
+    // j * 2 is kept when it's the right operand of an add, which has to take the left one
+    const msu_str_t *src = msu_str_new(R"(
+int main() {
+    int i = 3;
+    int j = 2;
+    int s = 1;
+    putn(s + i * 5 + j * 2 + j * 2 + i * 5);
+    return 0;
+}
+)");
+
+    parsenode_t *program = sea_parse(src);
+    report_errors(src, program);
+    msu_str_free(src);
+
+    sea_error_t *sea_error = NULL;
+    const msu_str_t *bytecode = sea_compile(program, &sea_error);
+    ASSERT_EQ(sea_error, nullptr) << msu_str_data(sea_error->message);
+
+    asm_error_t *asm_err = nullptr;
+    int *code = asm_assemble(bytecode, &asm_err);
+    ASSERT_EQ(asm_err, nullptr) << msu_str_to_cpp(asm_err->message);
+    msu_str_free(bytecode);
+
+    emulator_t *em = emulator_exec(code);
+    ASSERT_STREQ(em->output_buffer, "39 ");
+
+    emulator_free(em);
+    free(code);
+
+    parsenode_free(program);
+}
+
+// compiles `s` with `options` and runs it, what it printed. it has to stop without an error
+std::string run_compiled(const char *s, const sea_options_t *options) {
+    const msu_str_t *src = msu_str_new(s);
+    parsenode_t *program = sea_parse(src);
+    report_errors(src, program);
+
+    sea_error_t *sea_error = nullptr;
+    list_of_asm_insrs_t *insrs = sea_compile_ir_with(program, options, &sea_error);
+    EXPECT_EQ(sea_error, nullptr) << msu_str_data(sea_error->message);
+    asm_error_t *asm_err = nullptr;
+    int *code = asm_assemble_insrs(insrs, &asm_err);
+    EXPECT_EQ(asm_err, nullptr) << msu_str_to_cpp(asm_err->message);
+
+    emulator_t *em = emulator_exec(code);
+    EXPECT_EQ(em->error_code, ERROR_NONE);
+    std::string output = em->output_buffer;
+
+    emulator_free(em);
+    free(code);
+    list_of_asm_insrs_free(insrs, true);
+    parsenode_free(program);
+    msu_str_free(src);
+    return output;
+}
+
+TEST(sea_tests_e2e, bare_calls_as_branches) {
+    // the value of each call is dropped inside its branch, not after the branches join
+    const char *src = R"(
+int f(int x) {
+    putn(x);
+    return x;
+}
+
+int main() {
+    int j = 3;
+    if (j > 5) f(1);
+    if (j > 2) f(2);
+    if (j > 5) f(3); else f(4);
+    putn(j);
+    return 0;
+}
+)";
+    sea_options_t stack = sea_default_options(), fixed = sea_default_options();
+    fixed.static_locals = true;
+    ASSERT_EQ(run_compiled(src, &stack), "2 4 3 ");
+    ASSERT_EQ(run_compiled(src, &fixed), "2 4 3 ");
+}
+
+TEST(sea_tests_e2e, bare_recursive_call_as_a_branch) {
+    const char *src = R"(
+int down(int m) {
+    putn(m);
+    if (m > 0) down(m - 1);
+    return m;
+}
+
+int main() {
+    putn(down(2));
+    return 0;
+}
+)";
+    sea_options_t options = sea_default_options();
+    ASSERT_EQ(run_compiled(src, &options), "2 1 0 2 ");
+}
+
+TEST(sea_tests_e2e, bare_calls_as_loop_bodies) {
+    const char *src = R"(
+int n = 0;
+
+int tick(int x) {
+    n = n + 1;
+    putn(x);
+    return n;
+}
+
+int main() {
+    for (int i = 5; i < 7; i = i + 1) tick(i);
+    while (n < 4) tick(n);
+    putn(n);
+    return 0;
+}
+)";
+    sea_options_t stack = sea_default_options(), fixed = sea_default_options();
+    fixed.static_locals = true;
+    ASSERT_EQ(run_compiled(src, &stack), "5 6 2 3 4 ");
+    ASSERT_EQ(run_compiled(src, &fixed), "5 6 2 3 4 ");
+}
+
+TEST(sea_tests_e2e, steps_out_of_range_are_left_to_the_assembler) {
+    const msu_str_t *src = msu_str_new("int g = 1; int main() { g = g + 1000; putn(g); return 0; }");
+    parsenode_t *program = sea_parse(src);
+    report_errors(src, program);
+
+    // a global is stepped in its cell, except by what no cell holds
+    sea_options_t options = sea_default_options();
+    sea_error_t *sea_error = nullptr;
+    list_of_asm_insrs_t *insrs = sea_compile_ir_with(program, &options, &sea_error);
+    ASSERT_EQ(sea_error, nullptr) << msu_str_data(sea_error->message);
+
+    asm_error_t *asm_err = nullptr;
+    int *code = asm_assemble_insrs(insrs, &asm_err);
+    ASSERT_NE(asm_err, nullptr);
+    ASSERT_NE(msu_str_to_cpp(asm_err->message).find("1000"), std::string::npos) << msu_str_to_cpp(asm_err->message);
+
+    asm_error_free(asm_err);
+    free(code);
+    list_of_asm_insrs_free(insrs, true);
+    parsenode_free(program);
+    msu_str_free(src);
+}
+
+TEST(sea_tests_e2e, equality_as_a_value) {
+    // SNOT on the only value on the stack
+    const char *src = R"(
+int same(int b) {
+    putn(b >= b + 10);
+    putn(b == 4);
+    return b != 4;
+}
+
+int main() {
+    putn(3 == 3);
+    putn(same(4));
+    return 0;
+}
+)";
+    sea_options_t stack = sea_default_options(), fixed = sea_default_options();
+    fixed.static_locals = true;
+    ASSERT_EQ(run_compiled(src, &stack), "1 0 1 0 ");
+    ASSERT_EQ(run_compiled(src, &fixed), "1 0 1 0 ");
+}
+
+TEST(sea_tests_e2e, negated_short_circuits_read_locals) {
+    // the zero it is subtracted from is on the stack above the locals
+    const char *src = R"(
+int main() {
+    int a = 3;
+    int b = 7;
+    putn(-((2 > a) || (b > 50)));
+    putn(-((a > 2) && (b > 5)));
+    return 0;
+}
+)";
+    sea_options_t stack = sea_default_options(), fixed = sea_default_options();
+    fixed.static_locals = true;
+    ASSERT_EQ(run_compiled(src, &stack), "0 -1 ");
+    ASSERT_EQ(run_compiled(src, &fixed), "0 -1 ");
+}
@@ -0,0 +1,111 @@
+#include <gtest/gtest.h>
+#include <string>
+#include "testbase.hxx"
+
+extern "C" {
+#include "lmsm/superopt.h"
+#include "lmsm/opt.h"
+#include "lmsm/asm.h"
+}
+
+superopt_seq_t Seq(const char *s) {
+    std::string text(s);
+    superopt_seq_t seq = {};
+    const char *err = opt_parse_steps(&text[0], seq.steps, &seq.len);
+    EXPECT_EQ(err, nullptr) << err;
+    return seq;
+}
+
+// what superopt finds for `pattern`, or "none"
+std::string Search(const char *pattern) {
+    superopt_options_t options = superopt_default_options();
+    superopt_seq_t seq = Seq(pattern), out = {};
+    if (!superopt_search(&seq, &options, &out)) return "none";
+    const msu_str_t *text = superopt_seq_print(&out);
+    std::string result = msu_str_data(text);
+    msu_str_free(text);
+    return result;
+}
+
+//==========================================================================
+// Search tests
+//==========================================================================
+
+TEST(superopt, finds_cheaper_sequences) {
+    ASSERT_EQ(Search("SPUSH; SPOP"), "");
+    ASSERT_EQ(Search("SPUSHI a; SPOP"), "LDI a");
+    ASSERT_EQ(Search("SSWAP; SADD"), "SADD");
+    ASSERT_EQ(Search("SPUSHI 0; SADD"), "LDI 0");
+}
+
+TEST(superopt, respects_the_clamp) {
+    // x - 1 + 1 isn't x when x is -999, so only the second LDI can go
+    ASSERT_EQ(Search("SPUSHI 1; SSUB; SPUSHI 1; SADD"), "SPUSHI 1; SSUB; SPUSH; SADD");
+    // dividing by zero halts, so the division stays though its result is dropped
+    ASSERT_EQ(Search("SPUSHI 0; SDIV; SDROP"), "SPUSHI 0; SDIV");
+}
+
+TEST(superopt, equivalence_checks_every_input) {
+    superopt_options_t options = superopt_default_options();
+    superopt_seq_t sub = Seq("SSWAP; SSUB"), rsub = Seq("SSUB");
+    ASSERT_FALSE(superopt_equivalent(&sub, &rsub, &options));
+
+    superopt_seq_t max = Seq("SSWAP; SMAX"), bare = Seq("SMAX");
+    options.exhaustive = true;
+    ASSERT_TRUE(superopt_equivalent(&max, &bare, &options));
+}
+
+//==========================================================================
+// Corpus tests
+//==========================================================================
+
+TEST(superopt, patterns_are_counted_with_constants_as_variables) {
+    const msu_str_t *src = msu_str_new("SPUSHI 7\nSPOP\nOUT\nSPUSHI 9\nSPOP\nfoo SPUSHI 1\nSPOP\nHLT\n");
+    list_of_asm_insrs_t *insrs = asm_parse(src);
+    superopt_patterns_t *patterns = superopt_patterns_new();
+    superopt_patterns_add(patterns, insrs, 3);
+
+    ASSERT_EQ(patterns->len, 2);
+    const msu_str_t *first = superopt_seq_print(&patterns->patterns[0].seq);
+    ASSERT_MSU_STREQ(first, "SPUSHI a; SPOP");
+    ASSERT_EQ(patterns->patterns[0].count, 2);
+    // a label may start a window but not be inside one
+    const msu_str_t *second = superopt_seq_print(&patterns->patterns[1].seq);
+    ASSERT_MSU_STREQ(second, "SPUSHI 1; SPOP");
+
+    msu_str_free(first);
+    msu_str_free(second);
+    superopt_patterns_free(patterns);
+    list_of_asm_insrs_free(insrs, true);
+    msu_str_free(src);
+}
+
+TEST(superopt, known_rules_are_not_searched_again) {
+    const msu_str_t *src = msu_str_new("SPUSHI 7\nSPOP\nSPUSH\nSDUP\nSPOP\nOUT\nSPUSH\nSDUP\nSPOP\nHLT\n");
+    list_of_asm_insrs_t *insrs = asm_parse(src);
+    superopt_patterns_t *patterns = superopt_patterns_new();
+    superopt_patterns_add(patterns, insrs, 3);
+
+    opt_rules_t *rules = opt_rules_new();
+    const msu_str_t *rules_src = msu_str_new("SPUSHI a; SPOP => LDI a\n");
+    ASSERT_EQ(opt_rules_parse(rules, rules_src), nullptr);
+
+    superopt_options_t options = superopt_default_options();
+    const msu_str_t *found = superopt_search_all(patterns, rules, &options);
+    ASSERT_MSU_STREQ(found, "# found by superopt, do not edit\n"
+                            "SPUSH; SDUP; SPOP => SPUSH  # seen 2 times\n"
+                            "# 3 patterns searched\n");
+
+    // and what was found parses back
+    opt_rules_t *parsed = opt_rules_new();
+    ASSERT_EQ(opt_rules_parse(parsed, found), nullptr);
+    ASSERT_EQ(parsed->len, 1);
+
+    opt_rules_free(parsed);
+    msu_str_free(found);
+    msu_str_free(rules_src);
+    opt_rules_free(rules);
+    superopt_patterns_free(patterns);
+    list_of_asm_insrs_free(insrs, true);
+    msu_str_free(src);
+}